@@ -1,9 +1,24 @@
 
 #include "ir_remote.h"
 #include "stm32f4xx_bsp.h"
+#include "ir_rx.h"
+#include "ir_capture.h"
+#include "ir_pingpong.h"
+#include "ir_nec.h"
+#include "ir_rc5.h"
+#include "ir_rc6.h"
+#include "ir_sirc.h"
+#include "ir_samsung.h"
+#include "ir_jvc.h"
+#include "ir_key.h"
+#include "ir_dedup.h"
+#include "ir_carrier.h"
+#include "ir_envelope.h"
+#include "ir_proto.h"
+#include "ir_tx.h"
 
 /* Handle for the timers */
-TIM_HandleTypeDef               Capture_TimHandle;
+TIM_HandleTypeDef               Capture_TimHandle[CAPTURE_RX_NUM];
 TIM_HandleTypeDef               Modulation_TimHandle;
 TIM_HandleTypeDef               Timebase_TimHandle;
 
@@ -13,71 +28,197 @@ static TIM_IC_InitTypeDef       Capture_Tim_Config;
 /* Slave configuration structure */
 static TIM_SlaveConfigTypeDef   Capture_Tim_Slave_Config;
 
-/* Captured Value */
-static __IO uint32_t            Capture_Tim_Log[128];
-/* This counter is used to index into the capture timer log */
-static uint32_t                 Capture_Tim_Cntr = 0;
-
-enum key_tx_phase {
-  STR_BIT_H,
-  STR_BIT_L,
-  ZER_BIT_H,
-  ZER_BIT_L,
-  ONE_BIT_H,
-  ONE_BIT_L,
-  RPT_BIT_H,
-  RPT_BIT_L,
-  IFS,
-};
+/* Timer Output Compare Configuration Structure declaration */
+static TIM_OC_InitTypeDef       Capture_Tim_Timeout_Config;
+static TIM_OC_InitTypeDef       Modulation_Tim_Config;
+
+#if CAPTURE_TIM_TIMESTAMP
+/* The capture timer runs free over its 32 bits at the timer clock (84 MHz),
+ * the captured values are timestamps and the durations are computed by
+ * subtraction, so no pulse overflows the timer.
+ */
+#define CAPTURE_TIM_PERIOD      0xFFFFFFFF
+#define CAPTURE_TIM_TICKS_PER_US 84
+#else
+/* The capture timer is reset on every edge, the captured values are the
+ * durations in micro seconds.
+ */
+#define CAPTURE_TIM_PERIOD      65535
+#define CAPTURE_TIM_TICKS_PER_US 1
+#endif
+
+/* Idle time after the last edge that closes the frame (micro seconds). It
+ * bounds the latency of the last frame of a key press, and has to be longer
+ * than the spaces within a frame and at least IR_GAP_MIN.
+ */
+#define CAPTURE_GAP_TIMEOUT     10000
+#define CAPTURE_GAP_TICKS       (CAPTURE_GAP_TIMEOUT * CAPTURE_TIM_TICKS_PER_US)
+#if CAPTURE_GAP_TIMEOUT < IR_GAP_MIN || CAPTURE_GAP_TICKS > CAPTURE_TIM_PERIOD
+#error "CAPTURE_GAP_TIMEOUT out of range"
+#endif
+
+/* Pulses shorter than this are glitches (micro seconds), well below the
+ * shortest pulse of the protocols (the 444 us RC6 half bit). The input
+ * filter of the timer removes the spikes it can (up to 12 us), in interrupt
+ * mode the capture ISR merges the longer ones into the pulses around them.
+ */
+#define CAPTURE_GLITCH_MIN      100
+
+/* Timer clock divider of the input filter sampling clock (fDTS) */
+#define CAPTURE_TIM_CKD         4
+
+#if CAPTURE_TIM_USE_DMA
+/* Number of captured values in the DMA buffer */
+#define CAPTURE_DMA_LEN         128
+#else
+/* Number of pulses in a frame buffer, a NEC frame has 68 with the gap */
+#define CAPTURE_FRAME_LEN       128
+#endif
 
-static const uint16_t key_tx_phase_period[] = {
-   896, /* STR_BIT_H */
-   448, /* STR_BIT_L */
-    56, /* ZER_BIT_H */
-    56, /* ZER_BIT_L */
-    56, /* ONE_BIT_H */
-   168, /* ONE_BIT_L */
-   896, /* RPT_BIT_H */
-   224, /* RPT_BIT_L */
-  4740, /* IFS       */
+/**
+  * @brief Capture and decode path of an IR receiver
+  */
+struct capture_rx {
+#if CAPTURE_TIM_USE_DMA
+  uint32_t dma_buf[CAPTURE_DMA_LEN];    /*!< Captured values written by the DMA */
+  struct ir_capture_init capture_init;  /*!< Consumer init parameters */
+  void *capture;                        /*!< Consumer of the captured values */
+  __IO uint32_t dma_pending;            /*!< Half buffers filled since the last drain */
+  __IO uint32_t dma_timeout;            /*!< The line went idle since the last drain */
+  __IO uint32_t dma_timeout_wr;         /*!< DMA write index when the line went idle */
+#else
+  struct ir_pulse frame_buf[2 * CAPTURE_FRAME_LEN]; /*!< Ping-pong frame buffers */
+  struct ir_pingpong_init frames_init;  /*!< Frame buffers init parameters */
+  void *frames;                         /*!< Frame buffers the capture ISR fills */
+#if CAPTURE_TIM_TIMESTAMP
+  __IO uint32_t last_stamp;             /*!< Timestamp of the last captured edge */
+#endif
+  __IO uint32_t glitch_cntr;            /*!< Glitches rejected by the capture ISR */
+#endif
+  struct ir_rx_stats rx_stats;          /*!< Frame cache counters of the engine */
+  __IO uint32_t overflow_cntr;          /*!< Values (whole frames in interrupt mode)
+                                             lost because the main loop fell behind */
+  void *rx;                             /*!< Receive engine of the receiver */
+  struct ir_frame frame;                /*!< Last frame decoded by the receiver */
 };
 
-static const enum key_tx_phase key_tx_phase_sof[] = {
-  STR_BIT_H, STR_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ONE_BIT_H, ONE_BIT_L,
+/* Receivers, each with its own capture timer, buffers and receive engine */
+static struct capture_rx        Capture_Rx[CAPTURE_RX_NUM];
+
+static unsigned Capture_Rx_Of(TIM_HandleTypeDef *htim);
+static void Capture_Rx_Init(unsigned rx);
+#if CAPTURE_TIM_USE_DMA
+static unsigned Capture_Dma_Wr(unsigned rx);
+static void Capture_Process(unsigned rx, int cmd, unsigned wr);
+static void Capture_Dma_Event(unsigned rx);
+static void Capture_Dma_HalfCplt(DMA_HandleTypeDef *hdma);
+static void Capture_Dma_Drain(unsigned rx);
+#else
+static void Capture_Frame_Drain(unsigned rx);
+#endif
+
+/* A frame seen by more than one receiver is decoded by each of them within
+ * a few milli seconds, the copies are suppressed within this window (ms).
+ * It is shorter than the shortest frame period (45 ms for SIRC).
+ */
+#define IR_DEDUP_WINDOW         20
+
+static void                     *Ir_Dedup;
+static struct ir_dedup_init     Ir_Dedup_Init = { IR_DEDUP_WINDOW };
+
+/* Number of frames let through to the key layer */
+static __IO uint32_t            Ir_Rx_Frame_Cntr = 0;
+
+/* Key events made of the decoded frames: the first hold event half a second
+ * after the press, then ten per second. The key is released when no frame
+ * came for a bit more than the NEC repeat period (108 ms).
+ */
+#define IR_KEY_HOLD_DELAY       500
+#define IR_KEY_HOLD_PERIOD      100
+#define IR_KEY_RELEASE          150
+
+static void                     *Ir_Key;
+static struct ir_key_ring       Ir_Key_Ring;
+static struct ir_key_init       Ir_Key_Init = {
+  &Ir_Key_Ring, IR_KEY_HOLD_DELAY, IR_KEY_HOLD_PERIOD, IR_KEY_RELEASE,
 };
+/* Last key event */
+static struct ir_key_event      Ir_Key_Event;
+
+static void Ir_Rx_Frame_Ready(unsigned rx);
+static void Ir_Key_Poll(void);
+
+/* Protocol the carrier is set up for at start */
+#define IR_TX_PROTO             (&ir_proto_nec)
+
+static struct ir_carrier        Ir_Tx_Carrier;
 
-static const enum key_tx_phase key_tx_phase_rpt[] = {
-  RPT_BIT_H, RPT_BIT_L, ZER_BIT_H, ZER_BIT_L,
+/* Counter clock of the timebase timer, the phase periods are in its ticks */
+#define IR_TX_TIMEBASE_KHZ      100
+#define IR_TX_TICKS(us)         IR_TICKS(us, IR_TX_TIMEBASE_KHZ)
+
+/* Code set of the remote, a word per key (see IR_TX_KEY) */
+static const uint32_t           Ir_Tx_Keys[] = {
+  IR_TX_KEY(IR_PROTO_NEC, 0x4000, 0x41),
+  IR_TX_KEY(IR_PROTO_NEC, 0x04, 0x08),
+  IR_TX_KEY(IR_PROTO_SAMSUNG, 0x07, 0x02),
+  IR_TX_KEY(IR_PROTO_SIRC, 0x01, 0x15),
 };
-#if 0
-static const enum key_tx_phase key_tx_phase_key_0[] = {
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L,
-  ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L,
+
+/* Encoder of the frames on air, a frame is in progress while busy */
+static struct ir_tx             Ir_Tx;
+static volatile bool            Ir_Tx_Busy;
+
+/* Pulse durations of the protocols in timebase ticks, built at compile time */
+static const struct ir_timing   Ir_Tx_Nec_Ticks = IR_NEC_TIMING(IR_TX_TICKS);
+static const struct ir_timing   Ir_Tx_Sirc_Ticks = IR_SIRC_TIMING(IR_TX_TICKS);
+static const struct ir_timing   Ir_Tx_Samsung_Ticks = IR_SAMSUNG_TIMING(IR_TX_TICKS);
+static const struct ir_timing   Ir_Tx_Jvc_Ticks = IR_JVC_TIMING(IR_TX_TICKS);
+
+/* Tick tables, indexed by enum ir_protocol_id like the protocol descriptors */
+static const struct ir_timing *const Ir_Tx_Ticks[] = {
+  NULL,                     /* IR_PROTO_NONE    */
+  &Ir_Tx_Nec_Ticks,         /* IR_PROTO_NEC     */
+  NULL,                     /* IR_PROTO_RC5     */
+  NULL,                     /* IR_PROTO_RC6     */
+  &Ir_Tx_Sirc_Ticks,        /* IR_PROTO_SIRC    */
+  &Ir_Tx_Samsung_Ticks,     /* IR_PROTO_SAMSUNG */
+  &Ir_Tx_Jvc_Ticks,         /* IR_PROTO_JVC     */
 };
+
+#if TIMEBASE_TIM_USE_DMA
+/* Envelope the DMA plays in circles, a half is refilled from the encoder
+ * while the other half plays, so the frames may be of any length */
+#define IR_TX_DMA_LEN           32
+#define IR_TX_DMA_HALF          (IR_TX_DMA_LEN / 2)
+
+/* The update stream preloads the phase after the one the compare stream
+ * gates, it starts at the third entry and reads the first two again from
+ * the end */
+static uint16_t                 Ir_Tx_Arr[IR_TX_DMA_LEN + 2];
+static uint16_t                 Ir_Tx_Ccr[IR_TX_DMA_LEN];
+static struct ir_envelope       Ir_Tx_Envelope;
+/* Half that holds the end of the frames, -1 while the encoder runs */
+static int                      Ir_Tx_Dma_End;
+
+static void Ir_Tx_Dma_Fill(unsigned half);
+static void Ir_Tx_Dma_Start(void);
+static void Ir_Tx_Dma_Played(unsigned half);
+static void Ir_Tx_Dma_HalfCplt(DMA_HandleTypeDef *hdma);
+static void Ir_Tx_Dma_Cplt(DMA_HandleTypeDef *hdma);
 #endif
-static const enum key_tx_phase key_tx_phase_key_p3[] = {
-  ZER_BIT_H, ZER_BIT_L, ONE_BIT_H, ONE_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ONE_BIT_H, ONE_BIT_L, ZER_BIT_H, ZER_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L,
-  ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L,
-  ZER_BIT_H, ZER_BIT_L, ONE_BIT_H, ONE_BIT_L, ONE_BIT_H, ONE_BIT_L,
-};
 
+#if CAPTURE_TIM_TIMESTAMP
+static uint32_t Capture_Last_Edge(unsigned rx);
+#endif
+static uint32_t Capture_Filter_Select(uint32_t clk_hz);
 static void SystemClock_Config(void);
 static void Error_Handler(void);
 
 int main(void)
 {
+  unsigned rx;
+
   /* STM32F4xx HAL library initialization:
    * - Configure the Flash prefetch, instruction and Data caches
    * - Configure the Systick to generate an interrupt each 1 msec
@@ -96,40 +237,54 @@ int main(void)
   /* Configure LED4 GPIO */
   BSP_LED_Init(LED4);
 
-  /* Setup the input capture timer */
-  Capture_TimHandle.Instance = CAPTURE_TIM;
+  /* LED6 is on while a key is held, LED3 toggles on the hold events */
+  BSP_LED_Init(LED6);
+  BSP_LED_Init(LED3);
 
-  Capture_TimHandle.Init.Period = 65535;
-  Capture_TimHandle.Init.Prescaler = (uint32_t)((SystemCoreClock / 2) / 1000000) - 1;
-  Capture_TimHandle.Init.ClockDivision = 0;
-  Capture_TimHandle.Init.CounterMode = TIM_COUNTERMODE_UP;
-  if(HAL_TIM_IC_Init(&Capture_TimHandle) != HAL_OK)
+  /* Create the key layer, it turns the frames into key events */
+  ir_key_ring_init(&Ir_Key_Ring);
+  Ir_Key = new(ir_key, &Ir_Key_Init);
+  if (!Ir_Key)
     Error_Handler();
 
-  Capture_Tim_Config.ICPrescaler = TIM_ICPSC_DIV1;
-  Capture_Tim_Config.ICFilter = 0;
-  Capture_Tim_Config.ICPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
-  Capture_Tim_Config.ICSelection = TIM_ICSELECTION_DIRECTTI;
-  if(HAL_TIM_IC_ConfigChannel(&Capture_TimHandle,
-                              &Capture_Tim_Config,
-                              CAPTURE_TIM_CHANNEL) != HAL_OK)
+  /* Create the dedup stage, the frames of all the receivers go through it */
+  Ir_Dedup = new(ir_dedup, &Ir_Dedup_Init);
+  if (!Ir_Dedup)
     Error_Handler();
 
-  Capture_Tim_Slave_Config.SlaveMode = TIM_SLAVEMODE_RESET;
-  Capture_Tim_Slave_Config.InputTrigger = TIM_TS_TI2FP2;
-  Capture_Tim_Slave_Config.TriggerPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
-  if(HAL_TIM_SlaveConfigSynchronization(&Capture_TimHandle,
-                                        &Capture_Tim_Slave_Config) != HAL_OK)
+  /* Setup the capture path of every receiver */
+  for (rx = 0; rx < CAPTURE_RX_NUM; rx++)
+    Capture_Rx_Init(rx);
+
+  /* Setup the modulation timer, it runs at the timer clock and its PWM
+   * output is the carrier. The timebase interrupt (or the envelope DMA)
+   * gates the carrier through the compare register, which the channel
+   * preloads, so the gate switches on a carrier period boundary.
+   */
+  if (ir_carrier_init(&Ir_Tx_Carrier, &MODULATION_TIM->MODULATION_TIM_CCR,
+                      SystemCoreClock / 2, IR_TX_PROTO->carrier_hz,
+                      IR_TX_PROTO->duty_pct) != ENO_ERROR)
     Error_Handler();
 
-  /* Setup the modulation timer */
   Modulation_TimHandle.Instance = MODULATION_TIM;
 
-  Modulation_TimHandle.Init.Period = 5 - 1;
-  Modulation_TimHandle.Init.Prescaler = (uint32_t)((SystemCoreClock / 2) / 380000) - 1;
+  Modulation_TimHandle.Init.Period = Ir_Tx_Carrier.period - 1;
+  Modulation_TimHandle.Init.Prescaler = 0;
   Modulation_TimHandle.Init.ClockDivision = 0;
   Modulation_TimHandle.Init.CounterMode = TIM_COUNTERMODE_UP;
-  if(HAL_TIM_Base_Init(&Modulation_TimHandle) != HAL_OK)
+  if(HAL_TIM_PWM_Init(&Modulation_TimHandle) != HAL_OK)
+    Error_Handler();
+
+  /* Start with the carrier gated off */
+  Modulation_Tim_Config.OCMode = TIM_OCMODE_PWM1;
+  Modulation_Tim_Config.Pulse = 0;
+  Modulation_Tim_Config.OCPolarity = TIM_OCPOLARITY_HIGH;
+  Modulation_Tim_Config.OCFastMode = TIM_OCFAST_DISABLE;
+  if(HAL_TIM_PWM_ConfigChannel(&Modulation_TimHandle, &Modulation_Tim_Config,
+                               MODULATION_TIM_CHANNEL) != HAL_OK)
+    Error_Handler();
+
+  if(HAL_TIM_PWM_Start(&Modulation_TimHandle, MODULATION_TIM_CHANNEL) != HAL_OK)
     Error_Handler();
 
   /* Setup the timebase timer */
@@ -137,40 +292,643 @@ int main(void)
 
   /* Set the period low to allow the interrupt to fire immediately */
   Timebase_TimHandle.Init.Period = 1;
-  Timebase_TimHandle.Init.Prescaler = (uint32_t)((SystemCoreClock / 2) / 100000) - 1;
+  Timebase_TimHandle.Init.Prescaler = (uint32_t)((SystemCoreClock / 2) / (IR_TX_TIMEBASE_KHZ * 1000)) - 1;
   Timebase_TimHandle.Init.ClockDivision = 0;
   Timebase_TimHandle.Init.CounterMode = TIM_COUNTERMODE_UP;
   if(HAL_TIM_Base_Init(&Timebase_TimHandle) != HAL_OK)
     Error_Handler();
 
-  /* Start the input capture timer in interrupt mode */
-  if(HAL_TIM_IC_Start_IT(&Capture_TimHandle, CAPTURE_TIM_CHANNEL) != HAL_OK)
+  /* Send the first key of the code set and one repeat */
+  if (Ir_Tx_Send_Key(Ir_Tx_Keys[0], 1) != ENO_ERROR)
     Error_Handler();
 
-  /* Start the timebase timer */
-  if(HAL_TIM_Base_Start_IT(&Timebase_TimHandle) != HAL_OK)
+  /* Infinite loop, decode what the capture interrupts queued */
+  while (1)
+  {
+    for (rx = 0; rx < CAPTURE_RX_NUM; rx++)
+    {
+#if CAPTURE_TIM_USE_DMA
+      Capture_Dma_Drain(rx);
+#else
+      Capture_Frame_Drain(rx);
+#endif
+    }
+    Ir_Key_Poll();
+  }
+}
+
+
+/**
+  * @brief  Receiver of a capture timer handle
+  * @param  htim: TIM handle
+  * @retval Receiver index, CAPTURE_RX_NUM if the handle is not a capture timer
+  */
+static unsigned Capture_Rx_Of(TIM_HandleTypeDef *htim)
+{
+  unsigned rx;
+
+  for (rx = 0; rx < CAPTURE_RX_NUM; rx++)
+    if (htim == &Capture_TimHandle[rx])
+      break;
+
+  return rx;
+}
+
+/**
+  * @brief  Create the receive engine and the capture buffers of a receiver,
+  *         setup its capture timer and start it
+  * @param  rx: Receiver index
+  * @retval None
+  */
+static void Capture_Rx_Init(unsigned rx)
+{
+  struct capture_rx *crx = &Capture_Rx[rx];
+  const struct capture_bsp *bsp = &Capture_Bsp[rx];
+  TIM_HandleTypeDef *htim = &Capture_TimHandle[rx];
+
+  /* Create the receive engine and register the supported protocols, every
+   * receiver has its own decoder state
+   */
+  crx->rx = new(ir_rx, NULL);
+  if (!crx->rx ||
+      ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_nec, NULL)) ||
+      ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_rc5, NULL)) ||
+      ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_rc6, NULL)) ||
+      ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_sirc, NULL)) ||
+      ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_samsung, NULL)) ||
+      ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_jvc, NULL)))
     Error_Handler();
 
-  /* Infinite loop */
-  while (1)
+#if CAPTURE_TIM_USE_DMA
+  /* Create the consumer of the captured values, it feeds the engine */
+  crx->capture_init.buf = crx->dma_buf;
+  crx->capture_init.size = CAPTURE_DMA_LEN;
+  crx->capture_init.timeout = CAPTURE_GAP_TIMEOUT;
+  crx->capture_init.dec = crx->rx;
+  crx->capture_init.ticks_per_us = CAPTURE_TIM_TIMESTAMP ? CAPTURE_TIM_TICKS_PER_US : 0;
+  crx->capture = new(ir_capture, &crx->capture_init);
+  if (!crx->capture)
+    Error_Handler();
+#else
+  /* Create the frame buffers the capture ISR assembles the frames in */
+  crx->frames_init.buf = crx->frame_buf;
+  crx->frames_init.size = CAPTURE_FRAME_LEN;
+  crx->frames_init.timeout = CAPTURE_GAP_TIMEOUT;
+  crx->frames_init.glitch = CAPTURE_GLITCH_MIN;
+  crx->frames = new(ir_pingpong, &crx->frames_init);
+  if (!crx->frames)
+    Error_Handler();
+#endif
+
+  /* Setup the input capture timer */
+  htim->Instance = bsp->tim;
+
+  htim->Init.Period = CAPTURE_TIM_PERIOD;
+  htim->Init.Prescaler = (uint32_t)((SystemCoreClock / 2) /
+                         (CAPTURE_TIM_TICKS_PER_US * 1000000)) - 1;
+  htim->Init.ClockDivision = TIM_CLOCKDIVISION_DIV4;
+  htim->Init.CounterMode = TIM_COUNTERMODE_UP;
+  if(HAL_TIM_IC_Init(htim) != HAL_OK)
+    Error_Handler();
+
+  /* The filter delays both edges of a pulse alike, so the durations hold */
+  Capture_Tim_Config.ICPrescaler = TIM_ICPSC_DIV1;
+  Capture_Tim_Config.ICFilter = Capture_Filter_Select(SystemCoreClock / 2);
+  Capture_Tim_Config.ICPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
+  Capture_Tim_Config.ICSelection = TIM_ICSELECTION_DIRECTTI;
+  if(HAL_TIM_IC_ConfigChannel(htim, &Capture_Tim_Config, bsp->channel) != HAL_OK)
+    Error_Handler();
+
+#if !CAPTURE_TIM_TIMESTAMP
+  Capture_Tim_Slave_Config.SlaveMode = TIM_SLAVEMODE_RESET;
+  Capture_Tim_Slave_Config.InputTrigger = bsp->trigger;
+  Capture_Tim_Slave_Config.TriggerPolarity = TIM_INPUTCHANNELPOLARITY_BOTHEDGE;
+  if(HAL_TIM_SlaveConfigSynchronization(htim, &Capture_Tim_Slave_Config) != HAL_OK)
+    Error_Handler();
+#endif
+
+  /* The counter is reset on every edge, so a compare on the count of the
+   * gap timeout fires once the line has been idle that long. A free running
+   * counter moves the compare behind the last edge in the callback instead.
+   */
+  Capture_Tim_Timeout_Config.OCMode = TIM_OCMODE_TIMING;
+  Capture_Tim_Timeout_Config.Pulse = CAPTURE_GAP_TICKS;
+  Capture_Tim_Timeout_Config.OCPolarity = TIM_OCPOLARITY_HIGH;
+  Capture_Tim_Timeout_Config.OCFastMode = TIM_OCFAST_DISABLE;
+  if(HAL_TIM_OC_ConfigChannel(htim, &Capture_Tim_Timeout_Config,
+                              bsp->timeout_channel) != HAL_OK)
+    Error_Handler();
+
+  /* Close the frame on the gap timeout instead of waiting for the next edge */
+  __HAL_TIM_ENABLE_IT(htim, bsp->timeout_it);
+
+#if CAPTURE_TIM_USE_DMA
+  /* Start the input capture timer in DMA mode, the consumer only runs on
+   * the half and full transfer interrupts and on the timeout.
+   */
+  if(HAL_TIM_IC_Start_DMA(htim, bsp->channel, crx->dma_buf, CAPTURE_DMA_LEN) != HAL_OK)
+    Error_Handler();
+
+  /* HAL_DMA_Start_IT only enables the half transfer interrupt if a half
+   * transfer callback is set when it starts, which not every HAL version
+   * of HAL_TIM_IC_Start_DMA does. Set ours and enable the interrupt.
+   */
+  htim->hdma[bsp->dma_id]->XferHalfCpltCallback = Capture_Dma_HalfCplt;
+  __HAL_DMA_ENABLE_IT(htim->hdma[bsp->dma_id], DMA_IT_HT);
+#else
+  /* Start the input capture timer in interrupt mode */
+  if(HAL_TIM_IC_Start_IT(htim, bsp->channel) != HAL_OK)
+    Error_Handler();
+#endif
+}
+
+#if CAPTURE_TIM_USE_DMA
+/**
+  * @brief  Index of the next value the DMA writes
+  * @param  rx: Receiver index
+  * @retval DMA write index
+  */
+static unsigned Capture_Dma_Wr(unsigned rx)
+{
+  return CAPTURE_DMA_LEN -
+         __HAL_DMA_GET_COUNTER(Capture_TimHandle[rx].hdma[Capture_Bsp[rx].dma_id]);
+}
+
+/**
+  * @brief  Feed the values the DMA wrote up to the write index to the engine
+  * @param  rx: Receiver index
+  * @param  cmd: IOCTL_IR_CAP_PROCESS or IOCTL_IR_CAP_TIMEOUT
+  * @param  wr: DMA write index
+  * @retval None
+  */
+static void Capture_Process(unsigned rx, int cmd, unsigned wr)
+{
+  void *capture = Capture_Rx[rx].capture;
+
+  while (ioctl(capture, IOC(IOCTL_IR, cmd), &wr) == IR_DEC_FRAME_READY)
   {
+    ioctl(capture, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &Capture_Rx[rx].frame);
+    Ir_Rx_Frame_Ready(rx);
   }
 }
 
+/**
+  * @brief  Note a filled half of the DMA buffer for the main loop
+  * @param  rx: Receiver index
+  * @retval None
+  */
+static void Capture_Dma_Event(unsigned rx)
+{
+  /* The consumer tells a lap from the events and the write index */
+  Capture_Rx[rx].dma_pending++;
+}
+
+/**
+  * @brief  Capture DMA half transfer callback
+  * @param  hdma: DMA handle
+  * @retval None
+  */
+static void Capture_Dma_HalfCplt(DMA_HandleTypeDef *hdma)
+{
+  unsigned rx = Capture_Rx_Of((TIM_HandleTypeDef *)hdma->Parent);
+
+  if (rx < CAPTURE_RX_NUM)
+    Capture_Dma_Event(rx);
+}
+
+/**
+  * @brief  Capture DMA transfer complete callback (the DMA wrapped around)
+  * @param  htim: TIM handle
+  * @retval None
+  */
+void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
+{
+  unsigned rx = Capture_Rx_Of(htim);
+
+  if (rx < CAPTURE_RX_NUM)
+    Capture_Dma_Event(rx);
+}
+
+/**
+  * @brief  Run the consumer of a receiver for the DMA events noted by the
+  *         interrupts
+  * @param  rx: Receiver index
+  * @retval None
+  */
+static void Capture_Dma_Drain(unsigned rx)
+{
+  struct capture_rx *crx = &Capture_Rx[rx];
+  struct ir_capture_dma dma;
+  uint32_t timeout, timeout_wr;
+  unsigned dropped;
+
+  __disable_irq();
+  dma.halves = crx->dma_pending;
+  timeout = crx->dma_timeout;
+  timeout_wr = crx->dma_timeout_wr;
+  dma.wr = Capture_Dma_Wr(rx);
+  crx->dma_pending = crx->dma_timeout = 0;
+  __enable_irq();
+
+  if (!dma.halves && !timeout)
+    return;
 
+  /* If the DMA lapped the consumer, everything written so far is dropped,
+   * the timeout included
+   */
+  if (ioctl(crx->capture, IOC(IOCTL_IR, IOCTL_IR_CAP_CHECK), &dma) != ENO_ERROR)
+  {
+    ioctl(crx->capture, IOC(IOCTL_IR, IOCTL_IR_CAP_GET_DROPPED), &dropped);
+    crx->overflow_cntr = dropped;
+    return;
+  }
+
+  /* Values captured after the timeout belong to the next frame */
+  if (timeout)
+    Capture_Process(rx, IOCTL_IR_CAP_TIMEOUT, timeout_wr);
+  if (dma.halves)
+    Capture_Process(rx, IOCTL_IR_CAP_PROCESS, dma.wr);
+  ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_GET_STATS), &crx->rx_stats);
+}
+#else
 void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
 {
-  if (htim == &Capture_TimHandle && htim->Channel == CAPTURE_TIM_HAL_LAYER_CHANNEL_NUM)
+  unsigned rx = Capture_Rx_Of(htim);
+
+  if (rx < CAPTURE_RX_NUM && htim->Channel == Capture_Bsp[rx].hal_channel)
   {
+    struct capture_rx *crx = &Capture_Rx[rx];
+    struct ir_pulse pulse;
+#if CAPTURE_TIM_TIMESTAMP
+    uint32_t stamp = HAL_TIM_ReadCapturedValue(htim, Capture_Bsp[rx].channel);
+
+    /* Unsigned subtraction, so the timer wrapping around does not matter */
+    pulse.duration = (stamp - crx->last_stamp) / CAPTURE_TIM_TICKS_PER_US;
+    crx->last_stamp = stamp;
+#else
+
     /* Get the Input Capture value */
-    Capture_Tim_Log[Capture_Tim_Cntr % 128] = HAL_TIM_ReadCapturedValue(htim,
-                                  CAPTURE_TIM_CHANNEL) |
-                                  ((Capture_Tim_Cntr + 1) << 16);
+    pulse.duration = HAL_TIM_ReadCapturedValue(htim, Capture_Bsp[rx].channel);
+#endif
+
+    /* The receiver output is active low, so a high level after the edge
+     * means the captured interval was a mark.
+     */
+    pulse.mark = HAL_GPIO_ReadPin(Capture_Bsp[rx].gpio_port,
+                                  Capture_Bsp[rx].gpio_pin) == GPIO_PIN_SET;
+
+    /* Decoding is left to the main loop, the frame is handed over on the
+     * gap after it.
+     */
+    ioctl(crx->frames, IOC(IOCTL_IR, IOCTL_IR_PP_EDGE), &pulse);
   }
+}
 
-  Capture_Tim_Cntr++;
+/**
+  * @brief  Decode the frame handed over by the capture ISR of a receiver
+  * @param  rx: Receiver index
+  * @retval None
+  */
+static void Capture_Frame_Drain(unsigned rx)
+{
+  struct capture_rx *crx = &Capture_Rx[rx];
+  struct ir_pulse_seq seq;
+  unsigned dropped;
+
+  /* The whole frame is in contiguous memory, decode it in one go and give
+   * the buffer back to the ISR
+   */
+  if (ioctl(crx->frames, IOC(IOCTL_IR, IOCTL_IR_PP_GET_FRAME), &seq) == ENO_ERROR)
+  {
+    if (ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_FRAME), &seq) == IR_DEC_FRAME_READY)
+    {
+      ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &crx->frame);
+      Ir_Rx_Frame_Ready(rx);
+    }
+    ioctl(crx->frames, IOC(IOCTL_IR, IOCTL_IR_PP_RELEASE), NULL);
+    ioctl(crx->rx, IOC(IOCTL_IR, IOCTL_IR_RX_GET_STATS), &crx->rx_stats);
+  }
+
+  ioctl(crx->frames, IOC(IOCTL_IR, IOCTL_IR_PP_GET_DROPPED), &dropped);
+  crx->overflow_cntr = dropped;
+  ioctl(crx->frames, IOC(IOCTL_IR, IOCTL_IR_PP_GET_REJECTED), &dropped);
+  crx->glitch_cntr = dropped;
 }
+#endif
 
+/**
+  * @brief  Hand the frame decoded by a receiver to the key layer, unless
+  *         another receiver already did
+  * @param  rx: Receiver index
+  * @retval None
+  */
+static void Ir_Rx_Frame_Ready(unsigned rx)
+{
+  struct ir_dedup_input dup;
+  struct ir_key_input in;
+
+  dup.frame = &Capture_Rx[rx].frame;
+  dup.rx = rx;
+  dup.now = HAL_GetTick();
+  if (ioctl(Ir_Dedup, IOC(IOCTL_IR, IOCTL_IR_DEDUP_FRAME), &dup) != IR_DEC_FRAME_READY)
+    return;
+
+  Ir_Rx_Frame_Cntr++;
+
+  in.frame = dup.frame;
+  in.now = dup.now;
+  ioctl(Ir_Key, IOC(IOCTL_IR, IOCTL_IR_KEY_FRAME), &in);
+}
+
+/**
+  * @brief  Raise the hold and release events that are due and handle the
+  *         key events
+  * @param  None
+  * @retval None
+  */
+static void Ir_Key_Poll(void)
+{
+  uint32_t now = HAL_GetTick();
+
+  ioctl(Ir_Key, IOC(IOCTL_IR, IOCTL_IR_KEY_TICK), &now);
+
+  while (ir_key_ring_pop(&Ir_Key_Ring, &Ir_Key_Event) == ENO_ERROR)
+  {
+    switch (Ir_Key_Event.type)
+    {
+    case IR_KEY_PRESS:
+      BSP_LED_On(LED6);
+      break;
+    case IR_KEY_HOLD:
+      BSP_LED_Toggle(LED3);
+      break;
+    case IR_KEY_RELEASE:
+      BSP_LED_Off(LED6);
+      BSP_LED_Off(LED3);
+      break;
+    }
+  }
+}
+
+/**
+  * @brief  Select the longest input filter that is shorter than a glitch
+  * @param  clk_hz: Timer clock (fCK_INT) in Hz
+  * @retval ICFilter value (0 - 15)
+  */
+static uint32_t Capture_Filter_Select(uint32_t clk_hz)
+{
+  /* Filter length of the ICFilter values 1 - 15 in timer clocks: number of
+   * samples times the sampling clock divider (fCK_INT for 1 - 3, fDTS / 2
+   * to fDTS / 32 for the others)
+   */
+  static const uint16_t len[] = {
+    2, 4, 8,
+    6 * 2 * CAPTURE_TIM_CKD, 8 * 2 * CAPTURE_TIM_CKD,
+    6 * 4 * CAPTURE_TIM_CKD, 8 * 4 * CAPTURE_TIM_CKD,
+    6 * 8 * CAPTURE_TIM_CKD, 8 * 8 * CAPTURE_TIM_CKD,
+    5 * 16 * CAPTURE_TIM_CKD, 6 * 16 * CAPTURE_TIM_CKD, 8 * 16 * CAPTURE_TIM_CKD,
+    5 * 32 * CAPTURE_TIM_CKD, 6 * 32 * CAPTURE_TIM_CKD, 8 * 32 * CAPTURE_TIM_CKD,
+  };
+  uint32_t clocks = clk_hz / 1000000 * CAPTURE_GLITCH_MIN;
+  uint32_t filter = 0;
+
+  while (filter < sizeof(len) / sizeof(len[0]) && len[filter] < clocks)
+    filter++;
+
+  return filter;
+}
+
+#if CAPTURE_TIM_TIMESTAMP
+/**
+  * @brief  Timestamp of the last edge captured by a receiver
+  * @param  rx: Receiver index
+  * @retval Timer count of the edge
+  */
+static uint32_t Capture_Last_Edge(unsigned rx)
+{
+#if CAPTURE_TIM_USE_DMA
+  return Capture_Rx[rx].dma_buf[(Capture_Dma_Wr(rx) + CAPTURE_DMA_LEN - 1) % CAPTURE_DMA_LEN];
+#else
+  return Capture_Rx[rx].last_stamp;
+#endif
+}
+#endif
+
+/**
+  * @brief  Output compare callback, the line was idle for the gap timeout
+  * @param  htim: TIM handle
+  * @retval None
+  */
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+  unsigned rx = Capture_Rx_Of(htim);
+
+  if (rx < CAPTURE_RX_NUM && htim->Channel == Capture_Bsp[rx].timeout_hal_channel)
+  {
+#if CAPTURE_TIM_TIMESTAMP
+    uint32_t channel = Capture_Bsp[rx].timeout_channel;
+    uint32_t last = Capture_Last_Edge(rx);
+
+    /* Edges came after the compare was set, wait for the gap after the
+     * last one (unless the counter passed it in the meantime)
+     */
+    if (__HAL_TIM_GET_COUNTER(htim) - last < CAPTURE_GAP_TICKS)
+    {
+      __HAL_TIM_SET_COMPARE(htim, channel, last + CAPTURE_GAP_TICKS);
+      if (__HAL_TIM_GET_COUNTER(htim) - last < CAPTURE_GAP_TICKS)
+        return;
+    }
+    /* Repeat the timeout while the line idles */
+    __HAL_TIM_SET_COMPARE(htim, channel, __HAL_TIM_GET_COUNTER(htim) + CAPTURE_GAP_TICKS);
+#endif
+
+    /* Close the frame, the compare fires again (on every counter wrap of a
+     * timer reset on edges) while the line idles and the consumer ignores
+     * the repeats
+     */
+#if CAPTURE_TIM_USE_DMA
+    Capture_Rx[rx].dma_timeout_wr = Capture_Dma_Wr(rx);
+    Capture_Rx[rx].dma_timeout = 1;
+#else
+    ioctl(Capture_Rx[rx].frames, IOC(IOCTL_IR, IOCTL_IR_PP_TIMEOUT), NULL);
+#endif
+  }
+}
+
+/**
+  * @brief  Send a key
+  *         The key is packed into the code word of the protocol and the
+  *         phases are shifted out of it as they are sent, by the timebase
+  *         interrupt (or into the envelope the DMA plays, half of it at a
+  *         time).
+  * @param  protocol: One of enum ir_protocol_id
+  * @param  address: Device address
+  * @param  command: Key code
+  * @param  repeats: Number of repeats after the key frame
+  * @retval ENO_ERROR if the key is on air, EFAIL if the protocol can not be
+  *         sent or a key is on air already
+  */
+int Ir_Tx_Send(unsigned protocol, uint16_t address, uint16_t command, unsigned repeats)
+{
+  const struct ir_proto *proto = ir_proto_get(protocol);
+  int err;
+
+  if (!proto || Ir_Tx_Busy)
+    return EFAIL;
+
+  /* Carrier of the protocol, it stays gated off until the first mark */
+  if (ir_carrier_init(&Ir_Tx_Carrier, &MODULATION_TIM->MODULATION_TIM_CCR,
+                      SystemCoreClock / 2, proto->carrier_hz,
+                      proto->duty_pct) != ENO_ERROR)
+    return EFAIL;
+  MODULATION_TIM->ARR = Ir_Tx_Carrier.period - 1;
+
+  Ir_Tx_Busy = 1;
+#if TIMEBASE_TIM_USE_DMA
+  /* Play the envelope, an interrupt per half of it */
+  ir_tx_send(&Ir_Tx, proto, Ir_Tx_Ticks[protocol], address, command, repeats);
+  Ir_Tx_Dma_Start();
+  err = ENO_ERROR;
+#else
+  /* The first update loads the first phase */
+  ir_tx_send(&Ir_Tx, proto, Ir_Tx_Ticks[protocol], address, command, repeats);
+  __HAL_TIM_SET_AUTORELOAD(&Timebase_TimHandle, 1);
+  __HAL_TIM_SET_COUNTER(&Timebase_TimHandle, 0);
+  err = HAL_TIM_Base_Start_IT(&Timebase_TimHandle) == HAL_OK ? ENO_ERROR : EFAIL;
+#endif
+  if (err != ENO_ERROR)
+    Ir_Tx_Busy = 0;
+
+  return err;
+}
+
+/**
+  * @brief  Send a key of a code set
+  * @param  key: Key packed with IR_TX_KEY
+  * @param  repeats: Number of repeats after the key frame
+  * @retval See Ir_Tx_Send
+  */
+int Ir_Tx_Send_Key(uint32_t key, unsigned repeats)
+{
+  return Ir_Tx_Send(IR_TX_KEY_PROTOCOL(key), IR_TX_KEY_ADDRESS(key),
+                    IR_TX_KEY_COMMAND(key), repeats);
+}
+
+#if TIMEBASE_TIM_USE_DMA
+/**
+  * @brief  Fill a half of the envelope from the encoder
+  *         The first two auto reload values are copied after the last one,
+  *         where the update stream reads them.
+  * @param  half: 0 - first half, 1 - second half
+  * @retval None
+  */
+static void Ir_Tx_Dma_Fill(unsigned half)
+{
+  Ir_Tx_Envelope.arr = &Ir_Tx_Arr[half * IR_TX_DMA_HALF];
+  Ir_Tx_Envelope.ccr = &Ir_Tx_Ccr[half * IR_TX_DMA_HALF];
+  Ir_Tx_Envelope.size = IR_TX_DMA_HALF;
+  Ir_Tx_Envelope.len = 0;
+  if (ir_envelope_fill(&Ir_Tx_Envelope, &Ir_Tx, &Ir_Tx_Carrier) == ENO_ERROR &&
+      Ir_Tx_Dma_End < 0)
+    Ir_Tx_Dma_End = (int)half;
+
+  Ir_Tx_Arr[IR_TX_DMA_LEN] = Ir_Tx_Arr[0];
+  Ir_Tx_Arr[IR_TX_DMA_LEN + 1] = Ir_Tx_Arr[1];
+}
+
+/**
+  * @brief  Start playing the frames by DMA
+  *         The first phase is loaded into the timebase timer by an update
+  *         and the second one is preloaded. On every update the update
+  *         stream preloads the auto reload of the next phase, one tick into
+  *         every phase the compare stream writes the carrier gate. Both
+  *         streams play the envelope in circles, when the compare stream
+  *         is done with a half it is refilled. The DMA outranks the capture
+  *         streams, so no interrupt load delays a phase.
+  * @param  None
+  * @retval None
+  */
+static void Ir_Tx_Dma_Start(void)
+{
+  TIM_TypeDef *tim = Timebase_TimHandle.Instance;
+  DMA_HandleTypeDef *hdma = Timebase_TimHandle.hdma[TIM_DMA_ID_CC1];
+
+  Ir_Tx_Envelope.rest = 0;
+  Ir_Tx_Dma_End = -1;
+  Ir_Tx_Dma_Fill(0);
+  Ir_Tx_Dma_Fill(1);
+
+  tim->CR1 |= TIM_CR1_ARPE;
+  tim->ARR = Ir_Tx_Arr[0];
+  tim->EGR = TIM_EGR_UG;
+  tim->ARR = Ir_Tx_Arr[1];
+  tim->CCR1 = 1;
+  __HAL_TIM_CLEAR_FLAG(&Timebase_TimHandle, TIM_FLAG_UPDATE | TIM_FLAG_CC1);
+
+  /* The half transfer interrupt is enabled as its callback is set */
+  hdma->XferHalfCpltCallback = Ir_Tx_Dma_HalfCplt;
+  hdma->XferCpltCallback = Ir_Tx_Dma_Cplt;
+  if(HAL_DMA_Start(Timebase_TimHandle.hdma[TIM_DMA_ID_UPDATE], (uint32_t)&Ir_Tx_Arr[2],
+                   (uint32_t)&tim->ARR, IR_TX_DMA_LEN) != HAL_OK)
+    Error_Handler();
+  if(HAL_DMA_Start_IT(hdma, (uint32_t)Ir_Tx_Ccr,
+                      (uint32_t)&MODULATION_TIM->MODULATION_TIM_CCR,
+                      IR_TX_DMA_LEN) != HAL_OK)
+    Error_Handler();
+
+  __HAL_TIM_ENABLE_DMA(&Timebase_TimHandle, TIM_DMA_UPDATE | TIM_DMA_CC1);
+  __HAL_TIM_ENABLE(&Timebase_TimHandle);
+}
+
+/**
+  * @brief  The compare stream is done with a half of the envelope
+  *         The update stream, a phase ahead, is past the half too. Refill
+  *         it, unless it holds the end of the frames: the carrier is gated
+  *         off then, stop the timebase.
+  * @param  half: 0 - first half, 1 - second half
+  * @retval None
+  */
+static void Ir_Tx_Dma_Played(unsigned half)
+{
+  if (Ir_Tx_Dma_End != (int)half) {
+    Ir_Tx_Dma_Fill(half);
+    return;
+  }
+
+  __HAL_TIM_DISABLE(&Timebase_TimHandle);
+  __HAL_TIM_DISABLE_DMA(&Timebase_TimHandle, TIM_DMA_UPDATE | TIM_DMA_CC1);
+
+  /* The streams run in circles, stop both */
+  HAL_DMA_Abort(Timebase_TimHandle.hdma[TIM_DMA_ID_UPDATE]);
+  HAL_DMA_Abort(Timebase_TimHandle.hdma[TIM_DMA_ID_CC1]);
+
+  Ir_Tx_Busy = 0;
+}
+
+/**
+  * @brief  Compare stream half transfer callback
+  * @param  hdma: DMA handle
+  * @retval None
+  */
+static void Ir_Tx_Dma_HalfCplt(DMA_HandleTypeDef *hdma)
+{
+  (void)hdma;
+
+  Ir_Tx_Dma_Played(0);
+}
+
+/**
+  * @brief  Compare stream transfer complete callback
+  * @param  hdma: DMA handle
+  * @retval None
+  */
+static void Ir_Tx_Dma_Cplt(DMA_HandleTypeDef *hdma)
+{
+  (void)hdma;
+
+  Ir_Tx_Dma_Played(1);
+}
+#else
 /**
   * @brief  Period elapsed callback in non blocking mode
   * @param  htim: TIM handle
@@ -178,43 +936,28 @@ void HAL_TIM_IC_CaptureCallback(TIM_HandleTypeDef *htim)
   */
 void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
-  if (htim == &Modulation_TimHandle)
-    BSP_LED_Toggle(LED4);
+  struct ir_pulse phase;
 
   if (htim == &Timebase_TimHandle) {
-    static unsigned int key_bit_cntr = 0;
-    enum key_tx_phase phase = ZER_BIT_L;
-    uint16_t arr;
-
-    /* Tim3 runs continuosly, so halt the previous run */
-    HAL_TIM_Base_Stop_IT(&Modulation_TimHandle);
-    BSP_LED_Off(LED4);
-
-    if (key_bit_cntr < 32) {
-      phase = key_tx_phase_sof[key_bit_cntr];
-    } else if (key_bit_cntr < (32 + 36)) {
-      phase = key_tx_phase_key_p3[key_bit_cntr - 32];
-    } else if (key_bit_cntr < (32 + 36 + 1)) {
-      phase = IFS;
-    } else if (key_bit_cntr < (32 + 36 + 1 + 4)) {
-      phase = key_tx_phase_rpt[key_bit_cntr - 32 - 36 - 1];
-    } else {
+    if (!ir_tx_next(&Ir_Tx, &phase)) {
       HAL_TIM_Base_Stop_IT(&Timebase_TimHandle);
-      key_bit_cntr = 0;
+      ir_carrier_gate(&Ir_Tx_Carrier, 0);
+      BSP_LED_Off(LED4);
+      Ir_Tx_Busy = 0;
+      return;
     }
 
-    arr = key_tx_phase_period[phase];
-    if (arr) {
-      Timebase_TimHandle.Instance->ARR = arr;
-
-      if (phase == ZER_BIT_H || phase == ONE_BIT_H ||
-          phase == STR_BIT_H || phase == RPT_BIT_H)
-        HAL_TIM_Base_Start_IT(&Modulation_TimHandle);
+    Timebase_TimHandle.Instance->ARR = phase.duration - 1;
 
-      key_bit_cntr++;
-    }
+    /* Gate the carrier for the phase, LED4 shows the envelope */
+    ir_carrier_gate(&Ir_Tx_Carrier, phase.mark);
+    if (phase.mark)
+      BSP_LED_On(LED4);
+    else
+      BSP_LED_Off(LED4);
   }
 }
+#endif
 
 /**
   * @brief  This function is executed in case of error occurrence.
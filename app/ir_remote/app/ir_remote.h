@@ -1,6 +1,24 @@
 #ifndef __IR_REMOTE_H__
 #define __IR_REMOTE_H__
 
+#include "types.h"
 
+/**
+  * @brief  Send a key of a protocol with a descriptor (see ir_proto.h)
+  * @param  protocol: One of enum ir_protocol_id
+  * @param  address: Device address
+  * @param  command: Key code
+  * @param  repeats: Number of repeats after the key frame
+  * @retval ENO_ERROR if the key is on air
+  */
+int Ir_Tx_Send(unsigned protocol, uint16_t address, uint16_t command, unsigned repeats);
+
+/**
+  * @brief  Send a key packed with IR_TX_KEY (see ir_tx.h)
+  * @param  key: Protocol, address and command of the key
+  * @param  repeats: Number of repeats after the key frame
+  * @retval ENO_ERROR if the key is on air
+  */
+int Ir_Tx_Send_Key(uint32_t key, unsigned repeats);
 
 #endif /* __IR_REMOTE_H__ */
@@ -1,10 +1,44 @@
 
 #include "stm32f4xx_bsp.h"
 
-extern TIM_HandleTypeDef Capture_TimHandle;
-extern TIM_HandleTypeDef Modulation_TimHandle;
+extern TIM_HandleTypeDef Capture_TimHandle[CAPTURE_RX_NUM];
 extern TIM_HandleTypeDef Timebase_TimHandle;
 
+#if CAPTURE_RX_NUM < 1 || CAPTURE_RX_NUM > 2
+#error "CAPTURE_RX_NUM out of range"
+#endif
+
+const struct capture_bsp Capture_Bsp[CAPTURE_RX_NUM] = {
+  {
+    CAPTURE0_TIM, CAPTURE0_TIM_CHANNEL, CAPTURE0_TIM_HAL_LAYER_CHANNEL_NUM,
+    CAPTURE0_TIM_TRIGGER, CAPTURE0_TIM_TIMEOUT_CHANNEL,
+    CAPTURE0_TIM_TIMEOUT_HAL_LAYER_CHANNEL_NUM, CAPTURE0_TIM_TIMEOUT_IT,
+    CAPTURE0_TIM_GPIO_PORT, CAPTURE0_TIM_GPIO_PIN, CAPTURE0_TIM_DMA_ID,
+  },
+#if CAPTURE_RX_NUM > 1
+  {
+    CAPTURE1_TIM, CAPTURE1_TIM_CHANNEL, CAPTURE1_TIM_HAL_LAYER_CHANNEL_NUM,
+    CAPTURE1_TIM_TRIGGER, CAPTURE1_TIM_TIMEOUT_CHANNEL,
+    CAPTURE1_TIM_TIMEOUT_HAL_LAYER_CHANNEL_NUM, CAPTURE1_TIM_TIMEOUT_IT,
+    CAPTURE1_TIM_GPIO_PORT, CAPTURE1_TIM_GPIO_PIN, CAPTURE1_TIM_DMA_ID,
+  },
+#endif
+};
+
+#if CAPTURE_TIM_USE_DMA
+/* Handles for the capture DMA streams */
+static DMA_HandleTypeDef Capture_DmaHandle[CAPTURE_RX_NUM];
+#endif
+
+#if TIMEBASE_TIM_USE_DMA
+/* Handles for the tx envelope DMA streams */
+static DMA_HandleTypeDef Timebase_UpDmaHandle;
+static DMA_HandleTypeDef Timebase_CcDmaHandle;
+
+static void Timebase_Dma_Init(DMA_HandleTypeDef *dma, DMA_Stream_TypeDef *stream,
+                              uint32_t channel);
+#endif
+
 /*
  * Interrupt handlers for the CPU and the peripherals
  */
@@ -14,20 +48,43 @@ void SysTick_Handler(void)
   HAL_IncTick();
 }
 
-void Capture_TIM_IRQHandler(void)
+void Capture0_TIM_IRQHandler(void)
+{
+  HAL_TIM_IRQHandler(&Capture_TimHandle[0]);
+}
+
+#if CAPTURE_TIM_USE_DMA
+void Capture0_DMA_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&Capture_DmaHandle[0]);
+}
+#endif
+
+#if CAPTURE_RX_NUM > 1
+void Capture1_TIM_IRQHandler(void)
 {
-  HAL_TIM_IRQHandler(&Capture_TimHandle);
+  HAL_TIM_IRQHandler(&Capture_TimHandle[1]);
 }
 
-void Modulation_TIM_IRQHandler(void)
+#if CAPTURE_TIM_USE_DMA
+void Capture1_DMA_IRQHandler(void)
 {
-  HAL_TIM_IRQHandler(&Modulation_TimHandle);
+  HAL_DMA_IRQHandler(&Capture_DmaHandle[1]);
 }
+#endif
+#endif
 
+#if TIMEBASE_TIM_USE_DMA
+void Timebase_CC_DMA_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&Timebase_CcDmaHandle);
+}
+#else
 void Timebase_TIM_IRQHandler(void)
 {
   HAL_TIM_IRQHandler(&Timebase_TimHandle);
 }
+#endif
 
 /*
  * ST library callbacks imlementation
@@ -36,39 +93,147 @@ void Timebase_TIM_IRQHandler(void)
 void HAL_TIM_IC_MspInit(TIM_HandleTypeDef *htim)
 {
   GPIO_InitTypeDef GPIO_InitStruct;
-
-  /* Capture timer peripheral clock enable */
-  CAPTURE_TIM_CLK_ENABLE();
-
-  /* Enable GPIO clock */
-  CAPTURE_TIM_GPIO_PORT_CLK_ENABLE();
+  IRQn_Type tim_irqn;
+#if CAPTURE_TIM_USE_DMA
+  DMA_HandleTypeDef *dma;
+  IRQn_Type dma_irqn;
+#endif
+  unsigned rx;
+
+  /* Enable the clocks and select the resources of the receiver */
+  if (htim->Instance == CAPTURE0_TIM)
+  {
+    rx = 0;
+    CAPTURE0_TIM_CLK_ENABLE();
+    CAPTURE0_TIM_GPIO_PORT_CLK_ENABLE();
+    GPIO_InitStruct.Alternate = CAPTURE0_TIM_GPIO_AF;
+    tim_irqn = CAPTURE0_TIM_IRQn;
+#if CAPTURE_TIM_USE_DMA
+    CAPTURE0_DMA_CLK_ENABLE();
+    dma = &Capture_DmaHandle[0];
+    dma->Instance = CAPTURE0_DMA_STREAM;
+    dma->Init.Channel = CAPTURE0_DMA_CHANNEL;
+    dma_irqn = CAPTURE0_DMA_IRQn;
+#endif
+  }
+#if CAPTURE_RX_NUM > 1
+  else if (htim->Instance == CAPTURE1_TIM)
+  {
+    rx = 1;
+    CAPTURE1_TIM_CLK_ENABLE();
+    CAPTURE1_TIM_GPIO_PORT_CLK_ENABLE();
+    GPIO_InitStruct.Alternate = CAPTURE1_TIM_GPIO_AF;
+    tim_irqn = CAPTURE1_TIM_IRQn;
+#if CAPTURE_TIM_USE_DMA
+    CAPTURE1_DMA_CLK_ENABLE();
+    dma = &Capture_DmaHandle[1];
+    dma->Instance = CAPTURE1_DMA_STREAM;
+    dma->Init.Channel = CAPTURE1_DMA_CHANNEL;
+    dma_irqn = CAPTURE1_DMA_IRQn;
+#endif
+  }
+#endif
+  else
+    return;
 
   /* Configure timer channel alternate function */
-  GPIO_InitStruct.Pin = CAPTURE_TIM_GPIO_PIN;
+  GPIO_InitStruct.Pin = Capture_Bsp[rx].gpio_pin;
   GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
   GPIO_InitStruct.Pull = GPIO_PULLUP;
   GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
-  GPIO_InitStruct.Alternate = CAPTURE_TIM_GPIO_AF;
-  HAL_GPIO_Init(CAPTURE_TIM_GPIO_PORT, &GPIO_InitStruct);
+  HAL_GPIO_Init(Capture_Bsp[rx].gpio_port, &GPIO_InitStruct);
+
+#if CAPTURE_TIM_USE_DMA
+  /* Capture DMA stream copies the captured values into a circular buffer */
+  dma->Init.Direction = DMA_PERIPH_TO_MEMORY;
+  dma->Init.PeriphInc = DMA_PINC_DISABLE;
+  dma->Init.MemInc = DMA_MINC_ENABLE;
+  dma->Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  dma->Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  dma->Init.Mode = DMA_CIRCULAR;
+  dma->Init.Priority = DMA_PRIORITY_HIGH;
+  dma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+  HAL_DMA_Init(dma);
+
+  __HAL_LINKDMA(htim, hdma[Capture_Bsp[rx].dma_id], *dma);
+
+  /* Enable the capture DMA stream interrupt (half and full transfer) */
+  HAL_NVIC_SetPriority(dma_irqn, 4, 0);
+  HAL_NVIC_EnableIRQ(dma_irqn);
+#endif
 
   /* Enable the capture timer global interrupt */
-  HAL_NVIC_SetPriority(CAPTURE_TIM_IRQn, 4, 0);
-  HAL_NVIC_EnableIRQ(CAPTURE_TIM_IRQn);
+  HAL_NVIC_SetPriority(tim_irqn, 4, 0);
+  HAL_NVIC_EnableIRQ(tim_irqn);
 }
 
-void HAL_TIM_Base_MspInit(TIM_HandleTypeDef *htim)
+void HAL_TIM_PWM_MspInit(TIM_HandleTypeDef *htim)
 {
+  GPIO_InitTypeDef GPIO_InitStruct;
+
   /* Modulation timer peripheral clock enable */
   MODULATION_TIM_CLK_ENABLE();
 
-  /* Enable the modulation timer global interrupt */
-  HAL_NVIC_SetPriority(MODULATION_TIM_IRQn, 4, 0);
-  HAL_NVIC_EnableIRQ(MODULATION_TIM_IRQn);
+  /* Enable GPIO clock */
+  MODULATION_TIM_GPIO_PORT_CLK_ENABLE();
+
+  /* Configure timer channel alternate function, the carrier output */
+  GPIO_InitStruct.Pin = MODULATION_TIM_GPIO_PIN;
+  GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
+  GPIO_InitStruct.Alternate = MODULATION_TIM_GPIO_AF;
+  HAL_GPIO_Init(MODULATION_TIM_GPIO_PORT, &GPIO_InitStruct);
+}
 
+void HAL_TIM_Base_MspInit(TIM_HandleTypeDef *htim)
+{
   /* Timebase timer peripheral clock enable */
   TIMEBASE_TIM_CLK_ENABLE();
 
+#if TIMEBASE_TIM_USE_DMA
+  /* The envelope streams write the timer registers on the timer events */
+  TIMEBASE_DMA_CLK_ENABLE();
+  Timebase_Dma_Init(&Timebase_UpDmaHandle, TIMEBASE_UP_DMA_STREAM, TIMEBASE_UP_DMA_CHANNEL);
+  __HAL_LINKDMA(htim, hdma[TIM_DMA_ID_UPDATE], Timebase_UpDmaHandle);
+  Timebase_Dma_Init(&Timebase_CcDmaHandle, TIMEBASE_CC_DMA_STREAM, TIMEBASE_CC_DMA_CHANNEL);
+  __HAL_LINKDMA(htim, hdma[TIM_DMA_ID_CC1], Timebase_CcDmaHandle);
+
+  /* Enable the compare stream interrupt, it refills the envelope and ends
+   * the transmission */
+  HAL_NVIC_SetPriority(TIMEBASE_CC_DMA_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(TIMEBASE_CC_DMA_IRQn);
+#else
   /* Enable the timebase timer global interrupt */
   HAL_NVIC_SetPriority(TIMEBASE_TIM_IRQn, 4, 0);
   HAL_NVIC_EnableIRQ(TIMEBASE_TIM_IRQn);
+#endif
+}
+
+#if TIMEBASE_TIM_USE_DMA
+/**
+  * @brief  Setup a tx envelope DMA stream
+  * @param  dma: DMA handle
+  * @param  stream: DMA stream
+  * @param  channel: DMA channel of the timebase timer request
+  * @retval None
+  */
+static void Timebase_Dma_Init(DMA_HandleTypeDef *dma, DMA_Stream_TypeDef *stream,
+                              uint32_t channel)
+{
+  /* Half words from the envelope into a timer register, at a priority
+   * above the capture streams so a phase never starts late. The streams
+   * play the envelope in circles while it is refilled */
+  dma->Instance = stream;
+  dma->Init.Channel = channel;
+  dma->Init.Direction = DMA_MEMORY_TO_PERIPH;
+  dma->Init.PeriphInc = DMA_PINC_DISABLE;
+  dma->Init.MemInc = DMA_MINC_ENABLE;
+  dma->Init.PeriphDataAlignment = DMA_PDATAALIGN_HALFWORD;
+  dma->Init.MemDataAlignment = DMA_MDATAALIGN_HALFWORD;
+  dma->Init.Mode = DMA_CIRCULAR;
+  dma->Init.Priority = DMA_PRIORITY_VERY_HIGH;
+  dma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+  HAL_DMA_Init(dma);
 }
+#endif
@@ -4,26 +4,105 @@
 #include "stm32f4xx_hal.h"
 #include "stm32f4_discovery.h"
 
-/* Definitions for the rx capture timer resources */
-#define CAPTURE_TIM                           TIM5
-#define CAPTURE_TIM_CLK_ENABLE()              __HAL_RCC_TIM5_CLK_ENABLE()
-#define CAPTURE_TIM_CHANNEL                   TIM_CHANNEL_2
-#define CAPTURE_TIM_HAL_LAYER_CHANNEL_NUM     HAL_TIM_ACTIVE_CHANNEL_2
+/* Number of IR receivers (e.g., front and rear), each on its own capture
+ * timer with its own DMA stream */
+#define CAPTURE_RX_NUM                        2
 
-#define CAPTURE_TIM_GPIO_PORT_CLK_ENABLE()    __HAL_RCC_GPIOA_CLK_ENABLE()
-#define CAPTURE_TIM_GPIO_PORT                 GPIOA
-#define CAPTURE_TIM_GPIO_PIN                  GPIO_PIN_1
-#define CAPTURE_TIM_GPIO_AF                   GPIO_AF2_TIM5
+/* Definitions for the rx capture timer resources of the front receiver */
+#define CAPTURE0_TIM                          TIM5
+#define CAPTURE0_TIM_CLK_ENABLE()             __HAL_RCC_TIM5_CLK_ENABLE()
+#define CAPTURE0_TIM_CHANNEL                  TIM_CHANNEL_2
+#define CAPTURE0_TIM_HAL_LAYER_CHANNEL_NUM    HAL_TIM_ACTIVE_CHANNEL_2
+#define CAPTURE0_TIM_TRIGGER                  TIM_TS_TI2FP2
 
-#define CAPTURE_TIM_IRQn                      TIM5_IRQn
-#define Capture_TIM_IRQHandler                TIM5_IRQHandler
+/* Output compare channel (timing mode, the pin is not driven) that fires
+ * when the line has been idle for the gap timeout */
+#define CAPTURE0_TIM_TIMEOUT_CHANNEL          TIM_CHANNEL_1
+#define CAPTURE0_TIM_TIMEOUT_HAL_LAYER_CHANNEL_NUM HAL_TIM_ACTIVE_CHANNEL_1
+#define CAPTURE0_TIM_TIMEOUT_IT               TIM_IT_CC1
 
-/* Definitions for the tx modulation timer resources */
+#define CAPTURE0_TIM_GPIO_PORT_CLK_ENABLE()   __HAL_RCC_GPIOA_CLK_ENABLE()
+#define CAPTURE0_TIM_GPIO_PORT                GPIOA
+#define CAPTURE0_TIM_GPIO_PIN                 GPIO_PIN_1
+#define CAPTURE0_TIM_GPIO_AF                  GPIO_AF2_TIM5
+
+#define CAPTURE0_TIM_IRQn                     TIM5_IRQn
+#define Capture0_TIM_IRQHandler               TIM5_IRQHandler
+
+#define CAPTURE0_TIM_DMA_ID                   TIM_DMA_ID_CC2
+#define CAPTURE0_DMA_CLK_ENABLE()             __HAL_RCC_DMA1_CLK_ENABLE()
+#define CAPTURE0_DMA_STREAM                   DMA1_Stream4
+#define CAPTURE0_DMA_CHANNEL                  DMA_CHANNEL_6
+
+#define CAPTURE0_DMA_IRQn                     DMA1_Stream4_IRQn
+#define Capture0_DMA_IRQHandler               DMA1_Stream4_IRQHandler
+
+/* Definitions for the rx capture timer resources of the rear receiver.
+ * TIM2 is the other 32-bit timer, its channel 1 is on PA15 (JTDI, free
+ * when debugging over SWD) */
+#define CAPTURE1_TIM                          TIM2
+#define CAPTURE1_TIM_CLK_ENABLE()             __HAL_RCC_TIM2_CLK_ENABLE()
+#define CAPTURE1_TIM_CHANNEL                  TIM_CHANNEL_1
+#define CAPTURE1_TIM_HAL_LAYER_CHANNEL_NUM    HAL_TIM_ACTIVE_CHANNEL_1
+#define CAPTURE1_TIM_TRIGGER                  TIM_TS_TI1FP1
+
+#define CAPTURE1_TIM_TIMEOUT_CHANNEL          TIM_CHANNEL_2
+#define CAPTURE1_TIM_TIMEOUT_HAL_LAYER_CHANNEL_NUM HAL_TIM_ACTIVE_CHANNEL_2
+#define CAPTURE1_TIM_TIMEOUT_IT               TIM_IT_CC2
+
+#define CAPTURE1_TIM_GPIO_PORT_CLK_ENABLE()   __HAL_RCC_GPIOA_CLK_ENABLE()
+#define CAPTURE1_TIM_GPIO_PORT                GPIOA
+#define CAPTURE1_TIM_GPIO_PIN                 GPIO_PIN_15
+#define CAPTURE1_TIM_GPIO_AF                  GPIO_AF1_TIM2
+
+#define CAPTURE1_TIM_IRQn                     TIM2_IRQn
+#define Capture1_TIM_IRQHandler               TIM2_IRQHandler
+
+#define CAPTURE1_TIM_DMA_ID                   TIM_DMA_ID_CC1
+#define CAPTURE1_DMA_CLK_ENABLE()             __HAL_RCC_DMA1_CLK_ENABLE()
+#define CAPTURE1_DMA_STREAM                   DMA1_Stream5
+#define CAPTURE1_DMA_CHANNEL                  DMA_CHANNEL_3
+
+#define CAPTURE1_DMA_IRQn                     DMA1_Stream5_IRQn
+#define Capture1_DMA_IRQHandler               DMA1_Stream5_IRQHandler
+
+/* Capture the edges by DMA instead of one interrupt per edge */
+#define CAPTURE_TIM_USE_DMA                   1
+
+/* TIM5 and TIM2 are 32-bit timers: let them run free at the timer clock and
+ * capture absolute timestamps instead of resetting them on every edge */
+#define CAPTURE_TIM_TIMESTAMP                 0
+
+/**
+  * @brief Capture timer resources of an IR receiver
+  */
+struct capture_bsp {
+  TIM_TypeDef *tim;                         /*!< Capture timer */
+  uint32_t channel;                         /*!< Input capture channel */
+  HAL_TIM_ActiveChannel hal_channel;        /*!< Input capture channel of the callbacks */
+  uint32_t trigger;                         /*!< Slave mode trigger of the channel */
+  uint32_t timeout_channel;                 /*!< Gap timeout compare channel */
+  HAL_TIM_ActiveChannel timeout_hal_channel; /*!< Compare channel of the callbacks */
+  uint32_t timeout_it;                      /*!< Gap timeout compare interrupt */
+  GPIO_TypeDef *gpio_port;                  /*!< Receiver input port */
+  uint32_t gpio_pin;                        /*!< Receiver input pin */
+  uint32_t dma_id;                          /*!< DMA handle index of the channel */
+};
+
+/* Receivers, indexed like the capture timer handles */
+extern const struct capture_bsp Capture_Bsp[CAPTURE_RX_NUM];
+
+/* Definitions for the tx modulation timer resources. The carrier is the
+ * PWM output of the channel, it runs without interrupts */
 #define MODULATION_TIM                        TIM3
 #define MODULATION_TIM_CLK_ENABLE()           __HAL_RCC_TIM3_CLK_ENABLE()
+#define MODULATION_TIM_CHANNEL                TIM_CHANNEL_1
+#define MODULATION_TIM_CCR                    CCR1
 
-#define MODULATION_TIM_IRQn                   TIM3_IRQn
-#define Modulation_TIM_IRQHandler             TIM3_IRQHandler
+#define MODULATION_TIM_GPIO_PORT_CLK_ENABLE() __HAL_RCC_GPIOC_CLK_ENABLE()
+#define MODULATION_TIM_GPIO_PORT              GPIOC
+#define MODULATION_TIM_GPIO_PIN               GPIO_PIN_6
+#define MODULATION_TIM_GPIO_AF                GPIO_AF2_TIM3
 
 /* Definitions for the tx timebase timer resources */
 #define TIMEBASE_TIM                          TIM4
@@ -32,9 +111,26 @@
 #define TIMEBASE_TIM_IRQn                     TIM4_IRQn
 #define Timebase_TIM_IRQHandler               TIM4_IRQHandler
 
+/* The update stream writes the auto reload of the next phase, the compare
+ * stream (compare on 1, one tick into the phase) writes the carrier gate */
+#define TIMEBASE_DMA_CLK_ENABLE()             __HAL_RCC_DMA1_CLK_ENABLE()
+#define TIMEBASE_UP_DMA_STREAM                DMA1_Stream6
+#define TIMEBASE_UP_DMA_CHANNEL               DMA_CHANNEL_2
+#define TIMEBASE_CC_DMA_STREAM                DMA1_Stream0
+#define TIMEBASE_CC_DMA_CHANNEL               DMA_CHANNEL_2
+
+#define TIMEBASE_CC_DMA_IRQn                  DMA1_Stream0_IRQn
+#define Timebase_CC_DMA_IRQHandler            DMA1_Stream0_IRQHandler
+
+/* Play the tx envelope by DMA instead of one timebase interrupt per phase */
+#define TIMEBASE_TIM_USE_DMA                  1
+
 void SysTick_Handler(void);
-void Capture_TIM_IRQHandler(void);
-void Modulation_TIM_IRQHandler(void);
+void Capture0_TIM_IRQHandler(void);
+void Capture0_DMA_IRQHandler(void);
+void Capture1_TIM_IRQHandler(void);
+void Capture1_DMA_IRQHandler(void);
 void Timebase_TIM_IRQHandler(void);
+void Timebase_CC_DMA_IRQHandler(void);
 
 #endif /* __STM32F4XX_BSP_H__ */
@@ -0,0 +1,445 @@
+/**
+ * @file  broadcast.c
+ *
+ * @brief Broadcast ring
+ *
+ * The head counts the elements pushed and each subscriber cursor counts the
+ * elements read (or lost) by the subscriber. They run freely and are wrapped
+ * with a mask only to access the elements.
+ *
+ * The producer overwrites the slot of the element head - nelems, so a
+ * subscriber can read an element only while head - cursor < nelems. The
+ * slot being written is never readable: the producer publishes the previous
+ * head before it writes the slot. A subscriber copies the element and then
+ * reads the head again; if the producer has moved on far enough to overwrite
+ * the slot in the meantime, the copy is discarded and the element is counted
+ * as lost.
+ */
+
+#include "broadcast.h"
+#include "class.h"
+
+/*!< Address of the slot of the element at index i */
+#define BCAST_SLOT(desc, i)                                             \
+    ((uint8_t *)(desc)->init->elem +                                    \
+     ((i) & ((desc)->init->nelems - 1)) * (desc)->init->elem_size)
+/*!< Number of elements a subscriber can fall behind */
+#define BCAST_SIZE(desc)        ((desc)->init->nelems - 1)
+
+/**
+ * @brief Subscriber state
+ */
+struct broadcast_sub {
+    unsigned cursor;    /*!< Index of the next element to read */
+    unsigned lost;      /*!< Elements overwritten before they were read */
+};
+
+/**
+ * @brief Broadcast ring descriptor
+ *
+ * Internal structure used to manage the broadcast rings.
+ */
+struct broadcast_desc {
+    const struct class *class;
+    struct broadcast_init *init;    /*!< Ring init parameters */
+    unsigned head;                  /*!< Index of the next element to write */
+    unsigned nsubs;                 /*!< Number of subscribers */
+    struct broadcast_sub sub[BCAST_MAX_SUBSCRIBERS];
+};
+
+static int broadcast_push(struct broadcast_desc *desc, const void *elem);
+static int broadcast_subscribe(struct broadcast_desc *desc, unsigned *id);
+static int broadcast_pop(struct broadcast_desc *desc, struct broadcast_read *rd);
+
+static void *broadcast_ctor(void *data);
+static void broadcast_dtor(void *self);
+static int broadcast_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Push an element into the ring
+ *
+ * The oldest element is overwritten, the producer never waits for the
+ * subscribers. Only the producer may call this function.
+ *
+ * @param desc Ring descriptor
+ * @param elem Element to be pushed into the ring
+ *
+ * @return ENO_ERROR
+ */
+static int broadcast_push(struct broadcast_desc *desc, const void *elem)
+{
+    unsigned head = ATOMIC_LOAD_RELAXED(&desc->head);
+
+    /* The previous head is visible before the slot is overwritten */
+    ATOMIC_FENCE_RELEASE();
+    memcpy(BCAST_SLOT(desc, head), elem, desc->init->elem_size);
+    /* Publish the element to the subscribers */
+    ATOMIC_STORE_RELEASE(&desc->head, head + 1);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Add a subscriber
+ *
+ * Subscribers cannot be added concurrently, but the producer can be active.
+ *
+ * @param desc Ring descriptor
+ * @param id The subscriber id is returned in this param.
+ *
+ * @return ENO_ERROR, if the subscriber is added.
+ *         EFAIL, if the ring has the maximum number of subscribers.
+ */
+static int broadcast_subscribe(struct broadcast_desc *desc, unsigned *id)
+{
+    struct broadcast_sub *sub;
+
+    if (desc->nsubs == BCAST_MAX_SUBSCRIBERS)
+        return EFAIL;
+
+    sub = &desc->sub[desc->nsubs];
+    sub->cursor = ATOMIC_LOAD_ACQUIRE(&desc->head);
+    sub->lost = 0;
+    *id = desc->nsubs++;
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Read the next element of a subscriber
+ *
+ * The elements the subscriber fell too far behind to read are skipped and
+ * counted as lost. Only the subscriber may call this function for its id.
+ *
+ * @param desc Ring descriptor
+ * @param rd Subscriber id, memory for the element and the lost count
+ *
+ * @return ENO_ERROR, if an element is read.
+ *         EBUFFER_EMPTY, if the subscriber has read all the elements.
+ *         EFAIL, if the subscriber id is not valid.
+ */
+static int broadcast_pop(struct broadcast_desc *desc, struct broadcast_read *rd)
+{
+    struct broadcast_sub *sub;
+    unsigned cursor, head;
+    int ret;
+
+    if (rd->sub >= desc->nsubs)
+        return EFAIL;
+
+    sub = &desc->sub[rd->sub];
+    cursor = sub->cursor;
+
+    for (;;) {
+        /* Acquire the elements published by the producer */
+        head = ATOMIC_LOAD_ACQUIRE(&desc->head);
+        if (cursor == head) {
+            ret = EBUFFER_EMPTY;
+            break;
+        }
+
+        /* Skip the elements that were overwritten */
+        if (head - cursor > BCAST_SIZE(desc)) {
+            sub->lost += head - cursor - BCAST_SIZE(desc);
+            cursor = head - BCAST_SIZE(desc);
+        }
+
+        memcpy(rd->elem, BCAST_SLOT(desc, cursor), desc->init->elem_size);
+
+        /* The copy is valid, if the slot was not overwritten meanwhile */
+        ATOMIC_FENCE_ACQUIRE();
+        if (ATOMIC_LOAD_RELAXED(&desc->head) - cursor <= BCAST_SIZE(desc)) {
+            cursor++;
+            ret = ENO_ERROR;
+            break;
+        }
+    }
+
+    sub->cursor = cursor;
+    rd->lost = sub->lost;
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a broadcast ring descriptor
+ */
+static void *broadcast_ctor(void *data)
+{
+    struct broadcast_init *init = data;
+    struct broadcast_desc *desc;
+
+    /* Indexes are wrapped with a mask */
+    if (!init || init->nelems < 2 || (init->nelems & (init->nelems - 1)))
+        return NULL;
+
+    desc = mm_alloc(sizeof(struct broadcast_desc));
+    if (desc) {
+        desc->class = broadcast;
+        desc->init = init;
+        desc->head = 0;
+        desc->nsubs = 0;
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the broadcast ring descriptor
+ */
+static void broadcast_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle broadcast ring operations
+ */
+static int broadcast_ioctl(void *self, int cmd, void *data)
+{
+    struct broadcast_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_BROADCAST) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_BCAST_PUSH:
+            ret = broadcast_push(desc, data);
+            break;
+        case IOCTL_BCAST_SUBSCRIBE:
+            ret = broadcast_subscribe(desc, (unsigned *)data);
+            break;
+        case IOCTL_BCAST_POP:
+            ret = broadcast_pop(desc, (struct broadcast_read *)data);
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Broadcast ring class
+ */
+static const struct class _broadcast = {
+    broadcast_ctor,
+    broadcast_dtor,
+    broadcast_ioctl,
+};
+
+const void *broadcast = &_broadcast;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define BCAST_NELEMS        8
+#define BCAST_MT_NELEMS     64
+#define BCAST_MT_COUNT      (1UL << 20)
+
+/**
+ * @brief Test event
+ */
+struct test_event {
+    uint32_t seq;       /*!< Index of the event */
+    uint32_t check;     /*!< Inverted index, to detect torn copies */
+};
+
+static struct test_event test_elem[BCAST_NELEMS];
+static struct test_event test_mt_elem[BCAST_MT_NELEMS];
+static struct broadcast_desc *test_mt_bc;
+
+static int broadcast_test_push(struct broadcast_desc *desc, uint32_t seq);
+static int broadcast_ss_test(void);
+static void *broadcast_mt_producer(void *arg);
+static void *broadcast_mt_subscriber(void *arg);
+static int broadcast_mt_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Push the event with index seq
+ */
+static int broadcast_test_push(struct broadcast_desc *desc, uint32_t seq)
+{
+    struct test_event ev = { seq, ~seq };
+
+    return broadcast_push(desc, &ev);
+}
+
+/**
+ * @brief Single thread test
+ */
+static int broadcast_ss_test(void)
+{
+    struct broadcast_init init = { test_elem, (unsigned)sizeof(struct test_event),
+                                    BCAST_NELEMS };
+    struct broadcast_desc *desc;
+    struct test_event ev;
+    struct broadcast_read fast = { 0, &ev, 0 }, slow = { 0, &ev, 0 };
+    struct broadcast_read late = { 0, &ev, 0 };
+    uint32_t i;
+    int err = EFAIL;
+
+    desc = new(broadcast, &init);
+    TEST_AND_EXIT_ON_FAIL("broadcast_new", desc != NULL);
+    TEST_AND_EXIT_ON_FAIL("broadcast_subscribe",
+        (err = broadcast_subscribe(desc, &fast.sub)) == ENO_ERROR && fast.sub == 0);
+    TEST_AND_EXIT_ON_FAIL("broadcast_subscribe",
+        (err = broadcast_subscribe(desc, &slow.sub)) == ENO_ERROR && slow.sub == 1);
+
+    /* Every subscriber reads every element */
+    for (i = 0; i < 5; i++)
+        broadcast_test_push(desc, i);
+    for (i = 0; i < 5; i++) {
+        TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+            (err = broadcast_pop(desc, &fast)) == ENO_ERROR && ev.seq == i);
+        TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+            (err = broadcast_pop(desc, &slow)) == ENO_ERROR && ev.seq == i);
+    }
+    TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+        (err = broadcast_pop(desc, &fast)) == EBUFFER_EMPTY);
+
+    /* A late subscriber gets the new elements only */
+    TEST_AND_EXIT_ON_FAIL("broadcast_subscribe",
+        (err = broadcast_subscribe(desc, &late.sub)) == ENO_ERROR && late.sub == 2);
+    TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+        (err = broadcast_pop(desc, &late)) == EBUFFER_EMPTY);
+
+    /* The slow subscriber loses the oldest elements, the others do not */
+    for (i = 5; i < 15; i++) {
+        broadcast_test_push(desc, i);
+        TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+            (err = broadcast_pop(desc, &fast)) == ENO_ERROR && ev.seq == i &&
+            fast.lost == 0);
+    }
+    for (i = 15 - (BCAST_NELEMS - 1); i < 15; i++)
+        TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+            (err = broadcast_pop(desc, &slow)) == ENO_ERROR && ev.seq == i &&
+            slow.lost == 10 - (BCAST_NELEMS - 1));
+    TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+        (err = broadcast_pop(desc, &slow)) == EBUFFER_EMPTY);
+    for (i = 15 - (BCAST_NELEMS - 1); i < 15; i++)
+        TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+            (err = broadcast_pop(desc, &late)) == ENO_ERROR && ev.seq == i);
+    TEST_AND_EXIT_ON_FAIL("broadcast_pop", late.lost == 10 - (BCAST_NELEMS - 1));
+
+    late.sub = BCAST_MAX_SUBSCRIBERS;
+    TEST_AND_EXIT_ON_FAIL("broadcast_pop",
+        (err = broadcast_pop(desc, &late)) == EFAIL);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Producer thread, pushes a sequence of events without waiting
+ */
+static void *broadcast_mt_producer(void *arg)
+{
+    uint32_t i;
+
+    UNUSED(arg);
+
+    for (i = 0; i < BCAST_MT_COUNT; i++) {
+        broadcast_test_push(test_mt_bc, i);
+        /* Let the subscribers run, they fall behind in between */
+        if (!(i & 0xff))
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Subscriber thread, counts the events that are torn or out of
+ *        sequence (each event is either read or counted as lost)
+ */
+static void *broadcast_mt_subscriber(void *arg)
+{
+    struct broadcast_read *rd = arg;
+    struct test_event *ev = rd->elem;
+    unsigned long nread = 0, errors = 0;
+
+    while (nread + rd->lost < BCAST_MT_COUNT) {
+        if (broadcast_pop(test_mt_bc, rd) != ENO_ERROR) {
+            sched_yield();
+            continue;
+        }
+        if (ev->seq != nread + rd->lost || ev->check != ~ev->seq)
+            errors++;
+        nread++;
+    }
+
+    return (void *)errors;
+}
+
+/**
+ * @brief One producer and two subscriber threads
+ */
+static int broadcast_mt_test(void)
+{
+    struct broadcast_init init = { test_mt_elem, (unsigned)sizeof(struct test_event),
+                                   BCAST_MT_NELEMS };
+    struct test_event ev[2];
+    struct broadcast_read rd[2] = { { 0, &ev[0], 0 }, { 0, &ev[1], 0 } };
+    pthread_t producer, subscriber[2];
+    void *errors[2];
+    int i;
+
+    test_mt_bc = new(broadcast, &init);
+    if (!test_mt_bc || broadcast_subscribe(test_mt_bc, &rd[0].sub) ||
+        broadcast_subscribe(test_mt_bc, &rd[1].sub)) {
+        printf("broadcast_mt_test: ring allocation failed\n");
+        return EFAIL;
+    }
+
+    for (i = 0; i < 2; i++)
+        pthread_create(&subscriber[i], NULL, broadcast_mt_subscriber, &rd[i]);
+    pthread_create(&producer, NULL, broadcast_mt_producer, NULL);
+    pthread_join(producer, NULL);
+    for (i = 0; i < 2; i++)
+        pthread_join(subscriber[i], &errors[i]);
+
+    for (i = 0; i < 2; i++) {
+        printf("broadcast_mt_test: subscriber %d read %lu, lost %u of %lu events\n",
+               i, BCAST_MT_COUNT - rd[i].lost, rd[i].lost, BCAST_MT_COUNT);
+        if (errors[i]) {
+            printf("broadcast_mt_test: %lu events torn or out of sequence\n",
+                   (unsigned long)errors[i]);
+            return EFAIL;
+        }
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing broadcast ring\n");
+    if (broadcast_ss_test() != ENO_ERROR || broadcast_mt_test() != ENO_ERROR)
+        printf("Broadcast ring test failed\n");
+    else
+        printf("Broadcast ring test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,73 @@
+/**
+ * @file  broadcast.h
+ *
+ * @brief Broadcast ring
+ *
+ * A broadcast ring delivers every element pushed by a single producer to
+ * each of its subscribers, so an event (for example a decoded IR frame)
+ * reaches several consumers without being copied into a buffer per
+ * consumer. Every subscriber has its own read cursor into the shared ring.
+ *
+ * The producer never waits for the subscribers: the ring overwrites the
+ * oldest elements. A subscriber that falls behind by more than the ring can
+ * hold loses the oldest elements it has not read, without affecting the
+ * other subscribers, and the elements it lost are counted.
+ *
+ * The memory for the ring is provided by the caller, and the elements can be
+ * of any type. The number of elements must be a power of 2 and the ring
+ * holds one element less for each subscriber.
+ *
+ * Usage:
+ *
+ * void *bc = new(broadcast, &init);
+ * unsigned sub;
+ *
+ * ioctl(bc, IOC(IOCTL_BROADCAST, IOCTL_BCAST_SUBSCRIBE), &sub);
+ * ioctl(bc, IOC(IOCTL_BROADCAST, IOCTL_BCAST_PUSH), &frame);     (producer)
+ *
+ * struct broadcast_read rd = { sub, &frame, 0 };                  (subscriber)
+ * while (ioctl(bc, IOC(IOCTL_BROADCAST, IOCTL_BCAST_POP), &rd) == ENO_ERROR)
+ *     ...
+ */
+
+#ifndef __BROADCAST_H__
+#define __BROADCAST_H__
+
+#include "common.h"
+
+/**
+ * @brief Broadcast ring IOCTLs
+ */
+/*!< Write an element into the ring */
+#define IOCTL_BCAST_PUSH        0
+/*!< Add a subscriber (unsigned), returns the subscriber id in the param.
+ *   The subscriber receives the elements pushed after it subscribed. */
+#define IOCTL_BCAST_SUBSCRIBE   1
+/*!< Read the next element of a subscriber (struct broadcast_read) */
+#define IOCTL_BCAST_POP         2
+
+/*!< Maximum number of subscribers of a ring */
+#define BCAST_MAX_SUBSCRIBERS   8
+
+/**
+ * @brief Broadcast ring initializer
+ */
+struct broadcast_init {
+    void *elem;         /*!< Array of elements allocated by the caller */
+    unsigned elem_size; /*!< Size of an element (bytes) */
+    unsigned nelems;    /*!< Number of elements in the \a elem array */
+};
+
+/**
+ * @brief Read parameters of a subscriber
+ */
+struct broadcast_read {
+    unsigned sub;       /*!< Subscriber id */
+    void *elem;         /*!< Memory for the element read */
+    unsigned lost;      /*!< Returns the number of elements the subscriber lost */
+};
+
+/* Broadcast ring type definition */
+extern const void *broadcast;
+
+#endif /* __BROADCAST_H__ */
@@ -9,6 +9,22 @@
  * is full. The buffer is full if the next location to be written has the same
  * index as the current read index. The buffer is empty if the write (head)
  * and read (tail) indexes are the same.
+ *
+ * The head and tail run freely and are wrapped with a mask only to access the
+ * elements: head - tail is the number of elements in the buffer.
+ *
+ * The buffer is lock free for a single producer and a single consumer: the
+ * head is written only by the producer and the tail only by the consumer.
+ * The producer writes the element before it publishes the new head with a
+ * release store, and the consumer reads the head with an acquire load before
+ * it reads the element. The tail hands the free slots back the same way.
+ * Flushing the buffer is not safe while the producer or consumer is active.
+ *
+ * In the overwrite mode the producer drops the oldest element by moving the
+ * tail too, so both sides move the tail with a compare and swap. A consumer
+ * that loses the race to the producer discards the element it read and
+ * reads the next one. The tail never repeats (it runs freely), so a stale
+ * tail cannot be mistaken for the current one.
  */
 
 #include "buffer.h"
@@ -17,23 +33,52 @@
 /**
  * @brief Buffer descriptor
  *
- * Internal structure used to manage the buffers.
+ * Internal structure used to manage the buffers. On targets with a data
+ * cache, the fields written by the producer and by the consumer are on
+ * separate cache lines and away from the read only fields.
  */
 struct buffer_desc {
     const struct class *class;
     struct buffer_init *init;   /*!< Buffer init parameters */
-    unsigned head;              /*!< Buffer index for the writer */
-    unsigned tail;              /*!< Buffer index for the reader */
+#if CACHE_LINE_SIZE
+    char pad0[CACHE_LINE_SIZE];
+#endif
+    unsigned head;              /*!< Buffer index for the writer (free running) */
+    unsigned overflows;         /*!< Elements dropped because the buffer was full */
+#if CACHE_LINE_SIZE
+    char pad1[CACHE_LINE_SIZE - 2 * sizeof(unsigned)];
+#endif
+    unsigned tail;              /*!< Buffer index for the reader (free running) */
+#if CACHE_LINE_SIZE
+    char pad2[CACHE_LINE_SIZE - sizeof(unsigned)];
+#endif
 };
 
+/*!< Slot of the element at index i */
+#define BUFFER_SLOT(desc, i)    ((i) & ((desc)->init->nelems - 1))
+/*!< Number of elements the buffer can hold, one slot is always unused */
+#define BUFFER_SIZE(desc)       ((desc)->init->nelems - 1)
+
 static struct buffer_desc *buffer_init(struct buffer_init *init);
 static void buffer_deinit(struct buffer_desc *desc);
 static void buffer_flush(struct buffer_desc *desc);
 static bool buffer_is_empty(struct buffer_desc *desc);
-static bool buffer_is_full_(struct buffer_desc *desc, unsigned *next);
 static bool buffer_is_full(struct buffer_desc *desc);
-static int buffer_push(struct buffer_desc *desc, buffer_elem_t *elem);
+static void buffer_watermark(struct buffer_desc *desc, unsigned before,
+                             unsigned after);
+static bool buffer_release_(struct buffer_desc *desc, unsigned tail, unsigned n);
+static int buffer_push(struct buffer_desc *desc, const buffer_elem_t *elem);
 static int buffer_pop(struct buffer_desc *desc, buffer_elem_t *elem);
+static void buffer_span_(struct buffer_desc *desc, unsigned start, unsigned n,
+                         struct buffer_span *span);
+static unsigned buffer_reserve(struct buffer_desc *desc, struct buffer_span *span);
+static unsigned buffer_commit(struct buffer_desc *desc, unsigned n);
+static unsigned buffer_peek(struct buffer_desc *desc, struct buffer_span *span);
+static unsigned buffer_consume(struct buffer_desc *desc, unsigned n);
+static int buffer_push_n(struct buffer_desc *desc, const buffer_elem_t *elem,
+                         unsigned n);
+static int buffer_pop_n(struct buffer_desc *desc, buffer_elem_t *elem,
+                        unsigned n);
 
 static void *buffer_ctor(void *data);
 static void buffer_dtor(void *self);
@@ -47,18 +92,27 @@ static int buffer_ioctl(void *self, int cmd, void *data);
  * @param init Buffer init parameters
  *
  * @return Buffer descriptor, if the buffer allocation is successful.
- *         NULL, if the buffer allocation isnot successful.
+ *         NULL, if the buffer allocation isnot successful, the number of
+ *         elements is not a power of 2 or the watermark callback is
+ *         missing.
  */
 static struct buffer_desc *buffer_init(struct buffer_init *init)
 {
     struct buffer_desc *desc = NULL;
 
+    /* Indexes are wrapped with a mask */
+    if (!init->nelems || (init->nelems & (init->nelems - 1)))
+        return NULL;
+    if ((init->flags & BUFFER_FLAG_WATERMARK) && !init->watermark)
+        return NULL;
+
     /* Create and initialize a buffer descriptor */
     desc = mm_alloc(sizeof(struct buffer_desc));
     if (desc) {
         desc->class = buffer;
         desc->init = init;
         desc->head = desc->tail = 0;
+        desc->overflows = 0;
 
         buffer_flush(desc);
     }
@@ -101,46 +155,78 @@ static void buffer_flush(struct buffer_desc *desc)
  */
 static bool buffer_is_empty(struct buffer_desc *desc)
 {
-    return (desc->head == desc->tail);
+    return (ATOMIC_LOAD_ACQUIRE(&desc->head) == ATOMIC_LOAD_ACQUIRE(&desc->tail));
 }
 
 /**
- * @brief Test if the buffer is full
+ * @brief Tests if the buffer is full
  *
  * @param buf Buffer descriptor
- * @param next The next index in the buffer to be written is returned in this
- *             param. The index is valid only if this function returns 1 (i.e.,
- *             buffer is not full.
  *
- * @return 1 if the buffer is empty.
- *         0 if the buffer is not empty.
+ * @return 1, if the buffer is full.
+ *         0, if the buffer is not full.
  */
-static bool buffer_is_full_(struct buffer_desc *desc, unsigned *next)
+static bool buffer_is_full(struct buffer_desc *desc)
 {
-    *next = (desc->head + 1) % desc->init->nelems;
-    return (*next == desc->tail);
+    unsigned tail = ATOMIC_LOAD_ACQUIRE(&desc->tail);
+
+    return (ATOMIC_LOAD_ACQUIRE(&desc->head) - tail == BUFFER_SIZE(desc));
 }
 
 /**
- * @brief Tests if the buffer is full
+ * @brief Call the watermark callback, if the number of elements in the buffer
+ *        reached a watermark
+ *
+ * @param buf Buffer descriptor
+ * @param before Number of elements before the push or pop
+ * @param after Number of elements after the push or pop
+ */
+static void buffer_watermark(struct buffer_desc *desc, unsigned before,
+                             unsigned after)
+{
+    struct buffer_init *init = desc->init;
+
+    if (!(init->flags & BUFFER_FLAG_WATERMARK))
+        return;
+
+    if (before < init->high && after >= init->high)
+        init->watermark(init->arg, BUFFER_WATERMARK_HIGH);
+    else if (before > init->low && after <= init->low)
+        init->watermark(init->arg, BUFFER_WATERMARK_LOW);
+}
+
+/**
+ * @brief Move the tail past the elements read by the consumer
+ *
+ * In the overwrite mode, the producer moves the tail too (to drop the oldest
+ * element), so the tail is moved only if it did not change since the
+ * consumer read it.
  *
  * @param buf Buffer descriptor
+ * @param tail Tail read by the consumer
+ * @param n Number of elements read
  *
- * @return 1, if the buffer is full.
- *         0, if the buffer is not full.
+ * @return 1, if the tail is moved.
+ *         0, if the elements were overwritten while the consumer read them.
  */
-static bool buffer_is_full(struct buffer_desc *desc)
+static bool buffer_release_(struct buffer_desc *desc, unsigned tail, unsigned n)
 {
-    unsigned next;
+    if (desc->init->flags & BUFFER_FLAG_OVERWRITE)
+        return ATOMIC_CAS(&desc->tail, &tail, tail + n);
+
+    /* Hand the slots back to the producer */
+    ATOMIC_STORE_RELEASE(&desc->tail, tail + n);
 
-    return buffer_is_full_(desc, &next);
+    return 1;
 }
 
 /**
  * @brief Push an element into the buffer
  *
- * The element is not pushed into the buffer, if the buffer is already full. An
- * error code is returned instead.
+ * If the buffer is already full, the element is not pushed into the buffer
+ * and an error code is returned instead, or in the overwrite mode the oldest
+ * element is dropped to make room. Either way the overflow count is
+ * incremented. Only the producer may call this function.
  *
  * @param buf Buffer descriptor
  * @param elem Element to be pushed into the buffer.
@@ -148,26 +234,40 @@ static bool buffer_is_full(struct buffer_desc *desc)
  * @return 0, if the element is pushed into the buffer successfully.
  *         EBUFFER_FULL, if the element is not pushed into the buffer.
  */
-static int buffer_push(struct buffer_desc *desc, buffer_elem_t *elem)
+static int buffer_push(struct buffer_desc *desc, const buffer_elem_t *elem)
 {
-    unsigned next;
+    unsigned head = ATOMIC_LOAD_RELAXED(&desc->head);
+    /* Acquire the slot freed by the consumer */
+    unsigned tail = ATOMIC_LOAD_ACQUIRE(&desc->tail);
+    unsigned used = head - tail;
 
-    ATOMIC_START();
-    if (!buffer_is_full_(desc, &next)) {
-        desc->init->elem[next] = *elem;
-        desc->head = next;
-        ATOMIC_END();
+    if (used == BUFFER_SIZE(desc)) {
+        if (!(desc->init->flags & BUFFER_FLAG_OVERWRITE)) {
+            ATOMIC_STORE_RELAXED(&desc->overflows, desc->overflows + 1);
+            return EBUFFER_FULL;
+        }
 
-        return ENO_ERROR;
-    } else {
-        ATOMIC_END();
-        return EBUFFER_FULL;
+        /* Drop the oldest element, unless the consumer just popped it */
+        if (ATOMIC_CAS(&desc->tail, &tail, tail + 1)) {
+            ATOMIC_STORE_RELAXED(&desc->overflows, desc->overflows + 1);
+            tail++;
+        }
     }
+
+    desc->init->elem[BUFFER_SLOT(desc, head + 1)] = *elem;
+    /* Publish the element to the consumer */
+    ATOMIC_STORE_RELEASE(&desc->head, head + 1);
+
+    buffer_watermark(desc, used, head + 1 - tail);
+
+    return ENO_ERROR;
 }
 
 /**
  * @brief Pop an element from the buffer
  *
+ * Only the consumer may call this function.
+ *
  * @param buf Buffer descriptor
  * @param elem Memory (allocated by the caller) in which the next element from
  *             the buffer is returned.
@@ -177,18 +277,212 @@ static int buffer_push(struct buffer_desc *desc, buffer_elem_t *elem)
  */
 static int buffer_pop(struct buffer_desc *desc, buffer_elem_t *elem)
 {
-    ATOMIC_START();
-    if (!buffer_is_empty(desc)) {
-        unsigned next = (desc->tail + 1) % desc->init->nelems;
-        *elem = desc->init->elem[next];
-        desc->tail = next;
-        ATOMIC_END();
-
-        return ENO_ERROR;
-    } else {
-        ATOMIC_END();
-        return EBUFFER_EMPTY;
+    buffer_elem_t data;
+    unsigned head, tail;
+
+    /* Read again, if the element is overwritten while it is being read */
+    do {
+        tail = ATOMIC_LOAD_ACQUIRE(&desc->tail);
+        /* Acquire the element published by the producer */
+        head = ATOMIC_LOAD_ACQUIRE(&desc->head);
+        if (tail == head)
+            return EBUFFER_EMPTY;
+
+        data = desc->init->elem[BUFFER_SLOT(desc, tail + 1)];
+    } while (!buffer_release_(desc, tail, 1));
+
+    *elem = data;
+    buffer_watermark(desc, head - tail, head - tail - 1);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Split n elements starting at index start into contiguous spans
+ *
+ * @param buf Buffer descriptor
+ * @param start Index of the first element
+ * @param n Number of elements, at most the buffer size
+ * @param span The spans are returned in this param. The second span is empty,
+ *             unless the elements wrap around the end of the buffer.
+ */
+static void buffer_span_(struct buffer_desc *desc, unsigned start, unsigned n,
+                         struct buffer_span *span)
+{
+    unsigned slot = BUFFER_SLOT(desc, start);
+    unsigned seg = desc->init->nelems - slot;
+
+    if (seg > n)
+        seg = n;
+
+    span->elem[0] = &desc->init->elem[slot];
+    span->nelems[0] = seg;
+    span->elem[1] = desc->init->elem;
+    span->nelems[1] = n - seg;
+}
+
+/**
+ * @brief Return the free space of the buffer for the producer to write into
+ *
+ * The elements written into the spans are not visible to the consumer until
+ * they are committed. Only the producer may call this function.
+ *
+ * @param buf Buffer descriptor
+ * @param span The free space is returned in this param.
+ *
+ * @return Number of elements that can be written.
+ */
+static unsigned buffer_reserve(struct buffer_desc *desc, struct buffer_span *span)
+{
+    unsigned head = ATOMIC_LOAD_RELAXED(&desc->head);
+    /* Acquire the slots freed by the consumer */
+    unsigned space = BUFFER_SIZE(desc) - (head - ATOMIC_LOAD_ACQUIRE(&desc->tail));
+
+    buffer_span_(desc, head + 1, space, span);
+
+    return space;
+}
+
+/**
+ * @brief Publish n elements written into the reserved space
+ *
+ * @param buf Buffer descriptor
+ * @param n Number of elements written. It is limited to the free space.
+ *
+ * @return Number of elements committed.
+ */
+static unsigned buffer_commit(struct buffer_desc *desc, unsigned n)
+{
+    unsigned head = ATOMIC_LOAD_RELAXED(&desc->head);
+    unsigned used = head - ATOMIC_LOAD_ACQUIRE(&desc->tail);
+
+    if (n > BUFFER_SIZE(desc) - used)
+        n = BUFFER_SIZE(desc) - used;
+
+    /* Publish the elements to the consumer */
+    ATOMIC_STORE_RELEASE(&desc->head, head + n);
+
+    buffer_watermark(desc, used, used + n);
+
+    return n;
+}
+
+/**
+ * @brief Return the elements in the buffer without removing them
+ *
+ * The elements stay in the buffer until they are consumed. Only the consumer
+ * may call this function, and not in the overwrite mode.
+ *
+ * @param buf Buffer descriptor
+ * @param span The elements are returned in this param.
+ *
+ * @return Number of elements in the buffer.
+ */
+static unsigned buffer_peek(struct buffer_desc *desc, struct buffer_span *span)
+{
+    unsigned tail = ATOMIC_LOAD_RELAXED(&desc->tail);
+    /* Acquire the elements published by the producer */
+    unsigned used = ATOMIC_LOAD_ACQUIRE(&desc->head) - tail;
+
+    buffer_span_(desc, tail + 1, used, span);
+
+    return used;
+}
+
+/**
+ * @brief Remove n peeked elements from the buffer
+ *
+ * @param buf Buffer descriptor
+ * @param n Number of elements to remove. It is limited to the number of
+ *          elements in the buffer.
+ *
+ * @return Number of elements removed.
+ */
+static unsigned buffer_consume(struct buffer_desc *desc, unsigned n)
+{
+    unsigned tail = ATOMIC_LOAD_RELAXED(&desc->tail);
+    unsigned used = ATOMIC_LOAD_ACQUIRE(&desc->head) - tail;
+
+    if (n > used)
+        n = used;
+
+    buffer_release_(desc, tail, n);
+    buffer_watermark(desc, used, used - n);
+
+    return n;
+}
+
+/**
+ * @brief Push up to n elements into the buffer
+ *
+ * The elements that do not fit into the buffer are not pushed (or, in the
+ * overwrite mode, replace the oldest elements) and are added to the overflow
+ * count. Only the producer may call this function.
+ *
+ * @param buf Buffer descriptor
+ * @param elem Elements to be pushed into the buffer.
+ * @param n Number of elements in \a elem.
+ *
+ * @return Number of elements pushed into the buffer.
+ */
+static int buffer_push_n(struct buffer_desc *desc, const buffer_elem_t *elem,
+                         unsigned n)
+{
+    struct buffer_span span;
+    unsigned i, space, seg;
+
+    if (desc->init->flags & BUFFER_FLAG_OVERWRITE) {
+        for (i = 0; i < n; i++)
+            buffer_push(desc, &elem[i]);
+        return (int)n;
     }
+
+    space = buffer_reserve(desc, &span);
+    if (n > space) {
+        ATOMIC_STORE_RELAXED(&desc->overflows, desc->overflows + n - space);
+        n = space;
+    }
+
+    seg = (n < span.nelems[0]) ? n : span.nelems[0];
+    memcpy(span.elem[0], elem, seg * sizeof(buffer_elem_t));
+    memcpy(span.elem[1], elem + seg, (n - seg) * sizeof(buffer_elem_t));
+
+    return (int)buffer_commit(desc, n);
+}
+
+/**
+ * @brief Pop up to n elements from the buffer
+ *
+ * Only the consumer may call this function.
+ *
+ * @param buf Buffer descriptor
+ * @param elem Memory (allocated by the caller) in which the elements from
+ *             the buffer are returned.
+ * @param n Number of elements in \a elem.
+ *
+ * @return Number of elements popped from the buffer.
+ */
+static int buffer_pop_n(struct buffer_desc *desc, buffer_elem_t *elem,
+                        unsigned n)
+{
+    struct buffer_span span;
+    unsigned i, used, seg;
+
+    if (desc->init->flags & BUFFER_FLAG_OVERWRITE) {
+        for (i = 0; i < n && buffer_pop(desc, &elem[i]) == ENO_ERROR; i++)
+            ;
+        return (int)i;
+    }
+
+    used = buffer_peek(desc, &span);
+    if (n > used)
+        n = used;
+
+    seg = (n < span.nelems[0]) ? n : span.nelems[0];
+    memcpy(elem, span.elem[0], seg * sizeof(buffer_elem_t));
+    memcpy(elem + seg, span.elem[1], (n - seg) * sizeof(buffer_elem_t));
+
+    return (int)buffer_consume(desc, n);
 }
 
 /**
@@ -246,6 +540,35 @@ static int buffer_ioctl(void *self, int cmd, void *data)
             ret = 0;
             break;
         }
+        case IOCTL_BUF_GET_OVERFLOWS:
+            *(unsigned *)data = ATOMIC_LOAD_RELAXED(&desc->overflows);
+            ret = 0;
+            break;
+        case IOCTL_BUF_PUSH_N: {
+            struct buffer_xfer *x = data;
+            ret = buffer_push_n(desc, x->elem, x->nelems);
+            break;
+        }
+        case IOCTL_BUF_POP_N: {
+            struct buffer_xfer *x = data;
+            ret = buffer_pop_n(desc, x->elem, x->nelems);
+            break;
+        }
+        case IOCTL_BUF_RESERVE:
+            ret = (int)buffer_reserve(desc, (struct buffer_span *)data);
+            break;
+        case IOCTL_BUF_COMMIT:
+            ret = (int)buffer_commit(desc, *(unsigned *)data);
+            break;
+        case IOCTL_BUF_PEEK:
+            /* The elements could be overwritten while they are in use */
+            if (!(desc->init->flags & BUFFER_FLAG_OVERWRITE))
+                ret = (int)buffer_peek(desc, (struct buffer_span *)data);
+            break;
+        case IOCTL_BUF_CONSUME:
+            if (!(desc->init->flags & BUFFER_FLAG_OVERWRITE))
+                ret = (int)buffer_consume(desc, *(unsigned *)data);
+            break;
         default:
             break;
         }
@@ -272,15 +595,50 @@ const void *buffer = &_buffer;
 #ifdef UNIT_TEST
 
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "ring.h"
 
 #define BUFFER_NELEMS       4
 
+/*!< Two thread test buffer size and number of elements pushed through it */
+#define BUFFER_MT_NELEMS    1024
+#ifdef BUFFER_BENCH
+#define BUFFER_MT_COUNT     (1UL << 28)
+#else
+#define BUFFER_MT_COUNT     (1UL << 22)
+#endif
+
 static struct buffer_desc *test_buf;
 static buffer_elem_t test_buf_elem[BUFFER_NELEMS];
 
+static struct buffer_desc *test_mt_buf;
+static buffer_elem_t test_mt_buf_elem[BUFFER_MT_NELEMS];
+
+DEFINE_RING(test_ring, uint8_t, BUFFER_NELEMS)
+DEFINE_RING(test_mt_ring, buffer_elem_t, BUFFER_MT_NELEMS)
+
+static struct test_ring test_ring_buf;
+
+static buffer_elem_t test_mode_elem[BUFFER_NELEMS];
+static unsigned test_watermarks[2];
+static struct test_mt_ring test_mt_ring_buf;
+
 static void buffer_dump(const char *test);
 static void buffer_ss_test_err(const char *test, int lineno, int errno);
 static int buffer_ss_test(void);
+static void buffer_test_watermark(void *arg, int event);
+static int buffer_mode_test(void);
+static int buffer_ring_test(void);
+static void *buffer_mt_producer(void *arg);
+static void *buffer_mt_consumer(void *arg);
+static void *buffer_mt_ring_producer(void *arg);
+static void *buffer_mt_ring_consumer(void *arg);
+static int buffer_mt_run(const char *test, void *(*producer)(void *),
+                         void *(*consumer)(void *));
+static int buffer_mt_test(void);
 
 /* If cond is false, print diagnostics and abort the test */
 #define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
@@ -293,6 +651,17 @@ static int buffer_ss_test(void);
         }                                                   \
     } while (0)
 
+/* Same for the tests that do not use test_buf, without the dump. A value
+ * check failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL_NODUMP(test, cond)            \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error: %d\n", \
+                   test, __LINE__, err);                    \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
 /**
  * @brief Dump the buffer
  *
@@ -322,8 +691,9 @@ static void buffer_ss_test_err(const char *test, int lineno, int errno)
  */
 static int buffer_ss_test(void)
 {
-    struct buffer_init bi = { test_buf_elem, BUFFER_NELEMS, 0 };
-    buffer_elem_t test_data;
+    struct buffer_init bi = { test_buf_elem, BUFFER_NELEMS, 0, 0, 0, NULL, NULL };
+    buffer_elem_t test_data, test_bulk[BUFFER_NELEMS];
+    struct buffer_span span;
     int err = EFAIL;
 
     test_buf = new(buffer, &bi);
@@ -343,6 +713,7 @@ static int buffer_ss_test(void)
         (err = buffer_push(test_buf, &test_data)) == ENO_ERROR);
     TEST_AND_EXIT_ON_FAIL("buffer_push",
         (err = buffer_push(test_buf, &test_data)) == EBUFFER_FULL);
+    TEST_AND_EXIT_ON_FAIL("buffer_overflows", test_buf->overflows == 1);
 
     /* Test the buffer status on full buffer */
     err = EFAIL;
@@ -381,15 +752,332 @@ static int buffer_ss_test(void)
     TEST_AND_EXIT_ON_FAIL("buffer_pop",
         (err = buffer_pop(test_buf, &test_data)) == ENO_ERROR && test_data == 14);
 
+    /* Bulk push into a buffer with room for three elements */
+    test_bulk[0] = 20;
+    test_bulk[1] = 21;
+    test_bulk[2] = 22;
+    test_bulk[3] = 23;
+    TEST_AND_EXIT_ON_FAIL("buffer_push_n",
+        (err = buffer_push_n(test_buf, test_bulk, 4)) == 3);
+    TEST_AND_EXIT_ON_FAIL("buffer_overflows", test_buf->overflows == 2);
+    TEST_AND_EXIT_ON_FAIL("buffer_pop_n",
+        (err = buffer_pop_n(test_buf, test_bulk, 2)) == 2 &&
+        test_bulk[0] == 20 && test_bulk[1] == 21);
+
+    /* Bulk push and pop across the end of the buffer */
+    test_bulk[0] = 24;
+    test_bulk[1] = 25;
+    TEST_AND_EXIT_ON_FAIL("buffer_push_n",
+        (err = buffer_push_n(test_buf, test_bulk, 2)) == 2);
+    TEST_AND_EXIT_ON_FAIL("buffer_is_full", buffer_is_full(test_buf));
+    TEST_AND_EXIT_ON_FAIL("buffer_pop_n",
+        (err = buffer_pop_n(test_buf, test_bulk, 4)) == 3 &&
+        test_bulk[0] == 22 && test_bulk[1] == 24 && test_bulk[2] == 25);
+    TEST_AND_EXIT_ON_FAIL("buffer_pop_n",
+        (err = buffer_pop_n(test_buf, test_bulk, 4)) == 0);
+    TEST_AND_EXIT_ON_FAIL("buffer_is_empty", buffer_is_empty(test_buf));
+
+    /* Write and read in place */
+    TEST_AND_EXIT_ON_FAIL("buffer_reserve",
+        (err = (int)buffer_reserve(test_buf, &span)) == 3 &&
+        span.nelems[0] == 3 && span.nelems[1] == 0);
+    span.elem[0][0] = 30;
+    span.elem[0][1] = 31;
+    TEST_AND_EXIT_ON_FAIL("buffer_commit",
+        (err = (int)buffer_commit(test_buf, 2)) == 2);
+    TEST_AND_EXIT_ON_FAIL("buffer_peek",
+        (err = (int)buffer_peek(test_buf, &span)) == 2 &&
+        span.nelems[0] == 2 && span.nelems[1] == 0 &&
+        span.elem[0][0] == 30 && span.elem[0][1] == 31);
+    TEST_AND_EXIT_ON_FAIL("buffer_consume",
+        (err = (int)buffer_consume(test_buf, 1)) == 1);
+
+    /* Spans across the end of the buffer */
+    TEST_AND_EXIT_ON_FAIL("buffer_reserve",
+        (err = (int)buffer_reserve(test_buf, &span)) == 2 &&
+        span.nelems[0] == 1 && span.nelems[1] == 1);
+    span.elem[0][0] = 32;
+    span.elem[1][0] = 33;
+    TEST_AND_EXIT_ON_FAIL("buffer_commit",
+        (err = (int)buffer_commit(test_buf, 4)) == 2);
+    TEST_AND_EXIT_ON_FAIL("buffer_peek",
+        (err = (int)buffer_peek(test_buf, &span)) == 3 &&
+        span.nelems[0] == 2 && span.nelems[1] == 1 &&
+        span.elem[0][0] == 31 && span.elem[0][1] == 32 &&
+        span.elem[1][0] == 33);
+    TEST_AND_EXIT_ON_FAIL("buffer_consume",
+        (err = (int)buffer_consume(test_buf, 4)) == 3);
+    TEST_AND_EXIT_ON_FAIL("buffer_is_empty", buffer_is_empty(test_buf));
+
     return ENO_ERROR;
 }
 
+/**
+ * @brief Count the watermark events
+ */
+static void buffer_test_watermark(void *arg, int event)
+{
+    unsigned *count = arg;
+
+    count[event]++;
+}
+
+/**
+ * @brief Overwrite and watermark modes test
+ */
+static int buffer_mode_test(void)
+{
+    struct buffer_init ow = { test_mode_elem, BUFFER_NELEMS, BUFFER_FLAG_OVERWRITE,
+                              0, 0, NULL, NULL };
+    struct buffer_init wm = { test_mode_elem, BUFFER_NELEMS, BUFFER_FLAG_WATERMARK,
+                              2, 0, buffer_test_watermark, test_watermarks };
+    struct buffer_desc *desc;
+    buffer_elem_t test_data, test_bulk[BUFFER_NELEMS + 1];
+    struct buffer_span span;
+    int i, err = EFAIL;
+
+    /* Pushing into a full buffer drops the oldest elements */
+    desc = new(buffer, &ow);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite", desc != NULL);
+    for (i = 0; i < BUFFER_NELEMS + 1; i++) {
+        test_data = (buffer_elem_t)(50 + i);
+        TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite",
+            (err = buffer_push(desc, &test_data)) == ENO_ERROR);
+    }
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite", desc->overflows == 2);
+    for (i = 2; i < BUFFER_NELEMS + 1; i++)
+        TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite",
+            (err = buffer_pop(desc, &test_data)) == ENO_ERROR &&
+            test_data == (buffer_elem_t)(50 + i));
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite",
+        (err = buffer_pop(desc, &test_data)) == EBUFFER_EMPTY);
+
+    /* Bulk transfers keep the newest elements, the elements cannot be
+     * peeked */
+    for (i = 0; i < BUFFER_NELEMS + 1; i++)
+        test_bulk[i] = (buffer_elem_t)(60 + i);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite",
+        (err = buffer_push_n(desc, test_bulk, BUFFER_NELEMS + 1)) == BUFFER_NELEMS + 1);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite",
+        (err = ioctl(desc, IOC(IOCTL_BUFFER, IOCTL_BUF_PEEK), &span)) == EFAIL);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite",
+        (err = buffer_pop_n(desc, test_bulk, BUFFER_NELEMS)) == 3 &&
+        test_bulk[0] == 62 && test_bulk[1] == 63 && test_bulk[2] == 64);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_overwrite", desc->overflows == 4);
+
+    /* High watermark on the rise to 2 elements, low on the fall to 0 */
+    desc = new(buffer, &wm);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_watermark", desc != NULL);
+    test_data = 70;
+    buffer_push(desc, &test_data);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_watermark", test_watermarks[BUFFER_WATERMARK_HIGH] == 0);
+    buffer_push(desc, &test_data);
+    buffer_push(desc, &test_data);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_watermark", test_watermarks[BUFFER_WATERMARK_HIGH] == 1);
+    buffer_pop(desc, &test_data);
+    buffer_pop(desc, &test_data);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_watermark", test_watermarks[BUFFER_WATERMARK_LOW] == 0);
+    buffer_pop(desc, &test_data);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_watermark", test_watermarks[BUFFER_WATERMARK_LOW] == 1);
+
+    /* Bulk transfers cross the watermarks once */
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_watermark",
+        (err = buffer_push_n(desc, test_bulk, 3)) == 3 &&
+        test_watermarks[BUFFER_WATERMARK_HIGH] == 2);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("buffer_watermark",
+        (err = buffer_pop_n(desc, test_bulk, 3)) == 3 &&
+        test_watermarks[BUFFER_WATERMARK_LOW] == 2);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Typed ring test
+ */
+static int buffer_ring_test(void)
+{
+    uint8_t test_data;
+    int i, err = EFAIL;
+
+    test_ring_init(&test_ring_buf);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("ring_count", test_ring_count(&test_ring_buf) == 0);
+
+    /* Fill the ring, all the elements are usable, and test for overflow */
+    for (i = 0; i < BUFFER_NELEMS; i++)
+        TEST_AND_EXIT_ON_FAIL_NODUMP("ring_push",
+            (err = test_ring_push(&test_ring_buf, (uint8_t)(40 + i))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("ring_push",
+        (err = test_ring_push(&test_ring_buf, 44)) == EBUFFER_FULL);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("ring_overflows", test_ring_buf.overflows == 1);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("ring_count",
+        test_ring_count(&test_ring_buf) == BUFFER_NELEMS);
+
+    /* Empty the ring and test for underflow */
+    for (i = 0; i < BUFFER_NELEMS; i++)
+        TEST_AND_EXIT_ON_FAIL_NODUMP("ring_pop",
+            (err = test_ring_pop(&test_ring_buf, &test_data)) == ENO_ERROR &&
+            test_data == 40 + i);
+    TEST_AND_EXIT_ON_FAIL_NODUMP("ring_pop",
+        (err = test_ring_pop(&test_ring_buf, &test_data)) == EBUFFER_EMPTY);
+
+    /* Push and pop in lockstep around the end of the ring */
+    for (i = 0; i < 3 * BUFFER_NELEMS; i++) {
+        TEST_AND_EXIT_ON_FAIL_NODUMP("ring_push",
+            (err = test_ring_push(&test_ring_buf, (uint8_t)i)) == ENO_ERROR);
+        TEST_AND_EXIT_ON_FAIL_NODUMP("ring_pop",
+            (err = test_ring_pop(&test_ring_buf, &test_data)) == ENO_ERROR &&
+            test_data == i);
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Producer thread, pushes a sequence of numbers
+ */
+static void *buffer_mt_producer(void *arg)
+{
+    buffer_elem_t data;
+    unsigned long i;
+
+    UNUSED(arg);
+
+    for (i = 0; i < BUFFER_MT_COUNT; i++) {
+        data = (buffer_elem_t)i;
+        while (buffer_push(test_mt_buf, &data) != ENO_ERROR)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Consumer thread, pops the sequence and counts the elements that
+ *        are out of sequence
+ */
+static void *buffer_mt_consumer(void *arg)
+{
+    unsigned long *errors = arg;
+    buffer_elem_t data;
+    unsigned long i;
+
+    for (i = 0; i < BUFFER_MT_COUNT; i++) {
+        while (buffer_pop(test_mt_buf, &data) != ENO_ERROR)
+            sched_yield();
+        if (data != (buffer_elem_t)i)
+            (*errors)++;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Producer thread of the typed ring
+ */
+static void *buffer_mt_ring_producer(void *arg)
+{
+    unsigned long i;
+
+    UNUSED(arg);
+
+    for (i = 0; i < BUFFER_MT_COUNT; i++) {
+        while (test_mt_ring_push(&test_mt_ring_buf, (buffer_elem_t)i) != ENO_ERROR)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Consumer thread of the typed ring
+ */
+static void *buffer_mt_ring_consumer(void *arg)
+{
+    unsigned long *errors = arg;
+    buffer_elem_t data;
+    unsigned long i;
+
+    for (i = 0; i < BUFFER_MT_COUNT; i++) {
+        while (test_mt_ring_pop(&test_mt_ring_buf, &data) != ENO_ERROR)
+            sched_yield();
+        if (data != (buffer_elem_t)i)
+            (*errors)++;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Run a producer and a consumer thread and report the throughput
+ */
+static int buffer_mt_run(const char *test, void *(*producer)(void *),
+                         void *(*consumer)(void *))
+{
+    pthread_t producer_thread, consumer_thread;
+    struct timespec start, end;
+    unsigned long errors = 0;
+    double secs;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (pthread_create(&consumer_thread, NULL, consumer, &errors) ||
+        pthread_create(&producer_thread, NULL, producer, NULL)) {
+        printf("%s: thread creation failed\n", test);
+        return EFAIL;
+    }
+    pthread_join(producer_thread, NULL);
+    pthread_join(consumer_thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (double)(end.tv_sec - start.tv_sec) +
+           (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s: %lu elements in %.3f s (%.1f M elements/s)\n",
+           test, BUFFER_MT_COUNT, secs, (double)BUFFER_MT_COUNT / secs / 1e6);
+
+    if (errors) {
+        printf("%s: %lu elements out of sequence\n", test, errors);
+        return EFAIL;
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Push a sequence through the buffer and through a typed ring from a
+ *        producer thread to a consumer thread
+ */
+static int buffer_mt_test(void)
+{
+    struct buffer_init bi = { test_mt_buf_elem, BUFFER_MT_NELEMS, 0, 0, 0, NULL, NULL };
+    int err;
+
+    test_mt_buf = new(buffer, &bi);
+    if (!test_mt_buf) {
+        printf("buffer_mt_test: buffer allocation failed\n");
+        return EFAIL;
+    }
+
+    err = buffer_mt_run("buffer_mt_test", buffer_mt_producer, buffer_mt_consumer);
+    if (err == ENO_ERROR && !buffer_is_empty(test_mt_buf))
+        err = EFAIL;
+    if (err != ENO_ERROR)
+        return err;
+
+    test_mt_ring_init(&test_mt_ring_buf);
+    err = buffer_mt_run("ring_mt_test", buffer_mt_ring_producer,
+                        buffer_mt_ring_consumer);
+    if (err == ENO_ERROR && test_mt_ring_count(&test_mt_ring_buf))
+        err = EFAIL;
+
+    return err;
+}
+
 /**
  */
 int main(void)
 {
     printf("Testing Buffer SS\n");
-    if (buffer_ss_test() != ENO_ERROR)
+    if (buffer_ss_test() != ENO_ERROR || buffer_mode_test() != ENO_ERROR ||
+        buffer_ring_test() != ENO_ERROR || buffer_mt_test() != ENO_ERROR)
         printf("Buffer SS test failed\n");
     else
         printf("Buffer SS test passed\n");
@@ -11,15 +11,41 @@
  * application.
  *
  * The buffer subsystem can be configured using the flags parameter
- * when creating a new buffer.
+ * when creating a new buffer:
+ * - BUFFER_FLAG_OVERWRITE: Data pushed into a full buffer replaces the
+ *   oldest element, for trace and log buffers where the latest data matters
+ *   most. The zero copy consumer API (IOCTL_BUF_PEEK/IOCTL_BUF_CONSUME) is
+ *   not available in this mode.
+ * - BUFFER_FLAG_WATERMARK: The watermark callback is called when the number
+ *   of elements rises to the high watermark (in the producer context) and
+ *   when it falls to the low watermark (in the consumer context). A consumer
+ *   can then be woken once a batch of elements is queued instead of polling
+ *   the buffer.
  *
  * Constraints:
  * 1. The buffer size is currently constrained to be a power of 2
- *    (for performance reasons).
- * 2. Data being pushed into a full buffer will be ignored.
+ *    (for performance reasons), the indexes are wrapped with a mask.
+ * 2. Data being pushed into a full buffer will be ignored (unless the
+ *    buffer is in the overwrite mode). The dropped elements are counted and
+ *    the count is read with IOCTL_BUF_GET_OVERFLOWS. IOCTL_BUF_PUSH_N writes
+ *    as many elements as fit and drops the rest.
  * 3. Application can have only one global type for the buffer items.
+ *    Rings of other types are defined with DEFINE_RING() (see ring.h).
  * 4. This implementation caters to only a single producer and single
  *    consumer.
+ *
+ * Zero copy access:
+ * The producer can write directly into the buffer memory: IOCTL_BUF_RESERVE
+ * returns the free space and IOCTL_BUF_COMMIT publishes the elements
+ * written. Likewise, the consumer reads the elements in place with
+ * IOCTL_BUF_PEEK and removes them with IOCTL_BUF_CONSUME.
+ *
+ * struct buffer_span span;
+ * unsigned n = ioctl(buf, IOC(IOCTL_BUFFER, IOCTL_BUF_PEEK), &span);
+ *
+ * process(span.elem[0], span.nelems[0]);
+ * process(span.elem[1], span.nelems[1]);
+ * ioctl(buf, IOC(IOCTL_BUFFER, IOCTL_BUF_CONSUME), &n);
  */
 
 #ifndef __BUFFER_H__
@@ -27,6 +53,18 @@
 
 #include "common.h"
 
+/**
+ * @brief Flags to configure the buffer
+ */
+#define BUFFER_FLAG_OVERWRITE   BIT(0)  /*!< Overwrite the oldest element when full */
+#define BUFFER_FLAG_WATERMARK   BIT(1)  /*!< Call the watermark callback */
+
+/**
+ * @brief Watermark callback events
+ */
+#define BUFFER_WATERMARK_LOW    0   /*!< Number of elements fell to the low watermark */
+#define BUFFER_WATERMARK_HIGH   1   /*!< Number of elements rose to the high watermark */
+
 /**
  * @brief Buffer subsystem IOCTLs
  */
@@ -40,6 +78,26 @@
 #define IOCTL_BUF_IS_FULL       3
 /*!< Is the buffer empty */
 #define IOCTL_BUF_IS_EMPTY      4
+/*!< Number of elements dropped because the buffer was full (unsigned) */
+#define IOCTL_BUF_GET_OVERFLOWS 5
+/*!< Write up to N elements into the buffer (struct buffer_xfer), returns
+ *   the number of elements written */
+#define IOCTL_BUF_PUSH_N        6
+/*!< Read up to N elements from the buffer (struct buffer_xfer), returns
+ *   the number of elements read */
+#define IOCTL_BUF_POP_N         7
+/*!< Get the free space to write into (struct buffer_span), returns the
+ *   number of free elements */
+#define IOCTL_BUF_RESERVE       8
+/*!< Publish the elements written into the free space (unsigned), returns
+ *   the number of elements published */
+#define IOCTL_BUF_COMMIT        9
+/*!< Get the elements in the buffer without removing them (struct
+ *   buffer_span), returns the number of elements */
+#define IOCTL_BUF_PEEK          10
+/*!< Remove the peeked elements (unsigned), returns the number of elements
+ *   removed */
+#define IOCTL_BUF_CONSUME       11
 
 /**
  * @brief Buffer initializer
@@ -47,8 +105,35 @@
 struct buffer_init {
     buffer_elem_t *elem; /*!< Pointer to array of buffer elements allocated by the caller */
     unsigned nelems;     /*!< Number of elements in the \a elem array */
-    /*!< This field is unused for now */
     uint16_t flags;      /*!< Flags used to configure the buffer */
+    unsigned high;       /*!< High watermark (number of elements) */
+    unsigned low;        /*!< Low watermark (number of elements) */
+    /*!< Watermark callback, \a event is BUFFER_WATERMARK_HIGH or _LOW */
+    void (* watermark)(void *arg, int event);
+    void *arg;           /*!< Argument of the watermark callback */
+};
+
+/**
+ * @brief Bulk transfer parameters
+ *
+ * The elements are copied in at most two contiguous segments (the second
+ * one when the transfer wraps around the end of the buffer).
+ */
+struct buffer_xfer {
+    buffer_elem_t *elem; /*!< Elements to push, or memory for the popped elements */
+    unsigned nelems;     /*!< Number of elements in the \a elem array */
+};
+
+/**
+ * @brief Contiguous regions of the buffer memory
+ *
+ * The buffer memory is returned in place, in up to two spans: the second
+ * span is empty (zero elements), unless the region wraps around the end of
+ * the buffer.
+ */
+struct buffer_span {
+    buffer_elem_t *elem[2]; /*!< First element of each span */
+    unsigned nelems[2];     /*!< Number of elements in each span */
 };
 
 /* Buffer type definition */
@@ -0,0 +1,489 @@
+/**
+ * @file  mpmc.c
+ *
+ * @brief Multi-producer multi-consumer queue
+ *
+ * Bounded queue with a sequence number per slot. The enqueue and dequeue
+ * positions run freely and are wrapped with a mask only to access the slots.
+ * The sequence number of the slot of position pos is:
+ * - pos, if the slot is free for the producer of position pos.
+ * - pos + 1, if the slot holds the element of position pos.
+ * - pos + nslots, once the element is read (the slot is free for the
+ *   producer of the next lap).
+ *
+ * A producer claims a position by moving the enqueue position with a compare
+ * and swap, writes the element and releases the slot by storing the next
+ * sequence number. Consumers do the same with the dequeue position. The
+ * queue is full (or empty) if the sequence number of the slot is behind the
+ * position being claimed.
+ */
+
+#include "mpmc.h"
+#include "class.h"
+
+/**
+ * @brief MPMC queue descriptor
+ *
+ * Internal structure used to manage the queues. On targets with a data
+ * cache, the positions written by the producers and by the consumers are on
+ * separate cache lines and away from the read only fields.
+ */
+struct mpmc_desc {
+    const struct class *class;
+    struct mpmc_init *init;     /*!< Queue init parameters */
+#if CACHE_LINE_SIZE
+    char pad0[CACHE_LINE_SIZE];
+#endif
+    unsigned enq;               /*!< Position of the next element to write */
+    unsigned overflows;         /*!< Elements dropped because the queue was full */
+#if CACHE_LINE_SIZE
+    char pad1[CACHE_LINE_SIZE - 2 * sizeof(unsigned)];
+#endif
+    unsigned deq;               /*!< Position of the next element to read */
+#if CACHE_LINE_SIZE
+    char pad2[CACHE_LINE_SIZE - sizeof(unsigned)];
+#endif
+};
+
+/*!< Slot of the position pos */
+#define MPMC_SLOT(desc, pos)    (&(desc)->init->slot[(pos) & ((desc)->init->nslots - 1)])
+
+static int mpmc_push(struct mpmc_desc *desc, const buffer_elem_t *elem);
+static int mpmc_pop(struct mpmc_desc *desc, buffer_elem_t *elem);
+
+static void *mpmc_ctor(void *data);
+static void mpmc_dtor(void *self);
+static int mpmc_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Push an element into the queue
+ *
+ * The element is not pushed into the queue, if the queue is full. An error
+ * code is returned instead and the overflow count is incremented.
+ *
+ * @param desc Queue descriptor
+ * @param elem Element to be pushed into the queue
+ *
+ * @return ENO_ERROR, if the element is pushed into the queue.
+ *         EBUFFER_FULL, if the element is not pushed into the queue.
+ */
+static int mpmc_push(struct mpmc_desc *desc, const buffer_elem_t *elem)
+{
+    unsigned pos = ATOMIC_LOAD_RELAXED(&desc->enq);
+    struct mpmc_slot *slot;
+    int diff;
+
+    for (;;) {
+        slot = MPMC_SLOT(desc, pos);
+        /* Acquire the slot freed by the consumer of the previous lap */
+        diff = (int)(ATOMIC_LOAD_ACQUIRE(&slot->seq) - pos);
+        if (diff == 0) {
+            /* Slot is free, claim the position (pos is reloaded on failure) */
+            if (ATOMIC_CAS(&desc->enq, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            /* Slot still holds the element of the previous lap */
+            ATOMIC_ADD(&desc->overflows, 1);
+            return EBUFFER_FULL;
+        } else {
+            /* Another producer claimed the position */
+            pos = ATOMIC_LOAD_RELAXED(&desc->enq);
+        }
+    }
+
+    slot->elem = *elem;
+    /* Publish the element to the consumers */
+    ATOMIC_STORE_RELEASE(&slot->seq, pos + 1);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Pop an element from the queue
+ *
+ * @param desc Queue descriptor
+ * @param elem Memory (allocated by the caller) in which the next element from
+ *             the queue is returned.
+ *
+ * @return ENO_ERROR, if an element is popped from the queue.
+ *         EBUFFER_EMPTY, if the queue is empty.
+ */
+static int mpmc_pop(struct mpmc_desc *desc, buffer_elem_t *elem)
+{
+    unsigned pos = ATOMIC_LOAD_RELAXED(&desc->deq);
+    struct mpmc_slot *slot;
+    int diff;
+
+    for (;;) {
+        slot = MPMC_SLOT(desc, pos);
+        /* Acquire the element published by the producer */
+        diff = (int)(ATOMIC_LOAD_ACQUIRE(&slot->seq) - (pos + 1));
+        if (diff == 0) {
+            /* Slot holds an element, claim the position */
+            if (ATOMIC_CAS(&desc->deq, &pos, pos + 1))
+                break;
+        } else if (diff < 0) {
+            /* Slot is not written yet */
+            return EBUFFER_EMPTY;
+        } else {
+            /* Another consumer claimed the position */
+            pos = ATOMIC_LOAD_RELAXED(&desc->deq);
+        }
+    }
+
+    *elem = slot->elem;
+    /* Free the slot for the producer of the next lap */
+    ATOMIC_STORE_RELEASE(&slot->seq, pos + desc->init->nslots);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Create and return a MPMC queue descriptor
+ */
+static void *mpmc_ctor(void *data)
+{
+    struct mpmc_init *init = data;
+    struct mpmc_desc *desc;
+    unsigned i;
+
+    /* Positions are wrapped with a mask */
+    if (!init || !init->nslots || (init->nslots & (init->nslots - 1)))
+        return NULL;
+
+    desc = mm_alloc(sizeof(struct mpmc_desc));
+    if (desc) {
+        desc->class = mpmc;
+        desc->init = init;
+        desc->enq = desc->deq = 0;
+        desc->overflows = 0;
+        for (i = 0; i < init->nslots; i++)
+            init->slot[i].seq = i;
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the MPMC queue descriptor
+ */
+static void mpmc_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle MPMC queue operations
+ */
+static int mpmc_ioctl(void *self, int cmd, void *data)
+{
+    struct mpmc_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_MPMC) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_MPMC_PUSH:
+            ret = mpmc_push(desc, (buffer_elem_t *)data);
+            break;
+        case IOCTL_MPMC_POP:
+            ret = mpmc_pop(desc, (buffer_elem_t *)data);
+            break;
+        case IOCTL_MPMC_GET_OVERFLOWS:
+            *(unsigned *)data = ATOMIC_LOAD_RELAXED(&desc->overflows);
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief MPMC queue class
+ */
+static const struct class _mpmc = {
+    mpmc_ctor,
+    mpmc_dtor,
+    mpmc_ioctl,
+};
+
+const void *mpmc = &_mpmc;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "buffer.h"
+
+#define MPMC_NSLOTS         4
+
+/*!< Multi thread test: queue size, number of producers (and consumers) and
+ *   number of elements pushed by each producer */
+#define MPMC_MT_NSLOTS      1024
+#define MPMC_MT_THREADS     2
+#ifdef MPMC_BENCH
+#define MPMC_MT_COUNT       (1UL << 25)
+#else
+#define MPMC_MT_COUNT       (1UL << 19)
+#endif
+/*!< Elements are the producer id and a sequence number */
+#define MPMC_MT_SEQ_BITS    28
+#define MPMC_MT_SEQ_MASK    (BIT(MPMC_MT_SEQ_BITS) - 1)
+
+/**
+ * @brief Queue under test in the multi thread test
+ */
+struct mpmc_test_queue {
+    const char *name;
+    void *q;                    /*!< Queue object */
+    int push;                   /*!< Push IOCTL */
+    int pop;                    /*!< Pop IOCTL */
+    pthread_mutex_t *lock;      /*!< Lock around the IOCTLs, if not NULL */
+};
+
+/**
+ * @brief Producer or consumer thread state
+ */
+struct mpmc_test_thread {
+    pthread_t thread;
+    unsigned id;
+    unsigned long sum;          /*!< Consumer: sum of the sequence numbers */
+    unsigned long errors;       /*!< Consumer: elements out of sequence */
+};
+
+static struct mpmc_slot test_slot[MPMC_NSLOTS];
+static struct mpmc_slot test_mt_slot[MPMC_MT_NSLOTS];
+static buffer_elem_t test_mt_buf_elem[MPMC_MT_NSLOTS];
+static pthread_mutex_t test_mt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct mpmc_test_queue *test_q;
+static unsigned test_consumed;
+
+static int mpmc_ss_test(void);
+static int mpmc_test_op(int cmd, buffer_elem_t *elem);
+static void *mpmc_mt_producer(void *arg);
+static void *mpmc_mt_consumer(void *arg);
+static int mpmc_mt_run(struct mpmc_test_queue *tq);
+static int mpmc_mt_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Single thread test
+ */
+static int mpmc_ss_test(void)
+{
+    struct mpmc_init init = { test_slot, MPMC_NSLOTS };
+    struct mpmc_desc *desc;
+    buffer_elem_t test_data;
+    unsigned overflows;
+    int i, err = EFAIL;
+
+    desc = new(mpmc, &init);
+    TEST_AND_EXIT_ON_FAIL("mpmc_new", desc != NULL);
+
+    /* Fill the queue, all the slots are usable, and test for overflow */
+    for (i = 0; i < MPMC_NSLOTS; i++) {
+        test_data = (buffer_elem_t)(10 + i);
+        TEST_AND_EXIT_ON_FAIL("mpmc_push",
+            (err = mpmc_push(desc, &test_data)) == ENO_ERROR);
+    }
+    TEST_AND_EXIT_ON_FAIL("mpmc_push",
+        (err = mpmc_push(desc, &test_data)) == EBUFFER_FULL);
+    TEST_AND_EXIT_ON_FAIL("mpmc_overflows",
+        (err = ioctl(desc, IOC(IOCTL_MPMC, IOCTL_MPMC_GET_OVERFLOWS), &overflows)) ==
+        ENO_ERROR && overflows == 1);
+
+    /* Empty the queue and test for underflow */
+    for (i = 0; i < MPMC_NSLOTS; i++)
+        TEST_AND_EXIT_ON_FAIL("mpmc_pop",
+            (err = mpmc_pop(desc, &test_data)) == ENO_ERROR && test_data == (buffer_elem_t)(10 + i));
+    TEST_AND_EXIT_ON_FAIL("mpmc_pop",
+        (err = mpmc_pop(desc, &test_data)) == EBUFFER_EMPTY);
+
+    /* Push and pop in lockstep over several laps */
+    for (i = 0; i < 3 * MPMC_NSLOTS; i++) {
+        test_data = (buffer_elem_t)i;
+        TEST_AND_EXIT_ON_FAIL("mpmc_push",
+            (err = ioctl(desc, IOC(IOCTL_MPMC, IOCTL_MPMC_PUSH), &test_data)) == ENO_ERROR);
+        test_data = 0;
+        TEST_AND_EXIT_ON_FAIL("mpmc_pop",
+            (err = ioctl(desc, IOC(IOCTL_MPMC, IOCTL_MPMC_POP), &test_data)) == ENO_ERROR &&
+            test_data == (buffer_elem_t)i);
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Push or pop through the queue under test
+ */
+static int mpmc_test_op(int cmd, buffer_elem_t *elem)
+{
+    int ret;
+
+    if (test_q->lock)
+        pthread_mutex_lock(test_q->lock);
+    ret = ioctl(test_q->q, cmd, elem);
+    if (test_q->lock)
+        pthread_mutex_unlock(test_q->lock);
+
+    return ret;
+}
+
+/**
+ * @brief Producer thread, pushes its id and a sequence number
+ */
+static void *mpmc_mt_producer(void *arg)
+{
+    struct mpmc_test_thread *t = arg;
+    buffer_elem_t data;
+    unsigned long i;
+
+    for (i = 0; i < MPMC_MT_COUNT; i++) {
+        data = (buffer_elem_t)((t->id << MPMC_MT_SEQ_BITS) | i);
+        while (mpmc_test_op(test_q->push, &data) != ENO_ERROR)
+            sched_yield();
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Consumer thread, checks that the elements of each producer arrive
+ *        in sequence
+ */
+static void *mpmc_mt_consumer(void *arg)
+{
+    struct mpmc_test_thread *t = arg;
+    unsigned long next[MPMC_MT_THREADS] = { 0 };
+    buffer_elem_t data, id, seq;
+
+    while (ATOMIC_LOAD_RELAXED(&test_consumed) < MPMC_MT_THREADS * MPMC_MT_COUNT) {
+        if (mpmc_test_op(test_q->pop, &data) != ENO_ERROR) {
+            sched_yield();
+            continue;
+        }
+        ATOMIC_ADD(&test_consumed, 1);
+
+        id = data >> MPMC_MT_SEQ_BITS;
+        seq = data & MPMC_MT_SEQ_MASK;
+        if (id >= MPMC_MT_THREADS || seq < next[id])
+            t->errors++;
+        else
+            next[id] = seq + 1;
+        t->sum += seq;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Run the producers and consumers on a queue and report the
+ *        throughput
+ */
+static int mpmc_mt_run(struct mpmc_test_queue *tq)
+{
+    struct mpmc_test_thread prod[MPMC_MT_THREADS], cons[MPMC_MT_THREADS];
+    struct timespec start, end;
+    unsigned long sum = 0, errors = 0;
+    double secs;
+    unsigned i;
+
+    test_q = tq;
+    test_consumed = 0;
+    memset(prod, 0, sizeof(prod));
+    memset(cons, 0, sizeof(cons));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < MPMC_MT_THREADS; i++) {
+        prod[i].id = cons[i].id = i;
+        pthread_create(&cons[i].thread, NULL, mpmc_mt_consumer, &cons[i]);
+        pthread_create(&prod[i].thread, NULL, mpmc_mt_producer, &prod[i]);
+    }
+    for (i = 0; i < MPMC_MT_THREADS; i++) {
+        pthread_join(prod[i].thread, NULL);
+        pthread_join(cons[i].thread, NULL);
+        sum += cons[i].sum;
+        errors += cons[i].errors;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (double)(end.tv_sec - start.tv_sec) +
+           (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s: %d producers, %d consumers, %lu elements in %.3f s (%.1f M elements/s)\n",
+           tq->name, MPMC_MT_THREADS, MPMC_MT_THREADS, MPMC_MT_THREADS * MPMC_MT_COUNT,
+           secs, (double)(MPMC_MT_THREADS * MPMC_MT_COUNT) / secs / 1e6);
+
+    /* Every element arrived once and in sequence */
+    if (errors || sum != MPMC_MT_THREADS * (MPMC_MT_COUNT * (MPMC_MT_COUNT - 1) / 2)) {
+        printf("%s: %lu elements out of sequence, sum %lu\n", tq->name, errors, sum);
+        return EFAIL;
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Compare the MPMC queue with the buffer protected by a mutex
+ */
+static int mpmc_mt_test(void)
+{
+    struct mpmc_init mi = { test_mt_slot, MPMC_MT_NSLOTS };
+    struct buffer_init bi = { test_mt_buf_elem, MPMC_MT_NSLOTS, 0, 0, 0, NULL, NULL };
+    struct mpmc_test_queue mq = {
+        "mpmc_mt_test", NULL,
+        IOC(IOCTL_MPMC, IOCTL_MPMC_PUSH), IOC(IOCTL_MPMC, IOCTL_MPMC_POP), NULL,
+    };
+    struct mpmc_test_queue bq = {
+        "buffer_mutex_mt_test", NULL,
+        IOC(IOCTL_BUFFER, IOCTL_BUF_PUSH), IOC(IOCTL_BUFFER, IOCTL_BUF_POP), &test_mt_lock,
+    };
+    int err;
+
+    mq.q = new(mpmc, &mi);
+    bq.q = new(buffer, &bi);
+    if (!mq.q || !bq.q) {
+        printf("mpmc_mt_test: queue allocation failed\n");
+        return EFAIL;
+    }
+
+    err = mpmc_mt_run(&mq);
+    if (err == ENO_ERROR)
+        err = mpmc_mt_run(&bq);
+
+    return err;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing MPMC queue\n");
+    if (mpmc_ss_test() != ENO_ERROR || mpmc_mt_test() != ENO_ERROR)
+        printf("MPMC queue test failed\n");
+    else
+        printf("MPMC queue test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,59 @@
+/**
+ * @file  mpmc.h
+ *
+ * @brief Multi-producer multi-consumer queue
+ *
+ * Bounded queue of buffer_elem_t elements that any number of producers and
+ * consumers (threads or interrupt handlers) can use at the same time, for
+ * work items queued by several ISRs. The memory for the queue is provided by
+ * the caller as an array of slots; each slot holds an element and a sequence
+ * number that tells whether the slot is free or holds an element.
+ *
+ * Producers and consumers claim positions with a compare and swap and never
+ * wait for each other: an interrupt handler that preempts a producer or
+ * consumer in the middle of an operation uses the next slot. An element
+ * whose producer was preempted is not visible until the producer completes
+ * the push, and the queue looks empty at that slot meanwhile.
+ *
+ * Constraints:
+ * 1. The number of slots has to be a power of 2.
+ * 2. Data being pushed into a full queue will be ignored. The dropped
+ *    elements are counted and the count is read with
+ *    IOCTL_MPMC_GET_OVERFLOWS.
+ */
+
+#ifndef __MPMC_H__
+#define __MPMC_H__
+
+#include "common.h"
+
+/**
+ * @brief MPMC queue IOCTLs
+ */
+/*!< Write an element into the queue */
+#define IOCTL_MPMC_PUSH             0
+/*!< Read an element from the queue */
+#define IOCTL_MPMC_POP              1
+/*!< Number of elements dropped because the queue was full (unsigned) */
+#define IOCTL_MPMC_GET_OVERFLOWS    2
+
+/**
+ * @brief Queue slot
+ */
+struct mpmc_slot {
+    unsigned seq;           /*!< Sequence number, managed by the queue */
+    buffer_elem_t elem;     /*!< Element */
+};
+
+/**
+ * @brief MPMC queue initializer
+ */
+struct mpmc_init {
+    struct mpmc_slot *slot; /*!< Array of slots allocated by the caller */
+    unsigned nslots;        /*!< Number of slots in the \a slot array */
+};
+
+/* MPMC queue type definition */
+extern const void *mpmc;
+
+#endif /* __MPMC_H__ */
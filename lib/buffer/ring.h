@@ -0,0 +1,114 @@
+/**
+ * @file  ring.h
+ *
+ * @brief Typed ring buffers
+ *
+ * DEFINE_RING(name, type, size) defines struct name, a ring of \a size
+ * elements of \a type for a single producer and a single consumer, and the
+ * functions to use it (name_init, name_push, ...). Each ring has its own
+ * element type, so an application can have, for example, a uint32_t capture
+ * ring and a uint8_t UART ring.
+ *
+ * The size has to be a power of 2 (checked at compile time), so the indexes
+ * are wrapped with a constant mask and the functions are small enough to be
+ * inlined. There is no descriptor allocation and no ioctl dispatch, unlike
+ * the buffer subsystem.
+ *
+ * The head and tail count the elements pushed and popped, and wrap around
+ * freely: head - tail is the number of elements in the ring, so all \a size
+ * elements are usable. The producer and consumer synchronize with acquire
+ * and release accesses to head and tail, like the buffer subsystem.
+ *
+ * Usage:
+ *
+ * DEFINE_RING(uart_ring, uint8_t, 64)
+ *
+ * static struct uart_ring uart_rx;
+ *
+ * uart_ring_init(&uart_rx);
+ * uart_ring_push(&uart_rx, c);                        (producer)
+ * while (uart_ring_pop(&uart_rx, &c) == ENO_ERROR)    (consumer)
+ *     ...
+ */
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#include "common.h"
+
+/*!< Padding to the end of the cache line, after n unsigned fields */
+#if CACHE_LINE_SIZE
+#define RING_PAD(pad, n)    char pad[CACHE_LINE_SIZE - (n) * sizeof(unsigned)];
+#else
+#define RING_PAD(pad, n)
+#endif
+
+/**
+ * @brief Define a ring type and its functions
+ *
+ * @param name Name of the ring structure, prefix of the functions
+ * @param type Element type
+ * @param size Number of elements, a power of 2
+ */
+#define DEFINE_RING(name, type, size)                                   \
+                                                                        \
+typedef char name##_size_is_pow2[                                       \
+    ((size) > 0 && ((size) & ((size) - 1)) == 0) ? 1 : -1];             \
+                                                                        \
+struct name {                                                           \
+    unsigned head;      /*!< Elements pushed, written by the producer */ \
+    unsigned overflows; /*!< Elements dropped because the ring was full */ \
+    RING_PAD(pad0, 2)                                                   \
+    unsigned tail;      /*!< Elements popped, written by the consumer */ \
+    RING_PAD(pad1, 1)                                                   \
+    type elem[size];                                                    \
+};                                                                      \
+                                                                        \
+/* Empty the ring, not safe while the producer or consumer is active */ \
+static inline void name##_init(struct name *r)                          \
+{                                                                       \
+    r->head = r->tail = 0;                                              \
+    r->overflows = 0;                                                   \
+}                                                                       \
+                                                                        \
+/* Number of elements in the ring */                                    \
+static inline unsigned name##_count(struct name *r)                     \
+{                                                                       \
+    return ATOMIC_LOAD_ACQUIRE(&r->head) - ATOMIC_LOAD_ACQUIRE(&r->tail); \
+}                                                                       \
+                                                                        \
+/* Push an element (producer), ENO_ERROR or EBUFFER_FULL */             \
+static inline int name##_push(struct name *r, type elem)                \
+{                                                                       \
+    unsigned head = ATOMIC_LOAD_RELAXED(&r->head);                      \
+                                                                        \
+    /* Acquire the slot freed by the consumer */                        \
+    if (head - ATOMIC_LOAD_ACQUIRE(&r->tail) == (unsigned)(size)) {     \
+        ATOMIC_STORE_RELAXED(&r->overflows, r->overflows + 1);          \
+        return EBUFFER_FULL;                                            \
+    }                                                                   \
+                                                                        \
+    r->elem[head & ((unsigned)(size) - 1)] = elem;                      \
+    /* Publish the element to the consumer */                           \
+    ATOMIC_STORE_RELEASE(&r->head, head + 1);                           \
+                                                                        \
+    return ENO_ERROR;                                                   \
+}                                                                       \
+                                                                        \
+/* Pop an element (consumer), ENO_ERROR or EBUFFER_EMPTY */             \
+static inline int name##_pop(struct name *r, type *elem)                \
+{                                                                       \
+    unsigned tail = ATOMIC_LOAD_RELAXED(&r->tail);                      \
+                                                                        \
+    /* Acquire the element published by the producer */                 \
+    if (tail == ATOMIC_LOAD_ACQUIRE(&r->head))                          \
+        return EBUFFER_EMPTY;                                           \
+                                                                        \
+    *elem = r->elem[tail & ((unsigned)(size) - 1)];                     \
+    /* Hand the slot back to the producer */                            \
+    ATOMIC_STORE_RELEASE(&r->tail, tail + 1);                           \
+                                                                        \
+    return ENO_ERROR;                                                   \
+}
+
+#endif /* __RING_H__ */
@@ -1,8 +1,119 @@
+/**
+ * @file  atomic.h
+ *
+ * @brief Atomic accesses
+ *
+ * Loads and stores of the indexes shared by producers and consumers. The
+ * stores done before a release store are visible to the thread (or
+ * interrupt handler) that reads the stored value with an acquire load. The
+ * relaxed accesses are atomic, but do not order other accesses.
+ * ATOMIC_CAS() stores a value only if the current value is the expected one
+ * (compare and swap) and ATOMIC_ADD() adds to the current value, for the
+ * data written by more than one thread. The fences order the accesses
+ * around them without accessing a variable.
+ *
+ * GCC compatible compilers use the builtins of the C11 memory model, so the
+ * lib can be tested with threads on the host. ARMCC has no such builtins:
+ * aligned word accesses are atomic on the Cortex-M, so a volatile access and
+ * a memory barrier are used instead, and LDREX/STREX for the read-modify-
+ * write accesses. The ARMCC variant only handles word sized (unsigned)
+ * operands.
+ */
+
 #ifndef __ATOMIC_H__
 #define __ATOMIC_H__
 
-#define ATOMIC_START()
-#define ATOMIC_END()
+#if defined(__GNUC__)
 
-#endif /* __ATOMIC_H__ */
+#define ATOMIC_LOAD_RELAXED(ptr)        __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define ATOMIC_LOAD_ACQUIRE(ptr)        __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_RELAXED(ptr, val)  __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+#define ATOMIC_STORE_RELEASE(ptr, val)  __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+/*!< Returns 1 if the value was stored, else 0 and the current value is
+ *   returned in *expected */
+#define ATOMIC_CAS(ptr, expected, val)                                  \
+    __atomic_compare_exchange_n(ptr, expected, val, 0,                  \
+                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+/*!< Add to the value and return the previous value, does not order other
+ *   accesses */
+#define ATOMIC_ADD(ptr, val)            __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED)
+/*!< Order the loads before the fence before the accesses after it */
+#define ATOMIC_FENCE_ACQUIRE()          __atomic_thread_fence(__ATOMIC_ACQUIRE)
+/*!< Order the accesses before the fence before the stores after it */
+#define ATOMIC_FENCE_RELEASE()          __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#elif defined(__CC_ARM)
+
+/**
+ * @brief Load a word, later accesses are not moved before the load
+ */
+static __inline unsigned atomic_load_acquire(volatile const unsigned *ptr)
+{
+    unsigned val = *ptr;
+
+    __dmb(0xf);
+    return val;
+}
+
+/**
+ * @brief Compare and swap a word with exclusive accesses
+ */
+static __inline int atomic_cas(volatile unsigned *ptr, unsigned *expected,
+                               unsigned val)
+{
+    unsigned cur;
+
+    __dmb(0xf);
+    do {
+        cur = __ldrex(ptr);
+        if (cur != *expected) {
+            __clrex();
+            *expected = cur;
+            __dmb(0xf);
+            return 0;
+        }
+    } while (__strex(val, ptr));
+    __dmb(0xf);
+
+    return 1;
+}
 
+/**
+ * @brief Add to a word with exclusive accesses
+ */
+static __inline unsigned atomic_add(volatile unsigned *ptr, unsigned val)
+{
+    unsigned cur;
+
+    do {
+        cur = __ldrex(ptr);
+    } while (__strex(cur + val, ptr));
+
+    return cur;
+}
+
+#define ATOMIC_LOAD_RELAXED(ptr)        (*(volatile const unsigned *)(ptr))
+#define ATOMIC_LOAD_ACQUIRE(ptr)        atomic_load_acquire(ptr)
+#define ATOMIC_STORE_RELAXED(ptr, val)  (*(volatile unsigned *)(ptr) = (val))
+#define ATOMIC_STORE_RELEASE(ptr, val)  (__dmb(0xf), *(volatile unsigned *)(ptr) = (val))
+#define ATOMIC_CAS(ptr, expected, val)  atomic_cas(ptr, expected, val)
+#define ATOMIC_ADD(ptr, val)            atomic_add(ptr, val)
+#define ATOMIC_FENCE_ACQUIRE()          __dmb(0xf)
+#define ATOMIC_FENCE_RELEASE()          __dmb(0xf)
+
+#else
+#error "Atomic accesses are not implemented for this compiler"
+#endif
+
+/*!< Data cache line size, 0 if the target has no data cache. The data
+ *   written by different threads is kept on separate lines, so the threads
+ *   do not invalidate each other's cache (false sharing). */
+#ifndef CACHE_LINE_SIZE
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define CACHE_LINE_SIZE     64
+#else
+#define CACHE_LINE_SIZE     0
+#endif
+#endif
+
+#endif /* __ATOMIC_H__ */
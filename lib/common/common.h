@@ -31,7 +31,9 @@
 /**
  * @brief Return the offset of the structure member
  */
+#ifndef offsetof
 #define offsetof(type, member)              ((size_t)&((type *)0)->member)
+#endif
 
 /**
  * @brief Return the address of the containing structure
@@ -6,6 +6,9 @@
 /* Buffer subsystem errors */
 #define EBUFFER_FULL          -2
 #define EBUFFER_EMPTY         -3
+/* IR subsystem errors */
+#define EIR_TIMING            -4
+#define EIR_CHECKSUM          -5
 
 #endif /* __ERRNO_H__ */
 
@@ -10,6 +10,9 @@
 #define IOCTL_TEMPLATE          0
 #define IOCTL_BUFFER            1
 #define IOCTL_GPIO              2
+#define IOCTL_IR                3
+#define IOCTL_BROADCAST         4
+#define IOCTL_MPMC              5
 
 /**
  * @brief Data type for the buffer item
@@ -17,7 +20,7 @@
  * This is the type for each item of the buffer. App has to define
  * this data type as per it's requirements.
  */
-typedef uint8_t buffer_elem_t;
+typedef uint32_t buffer_elem_t;
 
 #endif /* __CONFIG_H__ */
 
@@ -0,0 +1,74 @@
+/**
+ * @file  ir.c
+ *
+ * @brief IR Subsystem
+ *
+ * Helpers shared by the IR protocol decoders.
+ */
+
+#include "ir.h"
+
+/**
+ */
+void ir_quality_reset(struct ir_quality *q)
+{
+    q->dev = q->nom = 0;
+}
+
+/**
+ */
+void ir_quality_add(struct ir_quality *q, uint32_t d, uint32_t nominal)
+{
+    q->dev += (d > nominal) ? d - nominal : nominal - d;
+    q->nom += nominal;
+}
+
+/**
+ * The average deviation is scaled so that a frame whose pulses are off by
+ * half the tolerance on average scores 50. Frames of protocols without an
+ * integrity check lose a quarter of the score.
+ */
+uint8_t ir_confidence(const struct ir_quality *q, bool checked)
+{
+    uint32_t penalty = 0;
+    uint32_t score;
+
+    if (q->nom)
+        penalty = q->dev * (10000 / IR_TOLERANCE_PCT) / q->nom;
+
+    score = (penalty < 100) ? 100 - penalty : 0;
+    if (!checked)
+        score -= score / 4;
+
+    return (uint8_t)score;
+}
+
+/**
+ */
+void ir_manchester_reset(struct ir_manchester *m, bool one_first)
+{
+    m->code = 0;
+    m->nbits = 0;
+    m->nhalves = 0;
+    m->first = 0;
+    m->one_first = one_first;
+}
+
+/**
+ */
+int ir_manchester_half(struct ir_manchester *m, bool level)
+{
+    if (!(m->nhalves++ & 1)) {
+        m->first = level;
+        return ENO_ERROR;
+    }
+
+    /* There has to be a transition in the middle of every bit */
+    if (m->first == level)
+        return EIR_TIMING;
+
+    m->code = (m->code << 1) | (m->first == m->one_first);
+    m->nbits++;
+
+    return ENO_ERROR;
+}
@@ -0,0 +1,163 @@
+/**
+ * @file  ir.h
+ *
+ * @brief IR Subsystem
+ *
+ * Data types and IOCTLs shared by the IR protocol decoders. The capture
+ * path hands the decoders one pulse per captured edge. A pulse is the
+ * time spent in one state (mark or space) of the demodulated IR signal.
+ * Decoders run a state machine over these pulses and report a frame as
+ * soon as the last pulse of the frame is consumed.
+ *
+ * All durations are in micro seconds.
+ */
+
+#ifndef __IR_H__
+#define __IR_H__
+
+#include "common.h"
+
+/**
+ * @brief IR decoder IOCTLs
+ */
+/*!< Feed a pulse (struct ir_pulse) to the decoder */
+#define IOCTL_IR_DEC_EDGE           0
+/*!< Reset the decoder state machine */
+#define IOCTL_IR_DEC_RESET          1
+/*!< Read the last decoded frame (struct ir_frame) */
+#define IOCTL_IR_DEC_GET_FRAME      2
+/*!< Get the pulse classifier tables of the decoder (const uint8_t
+ *   (*)[IR_LUT_SIZE], see ir_lut.h) */
+#define IOCTL_IR_DEC_GET_LUT        3
+
+/*!< Returned by IOCTL_IR_DEC_EDGE when a frame is ready to be read */
+#define IR_DEC_FRAME_READY          1
+
+/*!< Allowed deviation (in percent) from the nominal pulse duration */
+#define IR_TOLERANCE_PCT            25
+
+/*!< Spaces at least this long (in micro seconds) end a frame */
+#define IR_GAP_MIN                  8000
+
+/**
+ * @brief Test if the duration is within tolerance of the nominal value
+ */
+#define IR_MATCH(d, nominal)                                            \
+    ((d) >= (nominal) - (nominal) * IR_TOLERANCE_PCT / 100 &&           \
+     (d) <= (nominal) + (nominal) * IR_TOLERANCE_PCT / 100)
+
+/**
+ * @brief IR protocols
+ */
+enum ir_protocol_id {
+    IR_PROTO_NONE,
+    IR_PROTO_NEC,
+    IR_PROTO_RC5,
+    IR_PROTO_RC6,
+    IR_PROTO_SIRC,
+    IR_PROTO_SAMSUNG,
+    IR_PROTO_JVC,
+};
+
+/*!< Frame is a repeat code (key is held down) */
+#define IR_FRAME_REPEAT             BIT(0)
+/*!< Toggle bit of the frame (RC5 and RC6) */
+#define IR_FRAME_TOGGLE             BIT(1)
+
+/**
+ * @brief Demodulated IR pulse
+ */
+struct ir_pulse {
+    uint32_t duration;  /*!< Duration of the pulse in micro seconds */
+    bool mark;          /*!< 1 - carrier present (mark), 0 - carrier absent (space) */
+};
+
+/**
+ * @brief Pulses of a frame in contiguous memory
+ */
+struct ir_pulse_seq {
+    struct ir_pulse *pulse;         /*!< First pulse of the frame */
+    unsigned npulses;               /*!< Number of pulses, including the gap */
+};
+
+/**
+ * @brief Decoded IR frame
+ */
+struct ir_frame {
+    uint8_t protocol;   /*!< One of enum ir_protocol_id */
+    uint8_t flags;      /*!< IR_FRAME_* flags */
+    uint16_t address;   /*!< Device address */
+    uint16_t command;   /*!< Key code */
+    uint8_t confidence; /*!< How well the frame fits the protocol (0 - 100) */
+};
+
+/**
+ * @brief Timing quality of the pulses of a frame
+ *
+ * Decoders accumulate the deviation of each pulse from its nominal
+ * duration and turn it into the confidence of the frame, so a frame
+ * that barely fit the timing windows scores lower than a clean one.
+ */
+struct ir_quality {
+    uint32_t dev;       /*!< Sum of the deviations from the nominal durations */
+    uint32_t nom;       /*!< Sum of the nominal durations */
+};
+
+/**
+ * @brief Manchester (bi-phase) bit decoder state
+ *
+ * Used by the RC5 and RC6 decoders. Bits are shifted in MSB first.
+ */
+struct ir_manchester {
+    uint32_t code;      /*!< Bits received so far */
+    uint8_t nbits;      /*!< Number of bits received */
+    uint8_t nhalves;    /*!< Number of half bits received */
+    bool first;         /*!< Level of the first half of the current bit */
+    bool one_first;     /*!< Level of the first half of a one bit */
+};
+
+/**
+ * @brief Reset the quality accumulator
+ */
+void ir_quality_reset(struct ir_quality *q);
+
+/**
+ * @brief Add the deviation of a classified pulse to the quality accumulator
+ *
+ * @param q Quality accumulator.
+ * @param d Measured duration.
+ * @param nominal Nominal duration of the class the pulse fell in.
+ */
+void ir_quality_add(struct ir_quality *q, uint32_t d, uint32_t nominal);
+
+/**
+ * @brief Compute the frame confidence from the accumulated quality
+ *
+ * @param q Quality accumulator.
+ * @param checked 1, if the frame passed an integrity check (e.g., inverted
+ *                copy of the command).
+ *
+ * @return Confidence from 0 to 100.
+ */
+uint8_t ir_confidence(const struct ir_quality *q, bool checked);
+
+/**
+ * @brief Reset the Manchester bit decoder
+ *
+ * @param m Manchester decoder state.
+ * @param one_first Level of the first half of a one bit.
+ */
+void ir_manchester_reset(struct ir_manchester *m, bool one_first);
+
+/**
+ * @brief Feed one half bit to the Manchester bit decoder
+ *
+ * @param m Manchester decoder state.
+ * @param level Level of the half bit (1 - mark, 0 - space).
+ *
+ * @return ENO_ERROR, if the half bit is consumed.
+ *         EIR_TIMING, if both halves of a bit have the same level.
+ */
+int ir_manchester_half(struct ir_manchester *m, bool level);
+
+#endif /* __IR_H__ */
@@ -0,0 +1,617 @@
+/**
+ * @file  ir_capture.c
+ *
+ * @brief IR capture consumer
+ *
+ * The consumer keeps its own read index into the DMA buffer, the level
+ * of the next pulse and, for timestamps, the timestamp of the last edge.
+ * The DMA write index is passed in by the caller, so the consumer does not
+ * touch any peripheral and runs the same way on the target and on the
+ * host.
+ *
+ * To detect a lap, the consumer counts the values it read and the half
+ * buffers the DMA filled since it was created. The DMA is always at or
+ * after the last half boundary it raised an event for, so if that boundary
+ * is past the value at the write index on the current lap, the DMA is at
+ * least one lap ahead.
+ */
+
+#include "ir_capture.h"
+#include "class.h"
+
+/**
+ * @brief IR capture consumer descriptor
+ *
+ * Internal structure used to manage the consumer.
+ */
+struct ir_capture_desc {
+    const struct class *class;
+    const struct ir_capture_init *init; /*!< Consumer init parameters */
+    unsigned rd;                /*!< Buffer index for the consumer */
+    unsigned nread;             /*!< Values read, wraps around */
+    unsigned nhalf;             /*!< Values up to the last half boundary the
+                                     DMA passed, wraps around */
+    unsigned dropped;           /*!< Values dropped on a lap */
+    bool mark;                  /*!< Level of the next pulse */
+    bool idle;                  /*!< Next value ends an idle line and is dropped */
+    uint32_t last;              /*!< Timestamp of the last edge */
+    bool valid;                 /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;      /*!< Last decoded frame */
+};
+
+static void ir_capture_reset(struct ir_capture_desc *desc);
+static uint32_t ir_capture_duration(struct ir_capture_desc *desc, uint32_t val);
+static int ir_capture_feed(struct ir_capture_desc *desc, struct ir_pulse *pulse);
+static int ir_capture_process(struct ir_capture_desc *desc, unsigned wr);
+static int ir_capture_timeout(struct ir_capture_desc *desc, unsigned wr);
+static int ir_capture_check(struct ir_capture_desc *desc, const struct ir_capture_dma *dma);
+
+static void *ir_capture_ctor(void *data);
+static void ir_capture_dtor(void *self);
+static int ir_capture_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Reset the consumer and the decoder
+ *
+ * The line is assumed to be idle, so the first captured value is dropped.
+ *
+ * @param desc Consumer descriptor
+ */
+static void ir_capture_reset(struct ir_capture_desc *desc)
+{
+    desc->mark = 1;
+    desc->idle = 1;
+    desc->valid = 0;
+    ioctl(desc->init->dec, IOC(IOCTL_IR, IOCTL_IR_DEC_RESET), NULL);
+}
+
+/**
+ * @brief Turn a captured value into a pulse duration
+ *
+ * @param desc Consumer descriptor
+ * @param val Captured value
+ *
+ * @return Duration of the pulse that ended on the edge (micro seconds)
+ */
+static uint32_t ir_capture_duration(struct ir_capture_desc *desc, uint32_t val)
+{
+    uint32_t d;
+
+    if (!desc->init->ticks_per_us)
+        return val;
+
+    /* Unsigned subtraction, so the timer wrapping around does not matter */
+    d = (val - desc->last) / desc->init->ticks_per_us;
+    desc->last = val;
+
+    return d;
+}
+
+/**
+ * @brief Feed a pulse to the decoder
+ *
+ * @return IR_DEC_FRAME_READY, if the pulse completed a frame.
+ *         ENO_ERROR, otherwise.
+ */
+static int ir_capture_feed(struct ir_capture_desc *desc, struct ir_pulse *pulse)
+{
+    void *dec = desc->init->dec;
+
+    if (ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), pulse) != IR_DEC_FRAME_READY ||
+        ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &desc->frame) != ENO_ERROR)
+        return ENO_ERROR;
+
+    desc->valid = 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Feed the captured values up to the DMA write index to the decoder
+ *
+ * @param desc Consumer descriptor
+ * @param wr DMA write index
+ *
+ * @return IR_DEC_FRAME_READY, if a frame was decoded. The values after the
+ *         last pulse of the frame are left for the next call.
+ *         ENO_ERROR, if all the values were processed.
+ *         EFAIL, if the write index is out of range.
+ */
+static int ir_capture_process(struct ir_capture_desc *desc, unsigned wr)
+{
+    const struct ir_capture_init *init = desc->init;
+    struct ir_pulse pulse;
+
+    if (wr >= init->size)
+        return EFAIL;
+
+    while (desc->rd != wr) {
+        pulse.duration = ir_capture_duration(desc, init->buf[desc->rd]);
+        desc->nread++;
+        if (++desc->rd == init->size)
+            desc->rd = 0;
+
+        /* The gap was fed on the timeout */
+        if (desc->idle) {
+            desc->idle = 0;
+            desc->mark = 1;
+            continue;
+        }
+
+        pulse.mark = desc->mark;
+        desc->mark = !desc->mark;
+        if (ir_capture_feed(desc, &pulse) == IR_DEC_FRAME_READY)
+            return IR_DEC_FRAME_READY;
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Close the frame in progress after the line went idle
+ *
+ * @param desc Consumer descriptor
+ * @param wr DMA write index
+ *
+ * @return IR_DEC_FRAME_READY, if a frame was decoded. The call has to be
+ *         repeated to finish the timeout processing.
+ *         ENO_ERROR, if the timeout was processed.
+ *         EFAIL, if the write index is out of range.
+ */
+static int ir_capture_timeout(struct ir_capture_desc *desc, unsigned wr)
+{
+    struct ir_pulse gap;
+    int ret;
+
+    ret = ir_capture_process(desc, wr);
+    if (ret != ENO_ERROR || desc->idle)
+        return ret;
+
+    /* Whatever the parity says, an idle line is a space */
+    gap.duration = desc->init->timeout;
+    gap.mark = 0;
+    desc->idle = 1;
+
+    return ir_capture_feed(desc, &gap);
+}
+
+/**
+ * @brief Drop the unread values if the DMA wrote a whole buffer or more
+ *        since the consumer read them
+ *
+ * @param desc Consumer descriptor
+ * @param dma DMA write index and the events since the last check
+ *
+ * @return ENO_ERROR, if the unread values are intact.
+ *         EBUFFER_FULL, if the DMA lapped the consumer. The read index is
+ *         moved to the write index and the decoder is reset.
+ *         EFAIL, if the write index is out of range.
+ */
+static int ir_capture_check(struct ir_capture_desc *desc, const struct ir_capture_dma *dma)
+{
+    unsigned size = desc->init->size;
+    unsigned unread, lost;
+
+    if (dma->wr >= size)
+        return EFAIL;
+
+    desc->nhalf += dma->halves * (size / 2);
+
+    /* Values to the write index if the DMA is on the consumer's lap. A full
+     * buffer leaves the write index on the read index, so it counts as a lap
+     * too: the DMA is overwriting the oldest value already.
+     */
+    unread = (dma->wr + size - desc->rd) % size;
+    if ((int)(desc->nhalf - (desc->nread + unread)) <= 0)
+        return ENO_ERROR;
+
+    /* Whole laps until the write index is past the last half boundary */
+    lost = unread + (desc->nhalf - desc->nread - unread + size - 1) / size * size;
+    desc->dropped += lost;
+    desc->nread += lost;
+    desc->rd = dma->wr;
+    ir_capture_reset(desc);
+
+    return EBUFFER_FULL;
+}
+
+/**
+ * @brief Create and return an IR capture consumer descriptor
+ */
+static void *ir_capture_ctor(void *data)
+{
+    const struct ir_capture_init *init = data;
+    struct ir_capture_desc *desc;
+
+    if (!init || !init->buf || !init->size || (init->size & 1) || !init->dec)
+        return NULL;
+
+    desc = mm_alloc(sizeof(struct ir_capture_desc));
+    if (desc) {
+        desc->class = ir_capture;
+        desc->init = init;
+        desc->rd = 0;
+        desc->nread = desc->nhalf = desc->dropped = 0;
+        desc->last = 0;
+        ir_capture_reset(desc);
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the IR capture consumer descriptor
+ */
+static void ir_capture_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle IR capture consumer operations
+ */
+static int ir_capture_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_capture_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_CAP_PROCESS:
+            ret = ir_capture_process(desc, *(unsigned *)data);
+            break;
+        case IOCTL_IR_CAP_TIMEOUT:
+            ret = ir_capture_timeout(desc, *(unsigned *)data);
+            break;
+        case IOCTL_IR_CAP_CHECK:
+            ret = ir_capture_check(desc, data);
+            break;
+        case IOCTL_IR_CAP_GET_DROPPED:
+            *(unsigned *)data = desc->dropped;
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_RESET:
+            /* The values before the DMA write index are discarded */
+            desc->nread += (*(unsigned *)data + desc->init->size - desc->rd) % desc->init->size;
+            desc->rd = *(unsigned *)data;
+            ir_capture_reset(desc);
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief IR capture consumer class
+ */
+static const struct class _ir_capture = {
+    ir_capture_ctor,
+    ir_capture_dtor,
+    ir_capture_ioctl,
+};
+
+const void *ir_capture = &_ir_capture;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "ir_rx.h"
+#include "ir_nec.h"
+#include "ir_sirc.h"
+#include "ir_test.h"
+
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+
+#define TEST_DMA_SIZE       64
+#define TEST_TIM_PERIOD     20000
+#define TEST_MAX_PULSES     512
+#define TEST_MAX_FRAMES     8
+
+/**
+ * @brief Emulated capture timer and DMA stream
+ *
+ * The timer is reset on every edge (or runs free) and the DMA copies the
+ * captured count into the circular buffer. The counter register of the DMA
+ * counts down from the buffer size, as on the target.
+ */
+struct test_dma {
+    uint32_t buf[TEST_DMA_SIZE];
+    unsigned ndtr;              /*!< DMA number of data register */
+    unsigned events;            /*!< Number of consumer wake ups */
+    unsigned halves;            /*!< Half transfer events since the last wake up */
+    bool stall;                 /*!< The consumer misses its wake ups */
+    unsigned ticks_per_us;      /*!< 0 if the timer is reset on every edge */
+    uint32_t now;               /*!< Count of the free running timer */
+};
+
+/**
+ * @brief Level train played through the emulated capture hardware
+ */
+struct test_tx {
+    struct ir_pulse pulse[TEST_MAX_PULSES];
+    unsigned npulses;
+};
+
+static struct test_dma test_dma;
+static struct test_tx test_tx;
+static struct ir_frame test_frames[TEST_MAX_FRAMES];
+static unsigned test_nframes;
+
+static void test_level(struct test_tx *tx, bool mark, uint32_t d);
+static void test_nec(struct test_tx *tx, uint8_t addr, uint8_t cmd);
+static void test_sirc(struct test_tx *tx, uint8_t addr, uint8_t cmd);
+static void test_consume(void *cap, int cmd);
+static void test_capture(void *cap, uint32_t d);
+static void test_play(void *cap, const struct test_tx *tx);
+static int ir_capture_run(struct ir_capture_init *init);
+static int ir_capture_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ */
+static void test_level(struct test_tx *tx, bool mark, uint32_t d)
+{
+    if (tx->npulses < TEST_MAX_PULSES) {
+        tx->pulse[tx->npulses].mark = mark;
+        tx->pulse[tx->npulses].duration = d;
+        tx->npulses++;
+    }
+}
+
+/**
+ */
+static void test_nec(struct test_tx *tx, uint8_t addr, uint8_t cmd)
+{
+    tx->npulses += ir_test_nec(tx->pulse + tx->npulses, TEST_MAX_PULSES - tx->npulses,
+                               addr, cmd, 0);
+}
+
+/**
+ */
+static void test_sirc(struct test_tx *tx, uint8_t addr, uint8_t cmd)
+{
+    uint32_t code = cmd | (uint32_t)addr << IR_SIRC_CMD_BITS;
+    unsigned i;
+
+    test_level(tx, 1, IR_SIRC_HDR_MARK);
+    for (i = 0; i < 12; i++) {
+        test_level(tx, 0, IR_SIRC_BIT_SPACE);
+        test_level(tx, 1, (code & BIT(i)) ? IR_SIRC_ONE_MARK : IR_SIRC_ZERO_MARK);
+    }
+}
+
+/**
+ * @brief Consumer run from the emulated interrupts
+ */
+static void test_consume(void *cap, int cmd)
+{
+    struct ir_capture_dma dma;
+
+    dma.halves = test_dma.halves;
+    dma.wr = TEST_DMA_SIZE - test_dma.ndtr;
+    test_dma.halves = 0;
+    test_dma.events++;
+    if (ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_CAP_CHECK), &dma) != ENO_ERROR)
+        return;
+
+    while (ioctl(cap, IOC(IOCTL_IR, cmd), &dma.wr) == IR_DEC_FRAME_READY) {
+        if (test_nframes < TEST_MAX_FRAMES)
+            ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &test_frames[test_nframes++]);
+    }
+}
+
+/**
+ * @brief Capture event, the DMA copies the count of the timer
+ */
+static void test_capture(void *cap, uint32_t d)
+{
+    if (test_dma.ticks_per_us) {
+        test_dma.now += d * test_dma.ticks_per_us;
+        d = test_dma.now;
+    }
+    test_dma.buf[TEST_DMA_SIZE - test_dma.ndtr] = d;
+    if (--test_dma.ndtr == TEST_DMA_SIZE / 2) {
+        test_dma.halves++;
+    } else if (!test_dma.ndtr) {
+        test_dma.ndtr = TEST_DMA_SIZE;
+        test_dma.halves++;
+    } else {
+        return;
+    }
+
+    if (!test_dma.stall)
+        test_consume(cap, IOCTL_IR_CAP_PROCESS);
+}
+
+/**
+ * @brief Play the level train through the emulated timer and DMA
+ *
+ * The line stays idle after the last pulse, so the emulated timer runs
+ * into the timeout.
+ */
+static void test_play(void *cap, const struct test_tx *tx)
+{
+    uint32_t d;
+    unsigned i;
+
+    for (i = 0; i <= tx->npulses; i++) {
+        d = (i < tx->npulses) ? tx->pulse[i].duration : TEST_TIM_PERIOD + 1;
+
+        /* Timeout event, the count of a timer reset on edges wraps around */
+        if (d > TEST_TIM_PERIOD) {
+            test_consume(cap, IOCTL_IR_CAP_TIMEOUT);
+            if (!test_dma.ticks_per_us)
+                d %= TEST_TIM_PERIOD + 1;
+        }
+        if (i == tx->npulses)
+            break;
+
+        test_capture(cap, d);
+    }
+}
+
+/**
+ * @brief Play frames of two protocols through a consumer
+ */
+static int ir_capture_run(struct ir_capture_init *init)
+{
+    static const struct ir_frame expect[] = {
+        { IR_PROTO_NEC,     0,               0x04,  0x08, 0 },
+        { IR_PROTO_SIRC,    0,               0x01,  0x15, 0 },
+        { IR_PROTO_NEC,     0,               0x10,  0x16, 0 },
+        { IR_PROTO_SIRC,    0,               0x02,  0x33, 0 },
+    };
+    struct test_tx *tx = &test_tx;
+    unsigned i, edges, dropped;
+    void *cap;
+    int err = EFAIL;
+
+    cap = new(ir_capture, init);
+    TEST_AND_EXIT_ON_FAIL("ir_capture_new", cap != NULL);
+
+    /* The line idles for longer than the timer period before the first
+     * frame and the SIRC frames end the bursts, so only the timeout can
+     * close them.
+     */
+    tx->npulses = 0;
+    test_level(tx, 0, 3 * TEST_TIM_PERIOD + 1234);
+    test_nec(tx, 0x04, 0x08);
+    test_level(tx, 0, 12000);
+    test_sirc(tx, 0x01, 0x15);
+    test_level(tx, 0, TEST_TIM_PERIOD + 4321);
+    test_nec(tx, 0x10, 0x16);
+    test_level(tx, 0, 41000);
+    test_sirc(tx, 0x02, 0x33);
+
+    test_dma.ndtr = TEST_DMA_SIZE;
+    test_dma.events = 0;
+    test_dma.halves = 0;
+    test_dma.stall = 0;
+    test_dma.ticks_per_us = init->ticks_per_us;
+    /* The free running timer wraps around during the frames */
+    test_dma.now = 0xfff00000UL;
+    test_nframes = 0;
+    test_play(cap, tx);
+
+    edges = tx->npulses;
+    printf("%-15s: %u ticks/us: %u edges, %u consumer runs\n", "capture",
+           init->ticks_per_us, edges, test_dma.events);
+    for (i = 0; i < test_nframes; i++)
+        printf("%-15s: proto %u addr 0x%04x cmd 0x%02x conf %3u\n", "frame",
+               test_frames[i].protocol, test_frames[i].address,
+               test_frames[i].command, test_frames[i].confidence);
+
+    TEST_AND_EXIT_ON_FAIL("frame_count", test_nframes == ARRAY_SIZE(expect));
+    for (i = 0; i < test_nframes; i++) {
+        TEST_AND_EXIT_ON_FAIL("frame_protocol", test_frames[i].protocol == expect[i].protocol);
+        TEST_AND_EXIT_ON_FAIL("frame_address", test_frames[i].address == expect[i].address);
+        TEST_AND_EXIT_ON_FAIL("frame_command", test_frames[i].command == expect[i].command);
+    }
+
+    /* One wake up per half buffer and per idle period, not one per edge */
+    TEST_AND_EXIT_ON_FAIL("consumer_runs", test_dma.events <= edges / (TEST_DMA_SIZE / 2) + 4);
+
+    err = ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_CAP_GET_DROPPED), &dropped);
+    TEST_AND_EXIT_ON_FAIL("no_lap", err == ENO_ERROR && dropped == 0);
+
+    /* The main loop misses two wake ups, one value short of a lap */
+    test_dma.stall = 1;
+    for (i = 0; i < TEST_DMA_SIZE - 1; i++)
+        test_capture(cap, 500);
+    test_dma.stall = 0;
+    test_consume(cap, IOCTL_IR_CAP_PROCESS);
+    err = ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_CAP_GET_DROPPED), &dropped);
+    TEST_AND_EXIT_ON_FAIL("short_of_lap", err == ENO_ERROR && dropped == 0);
+
+    /* The DMA laps the consumer by exactly two halves, so the write index
+     * is back on the read index
+     */
+    test_dma.stall = 1;
+    for (i = 0; i < TEST_DMA_SIZE; i++)
+        test_capture(cap, 500);
+    test_dma.stall = 0;
+    test_consume(cap, IOCTL_IR_CAP_PROCESS);
+    err = ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_CAP_GET_DROPPED), &dropped);
+    TEST_AND_EXIT_ON_FAIL("lap", err == ENO_ERROR && dropped == TEST_DMA_SIZE);
+
+    /* Reset drops what the DMA wrote before the reset */
+    i = TEST_DMA_SIZE - test_dma.ndtr;
+    err = ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_DEC_RESET), &i);
+    TEST_AND_EXIT_ON_FAIL("reset", err == ENO_ERROR);
+    err = ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &test_frames[0]);
+    TEST_AND_EXIT_ON_FAIL("get_frame_after_reset", err == EFAIL);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Top level IR capture test function
+ *
+ * Runs the timer reset on every edge and the free running timer with
+ * timestamps at 84 ticks per micro second.
+ */
+static int ir_capture_ss_test(void)
+{
+    static struct ir_capture_init init[] = {
+        { test_dma.buf, TEST_DMA_SIZE, TEST_TIM_PERIOD, NULL, 0 },
+        { test_dma.buf, TEST_DMA_SIZE, TEST_TIM_PERIOD, NULL, 84 },
+    };
+    void *dec;
+    unsigned i;
+    int err = EFAIL;
+
+    dec = new(ir_rx, NULL);
+    TEST_AND_EXIT_ON_FAIL("ir_rx_new", dec != NULL);
+    TEST_AND_EXIT_ON_FAIL("add_nec",
+        (err = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_nec, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_sirc",
+        (err = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_sirc, NULL))) == ENO_ERROR);
+
+    for (i = 0; i < ARRAY_SIZE(init); i++) {
+        init[i].dec = dec;
+        err = ir_capture_run(&init[i]);
+        if (err != ENO_ERROR)
+            return err;
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR capture\n");
+    if (ir_capture_ss_test() != ENO_ERROR)
+        printf("IR capture test failed\n");
+    else
+        printf("IR capture test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,92 @@
+/**
+ * @file  ir_capture.h
+ *
+ * @brief IR capture consumer
+ *
+ * Batched consumer for the edges captured by DMA. The capture timer runs
+ * in reset-on-edge mode, so every captured value is the duration of the
+ * pulse that just ended, and the DMA writes the values into a circular
+ * buffer without interrupting the CPU. The consumer runs on the DMA half
+ * transfer and transfer complete interrupts and on the capture timeout. It
+ * turns all the values written since its last run into pulses and feeds
+ * them to a decoder (usually the receive engine).
+ *
+ * The DMA cannot record the level of the line, so the level is inferred:
+ * pulses alternate between mark and space, and a capture timeout (line
+ * idle for the gap timeout since the last edge) means that the pulse in
+ * progress is the gap after a frame. The timeout feeds the gap to the
+ * decoder right away, so the frame is decoded without waiting for the next
+ * edge, and resynchronizes the level, so a lost edge corrupts at most one
+ * frame. The value captured at the end of the gap was already fed (as the
+ * timeout) and is dropped.
+ *
+ * With a 32-bit timer the capture can instead run free and the DMA writes
+ * the absolute timer count of every edge. The consumer then computes the
+ * durations by subtracting the previous timestamp, so pulses longer than
+ * the timer period (e.g., the gap between NEC frames) do not overflow, and
+ * the timer can run at more than one tick per micro second.
+ *
+ * The write index alone cannot tell a full buffer from an empty one, so
+ * before processing the consumer is also told how many half transfer and
+ * transfer complete events the DMA raised. If the DMA wrote a whole buffer
+ * or more since the consumer last read, the unread values are dropped and
+ * counted. The consumer stops as soon as a frame is decoded, so it is run
+ * until it returns something other than IR_DEC_FRAME_READY:
+ *
+ * struct ir_capture_dma dma = { size - dma_counter, half_events };
+ *
+ * if (ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_CAP_CHECK), &dma) == ENO_ERROR)
+ *     while (ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_CAP_PROCESS), &dma.wr) == IR_DEC_FRAME_READY)
+ *         ioctl(cap, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame);
+ */
+
+#ifndef __IR_CAPTURE_H__
+#define __IR_CAPTURE_H__
+
+#include "ir.h"
+
+/**
+ * @brief IR capture IOCTLs (in addition to IOCTL_IR_DEC_RESET and
+ *        IOCTL_IR_DEC_GET_FRAME)
+ */
+/*!< Process the values up to the DMA write index (unsigned) */
+#define IOCTL_IR_CAP_PROCESS        16
+/*!< Process the values up to the DMA write index (unsigned), then close
+ *   the frame because the line is idle */
+#define IOCTL_IR_CAP_TIMEOUT        17
+/*!< Drop the unread values if the DMA lapped the consumer (struct ir_capture_dma) */
+#define IOCTL_IR_CAP_CHECK          18
+/*!< Get the number of values dropped because the DMA lapped the consumer (unsigned) */
+#define IOCTL_IR_CAP_GET_DROPPED    19
+
+/**
+ * @brief IR capture consumer initializer
+ */
+struct ir_capture_init {
+    volatile const uint32_t *buf;   /*!< Circular buffer written by the DMA */
+    unsigned size;                  /*!< Number of values in \a buf (even) */
+    uint32_t timeout;               /*!< Idle time that raises the timeout (micro seconds) */
+    void *dec;                      /*!< Decoder the pulses are fed to */
+    unsigned ticks_per_us;          /*!< 0 - the values are durations in micro
+                                         seconds (timer reset on every edge),
+                                         else - the values are timestamps of a
+                                         free running 32-bit timer with this
+                                         many ticks per micro second */
+};
+
+/**
+ * @brief DMA position for IOCTL_IR_CAP_CHECK
+ *
+ * The event count is read before the write index, so the events never
+ * count a half the write index has not reached.
+ */
+struct ir_capture_dma {
+    unsigned wr;                    /*!< DMA write index */
+    unsigned halves;                /*!< Half transfer and transfer complete
+                                         events since the last check */
+};
+
+/* IR capture consumer type definition */
+extern const void *ir_capture;
+
+#endif /* __IR_CAPTURE_H__ */
@@ -0,0 +1,219 @@
+/**
+ * @file  ir_carrier.c
+ *
+ * @brief IR transmit carrier
+ */
+
+#include "ir_carrier.h"
+
+/**
+ */
+int ir_carrier_init(struct ir_carrier *carrier, volatile uint32_t *ccr, uint32_t clk_hz,
+                    uint32_t freq_hz, unsigned duty_pct)
+{
+    uint32_t period;
+
+    if (!freq_hz || !duty_pct || duty_pct >= 100)
+        return EFAIL;
+
+    /* Nearest period, the pulse is rounded down */
+    period = (clk_hz + freq_hz / 2) / freq_hz;
+    if (period < 2 || period > IR_CARRIER_PERIOD_MAX)
+        return EFAIL;
+
+    carrier->ccr = ccr;
+    carrier->period = period;
+    carrier->pulse = period * duty_pct / 100;
+    ir_carrier_gate(carrier, 0);
+
+    return ENO_ERROR;
+}
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "ir_nec.h"
+#include "ir_test.h"
+
+#define TEST_CLK_HZ         84000000
+#define TEST_CLK_PER_US     (TEST_CLK_HZ / 1000000)
+#define TEST_FREQ_HZ        38000
+#define TEST_DUTY_PCT       33
+#define TEST_GAP            40000
+/* Header, 32 bits, stop mark and gap */
+#define TEST_NPHASES        (IR_TEST_NEC_PULSES + 1)
+
+/**
+ * @brief Registers of the stub timer
+ *
+ * An up counting timer in PWM mode 1 with the compare preload enabled: the
+ * output is active while the counter is below the active compare value,
+ * which is loaded from the compare register on every update event.
+ */
+struct test_tim {
+    uint32_t cr1;           /* Control register, only the enable bit */
+    uint32_t arr;           /* Auto reload */
+    uint32_t ccr;           /* Compare (preload) register */
+    uint32_t ccr_active;    /* Compare shadow register */
+    uint32_t cnt;           /* Counter */
+};
+
+/**
+ * @brief Carrier pulses seen in a phase of the envelope
+ */
+struct test_phase {
+    bool mark;
+    uint32_t duration;      /* Micro seconds */
+    unsigned rising;        /* Carrier pulses that started in the phase */
+};
+
+static struct test_tim test_tim;
+static struct test_phase test_phase[TEST_NPHASES];
+
+static unsigned test_nec(uint8_t addr, uint8_t cmd);
+static int test_run(const struct ir_carrier *carrier, unsigned nphases);
+static int ir_carrier_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err;                                     \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Fill the phases of a NEC frame, returns the number of phases
+ */
+static unsigned test_nec(uint8_t addr, uint8_t cmd)
+{
+    struct ir_pulse pulse[IR_TEST_NEC_PULSES];
+    unsigned i, n;
+
+    n = ir_test_nec(pulse, IR_TEST_NEC_PULSES, addr, cmd, 0);
+    for (i = 0; i < n; i++) {
+        test_phase[i].mark = pulse[i].mark;
+        test_phase[i].duration = pulse[i].duration;
+    }
+    test_phase[n].mark = 0;
+    test_phase[n++].duration = TEST_GAP;
+
+    return n;
+}
+
+/**
+ * @brief Run the stub timer over the phases, gating the carrier on every
+ *        phase boundary, and check every carrier pulse
+ */
+static int test_run(const struct ir_carrier *carrier, unsigned nphases)
+{
+    uint32_t width = 0;
+    unsigned i, t, end;
+    bool out, last = 0;
+    int err = EFAIL;
+
+    for (i = 0; i < nphases; i++) {
+        struct test_phase *p = &test_phase[i];
+
+        /* The gate is written wherever the counter happens to be */
+        ir_carrier_gate(carrier, p->mark);
+        p->rising = 0;
+
+        end = p->duration * TEST_CLK_PER_US;
+        for (t = 0; t < end; t++) {
+            out = test_tim.cnt < test_tim.ccr_active;
+            if (out && !last)
+                p->rising++;
+            if (out)
+                width++;
+            /* Every pulse is a whole pulse of the duty cycle */
+            if (!out && last)
+                TEST_AND_EXIT_ON_FAIL("pulse", width == carrier->pulse);
+            if (!out)
+                width = 0;
+            last = out;
+
+            if (test_tim.cnt++ == test_tim.arr) {
+                test_tim.cnt = 0;
+                test_tim.ccr_active = test_tim.ccr;
+            }
+        }
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Top level IR carrier test function
+ */
+static int ir_carrier_ss_test(void)
+{
+    struct ir_carrier carrier;
+    unsigned i, n, pulses = 0;
+    uint32_t cycles;
+    int err = EFAIL;
+
+    TEST_AND_EXIT_ON_FAIL("no_freq",
+        (err = ir_carrier_init(&carrier, &test_tim.ccr, TEST_CLK_HZ, 0, 50)) == EFAIL);
+    TEST_AND_EXIT_ON_FAIL("duty",
+        (err = ir_carrier_init(&carrier, &test_tim.ccr, TEST_CLK_HZ, TEST_FREQ_HZ, 100)) == EFAIL);
+    TEST_AND_EXIT_ON_FAIL("slow",
+        (err = ir_carrier_init(&carrier, &test_tim.ccr, TEST_CLK_HZ, 1000, 50)) == EFAIL);
+
+    /* The timer runs with the carrier gated off */
+    test_tim.ccr = 0x1234;
+    TEST_AND_EXIT_ON_FAIL("init",
+        (err = ir_carrier_init(&carrier, &test_tim.ccr, TEST_CLK_HZ, TEST_FREQ_HZ,
+                               TEST_DUTY_PCT)) == ENO_ERROR);
+    printf("%-15s: period %u pulse %u\n", "carrier", carrier.period, carrier.pulse);
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("timing", carrier.period == 2211 && carrier.pulse == 729);
+    TEST_AND_EXIT_ON_FAIL("off", test_tim.ccr == 0);
+    test_tim.cr1 = 1;
+    test_tim.arr = carrier.period - 1;
+    test_tim.cnt = 1000;
+
+    /* Every mark gets as many carrier periods as fit in it, give or take
+     * one since the gate waits for the period boundary, and no carrier
+     * pulse starts in a space
+     */
+    n = test_nec(0x04, 0x08);
+    TEST_AND_EXIT_ON_FAIL("run", (err = test_run(&carrier, n)) == ENO_ERROR);
+    err = EFAIL;
+    for (i = 0; i < n; i++) {
+        cycles = test_phase[i].duration * TEST_CLK_PER_US / carrier.period;
+        if (test_phase[i].mark)
+            TEST_AND_EXIT_ON_FAIL("mark", test_phase[i].rising == cycles ||
+                                          test_phase[i].rising == cycles + 1);
+        else
+            TEST_AND_EXIT_ON_FAIL("space", test_phase[i].rising == 0);
+        pulses += test_phase[i].rising;
+    }
+    printf("%-15s: %u phases, %u carrier pulses\n", "frame", n, pulses);
+
+    /* The timer was never stopped or reloaded */
+    TEST_AND_EXIT_ON_FAIL("timer", test_tim.cr1 == 1 && test_tim.arr == carrier.period - 1);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR carrier\n");
+    if (ir_carrier_ss_test() != ENO_ERROR)
+        printf("IR carrier test failed\n");
+    else
+        printf("IR carrier test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,66 @@
+/**
+ * @file  ir_carrier.h
+ *
+ * @brief IR transmit carrier
+ *
+ * The carrier is the PWM output of a timer channel that runs for the whole
+ * transmission. It is gated on for the marks and off for the spaces by
+ * writing the compare register of the channel: the pulse of the duty cycle
+ * or zero (PWM mode 1 stays inactive). With the compare preload enabled
+ * the new value is taken on the next update event, so the gate always
+ * switches between two carrier periods and never cuts a pulse short. The
+ * timer is never stopped or restarted, and it raises no interrupts.
+ *
+ * Usage:
+ *
+ * struct ir_carrier carrier;
+ *
+ * ir_carrier_init(&carrier, &TIM3->CCR1, 84000000, 38000, 33);
+ * (configure the timer with a period of carrier.period clocks, PWM mode 1
+ *  with the compare preload enabled, and start it)
+ *
+ * ir_carrier_gate(&carrier, pulse.mark);           (on every phase boundary)
+ */
+
+#ifndef __IR_CARRIER_H__
+#define __IR_CARRIER_H__
+
+#include "ir.h"
+
+/*!< Longest carrier period in timer clocks (16-bit auto reload) */
+#define IR_CARRIER_PERIOD_MAX       65536
+
+/**
+ * @brief IR carrier descriptor
+ */
+struct ir_carrier {
+    volatile uint32_t *ccr;     /*!< Compare register of the PWM channel */
+    uint32_t period;            /*!< Carrier period in timer clocks (auto reload + 1) */
+    uint32_t pulse;             /*!< Compare value while the carrier is gated on */
+};
+
+/**
+ * @brief Compute the carrier timing and gate the carrier off
+ *
+ * @param carrier Carrier descriptor.
+ * @param ccr Compare register of the PWM channel.
+ * @param clk_hz Timer clock in Hz.
+ * @param freq_hz Carrier frequency in Hz.
+ * @param duty_pct Duty cycle in percent (1 - 99).
+ *
+ * @return ENO_ERROR, if the carrier is set up.
+ *         EFAIL, if the frequency or the duty cycle is out of range.
+ */
+int ir_carrier_init(struct ir_carrier *carrier, volatile uint32_t *ccr, uint32_t clk_hz,
+                    uint32_t freq_hz, unsigned duty_pct);
+
+/**
+ * @brief Gate the carrier on (mark) or off (space) from the next carrier
+ *        period on
+ */
+static inline void ir_carrier_gate(const struct ir_carrier *carrier, bool on)
+{
+    *carrier->ccr = on ? carrier->pulse : 0;
+}
+
+#endif /* __IR_CARRIER_H__ */
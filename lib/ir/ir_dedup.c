@@ -0,0 +1,376 @@
+/**
+ * @file  ir_dedup.c
+ *
+ * @brief IR receiver frame deduplication
+ *
+ * The frames let through are kept in a small history, the oldest one is
+ * replaced by the next. A new frame is compared with the whole history, so
+ * frames of different remotes seen at the same time by different receivers
+ * do not push each other out. Times are compared with unsigned subtraction,
+ * so the milli second clock can wrap around.
+ */
+
+#include "ir_dedup.h"
+#include "class.h"
+
+/**
+ * @brief Frame let through
+ */
+struct ir_dedup_entry {
+    uint8_t protocol;   /*!< One of enum ir_protocol_id */
+    uint8_t flags;      /*!< IR_FRAME_* flags */
+    uint16_t address;   /*!< Device address */
+    uint16_t command;   /*!< Key code */
+    uint8_t rx;         /*!< Receiver that decoded the frame */
+    bool valid;         /*!< The entry holds a frame */
+    uint32_t time;      /*!< Time the frame was let through */
+};
+
+/**
+ * @brief IR dedup descriptor
+ *
+ * Internal structure used to manage the dedup stage.
+ */
+struct ir_dedup_desc {
+    const struct class *class;
+    const struct ir_dedup_init *init;   /*!< Dedup init parameters */
+    struct ir_dedup_entry hist[IR_DEDUP_HISTORY]; /*!< Frames let through */
+    unsigned next;                      /*!< History entry replaced next */
+    unsigned suppressed;                /*!< Number of copies suppressed */
+};
+
+static bool ir_dedup_copy(const struct ir_dedup_entry *e, const struct ir_dedup_input *in,
+                          uint32_t window);
+static int ir_dedup_frame(struct ir_dedup_desc *desc, const struct ir_dedup_input *in);
+
+static void *ir_dedup_ctor(void *data);
+static void ir_dedup_dtor(void *self);
+static int ir_dedup_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Test if the frame is a copy, by another receiver, of the frame in
+ *        the history entry
+ */
+static bool ir_dedup_copy(const struct ir_dedup_entry *e, const struct ir_dedup_input *in,
+                          uint32_t window)
+{
+    const struct ir_frame *frame = in->frame;
+
+    return e->valid && e->rx != in->rx && in->now - e->time < window &&
+           e->protocol == frame->protocol && e->flags == frame->flags &&
+           e->address == frame->address && e->command == frame->command;
+}
+
+/**
+ * @brief Let the frame through, unless it is a copy
+ */
+static int ir_dedup_frame(struct ir_dedup_desc *desc, const struct ir_dedup_input *in)
+{
+    const struct ir_frame *frame = in->frame;
+    struct ir_dedup_entry *e;
+    unsigned i;
+
+    for (i = 0; i < IR_DEDUP_HISTORY; i++) {
+        if (ir_dedup_copy(&desc->hist[i], in, desc->init->window)) {
+            desc->suppressed++;
+            return ENO_ERROR;
+        }
+    }
+
+    e = &desc->hist[desc->next];
+    desc->next = (desc->next + 1) % IR_DEDUP_HISTORY;
+
+    e->protocol = frame->protocol;
+    e->flags = frame->flags;
+    e->address = frame->address;
+    e->command = frame->command;
+    e->rx = (uint8_t)in->rx;
+    e->valid = 1;
+    e->time = in->now;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Create and return an IR dedup descriptor
+ */
+static void *ir_dedup_ctor(void *data)
+{
+    const struct ir_dedup_init *init = data;
+    struct ir_dedup_desc *desc;
+    unsigned i;
+
+    if (!init)
+        return NULL;
+
+    desc = mm_alloc(sizeof(struct ir_dedup_desc));
+    if (desc) {
+        desc->class = ir_dedup;
+        desc->init = init;
+        for (i = 0; i < IR_DEDUP_HISTORY; i++)
+            desc->hist[i].valid = 0;
+        desc->next = 0;
+        desc->suppressed = 0;
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the IR dedup descriptor
+ */
+static void ir_dedup_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle IR dedup operations
+ */
+static int ir_dedup_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_dedup_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEDUP_FRAME:
+            ret = ir_dedup_frame(desc, (struct ir_dedup_input *)data);
+            break;
+        case IOCTL_IR_DEDUP_GET_SUPPRESSED:
+            *(unsigned *)data = desc->suppressed;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief IR dedup class
+ */
+static const struct class _ir_dedup = {
+    ir_dedup_ctor,
+    ir_dedup_dtor,
+    ir_dedup_ioctl,
+};
+
+const void *ir_dedup = &_ir_dedup;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "ir_rx.h"
+#include "ir_pingpong.h"
+#include "ir_nec.h"
+#include "ir_sirc.h"
+#include "ir_test.h"
+
+/* Number of receivers, each with its own buffers and receive engine */
+#define TEST_NRX            4
+#define TEST_FRAME_LEN      72
+#define TEST_GAP            40000
+#define TEST_WINDOW         20
+
+/**
+ * @brief Receiver instance
+ */
+struct test_rx {
+    struct ir_pulse buf[2 * TEST_FRAME_LEN];
+    struct ir_pingpong_init init;
+    void *pp;
+    void *rx;
+};
+
+/**
+ * @brief Transmission and the receivers that see it
+ */
+struct test_tx {
+    uint32_t time;      /* Time of the transmission (ms) */
+    uint8_t cmd;        /* NEC command, 0 - repeat code */
+    unsigned seen;      /* Mask of the receivers that see it */
+};
+
+static struct test_rx test_rx[TEST_NRX];
+static struct ir_dedup_init test_init = { TEST_WINDOW };
+
+static void test_level(struct test_rx *r, bool mark, uint32_t d);
+static int test_receive(struct test_rx *r, unsigned n, uint8_t cmd, struct ir_frame *frame);
+static int ir_dedup_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Capture ISR of a receiver
+ */
+static void test_level(struct test_rx *r, bool mark, uint32_t d)
+{
+    struct ir_pulse pulse;
+
+    pulse.mark = mark;
+    pulse.duration = d;
+    ioctl(r->pp, IOC(IOCTL_IR, IOCTL_IR_PP_EDGE), &pulse);
+}
+
+/**
+ * @brief Receive a NEC frame (address 0x04) or repeat code on receiver \a n
+ *        and decode it
+ *
+ * Every receiver stretches the marks by a different amount, as the receiver
+ * modules do at different signal strengths.
+ */
+static int test_receive(struct test_rx *r, unsigned n, uint8_t cmd, struct ir_frame *frame)
+{
+    struct ir_pulse pulse[IR_TEST_NEC_PULSES + 4];
+    uint32_t skew = 20 * n;
+    struct ir_pulse_seq seq;
+    unsigned i, npulses;
+    int ret;
+
+    /* The repeat code is what follows the frame and its gap */
+    npulses = ir_test_nec(pulse, IR_TEST_NEC_PULSES + 4, 0x04, cmd, cmd ? 0 : 1);
+    for (i = cmd ? 0 : IR_TEST_NEC_PULSES + 1; i < npulses; i++)
+        test_level(r, pulse[i].mark, pulse[i].mark ? pulse[i].duration + skew :
+                                                     pulse[i].duration - skew);
+    test_level(r, 0, TEST_GAP);
+
+    ret = ioctl(r->pp, IOC(IOCTL_IR, IOCTL_IR_PP_GET_FRAME), &seq);
+    if (ret != ENO_ERROR)
+        return ret;
+
+    ret = ioctl(r->rx, IOC(IOCTL_IR, IOCTL_IR_RX_FRAME), &seq);
+    if (ret == IR_DEC_FRAME_READY)
+        ret = ioctl(r->rx, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), frame);
+    else
+        ret = EFAIL;
+    ioctl(r->pp, IOC(IOCTL_IR, IOCTL_IR_PP_RELEASE), NULL);
+
+    return ret;
+}
+
+/**
+ * @brief Top level IR dedup test function
+ */
+static int ir_dedup_ss_test(void)
+{
+    /* A key held for two repeat codes, seen by all the receivers, then by
+     * some of them. Then two remotes at the same time, one seen by the
+     * front receivers and the other by the rear ones.
+     */
+    static const struct test_tx tx[] = {
+        {    0, 0x08, 0xF },
+        {  108, 0,    0x6 },
+        {  216, 0,    0x8 },
+        { 1000, 0x10, 0x3 },
+        { 1001, 0x11, 0xC },
+    };
+    static const uint8_t expect[] = { 0x08, 0x08, 0x08, 0x10, 0x11 };
+    struct ir_dedup_input in;
+    struct ir_frame frame;
+    unsigned i, n, passed = 0, suppressed;
+    void *dedup;
+    int err = EFAIL;
+
+    for (n = 0; n < TEST_NRX; n++) {
+        struct test_rx *r = &test_rx[n];
+
+        r->init.buf = r->buf;
+        r->init.size = TEST_FRAME_LEN;
+        r->init.timeout = TEST_GAP;
+        r->init.glitch = 0;
+        r->pp = new(ir_pingpong, &r->init);
+        TEST_AND_EXIT_ON_FAIL("ir_pingpong_new", r->pp != NULL);
+        r->rx = new(ir_rx, NULL);
+        TEST_AND_EXIT_ON_FAIL("ir_rx_new", r->rx != NULL);
+        TEST_AND_EXIT_ON_FAIL("add_nec",
+            (err = ioctl(r->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_nec, NULL))) == ENO_ERROR);
+        TEST_AND_EXIT_ON_FAIL("add_sirc",
+            (err = ioctl(r->rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_sirc, NULL))) == ENO_ERROR);
+        /* The value that ends the initial idle line is dropped */
+        test_level(r, 0, 1234);
+    }
+
+    err = EFAIL;
+    dedup = new(ir_dedup, &test_init);
+    TEST_AND_EXIT_ON_FAIL("ir_dedup_new", dedup != NULL);
+
+    /* The receivers decode one after the other, a milli second apart */
+    for (i = 0; i < sizeof(tx) / sizeof(tx[0]); i++) {
+        for (n = 0; n < TEST_NRX; n++) {
+            if (!(tx[i].seen & BIT(n)))
+                continue;
+
+            TEST_AND_EXIT_ON_FAIL("receive",
+                (err = test_receive(&test_rx[n], n, tx[i].cmd, &frame)) == ENO_ERROR);
+            TEST_AND_EXIT_ON_FAIL("frame",
+                frame.address == 0x04 && frame.command == expect[i] &&
+                !(frame.flags & IR_FRAME_REPEAT) == (tx[i].cmd != 0));
+
+            in.frame = &frame;
+            in.rx = n;
+            in.now = tx[i].time + n;
+            err = ioctl(dedup, IOC(IOCTL_IR, IOCTL_IR_DEDUP_FRAME), &in);
+            if (err == IR_DEC_FRAME_READY) {
+                printf("%-15s: rx %u at %4u ms: cmd 0x%02x%s\n", "frame", n, in.now,
+                       frame.command, (frame.flags & IR_FRAME_REPEAT) ? " (repeat)" : "");
+                TEST_AND_EXIT_ON_FAIL("order", passed == i);
+                passed++;
+            }
+        }
+        err = EFAIL;
+        TEST_AND_EXIT_ON_FAIL("one_per_tx", passed == i + 1);
+    }
+
+    /* The receiver that let a frame through is not suppressed */
+    in.rx = 2;
+    in.now++;
+    TEST_AND_EXIT_ON_FAIL("resend",
+        (err = ioctl(dedup, IOC(IOCTL_IR, IOCTL_IR_DEDUP_FRAME), &in)) == IR_DEC_FRAME_READY);
+
+    /* Nor is a copy after the window */
+    in.rx = 3;
+    in.now += TEST_WINDOW;
+    TEST_AND_EXIT_ON_FAIL("late",
+        (err = ioctl(dedup, IOC(IOCTL_IR, IOCTL_IR_DEDUP_FRAME), &in)) == IR_DEC_FRAME_READY);
+    in.rx = 0;
+    TEST_AND_EXIT_ON_FAIL("copy",
+        (err = ioctl(dedup, IOC(IOCTL_IR, IOCTL_IR_DEDUP_FRAME), &in)) == ENO_ERROR);
+
+    ioctl(dedup, IOC(IOCTL_IR, IOCTL_IR_DEDUP_GET_SUPPRESSED), &suppressed);
+    printf("%-15s: %u\n", "suppressed", suppressed);
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("suppressed", suppressed == 3 + 1 + 0 + 1 + 1 + 1);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR receiver frame deduplication\n");
+    if (ir_dedup_ss_test() != ENO_ERROR)
+        printf("IR dedup test failed\n");
+    else
+        printf("IR dedup test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,64 @@
+/**
+ * @file  ir_dedup.h
+ *
+ * @brief IR receiver frame deduplication
+ *
+ * A device with several receivers (e.g., front and rear) runs one capture
+ * path and one receive engine per receiver, and a remote pointed at the
+ * device is often seen by more than one of them. The frames of all the
+ * receivers are passed through the dedup stage, which lets the first copy
+ * of a frame through and suppresses the copies decoded by the other
+ * receivers within the dedup window, so one key press makes one event.
+ *
+ * A copy is the same protocol, address, command and flags (so the toggle
+ * bit and repeat codes are compared too). Frames from the receiver that let
+ * the frame through are never suppressed: a remote resends the frame while
+ * a key is held, and the key layer merges those. The window has to be
+ * shorter than the shortest resend period of the protocols (45 ms for
+ * SIRC) and longer than the decode latency between the receivers.
+ *
+ * Usage:
+ *
+ * struct ir_dedup_input in = { &frame, rx_index, now_ms };
+ *
+ * if (ioctl(dedup, IOC(IOCTL_IR, IOCTL_IR_DEDUP_FRAME), &in) == IR_DEC_FRAME_READY)
+ *     ioctl(key, IOC(IOCTL_IR, IOCTL_IR_KEY_FRAME), ...);
+ */
+
+#ifndef __IR_DEDUP_H__
+#define __IR_DEDUP_H__
+
+#include "ir.h"
+
+/**
+ * @brief IR dedup IOCTLs
+ */
+/*!< Pass a decoded frame (struct ir_dedup_input), returns IR_DEC_FRAME_READY
+ *   if the frame is let through, ENO_ERROR if it is a copy */
+#define IOCTL_IR_DEDUP_FRAME        40
+/*!< Number of copies suppressed (unsigned) */
+#define IOCTL_IR_DEDUP_GET_SUPPRESSED 41
+
+/*!< Number of frames let through that new frames are compared with */
+#define IR_DEDUP_HISTORY            4
+
+/**
+ * @brief Decoded frame, the receiver that decoded it and the time
+ */
+struct ir_dedup_input {
+    const struct ir_frame *frame;   /*!< Decoded frame */
+    unsigned rx;                    /*!< Receiver that decoded the frame */
+    uint32_t now;                   /*!< Time the frame was decoded (milli seconds) */
+};
+
+/**
+ * @brief IR dedup initializer
+ */
+struct ir_dedup_init {
+    uint32_t window;    /*!< Copies within this time are suppressed (milli seconds) */
+};
+
+/* IR dedup type definition */
+extern const void *ir_dedup;
+
+#endif /* __IR_DEDUP_H__ */
@@ -0,0 +1,453 @@
+/**
+ * @file  ir_envelope.c
+ *
+ * @brief IR transmit envelope for DMA playback
+ */
+
+#include "ir_envelope.h"
+
+static int ir_envelope_add(struct ir_envelope *env, uint32_t ticks, uint16_t ccr);
+
+/**
+ * @brief Add a phase, split in as many entries as the timer needs
+ */
+static int ir_envelope_add(struct ir_envelope *env, uint32_t ticks, uint16_t ccr)
+{
+    uint32_t n;
+
+    if (ticks < IR_ENVELOPE_TICKS_MIN)
+        ticks = IR_ENVELOPE_TICKS_MIN;
+
+    while (ticks) {
+        n = ticks;
+        if (n > IR_ENVELOPE_TICKS_MAX) {
+            /* Leave a remainder long enough for the compare event */
+            n = ticks - IR_ENVELOPE_TICKS_MAX < IR_ENVELOPE_TICKS_MIN ?
+                IR_ENVELOPE_TICKS_MAX - IR_ENVELOPE_TICKS_MIN : IR_ENVELOPE_TICKS_MAX;
+        }
+        if (env->len == env->size) {
+            /* Carried over to the next fill */
+            env->rest = ticks;
+            env->rest_ccr = ccr;
+            return EBUFFER_FULL;
+        }
+        env->arr[env->len] = (uint16_t)(n - 1);
+        env->ccr[env->len++] = ccr;
+        ticks -= n;
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int ir_envelope_add_pulse(struct ir_envelope *env, const struct ir_pulse *pulse,
+                          uint32_t clk_khz, const struct ir_carrier *carrier)
+{
+    return ir_envelope_add(env, (pulse->duration * clk_khz + 500) / 1000,
+                           pulse->mark ? (uint16_t)carrier->pulse : 0);
+}
+
+/**
+ */
+int ir_envelope_end(struct ir_envelope *env)
+{
+    /* The carrier is gated off when the pacing timer is stopped */
+    if (!env->len || env->ccr[env->len - 1])
+        return ir_envelope_add(env, IR_ENVELOPE_TICKS_MIN, 0);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int ir_envelope_build(struct ir_envelope *env, const struct ir_pulse *pulse, unsigned npulses,
+                      uint32_t clk_khz, const struct ir_carrier *carrier)
+{
+    unsigned i;
+    int err;
+
+    env->len = 0;
+    for (i = 0; i < npulses; i++) {
+        err = ir_envelope_add_pulse(env, &pulse[i], clk_khz, carrier);
+        if (err != ENO_ERROR)
+            return err;
+    }
+
+    return ir_envelope_end(env);
+}
+
+/**
+ */
+int ir_envelope_fill(struct ir_envelope *env, struct ir_tx *tx,
+                     const struct ir_carrier *carrier)
+{
+    struct ir_pulse phase;
+    uint32_t ticks = env->rest;
+    int err;
+
+    if (ticks) {
+        env->rest = 0;
+        err = ir_envelope_add(env, ticks, env->rest_ccr);
+        if (err != ENO_ERROR)
+            return err;
+    }
+
+    while (ir_tx_next(tx, &phase)) {
+        err = ir_envelope_add(env, phase.duration, phase.mark ? (uint16_t)carrier->pulse : 0);
+        if (err != ENO_ERROR)
+            return err;
+    }
+
+    /* The streams play on until they are stopped */
+    err = ir_envelope_end(env);
+    while (err == ENO_ERROR && env->len < env->size)
+        err = ir_envelope_add(env, IR_ENVELOPE_TICKS_MIN, 0);
+
+    return err;
+}
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "new.h"
+#include "ir_nec.h"
+#include "ir_test.h"
+
+#define TEST_CLK_KHZ        100
+#define TEST_US_PER_TICK    (1000 / TEST_CLK_KHZ)
+#define TEST_GAP            40000
+#define TEST_IDLE           1000000
+#define TEST_ROUND(us)      (((us) + TEST_US_PER_TICK / 2) / TEST_US_PER_TICK * TEST_US_PER_TICK)
+#define TEST_TICKS(us)      IR_TICKS(us, TEST_CLK_KHZ)
+/* Idle space, frame and repeat code */
+#define TEST_NPULSES        (IR_TEST_NEC_PULSES + 5)
+/* The idle space is split in two and an off phase ends the envelope */
+#define TEST_SIZE           (TEST_NPULSES + 2)
+/* Envelope the streams play in circles, shorter than a frame */
+#define TEST_RING           16
+#define TEST_HALF           (TEST_RING / 2)
+#define TEST_REPEATS        4
+/* Gate runs played, the streamed repeat codes make the most */
+#define TEST_NOUT           (TEST_SIZE + 4 * TEST_REPEATS)
+
+/**
+ * @brief Stub pacing timer and DMA streams
+ *
+ * An up counting timer with the auto reload preload enabled. On every
+ * update event the preload register is loaded into the counter and the
+ * update stream writes the next auto reload, one tick later the compare
+ * stream writes the carrier compare value.
+ */
+struct test_tim {
+    uint32_t arr;           /* Auto reload (preload) register */
+    uint32_t arr_active;    /* Auto reload shadow register */
+    uint32_t cnt;           /* Counter */
+    unsigned up;            /* Next entry of the update stream */
+    unsigned cc;            /* Next entry of the compare stream */
+};
+
+static struct ir_pulse test_pulse[TEST_NPULSES];
+static struct ir_pulse test_out[TEST_NOUT];
+static uint16_t test_arr[TEST_SIZE];
+static uint16_t test_ccr[TEST_SIZE];
+/* The update stream reads the first two entries again after the last ones */
+static uint16_t test_ring_arr[TEST_RING + 2];
+static uint16_t test_ring_ccr[TEST_RING];
+static uint32_t test_carrier_ccr;
+/* NEC timings in ticks of the pacing timer, the streamed frames use them */
+static const struct ir_timing test_nec_ticks = IR_NEC_TIMING(TEST_TICKS);
+
+static unsigned test_nec(uint8_t addr, uint8_t cmd);
+static bool test_gate(uint16_t on, unsigned *n);
+static unsigned test_play(const struct ir_envelope *env, uint16_t on);
+static int test_fill(struct ir_envelope *env, struct ir_tx *tx, unsigned half,
+                     const struct ir_carrier *carrier);
+static unsigned test_stream(struct ir_tx *tx, const struct ir_carrier *carrier);
+static int test_decode(unsigned from, unsigned nout, unsigned *nframes);
+static int ir_envelope_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Fill the pulses of a NEC frame and a repeat code, returns the
+ *        number of pulses
+ */
+static unsigned test_nec(uint8_t addr, uint8_t cmd)
+{
+    /* An idle space the timer can not play in one period first */
+    test_pulse[0].mark = 0;
+    test_pulse[0].duration = TEST_IDLE;
+
+    return 1 + ir_test_nec(test_pulse + 1, TEST_NPULSES - 1, addr, cmd, 1);
+}
+
+/**
+ * @brief Add a tick of the carrier gate to the runs in test_out, returns 0
+ *        if the gate is neither on nor off or the runs do not fit
+ */
+static bool test_gate(uint16_t on, unsigned *n)
+{
+    bool mark;
+
+    /* Only whole ticks of the timer, gated on or off */
+    if (test_carrier_ccr != on && test_carrier_ccr != 0)
+        return 0;
+    mark = test_carrier_ccr != 0;
+    if (!*n || test_out[*n - 1].mark != mark) {
+        if (*n == TEST_NOUT)
+            return 0;
+        test_out[*n].mark = mark;
+        test_out[(*n)++].duration = 0;
+    }
+    test_out[*n - 1].duration += TEST_US_PER_TICK;
+
+    return 1;
+}
+
+/**
+ * @brief Play the envelope on the stub timer, collecting the carrier gate
+ *        runs in test_out, returns the number of runs
+ *
+ * The software starts the timer with the first two auto reload values,
+ * the streams play the rest and the timer is stopped when the compare
+ * stream completes. No other software runs while the envelope plays.
+ */
+static unsigned test_play(const struct ir_envelope *env, uint16_t on)
+{
+    struct test_tim tim;
+    unsigned n = 0;
+
+    tim.arr_active = env->arr[0];
+    tim.arr = env->len > 1 ? env->arr[1] : env->arr[0];
+    tim.cnt = 0;
+    tim.up = 2;
+    tim.cc = 0;
+
+    for (;;) {
+        if (tim.cnt == 1) {
+            test_carrier_ccr = env->ccr[tim.cc++];
+            if (tim.cc == env->len)
+                break;
+        }
+
+        if (tim.cc && !test_gate(on, &n))
+            return 0;
+
+        if (tim.cnt++ == tim.arr_active) {
+            tim.cnt = 0;
+            tim.arr_active = tim.arr;
+            if (tim.up < env->len)
+                tim.arr = env->arr[tim.up++];
+        }
+    }
+
+    /* The last run ends when the timer is stopped */
+    test_out[n].mark = 0;
+    test_out[n++].duration = 0;
+
+    return n;
+}
+
+/**
+ * @brief Fill a half of the ring from the encoder, returns the result of
+ *        the fill
+ */
+static int test_fill(struct ir_envelope *env, struct ir_tx *tx, unsigned half,
+                     const struct ir_carrier *carrier)
+{
+    int err;
+
+    env->arr = test_ring_arr + half * TEST_HALF;
+    env->ccr = test_ring_ccr + half * TEST_HALF;
+    env->size = TEST_HALF;
+    env->len = 0;
+    err = ir_envelope_fill(env, tx, carrier);
+    test_ring_arr[TEST_RING] = test_ring_arr[0];
+    test_ring_arr[TEST_RING + 1] = test_ring_arr[1];
+
+    return err;
+}
+
+/**
+ * @brief Stream the frames of the encoder through the ring on the stub
+ *        timer, collecting the carrier gate runs in test_out, returns the
+ *        number of runs
+ *
+ * Both streams play the ring in circles, the update stream from the third
+ * entry on. Every time the compare stream has played a half, the half is
+ * filled again, the timer is stopped once the half that holds the end of
+ * the frames is played.
+ */
+static unsigned test_stream(struct ir_tx *tx, const struct ir_carrier *carrier)
+{
+    struct ir_envelope env;
+    struct test_tim tim;
+    unsigned half, end = 2, n = 0;
+
+    env.rest = 0;
+    for (half = 0; half < 2; half++) {
+        if (test_fill(&env, tx, half, carrier) == ENO_ERROR && end == 2)
+            end = half;
+    }
+
+    tim.arr_active = test_ring_arr[0];
+    tim.arr = test_ring_arr[1];
+    tim.cnt = 0;
+    tim.up = 2;
+    tim.cc = 0;
+
+    for (;;) {
+        if (tim.cnt == 1) {
+            test_carrier_ccr = test_ring_ccr[tim.cc++];
+            if (tim.cc % TEST_HALF == 0) {
+                half = tim.cc / TEST_HALF - 1;
+                tim.cc %= TEST_RING;
+                if (half == end)
+                    break;
+                if (test_fill(&env, tx, half, carrier) == ENO_ERROR && end == 2)
+                    end = half;
+            }
+        }
+
+        if ((tim.cc || n) && !test_gate((uint16_t)carrier->pulse, &n))
+            return 0;
+
+        if (tim.cnt++ == tim.arr_active) {
+            tim.cnt = 0;
+            tim.arr_active = tim.arr;
+            tim.arr = test_ring_arr[tim.up++];
+            if (tim.up == TEST_RING + 2)
+                tim.up = 2;
+        }
+    }
+
+    test_out[n].mark = 0;
+    test_out[n++].duration = 0;
+
+    return n;
+}
+
+/**
+ * @brief Decode the runs in test_out from \a from on, the frames must be a
+ *        NEC key (address 0x04, command 0x08) and its repeat codes
+ */
+static int test_decode(unsigned from, unsigned nout, unsigned *nframes)
+{
+    struct ir_frame frame;
+    void *nec;
+    unsigned i;
+    int res, err = EFAIL;
+
+    nec = new(ir_nec, NULL);
+    TEST_AND_EXIT_ON_FAIL("new", nec != NULL);
+    test_out[nout - 1].duration = TEST_GAP;
+    *nframes = 0;
+    for (i = from; i < nout; i++) {
+        res = ioctl(nec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &test_out[i]);
+        if (res != IR_DEC_FRAME_READY)
+            continue;
+        ioctl(nec, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame);
+        TEST_AND_EXIT_ON_FAIL("frame", frame.protocol == IR_PROTO_NEC &&
+                                       frame.address == 0x04 && frame.command == 0x08 &&
+                                       (*nframes == 0) == !(frame.flags & IR_FRAME_REPEAT));
+        (*nframes)++;
+    }
+    delete(nec);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Top level IR envelope test function
+ */
+static int ir_envelope_ss_test(void)
+{
+    struct ir_carrier carrier;
+    struct ir_envelope env;
+    struct ir_pulse phase;
+    struct ir_tx tx;
+    unsigned i, n, nout;
+    int err = EFAIL;
+
+    TEST_AND_EXIT_ON_FAIL("carrier",
+        (err = ir_carrier_init(&carrier, &test_carrier_ccr, 84000000, 38000, 33)) == ENO_ERROR);
+    n = test_nec(0x04, 0x08);
+
+    /* Too small for the frame */
+    env.arr = test_arr;
+    env.ccr = test_ccr;
+    env.size = n;
+    TEST_AND_EXIT_ON_FAIL("size",
+        (err = ir_envelope_build(&env, test_pulse, n, TEST_CLK_KHZ, &carrier)) == EBUFFER_FULL);
+
+    /* The idle space is split and an off phase is appended to the last mark */
+    env.size = TEST_SIZE;
+    TEST_AND_EXIT_ON_FAIL("build",
+        (err = ir_envelope_build(&env, test_pulse, n, TEST_CLK_KHZ, &carrier)) == ENO_ERROR);
+    printf("%-15s: %u pulses, %u phases\n", "envelope", n, env.len);
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("len", env.len == n + 2);
+    TEST_AND_EXIT_ON_FAIL("split", env.arr[0] == 65535 && env.arr[1] == 34463);
+    TEST_AND_EXIT_ON_FAIL("tail", env.ccr[env.len - 1] == 0 && env.ccr[env.len - 2] != 0);
+
+    /* Every pulse comes out with its length rounded to the tick, one tick late */
+    nout = test_play(&env, (uint16_t)carrier.pulse);
+    TEST_AND_EXIT_ON_FAIL("play", nout == n + 1);
+    for (i = 0; i < n; i++)
+        TEST_AND_EXIT_ON_FAIL("pulse", test_out[i].mark == test_pulse[i].mark &&
+                                       test_out[i].duration == TEST_ROUND(test_pulse[i].duration));
+
+    /* And decodes as the frame and the repeat code */
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(1, nout, &n)) == ENO_ERROR);
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("frames", n == 2);
+
+    /* Streamed through a ring shorter than a frame, every phase comes out,
+     * the last gap runs on until the timer is stopped */
+    ir_tx_send(&tx, &ir_proto_nec, &test_nec_ticks, 0x04, 0x08, TEST_REPEATS);
+    nout = test_stream(&tx, &carrier);
+    printf("%-15s: %u repeats, %u runs\n", "stream", TEST_REPEATS, nout);
+    ir_tx_send(&tx, &ir_proto_nec, &test_nec_ticks, 0x04, 0x08, TEST_REPEATS);
+    for (i = 0; ir_tx_next(&tx, &phase); i++)
+        TEST_AND_EXIT_ON_FAIL("stream_pulse", i + 2 < nout ?
+            test_out[i].mark == phase.mark &&
+            test_out[i].duration == phase.duration * TEST_US_PER_TICK :
+            i + 2 == nout && !test_out[i].mark &&
+            test_out[i].duration >= phase.duration * TEST_US_PER_TICK);
+    TEST_AND_EXIT_ON_FAIL("stream_len", i + 1 == nout);
+
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(0, nout, &n)) == ENO_ERROR);
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("stream_frames", n == 1 + TEST_REPEATS);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR envelope\n");
+    if (ir_envelope_ss_test() != ENO_ERROR)
+        printf("IR envelope test failed\n");
+    else
+        printf("IR envelope test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,136 @@
+/**
+ * @file  ir_envelope.h
+ *
+ * @brief IR transmit envelope for DMA playback
+ *
+ * Precomputes the phases (marks and spaces) of the frames to transmit as
+ * two sequences the DMA streams into the timers, so the CPU is only
+ * involved when the transmission starts and ends:
+ *
+ * - the auto reload of the pacing timer for every phase, written into the
+ *   (preloaded) auto reload register on every update event of the pacing
+ *   timer, so it takes effect one phase later;
+ * - the carrier compare value for every phase (see ir_carrier.h), written
+ *   into the carrier timer one tick after every update event of the pacing
+ *   timer (compare event on 1), so it takes effect on the next carrier
+ *   period.
+ *
+ * The first auto reload is loaded into the counter by an update generated
+ * by software and the second one is written into the preload register,
+ * the DMA plays the rest from the third one on. The carrier compare values
+ * are all played by the DMA. When the last one is written, the last phase
+ * (a space, the envelope always ends with the carrier gated off) has
+ * started and the pacing timer can be stopped.
+ *
+ * Phases longer than the 16-bit timer are split, phases shorter than two
+ * ticks are stretched, so the compare event on 1 happens in every phase.
+ *
+ * Frames of any length are streamed from an encoder (see ir_tx.h) through
+ * an envelope the streams play in circles: the half played last is filled
+ * while the other half plays. The encoder sends with the timings of the
+ * protocol in ticks of the pacing timer (see IR_TICKS), so a fill, which
+ * runs in the interrupt of the half played, only splits the phases. A
+ * phase that does not fit in the half is carried over to the next one, and
+ * once the encoder is done the rest of the half is filled with off phases.
+ *
+ * Usage:
+ *
+ * uint16_t arr[64], ccr[64];
+ * struct ir_envelope env = { arr, ccr, 64, 0, 0, 0 };
+ *
+ * ir_envelope_build(&env, pulse, npulses, 100, &carrier);
+ * (or, phase by phase from an encoder, env.len = 0,
+ *  ir_envelope_add_pulse(&env, &phase, 100, &carrier) for every phase,
+ *  then ir_envelope_end(&env))
+ * (pacing timer: ARR = arr[0], update, ARR = arr[1], CCR1 = 1,
+ *  DMA arr + 2 to ARR on update, DMA ccr to the carrier CCR on CC1,
+ *  start the counter and stop it when the carrier DMA completes)
+ *
+ * (streamed: tx started with timings in ticks, e.g. IR_NEC_TIMING(MY_TICKS),
+ *  env.arr, env.ccr and env.size set to a half, env.len = 0,
+ *  ir_envelope_fill(&env, &tx, &carrier) returns ENO_ERROR once the half
+ *  holds the end of the frames)
+ */
+
+#ifndef __IR_ENVELOPE_H__
+#define __IR_ENVELOPE_H__
+
+#include "ir.h"
+#include "ir_carrier.h"
+#include "ir_tx.h"
+
+/*!< Longest phase in ticks of the pacing timer (16-bit auto reload) */
+#define IR_ENVELOPE_TICKS_MAX       65536
+/*!< Shortest phase in ticks of the pacing timer */
+#define IR_ENVELOPE_TICKS_MIN       2
+
+/**
+ * @brief IR envelope
+ */
+struct ir_envelope {
+    uint16_t *arr;      /*!< Auto reload of the pacing timer for every phase */
+    uint16_t *ccr;      /*!< Carrier compare value for every phase */
+    unsigned size;      /*!< Number of entries in \a arr and \a ccr */
+    unsigned len;       /*!< Number of phases built */
+    uint32_t rest;      /*!< Ticks of the phase that did not fit, 0 if none */
+    uint16_t rest_ccr;  /*!< Carrier compare value of that phase */
+};
+
+/**
+ * @brief Build the envelope of the pulses
+ *
+ * @param env Envelope, \a arr, \a ccr and \a size set by the caller.
+ * @param pulse Pulses to transmit.
+ * @param npulses Number of pulses.
+ * @param clk_khz Counter clock of the pacing timer in kHz.
+ * @param carrier Carrier the envelope gates.
+ *
+ * @return ENO_ERROR, if the envelope is built.
+ *         EBUFFER_FULL, if the phases do not fit in the envelope.
+ */
+int ir_envelope_build(struct ir_envelope *env, const struct ir_pulse *pulse, unsigned npulses,
+                      uint32_t clk_khz, const struct ir_carrier *carrier);
+
+/**
+ * @brief Append a pulse to the envelope
+ *
+ * @param env Envelope, \a len set to 0 before the first pulse.
+ * @param pulse Pulse to transmit.
+ * @param clk_khz Counter clock of the pacing timer in kHz.
+ * @param carrier Carrier the envelope gates.
+ *
+ * @return ENO_ERROR, if the pulse is added.
+ *         EBUFFER_FULL, if the phases do not fit in the envelope.
+ */
+int ir_envelope_add_pulse(struct ir_envelope *env, const struct ir_pulse *pulse,
+                          uint32_t clk_khz, const struct ir_carrier *carrier);
+
+/**
+ * @brief End the envelope with the carrier gated off
+ *
+ * @param env Envelope.
+ *
+ * @return ENO_ERROR, if the envelope is complete.
+ *         EBUFFER_FULL, if the last phase does not fit in the envelope.
+ */
+int ir_envelope_end(struct ir_envelope *env);
+
+/**
+ * @brief Fill the envelope with the phases of an encoder
+ *
+ * The phase carried over from the last fill is added first. Once the
+ * encoder is done the envelope is ended and filled up with off phases.
+ *
+ * @param env Envelope, \a len set to 0 before every fill and \a rest set
+ *        to 0 before the first one.
+ * @param tx Encoder of the frames, with the timings in ticks of the pacing
+ *        timer.
+ * @param carrier Carrier the envelope gates.
+ *
+ * @return ENO_ERROR, if the envelope holds the end of the frames.
+ *         EBUFFER_FULL, if phases are left for the next fill.
+ */
+int ir_envelope_fill(struct ir_envelope *env, struct ir_tx *tx,
+                     const struct ir_carrier *carrier);
+
+#endif /* __IR_ENVELOPE_H__ */
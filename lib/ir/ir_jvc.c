@@ -0,0 +1,259 @@
+/**
+ * @file  ir_jvc.c
+ *
+ * @brief JVC protocol decoder
+ *
+ * The decoder is advanced once per captured pulse. After the last data bit
+ * the decoder waits for the stop mark and the gap that follows it, since
+ * only the gap tells a JVC frame apart from the start of a NEC frame.
+ */
+
+#include "ir_jvc.h"
+#include "ir_lut.h"
+#include "class.h"
+
+/* Pulse classes of the JVC timings */
+#define IR_JVC_MARK_SYM(c)                                              \
+    IR_LUT_SYM2(c, IR_JVC_BIT_MARK, IR_SYM_MARK_SHORT,                  \
+                IR_JVC_HDR_MARK, IR_SYM_MARK_HDR)
+#define IR_JVC_SPACE_SYM(c)                                             \
+    IR_LUT_GAP(c, IR_LUT_SYM3(c, IR_JVC_ZERO_SPACE, IR_SYM_SPACE_SHORT, \
+                              IR_JVC_ONE_SPACE, IR_SYM_SPACE_LONG,      \
+                              IR_JVC_HDR_SPACE, IR_SYM_SPACE_HDR))
+
+/**
+ * @brief Pulse classifier tables, indexed by the level of the pulse
+ */
+static const uint8_t ir_jvc_lut[2][IR_LUT_SIZE] = {
+    { IR_LUT_TABLE(IR_JVC_SPACE_SYM) },
+    { IR_LUT_TABLE(IR_JVC_MARK_SYM) },
+};
+
+/**
+ * @brief JVC decoder states
+ */
+enum ir_jvc_state {
+    JVC_IDLE,           /*!< Waiting for the header mark */
+    JVC_HDR_SPACE,      /*!< Waiting for the header space */
+    JVC_BIT_MARK,       /*!< Waiting for the mark of a data bit */
+    JVC_BIT_SPACE,      /*!< Waiting for the space of a data bit */
+    JVC_STOP_MARK,      /*!< Waiting for the stop mark */
+    JVC_GAP,            /*!< Waiting for the gap after the frame */
+};
+
+/**
+ * @brief JVC decoder descriptor
+ *
+ * Internal structure used to manage the decoder.
+ */
+struct ir_jvc_desc {
+    const struct class *class;
+    enum ir_jvc_state state;    /*!< Current decoder state */
+    unsigned nbits;             /*!< Number of data bits received */
+    uint32_t code;              /*!< Data bits received (LSB first) */
+    bool repeat;                /*!< Frame being received had no header */
+    struct ir_quality q;        /*!< Timing quality of the frame */
+    bool valid;                 /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;      /*!< Last decoded frame */
+};
+
+static void ir_jvc_reset(struct ir_jvc_desc *desc);
+static int ir_jvc_frame(struct ir_jvc_desc *desc);
+static int ir_jvc_edge(struct ir_jvc_desc *desc, const struct ir_pulse *pulse);
+
+static void *ir_jvc_ctor(void *data);
+static void ir_jvc_dtor(void *self);
+static int ir_jvc_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Reset the decoder state machine
+ *
+ * The last decoded frame is retained to accept the header-less repeats.
+ */
+static void ir_jvc_reset(struct ir_jvc_desc *desc)
+{
+    desc->state = JVC_IDLE;
+    desc->nbits = 0;
+    desc->code = 0;
+    desc->repeat = 0;
+    ir_quality_reset(&desc->q);
+}
+
+/**
+ * @brief Update the frame from the received code word
+ *
+ * @return IR_DEC_FRAME_READY
+ */
+static int ir_jvc_frame(struct ir_jvc_desc *desc)
+{
+    desc->frame.protocol = IR_PROTO_JVC;
+    desc->frame.flags = desc->repeat ? IR_FRAME_REPEAT : 0;
+    desc->frame.address = (uint8_t)desc->code;
+    desc->frame.command = (uint8_t)(desc->code >> 8);
+    desc->frame.confidence = ir_confidence(&desc->q, 0);
+    desc->valid = 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Advance the decoder by one pulse
+ *
+ * @param desc Decoder descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame.
+ *         ENO_ERROR, if the pulse was consumed, or if it is a header mark
+ *         that starts a new frame.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded and
+ *         does not start a new one.
+ */
+static int ir_jvc_edge(struct ir_jvc_desc *desc, const struct ir_pulse *pulse)
+{
+    uint32_t d = pulse->duration;
+    int sym = IR_LUT_SYM(ir_jvc_lut, pulse);
+    int ret = ENO_ERROR;
+
+    switch (desc->state) {
+    case JVC_IDLE:
+        break;
+    case JVC_HDR_SPACE:
+        if (sym == IR_SYM_SPACE_HDR) {
+            ir_quality_add(&desc->q, d, IR_JVC_HDR_SPACE);
+            desc->state = JVC_BIT_MARK;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case JVC_BIT_MARK:
+        if (sym == IR_SYM_MARK_SHORT) {
+            ir_quality_add(&desc->q, d, IR_JVC_BIT_MARK);
+            desc->state = JVC_BIT_SPACE;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case JVC_BIT_SPACE:
+        if (sym == IR_SYM_SPACE_SHORT) {
+            /* Zero bit, nothing to set in the code word */
+            ir_quality_add(&desc->q, d, IR_JVC_ZERO_SPACE);
+        } else if (sym == IR_SYM_SPACE_LONG) {
+            ir_quality_add(&desc->q, d, IR_JVC_ONE_SPACE);
+            desc->code |= (uint32_t)1 << desc->nbits;
+        } else {
+            ret = EIR_TIMING;
+            break;
+        }
+
+        desc->state = (++desc->nbits < IR_JVC_NBITS) ? JVC_BIT_MARK : JVC_STOP_MARK;
+        return ENO_ERROR;
+    case JVC_STOP_MARK:
+        if (sym == IR_SYM_MARK_SHORT) {
+            ir_quality_add(&desc->q, d, IR_JVC_BIT_MARK);
+            desc->state = JVC_GAP;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case JVC_GAP:
+        if (sym == IR_SYM_GAP) {
+            ret = ir_jvc_frame(desc);
+            ir_jvc_reset(desc);
+            return ret;
+        }
+        ret = EIR_TIMING;
+        break;
+    }
+
+    /* Look for the start of a new frame */
+    ir_jvc_reset(desc);
+    if (sym == IR_SYM_MARK_HDR) {
+        ir_quality_add(&desc->q, d, IR_JVC_HDR_MARK);
+        desc->state = JVC_HDR_SPACE;
+        ret = ENO_ERROR;
+    } else if (sym == IR_SYM_MARK_SHORT && desc->valid) {
+        /* Repeat frames start with the first data bit */
+        ir_quality_add(&desc->q, d, IR_JVC_BIT_MARK);
+        desc->state = JVC_BIT_SPACE;
+        desc->repeat = 1;
+        ret = ENO_ERROR;
+    } else if (pulse->mark) {
+        ret = EIR_TIMING;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a JVC decoder descriptor
+ */
+static void *ir_jvc_ctor(void *data)
+{
+    struct ir_jvc_desc *desc;
+
+    UNUSED(data);
+
+    desc = mm_alloc(sizeof(struct ir_jvc_desc));
+    if (desc) {
+        desc->class = ir_jvc;
+        desc->valid = 0;
+        ir_jvc_reset(desc);
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the JVC decoder descriptor
+ */
+static void ir_jvc_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle JVC decoder operations
+ */
+static int ir_jvc_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_jvc_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEC_EDGE:
+            ret = ir_jvc_edge(desc, (const struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_DEC_RESET:
+            ir_jvc_reset(desc);
+            desc->valid = 0;
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        case IOCTL_IR_DEC_GET_LUT:
+            *(const uint8_t (**)[IR_LUT_SIZE])data = ir_jvc_lut;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief JVC decoder class
+ */
+static const struct class _ir_jvc = {
+    ir_jvc_ctor,
+    ir_jvc_dtor,
+    ir_jvc_ioctl,
+};
+
+const void *ir_jvc = &_ir_jvc;
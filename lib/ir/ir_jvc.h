@@ -0,0 +1,50 @@
+/**
+ * @file  ir_jvc.h
+ *
+ * @brief JVC protocol decoder
+ *
+ * Streaming decoder for the JVC IR protocol.
+ *
+ * JVC frame (all bits are sent LSB first):
+ *   8.4 ms mark, 4.2 ms space, 8 bit address, 8 bit command, 526 us stop
+ *   mark.
+ *
+ * Held keys repeat the frame without the header. The JVC header is within
+ * the tolerance of the NEC header, so a JVC frame is only reported once
+ * the gap after the stop mark is seen. A NEC frame is ruled out as JVC as
+ * soon as its 17th bit arrives.
+ */
+
+#ifndef __IR_JVC_H__
+#define __IR_JVC_H__
+
+#include "ir.h"
+
+/**
+ * @brief JVC pulse durations in micro seconds
+ */
+#define IR_JVC_HDR_MARK         8440
+#define IR_JVC_HDR_SPACE        4220
+#define IR_JVC_BIT_MARK         526
+#define IR_JVC_ZERO_SPACE       526
+#define IR_JVC_ONE_SPACE        1583
+/*!< Frame start to the start of the next frame */
+#define IR_JVC_PERIOD           55000
+
+/*!< Carrier frequency in Hz */
+#define IR_JVC_CARRIER_HZ       38000
+
+/*!< Timing of the protocol descriptor (see ir_proto.h) */
+#define IR_JVC_TIMING(T)                                                \
+    { T(IR_JVC_HDR_MARK), T(IR_JVC_HDR_SPACE),                          \
+      T(IR_JVC_BIT_MARK), T(IR_JVC_ZERO_SPACE),                         \
+      T(IR_JVC_BIT_MARK), T(IR_JVC_ONE_SPACE),                          \
+      T(IR_JVC_BIT_MARK), T(0), T(IR_JVC_PERIOD) }
+
+/*!< Number of data bits in the JVC frame */
+#define IR_JVC_NBITS            16
+
+/* JVC decoder type definition */
+extern const void *ir_jvc;
+
+#endif /* __IR_JVC_H__ */
@@ -0,0 +1,327 @@
+/**
+ * @file  ir_key.c
+ *
+ * @brief IR key events
+ *
+ * The key layer keeps the key held down, the time of its last frame and
+ * the time of the next hold event. All times are compared with unsigned
+ * subtraction, so the milli second clock can wrap around.
+ */
+
+#include "ir_key.h"
+#include "class.h"
+
+/**
+ * @brief IR key layer descriptor
+ *
+ * Internal structure used to manage the key layer.
+ */
+struct ir_key_desc {
+    const struct class *class;
+    const struct ir_key_init *init; /*!< Key layer init parameters */
+    bool down;                  /*!< A key is held down */
+    bool holding;               /*!< Hold events are due for the key */
+    uint8_t toggle;             /*!< Toggle bit of the frame that pressed the key */
+    struct ir_key_event key;    /*!< Key held down */
+    uint32_t seen;              /*!< Time of the last frame of the key */
+    uint32_t hold;              /*!< Time of the next hold event */
+};
+
+static bool ir_key_due(uint32_t now, uint32_t t);
+static void ir_key_event(struct ir_key_desc *desc, uint8_t type);
+static void ir_key_tick(struct ir_key_desc *desc, uint32_t now);
+static void ir_key_frame(struct ir_key_desc *desc, const struct ir_key_input *in);
+
+static void *ir_key_ctor(void *data);
+static void ir_key_dtor(void *self);
+static int ir_key_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Test if the time \a t has come
+ */
+static bool ir_key_due(uint32_t now, uint32_t t)
+{
+    return now - t < BIT(31);
+}
+
+/**
+ * @brief Push an event for the key held down
+ */
+static void ir_key_event(struct ir_key_desc *desc, uint8_t type)
+{
+    desc->key.type = type;
+    ir_key_ring_push(desc->init->ring, desc->key);
+}
+
+/**
+ * @brief Raise the hold and release events due at \a now
+ *
+ * A late tick raises a single hold event, the missed ones are skipped.
+ */
+static void ir_key_tick(struct ir_key_desc *desc, uint32_t now)
+{
+    const struct ir_key_init *init = desc->init;
+
+    if (!desc->down)
+        return;
+
+    if (ir_key_due(now, desc->seen + init->release)) {
+        ir_key_event(desc, IR_KEY_RELEASE);
+        desc->down = 0;
+        return;
+    }
+
+    if (!desc->holding || !ir_key_due(now, desc->hold))
+        return;
+
+    desc->key.count++;
+    ir_key_event(desc, IR_KEY_HOLD);
+
+    desc->holding = init->hold_period != 0;
+    desc->hold += init->hold_period;
+    if (ir_key_due(now, desc->hold))
+        desc->hold = now + init->hold_period;
+}
+
+/**
+ * @brief Merge a frame into the key held down, or press a new key
+ */
+static void ir_key_frame(struct ir_key_desc *desc, const struct ir_key_input *in)
+{
+    const struct ir_frame *frame = in->frame;
+    uint8_t toggle = frame->flags & IR_FRAME_TOGGLE;
+
+    ir_key_tick(desc, in->now);
+
+    /* A repeat code carries no key, it continues whatever is held down */
+    if (desc->down &&
+        ((frame->flags & IR_FRAME_REPEAT) ||
+         (frame->protocol == desc->key.protocol && frame->address == desc->key.address &&
+          frame->command == desc->key.command && toggle == desc->toggle))) {
+        desc->seen = in->now;
+        return;
+    }
+
+    /* The frame that pressed the key was lost */
+    if (frame->flags & IR_FRAME_REPEAT)
+        return;
+
+    if (desc->down)
+        ir_key_event(desc, IR_KEY_RELEASE);
+
+    desc->down = 1;
+    desc->holding = 1;
+    desc->toggle = toggle;
+    desc->key.protocol = frame->protocol;
+    desc->key.address = frame->address;
+    desc->key.command = frame->command;
+    desc->key.count = 0;
+    desc->seen = in->now;
+    desc->hold = in->now + desc->init->hold_delay;
+    ir_key_event(desc, IR_KEY_PRESS);
+}
+
+/**
+ * @brief Create and return an IR key layer descriptor
+ */
+static void *ir_key_ctor(void *data)
+{
+    const struct ir_key_init *init = data;
+    struct ir_key_desc *desc;
+
+    if (!init || !init->ring)
+        return NULL;
+
+    desc = mm_alloc(sizeof(struct ir_key_desc));
+    if (desc) {
+        desc->class = ir_key;
+        desc->init = init;
+        desc->down = desc->holding = 0;
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the IR key layer descriptor
+ */
+static void ir_key_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle IR key layer operations
+ */
+static int ir_key_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_key_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_KEY_FRAME:
+            ir_key_frame(desc, (struct ir_key_input *)data);
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_KEY_TICK:
+            ir_key_tick(desc, *(uint32_t *)data);
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief IR key layer class
+ */
+static const struct class _ir_key = {
+    ir_key_ctor,
+    ir_key_dtor,
+    ir_key_ioctl,
+};
+
+const void *ir_key = &_ir_key;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+
+#define TEST_HOLD_DELAY     500
+#define TEST_HOLD_PERIOD    100
+#define TEST_RELEASE        150
+/* NEC repeat code period */
+#define TEST_REPEAT         108
+#define TEST_TICK           10
+
+static struct ir_key_ring test_ring;
+static struct ir_key_init test_init = {
+    &test_ring, TEST_HOLD_DELAY, TEST_HOLD_PERIOD, TEST_RELEASE,
+};
+
+static void test_frame(void *key, uint8_t proto, uint16_t cmd, uint8_t flags, uint32_t now);
+static int test_event(uint8_t type, uint16_t cmd, uint16_t count);
+static int ir_key_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err;                                     \
+        }                                                   \
+    } while (0)
+
+/**
+ */
+static void test_frame(void *key, uint8_t proto, uint16_t cmd, uint8_t flags, uint32_t now)
+{
+    struct ir_frame frame = { 0, 0, 0x04, 0, 100 };
+    struct ir_key_input in;
+
+    frame.protocol = proto;
+    frame.command = cmd;
+    frame.flags = flags;
+    in.frame = &frame;
+    in.now = now;
+    ioctl(key, IOC(IOCTL_IR, IOCTL_IR_KEY_FRAME), &in);
+}
+
+/**
+ * @brief Pop the next event and check it
+ */
+static int test_event(uint8_t type, uint16_t cmd, uint16_t count)
+{
+    struct ir_key_event event;
+
+    if (ir_key_ring_pop(&test_ring, &event) != ENO_ERROR)
+        return EBUFFER_EMPTY;
+
+    printf("%-15s: type %u proto %u addr 0x%04x cmd 0x%02x count %u\n", "event",
+           event.type, event.protocol, event.address, event.command, event.count);
+
+    return (event.type == type && event.command == cmd && event.count == count &&
+            event.address == 0x04) ? ENO_ERROR : EFAIL;
+}
+
+/**
+ * @brief Top level IR key layer test function
+ */
+static int ir_key_ss_test(void)
+{
+    uint32_t start, now;
+    unsigned i;
+    void *key;
+    int err = EFAIL;
+
+    ir_key_ring_init(&test_ring);
+    key = new(ir_key, &test_init);
+    TEST_AND_EXIT_ON_FAIL("ir_key_new", key != NULL);
+
+    /* A NEC key held for 9 repeat codes: one press, hold events at the
+     * auto repeat rate until the release timeout after the last repeat
+     * (972 + 150 ms), one release
+     */
+    start = 0xfffffe00;
+    test_frame(key, IR_PROTO_NEC, 0x08, 0, start);
+    for (i = 1; i <= 1300; i++) {
+        now = start + i;
+        if (i % TEST_REPEAT == 0 && i <= 9 * TEST_REPEAT)
+            test_frame(key, IR_PROTO_NEC, 0x08, IR_FRAME_REPEAT, now);
+        if (i % TEST_TICK == 0)
+            ioctl(key, IOC(IOCTL_IR, IOCTL_IR_KEY_TICK), &now);
+    }
+    TEST_AND_EXIT_ON_FAIL("press", (err = test_event(IR_KEY_PRESS, 0x08, 0)) == ENO_ERROR);
+    for (i = 1; i <= 7; i++)
+        TEST_AND_EXIT_ON_FAIL("hold", (err = test_event(IR_KEY_HOLD, 0x08, (uint16_t)i)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("release", (err = test_event(IR_KEY_RELEASE, 0x08, 7)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("empty", (err = test_event(IR_KEY_PRESS, 0, 0)) == EBUFFER_EMPTY);
+
+    /* A repeat code without a press is ignored */
+    now = 2000;
+    test_frame(key, IR_PROTO_NEC, 0x08, IR_FRAME_REPEAT, now);
+    TEST_AND_EXIT_ON_FAIL("repeat", (err = test_event(IR_KEY_PRESS, 0, 0)) == EBUFFER_EMPTY);
+
+    /* RC5 resends the frame while the key is held, a new press of the same
+     * key flips the toggle bit and another key releases the first one
+     */
+    test_frame(key, IR_PROTO_RC5, 0x10, 0, now);
+    test_frame(key, IR_PROTO_RC5, 0x10, 0, now + 114);
+    test_frame(key, IR_PROTO_RC5, 0x10, IR_FRAME_TOGGLE, now + 228);
+    test_frame(key, IR_PROTO_RC5, 0x11, IR_FRAME_TOGGLE, now + 342);
+    now += 342 + TEST_RELEASE;
+    ioctl(key, IOC(IOCTL_IR, IOCTL_IR_KEY_TICK), &now);
+    TEST_AND_EXIT_ON_FAIL("press", (err = test_event(IR_KEY_PRESS, 0x10, 0)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("release", (err = test_event(IR_KEY_RELEASE, 0x10, 0)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("press", (err = test_event(IR_KEY_PRESS, 0x10, 0)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("release", (err = test_event(IR_KEY_RELEASE, 0x10, 0)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("press", (err = test_event(IR_KEY_PRESS, 0x11, 0)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("release", (err = test_event(IR_KEY_RELEASE, 0x11, 0)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("empty", (err = test_event(IR_KEY_PRESS, 0, 0)) == EBUFFER_EMPTY);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR key events\n");
+    if (ir_key_ss_test() != ENO_ERROR)
+        printf("IR key event test failed\n");
+    else
+        printf("IR key event test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,90 @@
+/**
+ * @file  ir_key.h
+ *
+ * @brief IR key events
+ *
+ * Turns the decoded frames into key events. A remote sends a frame (or,
+ * for NEC, a repeat code) about every 100 ms while a key is held down. The
+ * key layer merges all of them into one press, hold events at a fixed
+ * auto repeat rate, and one release once the frames stop, so the consumer
+ * sees one event per action and not one per frame.
+ *
+ * A frame continues the key held down if it is a repeat code, or the same
+ * key with the same toggle bit (protocols that resend the whole frame).
+ * Any other frame releases the key held down and presses the new one. The
+ * key is released when no frame came for the release timeout.
+ *
+ * The events are pushed on a ring provided by the caller. The hold and
+ * release events are raised by the clock, so the clock has to be advanced
+ * regularly (every few ms) even when no frames are received:
+ *
+ * struct ir_key_input in = { &frame, now_ms };
+ *
+ * ioctl(key, IOC(IOCTL_IR, IOCTL_IR_KEY_FRAME), &in);    (on every frame)
+ * ioctl(key, IOC(IOCTL_IR, IOCTL_IR_KEY_TICK), &now_ms);  (main loop)
+ *
+ * while (ir_key_ring_pop(&ring, &event) == ENO_ERROR)
+ *     ...
+ */
+
+#ifndef __IR_KEY_H__
+#define __IR_KEY_H__
+
+#include "ir.h"
+#include "ring.h"
+
+/**
+ * @brief IR key IOCTLs
+ */
+/*!< Feed a decoded frame (struct ir_key_input) */
+#define IOCTL_IR_KEY_FRAME          32
+/*!< Advance the clock (uint32_t, milli seconds) */
+#define IOCTL_IR_KEY_TICK           33
+
+/*!< Number of events in the event ring */
+#define IR_KEY_RING_LEN             16
+
+/**
+ * @brief Key event types
+ */
+enum ir_key_event_type {
+    IR_KEY_PRESS,
+    IR_KEY_HOLD,
+    IR_KEY_RELEASE,
+};
+
+/**
+ * @brief Key event
+ */
+struct ir_key_event {
+    uint8_t type;       /*!< One of enum ir_key_event_type */
+    uint8_t protocol;   /*!< One of enum ir_protocol_id */
+    uint16_t address;   /*!< Device address */
+    uint16_t command;   /*!< Key code */
+    uint16_t count;     /*!< Hold events since the press (1 for the first hold) */
+};
+
+DEFINE_RING(ir_key_ring, struct ir_key_event, IR_KEY_RING_LEN)
+
+/**
+ * @brief Decoded frame and the time it was received
+ */
+struct ir_key_input {
+    const struct ir_frame *frame;   /*!< Decoded frame */
+    uint32_t now;                   /*!< Time the frame was received (milli seconds) */
+};
+
+/**
+ * @brief IR key layer initializer
+ */
+struct ir_key_init {
+    struct ir_key_ring *ring;   /*!< Ring the events are pushed on */
+    uint32_t hold_delay;        /*!< Time from the press to the first hold event (ms) */
+    uint32_t hold_period;       /*!< Time between hold events (ms), 0 - only one hold event */
+    uint32_t release;           /*!< Time after the last frame that releases the key (ms) */
+};
+
+/* IR key layer type definition */
+extern const void *ir_key;
+
+#endif /* __IR_KEY_H__ */
@@ -0,0 +1,130 @@
+/**
+ * @file  ir_lut.h
+ *
+ * @brief IR pulse classifier lookup tables
+ *
+ * Each decoder classifies a pulse with one shift and one load: the pulse
+ * duration is quantized into IR_LUT_BUCKET wide buckets and the bucket
+ * indexes a table that holds the symbol class of the pulse. A decoder has
+ * one table for the spaces and one for the marks, so the class also tells
+ * the level of the pulse.
+ *
+ * The tables are generated by the preprocessor from the timing definitions
+ * of the protocol. A bucket is classified by its center: it belongs to the
+ * nominal duration closest to the center, provided the center is within
+ * IR_TOLERANCE_PCT of it.
+ *
+ * Usage:
+ *
+ * #define MY_SPACE_SYM(c)  IR_LUT_GAP(c, IR_LUT_SYM3(c, 560, IR_SYM_SPACE_SHORT,
+ *                                            1690, IR_SYM_SPACE_LONG,
+ *                                            4500, IR_SYM_SPACE_HDR))
+ * static const uint8_t my_lut[2][IR_LUT_SIZE] = {
+ *     { IR_LUT_TABLE(MY_SPACE_SYM) },
+ *     { IR_LUT_TABLE(MY_MARK_SYM) },
+ * };
+ *
+ * switch (IR_LUT_SYM(my_lut, pulse)) { ... }
+ */
+
+#ifndef __IR_LUT_H__
+#define __IR_LUT_H__
+
+#include "ir.h"
+
+/*!< Bucket width is 1 << IR_LUT_SHIFT micro seconds */
+#define IR_LUT_SHIFT                6
+#define IR_LUT_BUCKET               (1UL << IR_LUT_SHIFT)
+/*!< Number of buckets, pulses longer than the table are marks too long to
+ *   classify or spaces that end a frame */
+#define IR_LUT_SIZE                 256
+#define IR_LUT_LIMIT                (IR_LUT_SIZE * IR_LUT_BUCKET)
+
+/**
+ * @brief Pulse symbol classes
+ *
+ * For the classes that are multiples of a time unit (Manchester coded
+ * protocols), the number of units is IR_SYM_UNITS(sym). It is 0 for all
+ * the other classes.
+ */
+enum ir_sym {
+    IR_SYM_INVALID      = 0x00, /*!< Does not fit any timing window */
+    IR_SYM_MARK_SHORT   = 0x01, /*!< Bit mark, one time unit */
+    IR_SYM_MARK_LONG    = 0x02, /*!< Long bit mark, two time units */
+    IR_SYM_MARK_LONGER  = 0x03, /*!< Three time units */
+    IR_SYM_MARK_HDR     = 0x04, /*!< Header (leader) mark */
+    IR_SYM_SPACE_SHORT  = 0x11, /*!< Bit space, one time unit */
+    IR_SYM_SPACE_LONG   = 0x12, /*!< Long bit space, two time units */
+    IR_SYM_SPACE_LONGER = 0x13, /*!< Three time units */
+    IR_SYM_SPACE_HDR    = 0x14, /*!< Header (leader) space */
+    IR_SYM_SPACE_RPT    = 0x18, /*!< Repeat code space */
+    IR_SYM_GAP          = 0x1c, /*!< Space that ends a frame */
+};
+
+#define IR_SYM_UNITS(sym)           ((unsigned)(sym) & 0x3)
+
+/**
+ * @brief Classify a pulse with the table of a decoder
+ */
+#define IR_LUT_SYM(lut, pulse)                                          \
+    ((pulse)->duration < IR_LUT_LIMIT ?                                 \
+     (lut)[(pulse)->mark][(pulse)->duration >> IR_LUT_SHIFT] :          \
+     ((pulse)->mark ? IR_SYM_INVALID : IR_SYM_GAP))
+
+/**
+ * @brief Table generator
+ *
+ * IR_LUT_TABLE(M) expands to the initializer of a table, M(c) being the
+ * class of the bucket centered at c.
+ */
+#define IR_LUT_CENTER(i)            (((i) << IR_LUT_SHIFT) + IR_LUT_BUCKET / 2)
+
+#define IR_LUT_4(M, i)                                                  \
+    M(IR_LUT_CENTER(i)), M(IR_LUT_CENTER((i) + 1)),                     \
+    M(IR_LUT_CENTER((i) + 2)), M(IR_LUT_CENTER((i) + 3))
+#define IR_LUT_16(M, i)                                                 \
+    IR_LUT_4(M, i), IR_LUT_4(M, (i) + 4),                               \
+    IR_LUT_4(M, (i) + 8), IR_LUT_4(M, (i) + 12)
+#define IR_LUT_64(M, i)                                                 \
+    IR_LUT_16(M, i), IR_LUT_16(M, (i) + 16),                            \
+    IR_LUT_16(M, (i) + 32), IR_LUT_16(M, (i) + 48)
+#define IR_LUT_TABLE(M)                                                 \
+    IR_LUT_64(M, 0UL), IR_LUT_64(M, 64UL),                              \
+    IR_LUT_64(M, 128UL), IR_LUT_64(M, 192UL)
+
+/*!< Upper bound of the last window */
+#define IR_LUT_INF                  (2 * IR_LUT_LIMIT)
+
+/**
+ * @brief Test if c is within tolerance of nominal and closer to it than to
+ *        the neighbouring nominals \a prev and \a next
+ */
+#define IR_LUT_WIN(c, prev, nominal, next)                              \
+    (IR_MATCH(c, nominal) &&                                            \
+     2 * (c) >= (prev) + (nominal) && 2 * (c) < (nominal) + (next))
+
+/**
+ * @brief Class of c among up to five nominals in ascending order
+ */
+#define IR_LUT_SYM5(c, n1, s1, n2, s2, n3, s3, n4, s4, n5, s5)          \
+    (IR_LUT_WIN(c, 0, n1, n2) ? (s1) :                                  \
+     IR_LUT_WIN(c, n1, n2, n3) ? (s2) :                                 \
+     IR_LUT_WIN(c, n2, n3, n4) ? (s3) :                                 \
+     IR_LUT_WIN(c, n3, n4, n5) ? (s4) :                                 \
+     IR_LUT_WIN(c, n4, n5, IR_LUT_INF) ? (s5) : IR_SYM_INVALID)
+
+#define IR_LUT_SYM4(c, n1, s1, n2, s2, n3, s3, n4, s4)                  \
+    IR_LUT_SYM5(c, n1, s1, n2, s2, n3, s3, n4, s4, IR_LUT_INF, IR_SYM_INVALID)
+#define IR_LUT_SYM3(c, n1, s1, n2, s2, n3, s3)                          \
+    IR_LUT_SYM4(c, n1, s1, n2, s2, n3, s3, IR_LUT_INF, IR_SYM_INVALID)
+#define IR_LUT_SYM2(c, n1, s1, n2, s2)                                  \
+    IR_LUT_SYM3(c, n1, s1, n2, s2, IR_LUT_INF, IR_SYM_INVALID)
+#define IR_LUT_SYM1(c, n1, s1)                                          \
+    IR_LUT_SYM2(c, n1, s1, IR_LUT_INF, IR_SYM_INVALID)
+
+/**
+ * @brief Class of a space: the gap, if c is at least IR_GAP_MIN
+ */
+#define IR_LUT_GAP(c, sym)          ((c) >= IR_GAP_MIN ? IR_SYM_GAP : (sym))
+
+#endif /* __IR_LUT_H__ */
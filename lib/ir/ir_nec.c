@@ -0,0 +1,455 @@
+/**
+ * @file  ir_nec.c
+ *
+ * @brief NEC protocol decoder
+ *
+ * The decoder is a state machine that is advanced once per captured pulse.
+ * Data bits are shifted into a 32 bit code word as they arrive, so no pulse
+ * needs to be stored and there is no second pass over the captured data.
+ * A pulse that does not match the expected timing resets the decoder; the
+ * same pulse is then checked for a header mark so that a frame following a
+ * corrupted one is not lost.
+ */
+
+#include "ir_nec.h"
+#include "ir_lut.h"
+#include "class.h"
+
+/* Pulse classes of the NEC timings */
+#define IR_NEC_MARK_SYM(c)                                              \
+    IR_LUT_SYM2(c, IR_NEC_BIT_MARK, IR_SYM_MARK_SHORT,                  \
+                IR_NEC_HDR_MARK, IR_SYM_MARK_HDR)
+#define IR_NEC_SPACE_SYM(c)                                             \
+    IR_LUT_GAP(c, IR_LUT_SYM4(c, IR_NEC_ZERO_SPACE, IR_SYM_SPACE_SHORT, \
+                              IR_NEC_ONE_SPACE, IR_SYM_SPACE_LONG,      \
+                              IR_NEC_RPT_SPACE, IR_SYM_SPACE_RPT,       \
+                              IR_NEC_HDR_SPACE, IR_SYM_SPACE_HDR))
+
+/**
+ * @brief Pulse classifier tables, indexed by the level of the pulse
+ */
+static const uint8_t ir_nec_lut[2][IR_LUT_SIZE] = {
+    { IR_LUT_TABLE(IR_NEC_SPACE_SYM) },
+    { IR_LUT_TABLE(IR_NEC_MARK_SYM) },
+};
+
+/**
+ * @brief NEC decoder states
+ */
+enum ir_nec_state {
+    NEC_IDLE,           /*!< Waiting for the header mark */
+    NEC_HDR_SPACE,      /*!< Waiting for the header (or repeat) space */
+    NEC_BIT_MARK,       /*!< Waiting for the mark of a data bit */
+    NEC_BIT_SPACE,      /*!< Waiting for the space of a data bit */
+    NEC_RPT_MARK,       /*!< Waiting for the stop mark of the repeat code */
+};
+
+/**
+ * @brief NEC decoder descriptor
+ *
+ * Internal structure used to manage the decoder.
+ */
+struct ir_nec_desc {
+    const struct class *class;
+    enum ir_nec_state state;    /*!< Current decoder state */
+    unsigned nbits;             /*!< Number of data bits received */
+    uint32_t code;              /*!< Data bits received (LSB first) */
+    struct ir_quality q;        /*!< Timing quality of the frame */
+    bool valid;                 /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;      /*!< Last decoded frame */
+};
+
+static void ir_nec_reset(struct ir_nec_desc *desc);
+static int ir_nec_frame(struct ir_nec_desc *desc);
+static int ir_nec_edge(struct ir_nec_desc *desc, const struct ir_pulse *pulse);
+
+static void *ir_nec_ctor(void *data);
+static void ir_nec_dtor(void *self);
+static int ir_nec_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Reset the decoder state machine
+ *
+ * The last decoded frame is retained to decode the subsequent repeat codes.
+ */
+static void ir_nec_reset(struct ir_nec_desc *desc)
+{
+    desc->state = NEC_IDLE;
+    desc->nbits = 0;
+    desc->code = 0;
+    ir_quality_reset(&desc->q);
+}
+
+/**
+ * @brief Validate the received code word and update the frame
+ *
+ * @return IR_DEC_FRAME_READY, if the code word is a valid NEC frame.
+ *         EIR_CHECKSUM, if the command does not match the inverted command.
+ */
+static int ir_nec_frame(struct ir_nec_desc *desc)
+{
+    uint32_t code = desc->code;
+    uint8_t cmd = (uint8_t)(code >> 16);
+    uint8_t ncmd = (uint8_t)(code >> 24);
+    uint8_t addr = (uint8_t)code;
+    uint8_t naddr = (uint8_t)(code >> 8);
+
+    if ((uint8_t)(cmd ^ ncmd) != 0xff) {
+        desc->valid = 0;
+        return EIR_CHECKSUM;
+    }
+
+    desc->frame.protocol = IR_PROTO_NEC;
+    desc->frame.flags = 0;
+    desc->frame.command = cmd;
+    desc->frame.confidence = ir_confidence(&desc->q, 1);
+
+    /* Address without the inverted copy is an extended (16 bit) address */
+    if ((uint8_t)(addr ^ naddr) == 0xff)
+        desc->frame.address = addr;
+    else
+        desc->frame.address = (uint16_t)code;
+
+    desc->valid = 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Advance the decoder by one pulse
+ *
+ * @param desc Decoder descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame or repeat code.
+ *         ENO_ERROR, if the pulse was consumed, or if it is a header mark
+ *         that starts a new frame.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded and
+ *         does not start a new one.
+ *         EIR_CHECKSUM, if the frame failed the integrity check.
+ */
+static int ir_nec_edge(struct ir_nec_desc *desc, const struct ir_pulse *pulse)
+{
+    uint32_t d = pulse->duration;
+    int sym = IR_LUT_SYM(ir_nec_lut, pulse);
+    int ret = ENO_ERROR;
+
+    switch (desc->state) {
+    case NEC_IDLE:
+        break;
+    case NEC_HDR_SPACE:
+        if (sym == IR_SYM_SPACE_HDR) {
+            ir_quality_add(&desc->q, d, IR_NEC_HDR_SPACE);
+            desc->state = NEC_BIT_MARK;
+            return ENO_ERROR;
+        } else if (sym == IR_SYM_SPACE_RPT) {
+            ir_quality_add(&desc->q, d, IR_NEC_RPT_SPACE);
+            desc->state = NEC_RPT_MARK;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case NEC_BIT_MARK:
+        if (sym == IR_SYM_MARK_SHORT) {
+            ir_quality_add(&desc->q, d, IR_NEC_BIT_MARK);
+            desc->state = NEC_BIT_SPACE;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case NEC_BIT_SPACE:
+        if (sym == IR_SYM_SPACE_SHORT) {
+            /* Zero bit, nothing to set in the code word */
+            ir_quality_add(&desc->q, d, IR_NEC_ZERO_SPACE);
+        } else if (sym == IR_SYM_SPACE_LONG) {
+            ir_quality_add(&desc->q, d, IR_NEC_ONE_SPACE);
+            desc->code |= (uint32_t)1 << desc->nbits;
+        } else {
+            ret = EIR_TIMING;
+            break;
+        }
+
+        if (++desc->nbits < IR_NEC_NBITS) {
+            desc->state = NEC_BIT_MARK;
+            return ENO_ERROR;
+        }
+
+        /* Last bit landed, the trailing stop mark is not waited for */
+        ret = ir_nec_frame(desc);
+        ir_nec_reset(desc);
+        return ret;
+    case NEC_RPT_MARK:
+        if (sym == IR_SYM_MARK_SHORT) {
+            if (!desc->valid) {
+                ir_nec_reset(desc);
+                return ENO_ERROR;
+            }
+            ir_quality_add(&desc->q, d, IR_NEC_BIT_MARK);
+            desc->frame.flags |= IR_FRAME_REPEAT;
+            desc->frame.confidence = ir_confidence(&desc->q, 1);
+            ir_nec_reset(desc);
+            return IR_DEC_FRAME_READY;
+        }
+        ret = EIR_TIMING;
+        break;
+    }
+
+    /* Look for the start of a new frame */
+    ir_nec_reset(desc);
+    if (sym == IR_SYM_MARK_HDR) {
+        ir_quality_add(&desc->q, d, IR_NEC_HDR_MARK);
+        desc->state = NEC_HDR_SPACE;
+        ret = ENO_ERROR;
+    } else if (pulse->mark) {
+        ret = EIR_TIMING;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a NEC decoder descriptor
+ */
+static void *ir_nec_ctor(void *data)
+{
+    struct ir_nec_desc *desc;
+
+    UNUSED(data);
+
+    desc = mm_alloc(sizeof(struct ir_nec_desc));
+    if (desc) {
+        desc->class = ir_nec;
+        desc->valid = 0;
+        ir_nec_reset(desc);
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the NEC decoder descriptor
+ */
+static void ir_nec_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle NEC decoder operations
+ */
+static int ir_nec_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_nec_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEC_EDGE:
+            ret = ir_nec_edge(desc, (const struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_DEC_RESET:
+            ir_nec_reset(desc);
+            desc->valid = 0;
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        case IOCTL_IR_DEC_GET_LUT:
+            *(const uint8_t (**)[IR_LUT_SIZE])data = ir_nec_lut;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief NEC decoder class
+ */
+static const struct class _ir_nec = {
+    ir_nec_ctor,
+    ir_nec_dtor,
+    ir_nec_ioctl,
+};
+
+const void *ir_nec = &_ir_nec;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+
+/*
+ * Edges recorded from a TSOP receiver on TIM5 CH2 (reset on edge). The
+ * first entry is the idle time before the first falling edge and is a
+ * space. Entries alternate between space and mark from there on.
+ */
+
+/* Key P3 (address 0x4000, command 0x41) followed by two repeat codes */
+static const uint32_t nec_rec_key_p3[] = {
+    23817,  9002,  4458,   612,   556,   571,   494,   574,
+      516,   636,   555,   626,   535,   566,   551,   617,
+      509,   570,   532,   573,   492,   616,   555,   634,
+      547,   590,   482,   642,   488,   569,   489,   636,
+     1637,   568,   534,   567,  1616,   579,   525,   615,
+      544,   631,   547,   635,   523,   633,   539,   575,
+     1613,   635,   538,   609,   550,   632,  1679,   634,
+     1680,   641,  1661,   625,  1619,   616,  1647,   621,
+      488,   620,  1641,   600, 39820,  8983,  2216,   593,
+    96110,  8940,  2317,   600,
+};
+
+/*
+ * Frame corrupted by a spike after 9 bits, followed by a clean frame from
+ * a remote using 8 bit addressing (address 0x10, command 0x16).
+ */
+static const uint32_t nec_rec_glitch[] = {
+    61002,  9054,  4546,   605,   505,   598,   485,   571,
+      547,   627,   509,   583,   519,   581,   500,   615,
+      557,   571,   491,   635,   522,   143, 18044,  8958,
+     4441,   584,   543,   591,   533,   563,   500,   637,
+      539,   595,  1651,   562,   544,   615,   494,   609,
+      484,   634,  1647,   578,  1622,   641,  1681,   620,
+     1616,   612,   512,   613,  1637,   575,  1626,   613,
+     1680,   586,   554,   588,  1631,   582,  1673,   605,
+      486,   568,  1674,   562,   490,   581,   494,   574,
+      516,   640,  1684,   571,   536,   640,   514,   581,
+     1655,   606,   485,   608,  1627,   577,  1673,   624,
+     1628,   623,
+};
+
+/* If cond is false, print diagnostics and abort the test */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err;                                     \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Expected decoder output for a recorded sequence
+ */
+struct ir_nec_expect {
+    unsigned idx;           /*!< Index of the pulse completing the frame */
+    struct ir_frame frame;  /*!< Expected frame */
+};
+
+static int ir_nec_test_seq(void *dec, const uint32_t *rec, unsigned n,
+                           const struct ir_nec_expect *exp, unsigned nexp);
+static int ir_nec_ss_test(void);
+
+/**
+ * @brief Feed a recorded sequence and verify the frames and their position
+ */
+static int ir_nec_test_seq(void *dec, const uint32_t *rec, unsigned n,
+                           const struct ir_nec_expect *exp, unsigned nexp)
+{
+    struct ir_pulse pulse;
+    struct ir_frame frame;
+    unsigned i, found = 0;
+    int err = EFAIL;
+
+    for (i = 0; i < n; i++) {
+        pulse.duration = rec[i];
+        pulse.mark = i & 1;
+        err = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &pulse);
+        if (err != IR_DEC_FRAME_READY)
+            continue;
+
+        TEST_AND_EXIT_ON_FAIL("unexpected_frame", found < nexp && exp[found].idx == i);
+        err = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame);
+        TEST_AND_EXIT_ON_FAIL("get_frame", err == ENO_ERROR);
+        err = EFAIL;
+        TEST_AND_EXIT_ON_FAIL("frame_protocol", frame.protocol == exp[found].frame.protocol);
+        TEST_AND_EXIT_ON_FAIL("frame_flags", frame.flags == exp[found].frame.flags);
+        TEST_AND_EXIT_ON_FAIL("frame_address", frame.address == exp[found].frame.address);
+        TEST_AND_EXIT_ON_FAIL("frame_command", frame.command == exp[found].frame.command);
+        TEST_AND_EXIT_ON_FAIL("frame_confidence", frame.confidence >= 50);
+        printf("%-15s: pulse %2u: addr 0x%04x cmd 0x%02x conf %3u%s\n", "frame", i,
+               frame.address, frame.command, frame.confidence,
+               (frame.flags & IR_FRAME_REPEAT) ? " (repeat)" : "");
+        found++;
+    }
+
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("missing_frame", found == nexp);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Top level NEC decoder test function
+ */
+static int ir_nec_ss_test(void)
+{
+    static const struct ir_nec_expect key_p3[] = {
+        { 66, { IR_PROTO_NEC, 0,               0x4000, 0x41, 0 } },
+        { 71, { IR_PROTO_NEC, IR_FRAME_REPEAT, 0x4000, 0x41, 0 } },
+        { 75, { IR_PROTO_NEC, IR_FRAME_REPEAT, 0x4000, 0x41, 0 } },
+    };
+    static const struct ir_nec_expect glitch[] = {
+        { 88, { IR_PROTO_NEC, 0,               0x0010, 0x16, 0 } },
+    };
+    struct ir_pulse pulse;
+    void *dec;
+    int err = EFAIL;
+
+    dec = new(ir_nec, NULL);
+    TEST_AND_EXIT_ON_FAIL("ir_nec_new", dec != NULL);
+
+    /* Repeat code without a preceding frame is not reported */
+    pulse.mark = 1;
+    pulse.duration = 9000;
+    ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &pulse);
+    pulse.mark = 0;
+    pulse.duration = 2250;
+    ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &pulse);
+    pulse.mark = 1;
+    pulse.duration = 562;
+    TEST_AND_EXIT_ON_FAIL("orphan_repeat",
+        (err = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &pulse)) == ENO_ERROR);
+
+    TEST_AND_EXIT_ON_FAIL("key_p3",
+        (err = ir_nec_test_seq(dec, nec_rec_key_p3, ARRAY_SIZE(nec_rec_key_p3),
+                               key_p3, ARRAY_SIZE(key_p3))) == ENO_ERROR);
+
+    TEST_AND_EXIT_ON_FAIL("reset",
+        (err = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_RESET), NULL)) == ENO_ERROR);
+
+    TEST_AND_EXIT_ON_FAIL("glitch",
+        (err = ir_nec_test_seq(dec, nec_rec_glitch, ARRAY_SIZE(nec_rec_glitch),
+                               glitch, ARRAY_SIZE(glitch))) == ENO_ERROR);
+
+    delete(dec);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing NEC decoder\n");
+    if (ir_nec_ss_test() != ENO_ERROR)
+        printf("NEC decoder test failed\n");
+    else
+        printf("NEC decoder test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,52 @@
+/**
+ * @file  ir_nec.h
+ *
+ * @brief NEC protocol decoder
+ *
+ * Streaming decoder for the NEC IR protocol. Each captured pulse is fed to
+ * the decoder using IOCTL_IR_DEC_EDGE and the decoder advances its state
+ * machine by exactly one step, so the cost per edge is constant. The frame
+ * is available the moment the space of the last data bit is consumed.
+ *
+ * NEC frame (all bits are sent LSB first):
+ *   9 ms mark, 4.5 ms space, 8 bit address, 8 bit ~address (or 16 bit
+ *   extended address), 8 bit command, 8 bit ~command, 562.5 us stop mark.
+ *
+ * NEC repeat code:
+ *   9 ms mark, 2.25 ms space, 562.5 us stop mark.
+ */
+
+#ifndef __IR_NEC_H__
+#define __IR_NEC_H__
+
+#include "ir.h"
+
+/**
+ * @brief NEC pulse durations in micro seconds
+ */
+#define IR_NEC_HDR_MARK         9000
+#define IR_NEC_HDR_SPACE        4500
+#define IR_NEC_RPT_SPACE        2250
+#define IR_NEC_BIT_MARK         562
+#define IR_NEC_ZERO_SPACE       562
+#define IR_NEC_ONE_SPACE        1687
+/*!< Frame start to the start of the next frame or repeat code */
+#define IR_NEC_PERIOD           108000
+
+/*!< Carrier frequency in Hz */
+#define IR_NEC_CARRIER_HZ       38000
+
+/*!< Timing of the protocol descriptor (see ir_proto.h) */
+#define IR_NEC_TIMING(T)                                                \
+    { T(IR_NEC_HDR_MARK), T(IR_NEC_HDR_SPACE),                          \
+      T(IR_NEC_BIT_MARK), T(IR_NEC_ZERO_SPACE),                         \
+      T(IR_NEC_BIT_MARK), T(IR_NEC_ONE_SPACE),                          \
+      T(IR_NEC_BIT_MARK), T(IR_NEC_RPT_SPACE), T(IR_NEC_PERIOD) }
+
+/*!< Number of data bits in the NEC frame */
+#define IR_NEC_NBITS            32
+
+/* NEC decoder type definition */
+extern const void *ir_nec;
+
+#endif /* __IR_NEC_H__ */
@@ -0,0 +1,541 @@
+/**
+ * @file  ir_pingpong.c
+ *
+ * @brief IR frame ping-pong buffers
+ *
+ * The ISR fills one buffer while the decoder owns the other one. The
+ * handover is a single shared word: the index (plus one) of the buffer
+ * handed to the decoder, or 0 once the decoder released it. The ISR
+ * publishes a frame with a release store and only reuses a buffer after
+ * it reads the released state with an acquire load, so the two sides never
+ * touch the same buffer at the same time.
+ */
+
+#include "ir_pingpong.h"
+#include "class.h"
+
+/**
+ * @brief IR ping-pong buffer descriptor
+ *
+ * Internal structure used to manage the buffers.
+ */
+struct ir_pingpong_desc {
+    const struct class *class;
+    const struct ir_pingpong_init *init; /*!< Buffer init parameters */
+    unsigned fill;              /*!< Buffer the ISR fills */
+    unsigned npulses;           /*!< Number of pulses in the buffer being filled */
+    bool overrun;               /*!< The frame does not fit in the buffer */
+    bool idle;                  /*!< Next value ends an idle line and is dropped */
+    bool merge;                 /*!< Next value continues the pulse before a glitch */
+    unsigned len[2];            /*!< Number of pulses of the handed over frames */
+    unsigned ready;             /*!< Handed over buffer plus one, 0 if none */
+    unsigned dropped;           /*!< Number of frames dropped */
+    unsigned rejected;          /*!< Number of glitches rejected */
+};
+
+static void ir_pingpong_append(struct ir_pingpong_desc *desc, const struct ir_pulse *pulse);
+static int ir_pingpong_close(struct ir_pingpong_desc *desc);
+static bool ir_pingpong_glitch(struct ir_pingpong_desc *desc, const struct ir_pulse *pulse);
+static int ir_pingpong_edge(struct ir_pingpong_desc *desc, const struct ir_pulse *pulse);
+static int ir_pingpong_timeout(struct ir_pingpong_desc *desc);
+static int ir_pingpong_get_frame(struct ir_pingpong_desc *desc, struct ir_pulse_seq *seq);
+
+static void *ir_pingpong_ctor(void *data);
+static void ir_pingpong_dtor(void *self);
+static int ir_pingpong_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Append a pulse to the buffer being filled
+ */
+static void ir_pingpong_append(struct ir_pingpong_desc *desc, const struct ir_pulse *pulse)
+{
+    const struct ir_pingpong_init *init = desc->init;
+
+    if (desc->npulses < init->size)
+        init->buf[desc->fill * init->size + desc->npulses++] = *pulse;
+    else
+        desc->overrun = 1;
+}
+
+/**
+ * @brief Hand the frame in the buffer being filled over to the decoder
+ *
+ * @param desc Buffer descriptor
+ *
+ * @return IR_DEC_FRAME_READY, if the frame was handed over.
+ *         EBUFFER_FULL, if the frame was dropped.
+ *         ENO_ERROR, if the buffer only holds the gap.
+ */
+static int ir_pingpong_close(struct ir_pingpong_desc *desc)
+{
+    unsigned n = desc->npulses;
+    bool overrun = desc->overrun;
+
+    desc->npulses = 0;
+    desc->overrun = 0;
+
+    if (n <= 1 && !overrun)
+        return ENO_ERROR;
+
+    /* The decoder still owns the other buffer */
+    if (overrun || ATOMIC_LOAD_ACQUIRE(&desc->ready)) {
+        ATOMIC_STORE_RELAXED(&desc->dropped, desc->dropped + 1);
+        return EBUFFER_FULL;
+    }
+
+    desc->len[desc->fill] = n;
+    ATOMIC_STORE_RELEASE(&desc->ready, desc->fill + 1);
+    desc->fill ^= 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Merge a glitch and the pulse after it into the pulse before it
+ *
+ * The pulse after the glitch has the level of the pulse before it, so the
+ * three make one pulse. Without a pulse before the glitch (the frame was
+ * just closed), both are part of the idle line and dropped.
+ *
+ * @return 1, if the pulse was merged.
+ *         0, if the pulse is not part of a glitch.
+ */
+static bool ir_pingpong_glitch(struct ir_pingpong_desc *desc, const struct ir_pulse *pulse)
+{
+    const struct ir_pingpong_init *init = desc->init;
+
+    if (!desc->merge) {
+        if (pulse->duration >= init->glitch)
+            return 0;
+        ATOMIC_STORE_RELAXED(&desc->rejected, desc->rejected + 1);
+    }
+
+    desc->merge = !desc->merge;
+    if (desc->npulses)
+        init->buf[desc->fill * init->size + desc->npulses - 1].duration += pulse->duration;
+
+    return 1;
+}
+
+/**
+ * @brief Append a captured pulse to the frame, close the frame on a gap
+ *
+ * @return IR_DEC_FRAME_READY, if the frame was handed over.
+ *         EBUFFER_FULL, if the frame was dropped.
+ *         ENO_ERROR, otherwise.
+ */
+static int ir_pingpong_edge(struct ir_pingpong_desc *desc, const struct ir_pulse *pulse)
+{
+    /* The gap was appended on the timeout */
+    if (desc->idle) {
+        desc->idle = 0;
+        return ENO_ERROR;
+    }
+
+    if (ir_pingpong_glitch(desc, pulse)) {
+        /* Wait for the pulse after the glitch, a merged space can be a gap */
+        if (desc->merge || !desc->npulses)
+            return ENO_ERROR;
+        pulse = &desc->init->buf[desc->fill * desc->init->size + desc->npulses - 1];
+    } else {
+        ir_pingpong_append(desc, pulse);
+    }
+
+    if (pulse->mark || pulse->duration < IR_GAP_MIN)
+        return ENO_ERROR;
+
+    return ir_pingpong_close(desc);
+}
+
+/**
+ * @brief Close the frame in progress after the line went idle
+ *
+ * @return IR_DEC_FRAME_READY, if the frame was handed over.
+ *         EBUFFER_FULL, if the frame was dropped.
+ *         ENO_ERROR, otherwise.
+ */
+static int ir_pingpong_timeout(struct ir_pingpong_desc *desc)
+{
+    struct ir_pulse gap;
+
+    /* The timeout repeats while the line idles */
+    if (desc->idle)
+        return ENO_ERROR;
+
+    /* The line idles at the level before a glitch */
+    desc->idle = 1;
+    desc->merge = 0;
+    gap.duration = desc->init->timeout;
+    gap.mark = 0;
+    ir_pingpong_append(desc, &gap);
+
+    return ir_pingpong_close(desc);
+}
+
+/**
+ * @brief Get the frame handed over to the decoder
+ *
+ * @return ENO_ERROR, if a frame is returned in \a seq.
+ *         EBUFFER_EMPTY, if no frame was handed over.
+ */
+static int ir_pingpong_get_frame(struct ir_pingpong_desc *desc, struct ir_pulse_seq *seq)
+{
+    unsigned ready = ATOMIC_LOAD_ACQUIRE(&desc->ready);
+
+    if (!ready)
+        return EBUFFER_EMPTY;
+
+    seq->pulse = &desc->init->buf[(ready - 1) * desc->init->size];
+    seq->npulses = desc->len[ready - 1];
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Create and return an IR ping-pong buffer descriptor
+ */
+static void *ir_pingpong_ctor(void *data)
+{
+    const struct ir_pingpong_init *init = data;
+    struct ir_pingpong_desc *desc;
+
+    if (!init || !init->buf || !init->size)
+        return NULL;
+
+    desc = mm_alloc(sizeof(struct ir_pingpong_desc));
+    if (desc) {
+        desc->class = ir_pingpong;
+        desc->init = init;
+        desc->fill = desc->npulses = 0;
+        desc->overrun = 0;
+        /* The line is assumed to be idle, so the first value is dropped */
+        desc->idle = 1;
+        desc->merge = 0;
+        desc->ready = 0;
+        desc->dropped = desc->rejected = 0;
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the IR ping-pong buffer descriptor
+ */
+static void ir_pingpong_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle IR ping-pong buffer operations
+ */
+static int ir_pingpong_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_pingpong_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_PP_EDGE:
+            ret = ir_pingpong_edge(desc, (struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_PP_TIMEOUT:
+            ret = ir_pingpong_timeout(desc);
+            break;
+        case IOCTL_IR_PP_GET_FRAME:
+            ret = ir_pingpong_get_frame(desc, (struct ir_pulse_seq *)data);
+            break;
+        case IOCTL_IR_PP_RELEASE:
+            ATOMIC_STORE_RELEASE(&desc->ready, 0);
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_PP_GET_DROPPED:
+            *(unsigned *)data = ATOMIC_LOAD_RELAXED(&desc->dropped);
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_PP_GET_REJECTED:
+            *(unsigned *)data = ATOMIC_LOAD_RELAXED(&desc->rejected);
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief IR ping-pong buffer class
+ */
+static const struct class _ir_pingpong = {
+    ir_pingpong_ctor,
+    ir_pingpong_dtor,
+    ir_pingpong_ioctl,
+};
+
+const void *ir_pingpong = &_ir_pingpong;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "ir_rx.h"
+#include "ir_nec.h"
+#include "ir_sirc.h"
+#include "ir_test.h"
+
+#define TEST_FRAME_LEN      80
+#define TEST_TIM_PERIOD     20000
+#define TEST_GLITCH         100
+
+static struct ir_pulse test_buf[2 * TEST_FRAME_LEN];
+static struct ir_pingpong_init test_init = {
+    test_buf, TEST_FRAME_LEN, TEST_TIM_PERIOD + 1, TEST_GLITCH,
+};
+
+static int test_level(void *pp, bool mark, uint32_t d);
+static int test_nec(void *pp, uint8_t addr, uint8_t cmd);
+static int test_nec_glitch(void *pp, uint8_t addr, uint8_t cmd);
+static int test_sirc(void *pp, uint8_t addr, uint8_t cmd);
+static int test_decode(void *pp, void *rx, struct ir_frame *frame, unsigned *npulses);
+static int ir_pingpong_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Capture ISR, returns the result of the last pulse
+ */
+static int test_level(void *pp, bool mark, uint32_t d)
+{
+    struct ir_pulse pulse;
+
+    pulse.mark = mark;
+    pulse.duration = d;
+
+    return ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_EDGE), &pulse);
+}
+
+/**
+ */
+static int test_nec(void *pp, uint8_t addr, uint8_t cmd)
+{
+    struct ir_pulse pulse[IR_TEST_NEC_PULSES];
+    unsigned i, n;
+    int ret = EFAIL;
+
+    n = ir_test_nec(pulse, IR_TEST_NEC_PULSES, addr, cmd, 0);
+    for (i = 0; i < n; i++)
+        ret = test_level(pp, pulse[i].mark, pulse[i].duration);
+
+    return ret;
+}
+
+/**
+ * @brief NEC frame with a spike in the header mark and in every bit space
+ */
+static int test_nec_glitch(void *pp, uint8_t addr, uint8_t cmd)
+{
+    struct ir_pulse pulse[IR_TEST_NEC_PULSES];
+    unsigned i, n;
+    uint32_t d;
+    int ret = EFAIL;
+
+    n = ir_test_nec(pulse, IR_TEST_NEC_PULSES, addr, cmd, 0);
+    for (i = 0; i < n; i++) {
+        d = pulse[i].duration;
+        if (i == 0) {
+            test_level(pp, 1, 3000);
+            test_level(pp, 0, 40);
+            d -= 3040;
+        } else if (i > 1 && !pulse[i].mark) {
+            test_level(pp, 0, 200);
+            test_level(pp, 1, 20);
+            d -= 220;
+        }
+        ret = test_level(pp, pulse[i].mark, d);
+    }
+
+    return ret;
+}
+
+/**
+ */
+static int test_sirc(void *pp, uint8_t addr, uint8_t cmd)
+{
+    uint32_t code = cmd | (uint32_t)addr << IR_SIRC_CMD_BITS;
+    unsigned i;
+    int ret;
+
+    ret = test_level(pp, 1, IR_SIRC_HDR_MARK);
+    for (i = 0; i < 12; i++) {
+        test_level(pp, 0, IR_SIRC_BIT_SPACE);
+        ret = test_level(pp, 1, (code & BIT(i)) ? IR_SIRC_ONE_MARK : IR_SIRC_ZERO_MARK);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Decode the handed over frame and release its buffer
+ */
+static int test_decode(void *pp, void *rx, struct ir_frame *frame, unsigned *npulses)
+{
+    struct ir_pulse_seq seq;
+    int ret;
+
+    ret = ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_GET_FRAME), &seq);
+    if (ret != ENO_ERROR)
+        return ret;
+
+    *npulses = seq.npulses;
+    ret = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_FRAME), &seq);
+    if (ret == IR_DEC_FRAME_READY)
+        ret = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), frame);
+    else
+        ret = EFAIL;
+    ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_RELEASE), NULL);
+
+    return ret;
+}
+
+/**
+ * @brief Top level IR ping-pong buffer test function
+ */
+static int ir_pingpong_ss_test(void)
+{
+    struct ir_frame frame;
+    unsigned i, npulses, dropped, rejected;
+    void *pp, *rx;
+    int err = EFAIL;
+
+    rx = new(ir_rx, NULL);
+    TEST_AND_EXIT_ON_FAIL("ir_rx_new", rx != NULL);
+    TEST_AND_EXIT_ON_FAIL("add_nec",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_nec, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_sirc",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_sirc, NULL))) == ENO_ERROR);
+
+    err = EFAIL;
+    pp = new(ir_pingpong, &test_init);
+    TEST_AND_EXIT_ON_FAIL("ir_pingpong_new", pp != NULL);
+
+    /* The value that ends the initial idle line is dropped, the frame is
+     * handed over on the gap and holds all its pulses and the gap
+     */
+    TEST_AND_EXIT_ON_FAIL("idle", (err = test_level(pp, 0, 1234)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("nec", (err = test_nec(pp, 0x04, 0x08)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("get_frame_early",
+        (err = test_decode(pp, rx, &frame, &npulses)) == EBUFFER_EMPTY);
+    TEST_AND_EXIT_ON_FAIL("gap", (err = test_level(pp, 0, 12000)) == IR_DEC_FRAME_READY);
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(pp, rx, &frame, &npulses)) == ENO_ERROR);
+    printf("%-15s: %u pulses: proto %u addr 0x%04x cmd 0x%02x\n", "frame",
+           npulses, frame.protocol, frame.address, frame.command);
+    TEST_AND_EXIT_ON_FAIL("frame",
+        npulses == 2 * IR_NEC_NBITS + 4 && frame.protocol == IR_PROTO_NEC &&
+        frame.address == 0x04 && frame.command == 0x08);
+
+    /* A frame that ends with a mark is closed by the timeout, the value
+     * captured at the end of the idle line is dropped
+     */
+    TEST_AND_EXIT_ON_FAIL("sirc", (err = test_sirc(pp, 0x01, 0x15)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("timeout",
+        (err = ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_TIMEOUT), NULL)) == IR_DEC_FRAME_READY);
+    TEST_AND_EXIT_ON_FAIL("timeout_again",
+        (err = ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_TIMEOUT), NULL)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(pp, rx, &frame, &npulses)) == ENO_ERROR);
+    printf("%-15s: %u pulses: proto %u addr 0x%04x cmd 0x%02x\n", "frame",
+           npulses, frame.protocol, frame.address, frame.command);
+    TEST_AND_EXIT_ON_FAIL("frame",
+        npulses == 26 && frame.protocol == IR_PROTO_SIRC &&
+        frame.address == 0x01 && frame.command == 0x15);
+    TEST_AND_EXIT_ON_FAIL("idle", (err = test_level(pp, 0, 4321)) == ENO_ERROR);
+
+    /* The decoder keeps the first frame, so the ISR fills the other buffer
+     * and drops the frame after it
+     */
+    test_nec(pp, 0x10, 0x16);
+    TEST_AND_EXIT_ON_FAIL("gap", (err = test_level(pp, 0, 41000)) == IR_DEC_FRAME_READY);
+    test_nec(pp, 0x11, 0x17);
+    TEST_AND_EXIT_ON_FAIL("gap_full", (err = test_level(pp, 0, 41000)) == EBUFFER_FULL);
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(pp, rx, &frame, &npulses)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("frame", frame.address == 0x10 && frame.command == 0x16);
+    test_nec(pp, 0x12, 0x18);
+    TEST_AND_EXIT_ON_FAIL("gap", (err = test_level(pp, 0, 41000)) == IR_DEC_FRAME_READY);
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(pp, rx, &frame, &npulses)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("frame", frame.address == 0x12 && frame.command == 0x18);
+
+    /* A frame longer than a buffer is dropped */
+    for (i = 0; i < TEST_FRAME_LEN; i++) {
+        test_level(pp, 1, 500);
+        test_level(pp, 0, 500);
+    }
+    TEST_AND_EXIT_ON_FAIL("gap_overrun", (err = test_level(pp, 0, 41000)) == EBUFFER_FULL);
+    TEST_AND_EXIT_ON_FAIL("get_frame_overrun",
+        (err = test_decode(pp, rx, &frame, &npulses)) == EBUFFER_EMPTY);
+    test_nec(pp, 0x13, 0x19);
+    TEST_AND_EXIT_ON_FAIL("gap", (err = test_level(pp, 0, 41000)) == IR_DEC_FRAME_READY);
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(pp, rx, &frame, &npulses)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("frame", frame.address == 0x13 && frame.command == 0x19);
+
+    TEST_AND_EXIT_ON_FAIL("dropped",
+        (err = ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_GET_DROPPED), &dropped)) == ENO_ERROR &&
+        dropped == 2);
+
+    /* The glitches are merged into the pulses around them, the frame holds
+     * the pulses of a clean one
+     */
+    TEST_AND_EXIT_ON_FAIL("nec_glitch", (err = test_nec_glitch(pp, 0x14, 0x1a)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("gap", (err = test_level(pp, 0, 41000)) == IR_DEC_FRAME_READY);
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(pp, rx, &frame, &npulses)) == ENO_ERROR);
+    printf("%-15s: %u pulses: proto %u addr 0x%04x cmd 0x%02x\n", "frame",
+           npulses, frame.protocol, frame.address, frame.command);
+    TEST_AND_EXIT_ON_FAIL("frame",
+        npulses == 2 * IR_NEC_NBITS + 4 && frame.address == 0x14 && frame.command == 0x1a);
+
+    /* A spike on the idle line does not start a frame, a spike in the gap
+     * does not end it early
+     */
+    TEST_AND_EXIT_ON_FAIL("idle_glitch", (err = test_level(pp, 1, 30)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("idle_glitch", (err = test_level(pp, 0, 5000)) == ENO_ERROR);
+    test_nec(pp, 0x15, 0x1b);
+    TEST_AND_EXIT_ON_FAIL("gap_glitch", (err = test_level(pp, 0, 6000)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("gap_glitch", (err = test_level(pp, 1, 50)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("gap", (err = test_level(pp, 0, 6000)) == IR_DEC_FRAME_READY);
+    TEST_AND_EXIT_ON_FAIL("decode", (err = test_decode(pp, rx, &frame, &npulses)) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("frame",
+        npulses == 2 * IR_NEC_NBITS + 4 && frame.address == 0x15 && frame.command == 0x1b);
+
+    TEST_AND_EXIT_ON_FAIL("rejected",
+        (err = ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_GET_REJECTED), &rejected)) == ENO_ERROR &&
+        rejected == 3 + IR_NEC_NBITS);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR ping-pong buffers\n");
+    if (ir_pingpong_ss_test() != ENO_ERROR)
+        printf("IR ping-pong buffer test failed\n");
+    else
+        printf("IR ping-pong buffer test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
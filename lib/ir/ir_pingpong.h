@@ -0,0 +1,74 @@
+/**
+ * @file  ir_pingpong.h
+ *
+ * @brief IR frame ping-pong buffers
+ *
+ * Assembles the pulses captured by the capture ISR into one of two frame
+ * buffers. When the gap after a frame is captured (or the line idles for
+ * the gap timeout after the last edge), the buffer holding the frame is
+ * handed to the decoder and the ISR goes on with the other buffer. The ISR
+ * never waits on the decoder, and the decoder is woken once per frame and
+ * sees the whole frame in contiguous memory.
+ *
+ * The decoder owns the handed over buffer until it releases it. A frame
+ * that ends while the decoder still owns the other buffer, or that does
+ * not fit in a buffer, is dropped and counted.
+ *
+ * The ISR can reject glitches (e.g., spikes from lamps or sunlight): a pulse
+ * shorter than the glitch threshold and the pulse after it are merged into
+ * the pulse before the glitch, so the decoder never sees them and a spike
+ * inside a space does not start a frame. The glitches are counted.
+ *
+ * Usage:
+ *
+ * ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_EDGE), &pulse);                (ISR)
+ * ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_TIMEOUT), NULL);               (ISR)
+ *
+ * struct ir_pulse_seq seq;                                       (decoder)
+ *
+ * if (ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_GET_FRAME), &seq) == ENO_ERROR) {
+ *     ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_FRAME), &seq);
+ *     ioctl(pp, IOC(IOCTL_IR, IOCTL_IR_PP_RELEASE), NULL);
+ * }
+ */
+
+#ifndef __IR_PINGPONG_H__
+#define __IR_PINGPONG_H__
+
+#include "ir.h"
+
+/**
+ * @brief IR ping-pong buffer IOCTLs
+ */
+/*!< Append a captured pulse (struct ir_pulse) to the frame, returns
+ *   IR_DEC_FRAME_READY if the pulse ended the frame and the frame was handed
+ *   over */
+#define IOCTL_IR_PP_EDGE            24
+/*!< Close the frame because the line is idle, returns IR_DEC_FRAME_READY if
+ *   the frame was handed over. The value captured at the end of the idle
+ *   line is dropped. */
+#define IOCTL_IR_PP_TIMEOUT         25
+/*!< Get the handed over frame (struct ir_pulse_seq), returns EBUFFER_EMPTY
+ *   if there is none */
+#define IOCTL_IR_PP_GET_FRAME       26
+/*!< Give the handed over frame buffer back to the ISR */
+#define IOCTL_IR_PP_RELEASE         27
+/*!< Number of frames dropped (unsigned) */
+#define IOCTL_IR_PP_GET_DROPPED     28
+/*!< Number of glitches rejected (unsigned), each one removes two edges */
+#define IOCTL_IR_PP_GET_REJECTED    29
+
+/**
+ * @brief IR ping-pong buffer initializer
+ */
+struct ir_pingpong_init {
+    struct ir_pulse *buf;   /*!< Two frame buffers of \a size pulses each */
+    unsigned size;          /*!< Number of pulses in a frame buffer */
+    uint32_t timeout;       /*!< Idle time that raises the timeout (micro seconds) */
+    uint32_t glitch;        /*!< Shorter pulses are glitches (micro seconds), 0 - no filter */
+};
+
+/* IR ping-pong buffer type definition */
+extern const void *ir_pingpong;
+
+#endif /* __IR_PINGPONG_H__ */
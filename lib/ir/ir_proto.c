@@ -0,0 +1,228 @@
+/**
+ * @file  ir_proto.c
+ *
+ * @brief IR protocol descriptors
+ */
+
+#include "ir_proto.h"
+#include "ir_nec.h"
+#include "ir_samsung.h"
+#include "ir_jvc.h"
+#include "ir_sirc.h"
+
+const struct ir_proto ir_proto_nec = {
+    IR_PROTO_NEC, IR_CODING_DISTANCE, IR_NEC_NBITS, 0,
+    IR_NEC_CARRIER_HZ, IR_PROTO_DUTY_PCT, IR_NEC_TIMING(IR_US),
+};
+
+const struct ir_proto ir_proto_samsung = {
+    IR_PROTO_SAMSUNG, IR_CODING_DISTANCE, IR_SAMSUNG_NBITS, 0,
+    IR_SAMSUNG_CARRIER_HZ, IR_PROTO_DUTY_PCT, IR_SAMSUNG_TIMING(IR_US),
+};
+
+const struct ir_proto ir_proto_jvc = {
+    IR_PROTO_JVC, IR_CODING_DISTANCE, IR_JVC_NBITS, IR_PROTO_RPT_NO_HDR,
+    IR_JVC_CARRIER_HZ, IR_PROTO_DUTY_PCT, IR_JVC_TIMING(IR_US),
+};
+
+const struct ir_proto ir_proto_sirc = {
+    IR_PROTO_SIRC, IR_CODING_WIDTH, IR_SIRC_NBITS, 0,
+    IR_SIRC_CARRIER_HZ, IR_PROTO_DUTY_PCT, IR_SIRC_TIMING(IR_US),
+};
+
+/**
+ * @brief Descriptors, indexed by enum ir_protocol_id
+ */
+static const struct ir_proto *const ir_protos[] = {
+    NULL,                   /* IR_PROTO_NONE */
+    &ir_proto_nec,          /* IR_PROTO_NEC */
+    NULL,                   /* IR_PROTO_RC5, Manchester coded */
+    NULL,                   /* IR_PROTO_RC6, Manchester coded */
+    &ir_proto_sirc,         /* IR_PROTO_SIRC */
+    &ir_proto_samsung,      /* IR_PROTO_SAMSUNG */
+    &ir_proto_jvc,          /* IR_PROTO_JVC */
+};
+
+/**
+ */
+const struct ir_proto *ir_proto_get(unsigned protocol)
+{
+    if (protocol >= sizeof(ir_protos) / sizeof(ir_protos[0]))
+        return NULL;
+
+    return ir_protos[protocol];
+}
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "new.h"
+
+/* Leading gap and two 32 bit frames (header, bits, stop mark and gap) */
+#define TEST_NPULSES        (1 + 2 * (2 + 2 * 32 + 2))
+#define TEST_CLK_KHZ        100
+#define TEST_TICKS(us)      IR_TICKS(us, TEST_CLK_KHZ)
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+
+/**
+ * @brief Protocol, its decoder and a key to send
+ */
+struct test_case {
+    const char *name;
+    const struct ir_proto *proto;
+    const void *const *decoder;
+    uint32_t code;          /* Code word of the key */
+    uint16_t address;       /* Expected decoded address */
+    uint16_t command;       /* Expected decoded command */
+    bool repeat;            /* The second frame decodes as a repeat */
+};
+
+static const struct test_case test_case[] = {
+    { "nec", &ir_proto_nec, &ir_nec, 0xf708fb04, 0x04, 0x08, 1 },
+    { "samsung", &ir_proto_samsung, &ir_samsung, 0xe51a0707, 0x07, 0x1a, 0 },
+    { "jvc", &ir_proto_jvc, &ir_jvc, 0x1203, 0x03, 0x12, 1 },
+    { "sirc", &ir_proto_sirc, &ir_sirc, 0x095, 0x01, 0x15, 0 },
+};
+
+/* Tick tables of the transmitter, built at compile time */
+static const struct ir_timing test_nec_ticks = IR_NEC_TIMING(TEST_TICKS);
+
+static struct ir_pulse test_pulse[TEST_NPULSES];
+static unsigned test_npulses;
+
+static void test_add(bool mark, uint32_t duration);
+static void test_encode(const struct ir_proto *proto, uint32_t code, bool repeat);
+static int ir_proto_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err;                                     \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Append a pulse, merged with the last one if it has the same level
+ */
+static void test_add(bool mark, uint32_t duration)
+{
+    if (!duration)
+        return;
+    if (test_npulses && test_pulse[test_npulses - 1].mark == mark) {
+        test_pulse[test_npulses - 1].duration += duration;
+        return;
+    }
+    test_pulse[test_npulses].mark = mark;
+    test_pulse[test_npulses++].duration = duration;
+}
+
+/**
+ * @brief Encode a frame (or its repeat) from the descriptor, up to the
+ *        frame period
+ */
+static void test_encode(const struct ir_proto *proto, uint32_t code, bool repeat)
+{
+    const struct ir_timing *t = &proto->us;
+    uint32_t start = 0;
+    unsigned i;
+    bool one;
+
+    for (i = 0; i < test_npulses; i++)
+        start += test_pulse[i].duration;
+
+    if (repeat && t->rpt_space) {
+        test_add(1, t->hdr_mark);
+        test_add(0, t->rpt_space);
+        test_add(1, t->stop_mark);
+    } else {
+        if (!repeat || !(proto->flags & IR_PROTO_RPT_NO_HDR)) {
+            test_add(1, t->hdr_mark);
+            test_add(0, t->hdr_space);
+        }
+        for (i = 0; i < proto->nbits; i++) {
+            one = (code & BIT(i)) != 0;
+            test_add(1, one ? t->one_mark : t->zero_mark);
+            test_add(0, one ? t->one_space : t->zero_space);
+        }
+        test_add(1, t->stop_mark);
+    }
+
+    /* The gap fills the frame period */
+    for (i = 0; i < test_npulses; i++)
+        start -= test_pulse[i].duration;
+    test_add(0, t->period + start);
+}
+
+/**
+ * @brief Top level IR protocol descriptor test function
+ */
+static int ir_proto_ss_test(void)
+{
+    const struct test_case *c;
+    struct ir_frame frame;
+    unsigned i, k, nframes;
+    void *dec;
+    int res, err = EFAIL;
+
+    TEST_AND_EXIT_ON_FAIL("get", ir_proto_get(IR_PROTO_NEC) == &ir_proto_nec &&
+                                 ir_proto_get(IR_PROTO_JVC) == &ir_proto_jvc &&
+                                 ir_proto_get(IR_PROTO_RC5) == NULL &&
+                                 ir_proto_get(IR_PROTO_JVC + 1) == NULL);
+
+    /* The tick table is the descriptor in ticks */
+    TEST_AND_EXIT_ON_FAIL("ticks", test_nec_ticks.hdr_mark == 900 &&
+                                   test_nec_ticks.one_space == 169 &&
+                                   test_nec_ticks.period == 10800);
+
+    /* Every descriptor sends what its decoder decodes */
+    for (k = 0; k < ARRAY_SIZE(test_case); k++) {
+        c = &test_case[k];
+        TEST_AND_EXIT_ON_FAIL("proto", ir_proto_get(c->proto->protocol) == c->proto);
+
+        dec = new(*c->decoder, NULL);
+        TEST_AND_EXIT_ON_FAIL("new", dec != NULL);
+
+        test_npulses = 0;
+        test_add(0, c->proto->us.period);
+        test_encode(c->proto, c->code, 0);
+        test_encode(c->proto, c->code, 1);
+
+        for (i = 0, nframes = 0; i < test_npulses; i++) {
+            res = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &test_pulse[i]);
+            if (res != IR_DEC_FRAME_READY)
+                continue;
+            ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame);
+            TEST_AND_EXIT_ON_FAIL("frame", frame.protocol == c->proto->protocol &&
+                                           frame.address == c->address &&
+                                           frame.command == c->command);
+            if (nframes++ && c->repeat)
+                TEST_AND_EXIT_ON_FAIL("repeat", frame.flags & IR_FRAME_REPEAT);
+        }
+        TEST_AND_EXIT_ON_FAIL("frames", nframes == 2);
+        printf("%-15s: %u pulses\n", c->name, test_npulses);
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR protocol descriptors\n");
+    if (ir_proto_ss_test() != ENO_ERROR)
+        printf("IR protocol descriptor test failed\n");
+    else
+        printf("IR protocol descriptor test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
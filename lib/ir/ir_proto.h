@@ -0,0 +1,99 @@
+/**
+ * @file  ir_proto.h
+ *
+ * @brief IR protocol descriptors
+ *
+ * A protocol descriptor is a const table with everything needed to send a
+ * frame of a pulse distance or pulse width protocol: the carrier, the
+ * header, the mark and space of a zero and of a one bit, the stop mark,
+ * the repeat code and the frame period. The tables are built from the same
+ * timing definitions (IR_NEC_HDR_MARK, ...) that generate the pulse
+ * classifier tables of the decoders, so the transmitter sends exactly what
+ * the decoders expect. Adding a protocol is adding its table to ir_proto.c.
+ *
+ * Frame: header mark and space (if any), the data bits LSB first (mark and
+ * space of a zero or a one), the stop mark (if any), and a space up to the
+ * frame period. The last space of the frame is part of the gap.
+ *
+ * Repeat while the key is held: the repeat code (header mark, repeat space
+ * and stop mark) if the protocol has one, otherwise the frame again,
+ * without the header for IR_PROTO_RPT_NO_HDR.
+ *
+ * The durations are in micro seconds. IR_XXX_TIMING(T) expands to the
+ * timing of a protocol with every duration passed through T, so a
+ * transmitter builds its timer ticks at compile time:
+ *
+ * #define MY_TICKS(us)  IR_TICKS(us, 100)          (100 kHz counter clock)
+ *
+ * static const struct ir_timing my_nec_ticks = IR_NEC_TIMING(MY_TICKS);
+ */
+
+#ifndef __IR_PROTO_H__
+#define __IR_PROTO_H__
+
+#include "ir.h"
+
+/*!< Carrier duty cycle of the transmitted frames (percent) */
+#define IR_PROTO_DUTY_PCT           33
+
+/*!< Frame is repeated without the header while the key is held */
+#define IR_PROTO_RPT_NO_HDR         BIT(0)
+
+/**
+ * @brief Micro seconds to ticks of a counter clock in kHz, rounded
+ */
+#define IR_TICKS(us, clk_khz)       (((us) * (clk_khz) + 500) / 1000)
+#define IR_US(us)                   (us)
+
+/**
+ * @brief Bit coding
+ */
+enum ir_coding {
+    IR_CODING_DISTANCE,     /*!< Bit value in the length of the space */
+    IR_CODING_WIDTH,        /*!< Bit value in the length of the mark */
+};
+
+/**
+ * @brief Pulse durations of a protocol (micro seconds or timer ticks)
+ */
+struct ir_timing {
+    uint32_t hdr_mark;      /*!< Header mark, 0 if none */
+    uint32_t hdr_space;     /*!< Header space */
+    uint32_t zero_mark;     /*!< Mark of a zero bit */
+    uint32_t zero_space;    /*!< Space of a zero bit */
+    uint32_t one_mark;      /*!< Mark of a one bit */
+    uint32_t one_space;     /*!< Space of a one bit */
+    uint32_t stop_mark;     /*!< Mark after the last bit, 0 if none */
+    uint32_t rpt_space;     /*!< Space of the repeat code, 0 if the frame is resent */
+    uint32_t period;        /*!< Frame start to the start of the next frame */
+};
+
+/**
+ * @brief IR protocol descriptor
+ */
+struct ir_proto {
+    uint8_t protocol;       /*!< One of enum ir_protocol_id */
+    uint8_t coding;         /*!< One of enum ir_coding */
+    uint8_t nbits;          /*!< Number of data bits */
+    uint8_t flags;          /*!< IR_PROTO_* flags */
+    uint32_t carrier_hz;    /*!< Carrier frequency */
+    unsigned duty_pct;      /*!< Carrier duty cycle (percent) */
+    struct ir_timing us;    /*!< Pulse durations in micro seconds */
+};
+
+/* Protocol descriptors */
+extern const struct ir_proto ir_proto_nec;
+extern const struct ir_proto ir_proto_samsung;
+extern const struct ir_proto ir_proto_jvc;
+extern const struct ir_proto ir_proto_sirc;
+
+/**
+ * @brief Descriptor of a protocol
+ *
+ * @param protocol One of enum ir_protocol_id.
+ *
+ * @return Descriptor, NULL if the protocol has none.
+ */
+const struct ir_proto *ir_proto_get(unsigned protocol);
+
+#endif /* __IR_PROTO_H__ */
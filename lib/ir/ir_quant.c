@@ -0,0 +1,343 @@
+/**
+ * @file  ir_quant.c
+ *
+ * @brief Quantized IR pulse encoding
+ *
+ * The durations are stored as a number of units, the decoder multiplies
+ * them back with a single multiply and shift per pulse, no division.
+ */
+
+#include "ir_quant.h"
+
+/**
+ * Durations too long to be scaled to 1/16 micro seconds in 32 bits (over
+ * 4 minutes) are clamped, as are the durations longer than IR_QUANT_MAX
+ * units.
+ */
+unsigned ir_quant_encode(uint8_t *buf, unsigned size, const struct ir_pulse *pulse,
+                         uint32_t unit)
+{
+    uint32_t n = IR_QUANT_MAX;
+    uint8_t level = pulse->mark ? IR_QUANT_MARK : 0;
+
+    if (pulse->duration <= (UINT32_MAX - unit) >> IR_QUANT_FRAC_BITS)
+        n = ((pulse->duration << IR_QUANT_FRAC_BITS) + unit / 2) / unit;
+
+    if (n < IR_QUANT_ESC) {
+        if (size < 1)
+            return 0;
+        buf[0] = (uint8_t)(level | n);
+        return 1;
+    }
+
+    if (size < 3)
+        return 0;
+    if (n > IR_QUANT_MAX)
+        n = IR_QUANT_MAX;
+    buf[0] = (uint8_t)(level | IR_QUANT_ESC);
+    buf[1] = (uint8_t)n;
+    buf[2] = (uint8_t)(n >> 8);
+
+    return 3;
+}
+
+/**
+ */
+unsigned ir_quant_decode(const uint8_t **buf, const uint8_t *end, struct ir_pulse *pulse,
+                         unsigned npulses, uint32_t unit)
+{
+    const uint8_t *p = *buf;
+    uint32_t n;
+    unsigned i, len;
+
+    for (i = 0; i < npulses && p < end; i++) {
+        n = *p & IR_QUANT_ESC;
+        len = 1;
+        if (n == IR_QUANT_ESC) {
+            /* The 16-bit count may be short, the escape code says 3 bytes */
+            if (end - p < 3)
+                break;
+            n = p[1] | (uint32_t)p[2] << 8;
+            len = 3;
+        }
+        pulse[i].mark = (*p & IR_QUANT_MARK) != 0;
+        p += len;
+        pulse[i].duration = (n * unit + (1U << (IR_QUANT_FRAC_BITS - 1))) >> IR_QUANT_FRAC_BITS;
+    }
+
+    *buf = p;
+
+    return i;
+}
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include <time.h>
+#include "ir_rx.h"
+#include "ir_nec.h"
+#include "ir_test.h"
+
+/* NEC frame: header, 32 bits, stop bit and the gap */
+#define TEST_FRAME_PULSES   (IR_TEST_NEC_PULSES + 1)
+#define TEST_GAP            40000
+#define TEST_IDLE           100000
+/* Every TEST_IDLE_EVERY frame is followed by an idle line (escape code) */
+#define TEST_IDLE_EVERY     8
+#define TEST_LOG_FRAMES     256
+#define TEST_LOG_PULSES     (TEST_LOG_FRAMES * TEST_FRAME_PULSES)
+/* Pulses decoded per call, as a consumer decoding a frame at a time */
+#define TEST_BLOCK          64
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+#ifdef IR_QUANT_BENCH
+#define TEST_BENCH_ROUNDS   4096
+#else
+#define TEST_BENCH_ROUNDS   16
+#endif
+
+/* Captured durations in percent of the nominal ones, within the tolerance
+ * of the decoders */
+static const unsigned test_jitter_pct[] = { 83, 92, 100, 108, 117 };
+
+static struct ir_pulse test_pulse[TEST_LOG_PULSES];
+static uint8_t test_quant[TEST_LOG_PULSES + 2 * TEST_LOG_FRAMES];
+static uint32_t test_raw[TEST_LOG_PULSES];
+/* One encoded pulse */
+static uint8_t test_raw_quant[3];
+
+static unsigned test_nec(struct ir_pulse *pulse, uint8_t addr, uint8_t cmd, uint32_t gap);
+static int ir_quant_frame_test(void);
+static double test_elapsed(clock_t start);
+static int ir_quant_bench_test(void);
+static int ir_quant_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Store the pulses of a NEC frame, returns the number of pulses
+ */
+static unsigned test_nec(struct ir_pulse *pulse, uint8_t addr, uint8_t cmd, uint32_t gap)
+{
+    unsigned n = ir_test_nec(pulse, IR_TEST_NEC_PULSES, addr, cmd, 0);
+
+    pulse[n].mark = 0;
+    pulse[n++].duration = gap;
+
+    return n;
+}
+
+/**
+ * @brief Encode a frame, decode it back and feed it to the receive engine
+ */
+static int ir_quant_frame_test(void)
+{
+    struct ir_pulse pulse[TEST_FRAME_PULSES + 1], jitter;
+    struct ir_pulse_seq seq = { test_pulse, 0 };
+    struct ir_frame frame;
+    const uint8_t *p;
+    unsigned i, n, len = 0, jlen, nframes;
+    int err = EFAIL;
+    void *rx, *dec;
+
+    rx = new(ir_rx, NULL);
+    TEST_AND_EXIT_ON_FAIL("ir_rx_new", rx != NULL);
+    TEST_AND_EXIT_ON_FAIL("add_nec",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_nec, NULL))) == ENO_ERROR);
+
+    /* A frame takes a byte per pulse, the gap and the idle line take the
+     * escape code */
+    err = EFAIL;
+    n = test_nec(pulse, 0x04, 0x08, TEST_GAP);
+    pulse[n].mark = 1;
+    pulse[n++].duration = TEST_IDLE;
+    for (i = 0; i < n; i++)
+        len += ir_quant_encode(test_quant + len, sizeof(test_quant) - len, &pulse[i],
+                               IR_QUANT_UNIT_NEC);
+    TEST_AND_EXIT_ON_FAIL("encode", len == TEST_FRAME_PULSES + 5);
+
+    /* The durations are off by at most half a unit */
+    p = test_quant;
+    TEST_AND_EXIT_ON_FAIL("decode",
+        ir_quant_decode(&p, test_quant + len, test_pulse, TEST_LOG_PULSES,
+                        IR_QUANT_UNIT_NEC) == n && p == test_quant + len);
+    for (i = 0; i < n; i++)
+        TEST_AND_EXIT_ON_FAIL("pulse",
+            test_pulse[i].mark == pulse[i].mark &&
+            (test_pulse[i].duration > pulse[i].duration ?
+             test_pulse[i].duration - pulse[i].duration :
+             pulse[i].duration - test_pulse[i].duration) <= 141);
+
+    seq.npulses = TEST_FRAME_PULSES;
+    TEST_AND_EXIT_ON_FAIL("rx_frame",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_FRAME), &seq)) == IR_DEC_FRAME_READY);
+    TEST_AND_EXIT_ON_FAIL("get_frame",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame)) == ENO_ERROR);
+    printf("%-15s: %u bytes: proto %u addr 0x%04x cmd 0x%02x\n", "frame",
+           len, frame.protocol, frame.address, frame.command);
+    TEST_AND_EXIT_ON_FAIL("frame",
+        frame.protocol == IR_PROTO_NEC && frame.address == 0x04 && frame.command == 0x08);
+
+    /* Captured pulses off by up to 17 % still decode once quantized */
+    dec = new(ir_nec, NULL);
+    TEST_AND_EXIT_ON_FAIL("ir_nec_new", dec != NULL);
+    for (i = 0, nframes = 0; i < n; i++) {
+        jitter = pulse[i];
+        if (jitter.duration < TEST_GAP)
+            jitter.duration = jitter.duration *
+                              test_jitter_pct[i % ARRAY_SIZE(test_jitter_pct)] / 100;
+        jlen = ir_quant_encode(test_raw_quant, sizeof(test_raw_quant), &jitter,
+                               IR_QUANT_UNIT_NEC);
+        p = test_raw_quant;
+        TEST_AND_EXIT_ON_FAIL("jitter_decode",
+            ir_quant_decode(&p, test_raw_quant + jlen, &jitter, 1, IR_QUANT_UNIT_NEC) == 1);
+        if (ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &jitter) != IR_DEC_FRAME_READY)
+            continue;
+        TEST_AND_EXIT_ON_FAIL("jitter_frame",
+            ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame) == ENO_ERROR &&
+            frame.address == 0x04 && frame.command == 0x08);
+        nframes++;
+    }
+    TEST_AND_EXIT_ON_FAIL("jitter_frame", nframes == 1);
+
+    /* Decoding stops at the end of the log and at a truncated escape code */
+    err = EFAIL;
+    p = test_quant;
+    TEST_AND_EXIT_ON_FAIL("decode_short",
+        ir_quant_decode(&p, test_quant + len - 1, test_pulse, TEST_LOG_PULSES,
+                        IR_QUANT_UNIT_NEC) == n - 1 && p == test_quant + len - 3);
+
+    /* An escape code with a short count is 3 bytes long too */
+    test_quant[0] = IR_QUANT_MARK | IR_QUANT_ESC;
+    test_quant[1] = 0x10;
+    test_quant[2] = 0;
+    test_quant[3] = 0x05;
+    p = test_quant;
+    TEST_AND_EXIT_ON_FAIL("decode_esc",
+        ir_quant_decode(&p, test_quant + 4, test_pulse, TEST_LOG_PULSES,
+                        IR_QUANT_UNIT_NEC) == 2 && p == test_quant + 4 &&
+        test_pulse[0].mark && test_pulse[0].duration == 4500 &&
+        !test_pulse[1].mark && test_pulse[1].duration == 1406);
+
+    /* A pulse that does not fit is not stored, long pulses are clamped */
+    TEST_AND_EXIT_ON_FAIL("encode_full",
+        ir_quant_encode(test_quant, 2, &pulse[n - 1], IR_QUANT_UNIT_NEC) == 0 &&
+        ir_quant_encode(test_quant, 0, &pulse[0], IR_QUANT_UNIT_NEC) == 0);
+    pulse[0].duration = UINT32_MAX;
+    p = test_quant;
+    TEST_AND_EXIT_ON_FAIL("clamp",
+        ir_quant_encode(test_quant, 3, &pulse[0], IR_QUANT_UNIT_NEC) == 3 &&
+        ir_quant_decode(&p, test_quant + 3, test_pulse, 1, IR_QUANT_UNIT_NEC) == 1 &&
+        test_pulse[0].duration == (IR_QUANT_MAX * IR_QUANT_UNIT_NEC + 8) >> IR_QUANT_FRAC_BITS);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Processor time since \a start in seconds
+ */
+static double test_elapsed(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/**
+ * @brief Compare the decode throughput of a quantized log and of a log of
+ *        32-bit capture values
+ *
+ * The raw log holds the durations the quantized log decodes to, and its
+ * levels alternate as they are inferred from a DMA capture log. Both logs
+ * are turned into pulses a block at a time and must sum to the same total.
+ */
+static int ir_quant_bench_test(void)
+{
+    struct ir_pulse block[TEST_BLOCK];
+    unsigned i, j, n, r, len = 0;
+    unsigned long raw_sum = 0, quant_sum = 0;
+    double raw_time, quant_time;
+    const uint8_t *p;
+    clock_t start;
+    bool mark;
+    int err = EFAIL;
+
+    for (i = n = 0; i < TEST_LOG_FRAMES; i++)
+        n += test_nec(test_pulse + n, (uint8_t)i, (uint8_t)(i * 7),
+                      (i % TEST_IDLE_EVERY) ? TEST_GAP : TEST_IDLE);
+    for (i = 0; i < n; i++)
+        len += ir_quant_encode(test_quant + len, sizeof(test_quant) - len, &test_pulse[i],
+                               IR_QUANT_UNIT_NEC);
+    p = test_quant;
+    TEST_AND_EXIT_ON_FAIL("decode",
+        ir_quant_decode(&p, test_quant + len, test_pulse, n, IR_QUANT_UNIT_NEC) == n);
+    for (i = 0; i < n; i++)
+        test_raw[i] = test_pulse[i].duration;
+
+    start = clock();
+    for (r = 0; r < TEST_BENCH_ROUNDS; r++) {
+        mark = 1;
+        for (i = 0; i < n; i += j) {
+            for (j = 0; j < TEST_BLOCK && i + j < n; j++) {
+                block[j].duration = test_raw[i + j];
+                block[j].mark = mark;
+                mark = !mark;
+            }
+            while (j--)
+                raw_sum += block[j].duration;
+            j = TEST_BLOCK;
+        }
+    }
+    raw_time = test_elapsed(start);
+
+    start = clock();
+    for (r = 0; r < TEST_BENCH_ROUNDS; r++) {
+        p = test_quant;
+        while ((j = ir_quant_decode(&p, test_quant + len, block, TEST_BLOCK,
+                                    IR_QUANT_UNIT_NEC)))
+            while (j--)
+                quant_sum += block[j].duration;
+    }
+    quant_time = test_elapsed(start);
+
+    printf("%-15s: %u pulses in %u bytes, %.1f M pulses/s\n", "raw",
+           n, n * (unsigned)sizeof(test_raw[0]),
+           raw_time > 0 ? (double)n * TEST_BENCH_ROUNDS / raw_time / 1e6 : 0.0);
+    printf("%-15s: %u pulses in %u bytes, %.1f M pulses/s\n", "quantized",
+           n, len, quant_time > 0 ? (double)n * TEST_BENCH_ROUNDS / quant_time / 1e6 : 0.0);
+    TEST_AND_EXIT_ON_FAIL("sum", raw_sum == quant_sum);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Top level quantized encoding test function
+ */
+static int ir_quant_ss_test(void)
+{
+    int err;
+
+    if ((err = ir_quant_frame_test()) != ENO_ERROR)
+        return err;
+
+    return ir_quant_bench_test();
+}
+
+int main(void)
+{
+    printf("Testing IR quantized encoding\n");
+    if (ir_quant_ss_test() != ENO_ERROR)
+        printf("IR quantized encoding test failed\n");
+    else
+        printf("IR quantized encoding test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,81 @@
+/**
+ * @file  ir_quant.h
+ *
+ * @brief Quantized IR pulse encoding
+ *
+ * Compact storage format for captured pulses. A pulse is stored in one
+ * byte: the level in the top bit and the duration in the low 7 bits, as a
+ * number of protocol relative units (e.g., half the 562.5 us NEC tick),
+ * rounded to the nearest unit. Pulses of IR_QUANT_ESC units or more (long
+ * gaps) are stored as the escape code followed by the number of units in
+ * 16 bits, little endian. A log of pulses takes about a quarter of the
+ * memory of a log of 32-bit capture values.
+ *
+ * The unit is given in 1/16 micro seconds, so the units of the common
+ * protocols are exact. The decoders accept pulses within IR_TOLERANCE_PCT
+ * of the nominal duration, so the unit has to be at most about half the
+ * shortest pulse of the protocols to decode: rounding to a coarser unit
+ * moves a captured pulse that is off by less than the tolerance to the
+ * wrong side of it (a 1687 us space captured at 1400 us is 2 NEC ticks).
+ *
+ * Usage:
+ *
+ * n = ir_quant_encode(buf + len, sizeof(buf) - len, &pulse, IR_QUANT_UNIT_NEC);
+ * if (n == 0)
+ *     overflow++;
+ * len += n;
+ *
+ * const uint8_t *p = buf;
+ *
+ * while ((n = ir_quant_decode(&p, buf + len, pulse, NPULSES, IR_QUANT_UNIT_NEC)))
+ *     process(pulse, n);
+ */
+
+#ifndef __IR_QUANT_H__
+#define __IR_QUANT_H__
+
+#include "ir.h"
+
+/*!< Unit resolution is 1 / (1 << IR_QUANT_FRAC_BITS) micro seconds */
+#define IR_QUANT_FRAC_BITS          4
+/*!< Unit of \a us micro seconds */
+#define IR_QUANT_UNIT(us)           ((uint32_t)(us) << IR_QUANT_FRAC_BITS)
+/*!< Half the NEC tick (281.25 us), the NEC data pulses fit in 7 bits */
+#define IR_QUANT_UNIT_NEC           (IR_QUANT_UNIT(1125) / 4)
+
+/*!< Level of the pulse (1 - mark) */
+#define IR_QUANT_MARK               0x80
+/*!< Duration code that announces a 16-bit number of units */
+#define IR_QUANT_ESC                0x7F
+/*!< Longest pulse, in units, longer pulses are clamped */
+#define IR_QUANT_MAX                0xFFFF
+
+/**
+ * @brief Encode a pulse
+ *
+ * @param buf Where to store the encoded pulse.
+ * @param size Number of bytes available in \a buf.
+ * @param pulse Pulse to encode.
+ * @param unit Duration unit in 1/16 micro seconds.
+ *
+ * @return Number of bytes stored (1 or 3), 0 if the pulse does not fit.
+ */
+unsigned ir_quant_encode(uint8_t *buf, unsigned size, const struct ir_pulse *pulse,
+                         uint32_t unit);
+
+/**
+ * @brief Decode pulses
+ *
+ * @param buf Encoded pulses, advanced past the decoded ones.
+ * @param end End of the encoded pulses.
+ * @param pulse Where to store the decoded pulses.
+ * @param npulses Maximum number of pulses to decode.
+ * @param unit Duration unit in 1/16 micro seconds.
+ *
+ * @return Number of pulses decoded. A pulse truncated at \a end is not
+ *         decoded.
+ */
+unsigned ir_quant_decode(const uint8_t **buf, const uint8_t *end, struct ir_pulse *pulse,
+                         unsigned npulses, uint32_t unit);
+
+#endif /* __IR_QUANT_H__ */
@@ -0,0 +1,240 @@
+/**
+ * @file  ir_rc5.c
+ *
+ * @brief Philips RC5 protocol decoder
+ *
+ * Every pulse is one or two half bits long. The half bits are fed to the
+ * Manchester bit decoder as they arrive. The first half of the start bit
+ * is a space and cannot be told apart from the idle line, so it is implied
+ * by the first mark. Likewise, the second half of a trailing zero bit is a
+ * space that merges with the gap after the frame, so it is implied by the
+ * mark before it and the frame is reported without waiting for the gap.
+ */
+
+#include "ir_rc5.h"
+#include "ir_lut.h"
+#include "class.h"
+
+/* Pulse classes of the RC5 timings */
+#define IR_RC5_MARK_SYM(c)                                              \
+    IR_LUT_SYM2(c, IR_RC5_UNIT, IR_SYM_MARK_SHORT,                      \
+                2 * IR_RC5_UNIT, IR_SYM_MARK_LONG)
+#define IR_RC5_SPACE_SYM(c)                                             \
+    IR_LUT_GAP(c, IR_LUT_SYM2(c, IR_RC5_UNIT, IR_SYM_SPACE_SHORT,       \
+                              2 * IR_RC5_UNIT, IR_SYM_SPACE_LONG))
+
+/**
+ * @brief Pulse classifier tables, indexed by the level of the pulse
+ */
+static const uint8_t ir_rc5_lut[2][IR_LUT_SIZE] = {
+    { IR_LUT_TABLE(IR_RC5_SPACE_SYM) },
+    { IR_LUT_TABLE(IR_RC5_MARK_SYM) },
+};
+
+/**
+ * @brief RC5 decoder states
+ */
+enum ir_rc5_state {
+    RC5_IDLE,           /*!< Waiting for the mark of the start bit */
+    RC5_BITS,           /*!< Receiving the bits */
+};
+
+/**
+ * @brief RC5 decoder descriptor
+ *
+ * Internal structure used to manage the decoder.
+ */
+struct ir_rc5_desc {
+    const struct class *class;
+    enum ir_rc5_state state;    /*!< Current decoder state */
+    struct ir_manchester m;     /*!< Bit decoder */
+    struct ir_quality q;        /*!< Timing quality of the frame */
+    bool valid;                 /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;      /*!< Last decoded frame */
+};
+
+static void ir_rc5_reset(struct ir_rc5_desc *desc);
+static int ir_rc5_frame(struct ir_rc5_desc *desc);
+static int ir_rc5_bits(struct ir_rc5_desc *desc, const struct ir_pulse *pulse);
+static int ir_rc5_edge(struct ir_rc5_desc *desc, const struct ir_pulse *pulse);
+
+static void *ir_rc5_ctor(void *data);
+static void ir_rc5_dtor(void *self);
+static int ir_rc5_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Reset the decoder state machine
+ */
+static void ir_rc5_reset(struct ir_rc5_desc *desc)
+{
+    desc->state = RC5_IDLE;
+    ir_manchester_reset(&desc->m, 0);
+    ir_quality_reset(&desc->q);
+}
+
+/**
+ * @brief Update the frame from the received code word
+ *
+ * @return IR_DEC_FRAME_READY
+ */
+static int ir_rc5_frame(struct ir_rc5_desc *desc)
+{
+    uint32_t code = desc->m.code;
+
+    desc->frame.protocol = IR_PROTO_RC5;
+    desc->frame.flags = (code & BIT(11)) ? IR_FRAME_TOGGLE : 0;
+    desc->frame.address = (uint16_t)((code >> 6) & 0x1f);
+    /* The field bit is the inverted bit 6 of the command (RC5X) */
+    desc->frame.command = (uint16_t)((code & 0x3f) | ((~code & BIT(12)) >> 6));
+    desc->frame.confidence = ir_confidence(&desc->q, 0);
+    desc->valid = 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Feed the half bits of a pulse to the bit decoder
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed the frame.
+ *         ENO_ERROR, if the pulse was consumed.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded.
+ */
+static int ir_rc5_bits(struct ir_rc5_desc *desc, const struct ir_pulse *pulse)
+{
+    struct ir_manchester *m = &desc->m;
+    unsigned units;
+
+    units = IR_SYM_UNITS(IR_LUT_SYM(ir_rc5_lut, pulse));
+    if (!units)
+        return EIR_TIMING;
+
+    ir_quality_add(&desc->q, pulse->duration, units * IR_RC5_UNIT);
+
+    while (units--) {
+        if (m->nbits == IR_RC5_NBITS || ir_manchester_half(m, pulse->mark))
+            return EIR_TIMING;
+    }
+
+    /* Second half of a trailing zero merges with the gap */
+    if (m->nbits == IR_RC5_NBITS - 1 && (m->nhalves & 1) && m->first)
+        ir_manchester_half(m, 0);
+
+    if (m->nbits == IR_RC5_NBITS)
+        return ir_rc5_frame(desc);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Advance the decoder by one pulse
+ *
+ * @param desc Decoder descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame.
+ *         ENO_ERROR, if the pulse was consumed, or if it is a header mark
+ *         that starts a new frame.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded and
+ *         does not start a new one.
+ */
+static int ir_rc5_edge(struct ir_rc5_desc *desc, const struct ir_pulse *pulse)
+{
+    int ret = ENO_ERROR;
+
+    if (desc->state == RC5_BITS) {
+        ret = ir_rc5_bits(desc, pulse);
+        if (ret == ENO_ERROR)
+            return ret;
+
+        ir_rc5_reset(desc);
+        if (ret == IR_DEC_FRAME_READY)
+            return ret;
+    }
+
+    /* Look for the start of a new frame */
+    if (pulse->mark) {
+        desc->state = RC5_BITS;
+        ir_manchester_half(&desc->m, 0);
+        ret = ir_rc5_bits(desc, pulse);
+        if (ret != ENO_ERROR) {
+            ir_rc5_reset(desc);
+            ret = EIR_TIMING;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a RC5 decoder descriptor
+ */
+static void *ir_rc5_ctor(void *data)
+{
+    struct ir_rc5_desc *desc;
+
+    UNUSED(data);
+
+    desc = mm_alloc(sizeof(struct ir_rc5_desc));
+    if (desc) {
+        desc->class = ir_rc5;
+        desc->valid = 0;
+        ir_rc5_reset(desc);
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the RC5 decoder descriptor
+ */
+static void ir_rc5_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle RC5 decoder operations
+ */
+static int ir_rc5_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_rc5_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEC_EDGE:
+            ret = ir_rc5_edge(desc, (const struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_DEC_RESET:
+            ir_rc5_reset(desc);
+            desc->valid = 0;
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        case IOCTL_IR_DEC_GET_LUT:
+            *(const uint8_t (**)[IR_LUT_SIZE])data = ir_rc5_lut;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief RC5 decoder class
+ */
+static const struct class _ir_rc5 = {
+    ir_rc5_ctor,
+    ir_rc5_dtor,
+    ir_rc5_ioctl,
+};
+
+const void *ir_rc5 = &_ir_rc5;
@@ -0,0 +1,29 @@
+/**
+ * @file  ir_rc5.h
+ *
+ * @brief Philips RC5 protocol decoder
+ *
+ * Streaming decoder for the RC5 (and RC5X) IR protocol. Bits are Manchester
+ * coded with a half bit time of 889 us, a one is a space followed by a
+ * mark.
+ *
+ * RC5 frame (all bits are sent MSB first):
+ *   start bit (1), field bit (inverted bit 6 of the command in RC5X),
+ *   toggle bit, 5 bit address, 6 bit command.
+ */
+
+#ifndef __IR_RC5_H__
+#define __IR_RC5_H__
+
+#include "ir.h"
+
+/*!< RC5 half bit time in micro seconds */
+#define IR_RC5_UNIT             889
+
+/*!< Number of bits in the RC5 frame */
+#define IR_RC5_NBITS            14
+
+/* RC5 decoder type definition */
+extern const void *ir_rc5;
+
+#endif /* __IR_RC5_H__ */
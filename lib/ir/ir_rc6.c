@@ -0,0 +1,266 @@
+/**
+ * @file  ir_rc6.c
+ *
+ * @brief Philips RC6 protocol decoder
+ *
+ * After the leader every pulse is one to three time units long. The half
+ * bits are fed to the Manchester bit decoder as they arrive; the halves of
+ * the trailer bit are two time units long. The second half of a trailing
+ * one bit is a space that merges with the gap after the frame, so it is
+ * implied by the mark before it.
+ */
+
+#include "ir_rc6.h"
+#include "ir_lut.h"
+#include "class.h"
+
+/* Pulse classes of the RC6 timings */
+#define IR_RC6_MARK_SYM(c)                                              \
+    IR_LUT_SYM4(c, IR_RC6_UNIT, IR_SYM_MARK_SHORT,                      \
+                2 * IR_RC6_UNIT, IR_SYM_MARK_LONG,                      \
+                3 * IR_RC6_UNIT, IR_SYM_MARK_LONGER,                    \
+                IR_RC6_LDR_MARK, IR_SYM_MARK_HDR)
+#define IR_RC6_SPACE_SYM(c)                                             \
+    IR_LUT_GAP(c, IR_LUT_SYM3(c, IR_RC6_UNIT, IR_SYM_SPACE_SHORT,       \
+                              2 * IR_RC6_UNIT, IR_SYM_SPACE_LONG,       \
+                              3 * IR_RC6_UNIT, IR_SYM_SPACE_LONGER))
+
+/**
+ * @brief Pulse classifier tables, indexed by the level of the pulse
+ *
+ * The leader space is two time units long, so it is IR_SYM_SPACE_LONG.
+ */
+static const uint8_t ir_rc6_lut[2][IR_LUT_SIZE] = {
+    { IR_LUT_TABLE(IR_RC6_SPACE_SYM) },
+    { IR_LUT_TABLE(IR_RC6_MARK_SYM) },
+};
+
+/**
+ * @brief RC6 decoder states
+ */
+enum ir_rc6_state {
+    RC6_IDLE,           /*!< Waiting for the leader mark */
+    RC6_LDR_SPACE,      /*!< Waiting for the leader space */
+    RC6_BITS,           /*!< Receiving the bits */
+};
+
+/**
+ * @brief RC6 decoder descriptor
+ *
+ * Internal structure used to manage the decoder.
+ */
+struct ir_rc6_desc {
+    const struct class *class;
+    enum ir_rc6_state state;    /*!< Current decoder state */
+    struct ir_manchester m;     /*!< Bit decoder */
+    struct ir_quality q;        /*!< Timing quality of the frame */
+    bool valid;                 /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;      /*!< Last decoded frame */
+};
+
+static void ir_rc6_reset(struct ir_rc6_desc *desc);
+static int ir_rc6_frame(struct ir_rc6_desc *desc);
+static int ir_rc6_bits(struct ir_rc6_desc *desc, const struct ir_pulse *pulse,
+                       int sym);
+static int ir_rc6_edge(struct ir_rc6_desc *desc, const struct ir_pulse *pulse);
+
+static void *ir_rc6_ctor(void *data);
+static void ir_rc6_dtor(void *self);
+static int ir_rc6_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Reset the decoder state machine
+ */
+static void ir_rc6_reset(struct ir_rc6_desc *desc)
+{
+    desc->state = RC6_IDLE;
+    ir_manchester_reset(&desc->m, 1);
+    ir_quality_reset(&desc->q);
+}
+
+/**
+ * @brief Validate the start bit and mode and update the frame
+ *
+ * @return IR_DEC_FRAME_READY, if the code word is a valid mode 0 frame.
+ *         EIR_TIMING, otherwise.
+ */
+static int ir_rc6_frame(struct ir_rc6_desc *desc)
+{
+    uint32_t code = desc->m.code;
+
+    /* Start bit has to be set and only mode 0 is supported */
+    if ((code >> 17) != 0x8)
+        return EIR_TIMING;
+
+    desc->frame.protocol = IR_PROTO_RC6;
+    desc->frame.flags = (code & BIT(16)) ? IR_FRAME_TOGGLE : 0;
+    desc->frame.address = (uint8_t)(code >> 8);
+    desc->frame.command = (uint8_t)code;
+    desc->frame.confidence = ir_confidence(&desc->q, 0);
+    desc->valid = 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Feed the half bits of a pulse to the bit decoder
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed the frame.
+ *         ENO_ERROR, if the pulse was consumed.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded.
+ */
+static int ir_rc6_bits(struct ir_rc6_desc *desc, const struct ir_pulse *pulse,
+                       int sym)
+{
+    struct ir_manchester *m = &desc->m;
+    unsigned units, width;
+
+    units = IR_SYM_UNITS(sym);
+    if (!units)
+        return EIR_TIMING;
+
+    ir_quality_add(&desc->q, pulse->duration, units * IR_RC6_UNIT);
+
+    while (units) {
+        width = (m->nbits == IR_RC6_TRAILER_BIT) ? 2 : 1;
+        if (units < width || m->nbits == IR_RC6_NBITS ||
+            ir_manchester_half(m, pulse->mark))
+            return EIR_TIMING;
+        units -= width;
+    }
+
+    /* Second half of a trailing one merges with the gap */
+    if (m->nbits == IR_RC6_NBITS - 1 && (m->nhalves & 1) && m->first)
+        ir_manchester_half(m, 0);
+
+    if (m->nbits == IR_RC6_NBITS)
+        return ir_rc6_frame(desc);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Advance the decoder by one pulse
+ *
+ * @param desc Decoder descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame.
+ *         ENO_ERROR, if the pulse was consumed, or if it is a header mark
+ *         that starts a new frame.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded and
+ *         does not start a new one.
+ */
+static int ir_rc6_edge(struct ir_rc6_desc *desc, const struct ir_pulse *pulse)
+{
+    int sym = IR_LUT_SYM(ir_rc6_lut, pulse);
+    int ret = ENO_ERROR;
+
+    switch (desc->state) {
+    case RC6_IDLE:
+        break;
+    case RC6_LDR_SPACE:
+        if (sym == IR_SYM_SPACE_LONG) {
+            ir_quality_add(&desc->q, pulse->duration, IR_RC6_LDR_SPACE);
+            desc->state = RC6_BITS;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case RC6_BITS:
+        ret = ir_rc6_bits(desc, pulse, sym);
+        if (ret == ENO_ERROR)
+            return ret;
+        if (ret == IR_DEC_FRAME_READY) {
+            ir_rc6_reset(desc);
+            return ret;
+        }
+        break;
+    }
+
+    /* Look for the start of a new frame */
+    ir_rc6_reset(desc);
+    if (sym == IR_SYM_MARK_HDR) {
+        ir_quality_add(&desc->q, pulse->duration, IR_RC6_LDR_MARK);
+        desc->state = RC6_LDR_SPACE;
+        ret = ENO_ERROR;
+    } else if (pulse->mark) {
+        ret = EIR_TIMING;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a RC6 decoder descriptor
+ */
+static void *ir_rc6_ctor(void *data)
+{
+    struct ir_rc6_desc *desc;
+
+    UNUSED(data);
+
+    desc = mm_alloc(sizeof(struct ir_rc6_desc));
+    if (desc) {
+        desc->class = ir_rc6;
+        desc->valid = 0;
+        ir_rc6_reset(desc);
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the RC6 decoder descriptor
+ */
+static void ir_rc6_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle RC6 decoder operations
+ */
+static int ir_rc6_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_rc6_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEC_EDGE:
+            ret = ir_rc6_edge(desc, (const struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_DEC_RESET:
+            ir_rc6_reset(desc);
+            desc->valid = 0;
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        case IOCTL_IR_DEC_GET_LUT:
+            *(const uint8_t (**)[IR_LUT_SIZE])data = ir_rc6_lut;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief RC6 decoder class
+ */
+static const struct class _ir_rc6 = {
+    ir_rc6_ctor,
+    ir_rc6_dtor,
+    ir_rc6_ioctl,
+};
+
+const void *ir_rc6 = &_ir_rc6;
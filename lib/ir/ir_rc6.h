@@ -0,0 +1,35 @@
+/**
+ * @file  ir_rc6.h
+ *
+ * @brief Philips RC6 protocol decoder
+ *
+ * Streaming decoder for the RC6 mode 0 IR protocol. Bits are Manchester
+ * coded with a half bit time of 444 us, a one is a mark followed by a
+ * space. The trailer (toggle) bit is twice as long as the other bits.
+ *
+ * RC6 mode 0 frame (all bits are sent MSB first):
+ *   2.666 ms leader mark, 889 us leader space, start bit (1), 3 bit mode
+ *   (0), trailer bit, 8 bit address, 8 bit command.
+ */
+
+#ifndef __IR_RC6_H__
+#define __IR_RC6_H__
+
+#include "ir.h"
+
+/**
+ * @brief RC6 pulse durations in micro seconds
+ */
+#define IR_RC6_UNIT             444
+#define IR_RC6_LDR_MARK         (6 * IR_RC6_UNIT)
+#define IR_RC6_LDR_SPACE        (2 * IR_RC6_UNIT)
+
+/*!< Number of bits following the leader in the RC6 mode 0 frame */
+#define IR_RC6_NBITS            21
+/*!< Position of the double width trailer bit */
+#define IR_RC6_TRAILER_BIT      4
+
+/* RC6 decoder type definition */
+extern const void *ir_rc6;
+
+#endif /* __IR_RC6_H__ */
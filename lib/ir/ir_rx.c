@@ -0,0 +1,914 @@
+/**
+ * @file  ir_rx.c
+ *
+ * @brief IR receive engine
+ *
+ * The registered decoders that still fit the frame being received are
+ * tracked in a bit mask of candidates. A pulse is fed only to the
+ * candidates, and a candidate that rejects the pulse is removed from the
+ * mask. The decoders look for a header in a mark they cannot use and only
+ * reject it if it is not one, so a frame that starts right after a broken
+ * one is not lost, while an idle decoder drops out on the first mark of
+ * another protocol. A space of at least IR_GAP_MIN ends any frame, so it
+ * is fed to all the decoders (some protocols complete their frame on the
+ * gap) and every decoder becomes a candidate for the next frame. The work
+ * per pulse is bounded by IR_RX_MAX_DECODERS decoder steps.
+ *
+ * The frame cache keeps the lookup table bucket of every pulse of the
+ * cached frame and the decoders it was fed to. A pulse matches if each of
+ * those decoders finds the same symbol in its table for both buckets, one
+ * load per decoder, and after the first few pulses of a frame only one
+ * decoder is left. The decoders do not see a frame while it matches the
+ * cached one, so its pulses are kept: if the frame turns out to differ,
+ * the decoders catch up on them before the pulse that differs.
+ */
+
+#include "ir_rx.h"
+#include "ir_lut.h"
+#include "class.h"
+
+/**
+ * @brief IR receive engine descriptor
+ *
+ * Internal structure used to manage the engine.
+ */
+struct ir_rx_desc {
+    const struct class *class;
+    void *dec[IR_RX_MAX_DECODERS];  /*!< Registered decoders */
+    unsigned ndec;                  /*!< Number of registered decoders */
+    unsigned long all;              /*!< Mask of all the registered decoders */
+    unsigned long active;           /*!< Mask of the candidate decoders */
+    bool valid;                     /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;          /*!< Last decoded frame */
+    bool idle;                      /*!< The last pulse was a gap */
+    const uint8_t (*lut[IR_RX_MAX_DECODERS])[IR_LUT_SIZE]; /*!< Lookup
+                                         tables of the decoders */
+    bool classify;                  /*!< All the decoders have lookup tables */
+    uint16_t sig[IR_RX_CACHE_PULSES];   /*!< Bucket, gap and level of the
+                                             pulses of the frame */
+    uint8_t cand[IR_RX_CACHE_PULSES];   /*!< Decoders the pulses of the frame
+                                             were fed to */
+    uint16_t duration[IR_RX_CACHE_PULSES];  /*!< Durations of the pulses of
+                                                 the frame */
+    unsigned npulses;               /*!< Pulses of the frame, more than
+                                         IR_RX_CACHE_PULSES if it does not fit */
+    unsigned nready;                /*!< Frames the decoders completed in the
+                                         frame */
+    unsigned ready;                 /*!< Pulse that completed the frame */
+    bool match;                     /*!< The frame matched the cached one so
+                                         far, the decoders did not see it */
+    bool cached;                    /*!< The first \a cache_npulses of \a sig
+                                         hold the cached frame */
+    unsigned cache_npulses;         /*!< Pulses of the cached frame */
+    unsigned cache_ready;           /*!< Pulse that completed the cached frame */
+    struct ir_frame cache_frame;    /*!< Cached frame */
+    struct ir_rx_stats stats;       /*!< Frame cache counters */
+};
+
+static int ir_rx_add_decoder(struct ir_rx_desc *desc, void *dec);
+static void ir_rx_reset(struct ir_rx_desc *desc);
+static int ir_rx_edge(struct ir_rx_desc *desc, struct ir_pulse *pulse);
+static uint16_t ir_rx_class(const struct ir_pulse *pulse);
+static uint8_t ir_rx_sym(const uint8_t (*lut)[IR_LUT_SIZE], unsigned mark, unsigned bucket);
+static bool ir_rx_match(const struct ir_rx_desc *desc, unsigned n, uint16_t sig);
+static void ir_rx_store(struct ir_rx_desc *desc);
+static int ir_rx_pulse(struct ir_rx_desc *desc, struct ir_pulse *pulse);
+static int ir_rx_frame(struct ir_rx_desc *desc, const struct ir_pulse_seq *seq);
+
+static void *ir_rx_ctor(void *data);
+static void ir_rx_dtor(void *self);
+static int ir_rx_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Register a decoder with the engine
+ *
+ * A decoder without lookup tables disables the frame cache, since it
+ * cannot tell which pulses it handles alike.
+ *
+ * @return ENO_ERROR, if the decoder is registered.
+ *         EFAIL, if the decoder is invalid or there is no room for it.
+ */
+static int ir_rx_add_decoder(struct ir_rx_desc *desc, void *dec)
+{
+    const uint8_t (*lut)[IR_LUT_SIZE] = NULL;
+
+    if (!dec || desc->ndec == IR_RX_MAX_DECODERS)
+        return EFAIL;
+
+    if (ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_LUT), &lut) != ENO_ERROR)
+        desc->classify = 0;
+
+    desc->dec[desc->ndec] = dec;
+    desc->lut[desc->ndec] = lut;
+    desc->all |= BIT(desc->ndec);
+    desc->active = desc->all;
+    desc->ndec++;
+    desc->cached = 0;
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Reset all the registered decoders
+ */
+static void ir_rx_reset(struct ir_rx_desc *desc)
+{
+    unsigned i;
+
+    for (i = 0; i < desc->ndec; i++)
+        ioctl(desc->dec[i], IOC(IOCTL_IR, IOCTL_IR_DEC_RESET), NULL);
+
+    desc->active = desc->all;
+    desc->valid = 0;
+    desc->idle = 1;
+    desc->cached = 0;
+}
+
+/**
+ * @brief Feed a pulse to the candidate decoders
+ *
+ * When more than one decoder completes a frame on the same pulse, the
+ * frame with the highest confidence is reported.
+ *
+ * @param desc Engine descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame.
+ *         ENO_ERROR, otherwise.
+ */
+static int ir_rx_edge(struct ir_rx_desc *desc, struct ir_pulse *pulse)
+{
+    bool gap = !pulse->mark && pulse->duration >= IR_GAP_MIN;
+    bool ready = 0;
+    struct ir_frame frame;
+    unsigned long mask;
+    unsigned i;
+    int ret;
+
+    mask = gap ? desc->all : desc->active;
+    for (i = 0; mask; i++, mask >>= 1) {
+        if (!(mask & 1))
+            continue;
+
+        ret = ioctl(desc->dec[i], IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), pulse);
+        if (ret == IR_DEC_FRAME_READY) {
+            if (ioctl(desc->dec[i], IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame) == ENO_ERROR &&
+                (!ready || frame.confidence > desc->frame.confidence)) {
+                desc->frame = frame;
+                ready = 1;
+            }
+        } else if (ret < 0) {
+            /* Decoder ruled out, skip it until the next gap */
+            desc->active &= ~BIT(i);
+        }
+    }
+
+    desc->idle = gap;
+
+    /* All the decoders are idle again, so all of them are candidates */
+    if (gap || !desc->active)
+        desc->active = desc->all;
+
+    if (ready) {
+        desc->valid = 1;
+        return IR_DEC_FRAME_READY;
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Classify a pulse for the frame cache
+ *
+ * @return Lookup table bucket of the pulse (IR_LUT_SIZE past the tables),
+ *         shifted left by 2, bit 1 set for a gap and bit 0 for a mark.
+ */
+static uint16_t ir_rx_class(const struct ir_pulse *pulse)
+{
+    unsigned mark = pulse->mark != 0;
+    unsigned gap = !mark && pulse->duration >= IR_GAP_MIN;
+    unsigned bucket = IR_LUT_SIZE;
+
+    if (pulse->duration < IR_LUT_LIMIT)
+        bucket = pulse->duration >> IR_LUT_SHIFT;
+
+    return (uint16_t)(bucket << 2 | gap << 1 | mark);
+}
+
+/**
+ * @brief Symbol of a bucket in the lookup tables of a decoder, as
+ *        IR_LUT_SYM() classifies the pulses of the bucket
+ */
+static uint8_t ir_rx_sym(const uint8_t (*lut)[IR_LUT_SIZE], unsigned mark, unsigned bucket)
+{
+    if (bucket < IR_LUT_SIZE)
+        return lut[mark][bucket];
+
+    return mark ? IR_SYM_INVALID : IR_SYM_GAP;
+}
+
+/**
+ * @brief Test if a pulse takes the same path through the decoders as the
+ *        pulse of the cached frame at the same position
+ *
+ * The decoders the cached pulse was fed to must give both pulses the same
+ * symbol. They are the decoders the pulse is fed to now as well, since the
+ * pulses before matched.
+ */
+static bool ir_rx_match(const struct ir_rx_desc *desc, unsigned n, uint16_t sig)
+{
+    unsigned long mask = desc->cand[n];
+    unsigned mark = sig & 1;
+    unsigned i;
+
+    if ((sig & 3) != (desc->sig[n] & 3))
+        return 0;
+
+    for (i = 0; mask; i++, mask >>= 1) {
+        if ((mask & 1) &&
+            ir_rx_sym(desc->lut[i], mark, sig >> 2U) != ir_rx_sym(desc->lut[i], mark, desc->sig[n] >> 2U))
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Cache the frame that just ended, if the decoders completed exactly
+ *        one frame in it
+ *
+ * The decoders are idle before and after the frame, so its result only
+ * depends on the symbols of its pulses. A frame that completed nothing is
+ * not cached, and since the decoders saw it, the cached frame is dropped.
+ */
+static void ir_rx_store(struct ir_rx_desc *desc)
+{
+    if (desc->nready == 1 && desc->npulses <= IR_RX_CACHE_PULSES) {
+        desc->cached = 1;
+        desc->cache_npulses = desc->npulses;
+        desc->cache_ready = desc->ready;
+        desc->cache_frame = desc->frame;
+    } else if (desc->npulses > 1) {
+        desc->cached = 0;
+    }
+}
+
+/**
+ * @brief Match a pulse with the cached frame, or feed it to the decoders
+ *
+ * @param desc Engine descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame.
+ *         ENO_ERROR, otherwise.
+ */
+static int ir_rx_pulse(struct ir_rx_desc *desc, struct ir_pulse *pulse)
+{
+    struct ir_pulse prev;
+    uint16_t sig = 0;
+    unsigned n, i;
+    int ret;
+
+    /* A frame starts after a gap */
+    if (desc->idle) {
+        desc->npulses = desc->classify ? 0 : IR_RX_CACHE_PULSES + 1;
+        desc->nready = 0;
+        desc->match = desc->cached;
+    }
+
+    n = desc->npulses;
+    if (n < IR_RX_CACHE_PULSES) {
+        sig = ir_rx_class(pulse);
+        /* Longer pulses are past the lookup tables either way */
+        desc->duration[n] = pulse->duration > UINT16_MAX ? UINT16_MAX :
+                            (uint16_t)pulse->duration;
+        desc->npulses++;
+    } else {
+        desc->npulses = IR_RX_CACHE_PULSES + 1;
+    }
+
+    if (desc->match) {
+        if (ir_rx_match(desc, n, sig)) {
+            desc->idle = (sig >> 1) & 1;
+            if (n != desc->cache_ready)
+                return ENO_ERROR;
+
+            desc->frame = desc->cache_frame;
+            desc->valid = 1;
+            desc->stats.hits++;
+            return IR_DEC_FRAME_READY;
+        }
+
+        /* The decoders catch up on the pulses before this one. A frame they
+         * complete on them was reported from the cache already.
+         */
+        desc->match = 0;
+        desc->cached = 0;
+        for (i = 0; i < n; i++) {
+            prev.duration = desc->duration[i];
+            prev.mark = desc->sig[i] & 1;
+            if (ir_rx_edge(desc, &prev) == IR_DEC_FRAME_READY) {
+                desc->nready++;
+                desc->ready = i;
+            }
+        }
+    }
+
+    if (n < IR_RX_CACHE_PULSES) {
+        desc->sig[n] = sig;
+        desc->cand[n] = (uint8_t)((sig & 2) ? desc->all : desc->active);
+    }
+
+    ret = ir_rx_edge(desc, pulse);
+    if (ret == IR_DEC_FRAME_READY) {
+        desc->stats.misses++;
+        desc->nready++;
+        desc->ready = n;
+    }
+
+    if (desc->idle)
+        ir_rx_store(desc);
+
+    return ret;
+}
+
+/**
+ * @brief Feed all the pulses of a frame to the engine
+ *
+ * @param desc Engine descriptor
+ * @param seq Pulses of the frame
+ *
+ * @return IR_DEC_FRAME_READY, if a frame was decoded. If the pulses hold
+ *         more than one frame, the last one is reported.
+ *         ENO_ERROR, otherwise.
+ */
+static int ir_rx_frame(struct ir_rx_desc *desc, const struct ir_pulse_seq *seq)
+{
+    int ret = ENO_ERROR;
+    unsigned i;
+
+    for (i = 0; i < seq->npulses; i++) {
+        if (ir_rx_pulse(desc, &seq->pulse[i]) == IR_DEC_FRAME_READY)
+            ret = IR_DEC_FRAME_READY;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a receive engine descriptor
+ */
+static void *ir_rx_ctor(void *data)
+{
+    struct ir_rx_desc *desc;
+
+    UNUSED(data);
+
+    desc = mm_alloc(sizeof(struct ir_rx_desc));
+    if (desc) {
+        desc->class = ir_rx;
+        desc->ndec = 0;
+        desc->all = desc->active = 0;
+        desc->valid = 0;
+        desc->idle = 1;
+        desc->classify = 1;
+        desc->cached = 0;
+        desc->stats.hits = desc->stats.misses = 0;
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the receive engine descriptor
+ *
+ * The registered decoders are owned by the caller and are not deleted.
+ */
+static void ir_rx_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle receive engine operations
+ */
+static int ir_rx_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_rx_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEC_EDGE:
+            ret = ir_rx_pulse(desc, (struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_DEC_RESET:
+            ir_rx_reset(desc);
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        case IOCTL_IR_RX_ADD_DECODER:
+            ret = ir_rx_add_decoder(desc, data);
+            break;
+        case IOCTL_IR_RX_FRAME:
+            ret = ir_rx_frame(desc, (struct ir_pulse_seq *)data);
+            break;
+        case IOCTL_IR_RX_GET_STATS:
+            *(struct ir_rx_stats *)data = desc->stats;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief IR receive engine class
+ */
+static const struct class _ir_rx = {
+    ir_rx_ctor,
+    ir_rx_dtor,
+    ir_rx_ioctl,
+};
+
+const void *ir_rx = &_ir_rx;
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "ir_nec.h"
+#include "ir_rc5.h"
+#include "ir_rc6.h"
+#include "ir_sirc.h"
+#include "ir_samsung.h"
+#include "ir_jvc.h"
+#include "ir_test.h"
+
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+
+#define TEST_MAX_PULSES     2048
+#define TEST_GAP            30000
+
+/**
+ * @brief Synthesized pulse train
+ */
+struct test_tx {
+    struct ir_pulse pulse[TEST_MAX_PULSES];
+    unsigned npulses;
+    uint32_t seed;
+};
+
+static struct test_tx test_tx;
+
+static uint32_t test_jitter(struct test_tx *tx);
+static void test_level(struct test_tx *tx, bool mark, uint32_t d);
+static void test_pd(struct test_tx *tx, uint32_t hdr_mark, uint32_t hdr_space,
+                    uint32_t bit_mark, uint32_t zero_space, uint32_t one_space,
+                    unsigned nbits, uint32_t code);
+static void test_nec(struct test_tx *tx, uint8_t addr, uint8_t cmd);
+static void test_nec_repeat(struct test_tx *tx);
+static void test_samsung(struct test_tx *tx, uint8_t addr, uint8_t cmd);
+static void test_jvc(struct test_tx *tx, uint8_t addr, uint8_t cmd, bool repeat);
+static void test_sirc(struct test_tx *tx, unsigned nbits, uint16_t addr, uint8_t cmd);
+static void test_rc5(struct test_tx *tx, uint8_t addr, uint8_t cmd, bool toggle);
+static void test_rc6(struct test_tx *tx, uint8_t addr, uint8_t cmd, bool toggle);
+static int test_cache_frame(void *rx, struct test_tx *tx, bool edges,
+                            struct ir_frame *frame);
+static int ir_rx_prune_test(void *rx);
+static int ir_rx_cache_test(void *rx);
+static int ir_rx_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test. A value check
+ * failing after a successful call fails the test too */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err != ENO_ERROR ? err : EFAIL;          \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Receiver jitter: marks get longer and spaces shorter (0 - 63 us)
+ */
+static uint32_t test_jitter(struct test_tx *tx)
+{
+    tx->seed = tx->seed * 1103515245 + 12345;
+    return (tx->seed >> 16) & 0x3f;
+}
+
+/**
+ * @brief Append a level to the pulse train, merging it with the last pulse
+ *        if the level is the same
+ */
+static void test_level(struct test_tx *tx, bool mark, uint32_t d)
+{
+    d = mark ? d + test_jitter(tx) : d - test_jitter(tx);
+
+    if (tx->npulses && tx->pulse[tx->npulses - 1].mark == mark) {
+        tx->pulse[tx->npulses - 1].duration += d;
+    } else if (tx->npulses < TEST_MAX_PULSES) {
+        tx->pulse[tx->npulses].mark = mark;
+        tx->pulse[tx->npulses].duration = d;
+        tx->npulses++;
+    }
+}
+
+/**
+ * @brief Append a pulse distance coded frame (LSB first) and the gap
+ */
+static void test_pd(struct test_tx *tx, uint32_t hdr_mark, uint32_t hdr_space,
+                    uint32_t bit_mark, uint32_t zero_space, uint32_t one_space,
+                    unsigned nbits, uint32_t code)
+{
+    unsigned i;
+
+    if (hdr_mark) {
+        test_level(tx, 1, hdr_mark);
+        test_level(tx, 0, hdr_space);
+    }
+    for (i = 0; i < nbits; i++) {
+        test_level(tx, 1, bit_mark);
+        test_level(tx, 0, (code & BIT(i)) ? one_space : zero_space);
+    }
+    test_level(tx, 1, bit_mark);
+    test_level(tx, 0, TEST_GAP);
+}
+
+/**
+ */
+static void test_nec(struct test_tx *tx, uint8_t addr, uint8_t cmd)
+{
+    struct ir_pulse pulse[IR_TEST_NEC_PULSES];
+    unsigned i, n;
+
+    n = ir_test_nec(pulse, IR_TEST_NEC_PULSES, addr, cmd, 0);
+    for (i = 0; i < n; i++)
+        test_level(tx, pulse[i].mark, pulse[i].duration);
+    test_level(tx, 0, TEST_GAP);
+}
+
+/**
+ */
+static void test_nec_repeat(struct test_tx *tx)
+{
+    test_level(tx, 1, IR_NEC_HDR_MARK);
+    test_level(tx, 0, IR_NEC_RPT_SPACE);
+    test_level(tx, 1, IR_NEC_BIT_MARK);
+    test_level(tx, 0, TEST_GAP);
+}
+
+/**
+ */
+static void test_samsung(struct test_tx *tx, uint8_t addr, uint8_t cmd)
+{
+    uint32_t code = addr | (uint32_t)addr << 8 |
+                    (uint32_t)cmd << 16 | (uint32_t)(uint8_t)~cmd << 24;
+
+    test_pd(tx, IR_SAMSUNG_HDR_MARK, IR_SAMSUNG_HDR_SPACE, IR_SAMSUNG_BIT_MARK,
+            IR_SAMSUNG_ZERO_SPACE, IR_SAMSUNG_ONE_SPACE, IR_SAMSUNG_NBITS, code);
+}
+
+/**
+ */
+static void test_jvc(struct test_tx *tx, uint8_t addr, uint8_t cmd, bool repeat)
+{
+    test_pd(tx, repeat ? 0 : IR_JVC_HDR_MARK, IR_JVC_HDR_SPACE, IR_JVC_BIT_MARK,
+            IR_JVC_ZERO_SPACE, IR_JVC_ONE_SPACE, IR_JVC_NBITS,
+            addr | (uint32_t)cmd << 8);
+}
+
+/**
+ */
+static void test_sirc(struct test_tx *tx, unsigned nbits, uint16_t addr, uint8_t cmd)
+{
+    uint32_t code = cmd | (uint32_t)addr << IR_SIRC_CMD_BITS;
+    unsigned i;
+
+    test_level(tx, 1, IR_SIRC_HDR_MARK);
+    for (i = 0; i < nbits; i++) {
+        test_level(tx, 0, IR_SIRC_BIT_SPACE);
+        test_level(tx, 1, (code & BIT(i)) ? IR_SIRC_ONE_MARK : IR_SIRC_ZERO_MARK);
+    }
+    test_level(tx, 0, TEST_GAP);
+}
+
+/**
+ */
+static void test_rc5(struct test_tx *tx, uint8_t addr, uint8_t cmd, bool toggle)
+{
+    uint32_t code = BIT(13) | (uint32_t)!(cmd & BIT(6)) << 12 |
+                    (uint32_t)toggle << 11 | (uint32_t)(addr & 0x1f) << 6 |
+                    (cmd & 0x3f);
+    int i;
+
+    for (i = IR_RC5_NBITS - 1; i >= 0; i--) {
+        bool one = (code & BIT(i)) != 0;
+        test_level(tx, !one, IR_RC5_UNIT);
+        test_level(tx, one, IR_RC5_UNIT);
+    }
+    test_level(tx, 0, TEST_GAP);
+}
+
+/**
+ */
+static void test_rc6(struct test_tx *tx, uint8_t addr, uint8_t cmd, bool toggle)
+{
+    uint32_t code = BIT(20) | (uint32_t)toggle << 16 | (uint32_t)addr << 8 | cmd;
+    uint32_t half;
+    int i;
+
+    test_level(tx, 1, IR_RC6_LDR_MARK);
+    test_level(tx, 0, IR_RC6_LDR_SPACE);
+    for (i = IR_RC6_NBITS - 1; i >= 0; i--) {
+        bool one = (code & BIT(i)) != 0;
+        half = (i == IR_RC6_NBITS - 1 - IR_RC6_TRAILER_BIT) ? 2 * IR_RC6_UNIT : IR_RC6_UNIT;
+        test_level(tx, one, half);
+        test_level(tx, !one, half);
+    }
+    test_level(tx, 0, TEST_GAP);
+}
+
+/**
+ * @brief Decode the pulse train, as one frame or pulse by pulse, and start
+ *        a new train
+ */
+static int test_cache_frame(void *rx, struct test_tx *tx, bool edges,
+                            struct ir_frame *frame)
+{
+    struct ir_pulse_seq seq;
+    unsigned i;
+    int ret = ENO_ERROR;
+
+    if (edges) {
+        for (i = 0; i < tx->npulses; i++) {
+            if (ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &tx->pulse[i]) == IR_DEC_FRAME_READY)
+                ret = IR_DEC_FRAME_READY;
+        }
+    } else {
+        seq.pulse = tx->pulse;
+        seq.npulses = tx->npulses;
+        ret = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_FRAME), &seq);
+    }
+    tx->npulses = 0;
+
+    if (ret == IR_DEC_FRAME_READY)
+        ret = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), frame);
+    else
+        ret = EFAIL;
+
+    return ret;
+}
+
+/**
+ * @brief Candidate test, the idle decoders of the other protocols drop out
+ *        on the first mark of a frame
+ */
+static int ir_rx_prune_test(void *rx)
+{
+    static const struct {
+        const char *name;
+        unsigned long active;       /*!< Candidates before the gap */
+    } expect[] = {
+        { "prune_rc5", BIT(1) },
+        { "prune_rc6", BIT(2) },
+    };
+    struct ir_rx_desc *desc = rx;
+    struct test_tx *tx = &test_tx;
+    unsigned i, j;
+    bool ready;
+    int err = EFAIL;
+
+    for (j = 0; j < ARRAY_SIZE(expect); j++) {
+        tx->npulses = 0;
+        tx->seed = 3;
+        test_level(tx, 0, TEST_GAP);
+        if (j == 0)
+            test_rc5(tx, 0x0a, 0x21, 0);
+        else
+            test_rc6(tx, 0x0a, 0x21, 0);
+
+        ready = 0;
+        for (i = 0; i < tx->npulses; i++) {
+            if (i == tx->npulses - 1)
+                TEST_AND_EXIT_ON_FAIL(expect[j].name, desc->active == expect[j].active);
+            if (ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &tx->pulse[i]) == IR_DEC_FRAME_READY)
+                ready = 1;
+        }
+        TEST_AND_EXIT_ON_FAIL(expect[j].name, ready && desc->active == desc->all);
+    }
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Frame cache test, a frame with the same pulse classes as the last
+ *        one is reported from the cache, fed as one frame or pulse by pulse
+ */
+static int ir_rx_cache_test(void *rx)
+{
+    struct test_tx *tx = &test_tx;
+    struct ir_rx_stats start, stats;
+    struct ir_frame frame;
+    unsigned i;
+    int err = EFAIL;
+
+    TEST_AND_EXIT_ON_FAIL("stats",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_GET_STATS), &start)) == ENO_ERROR);
+
+    tx->npulses = 0;
+    tx->seed = 7;
+    test_nec(tx, 0x21, 0x42);
+    TEST_AND_EXIT_ON_FAIL("miss", (err = test_cache_frame(rx, tx, 0, &frame)) == ENO_ERROR &&
+                          frame.address == 0x21 && frame.command == 0x42);
+    tx->seed = 7;
+    test_nec(tx, 0x21, 0x42);
+    TEST_AND_EXIT_ON_FAIL("hit_edges", (err = test_cache_frame(rx, tx, 1, &frame)) == ENO_ERROR &&
+                          frame.address == 0x21 && frame.command == 0x42);
+    TEST_AND_EXIT_ON_FAIL("stats",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_GET_STATS), &stats)) == ENO_ERROR);
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("hit_edges", stats.hits == start.hits + 1 &&
+                          stats.misses == start.misses + 1);
+
+    /* Other jitter may or may not change the classes, the frame is the same */
+    test_nec(tx, 0x21, 0x42);
+    TEST_AND_EXIT_ON_FAIL("jitter", (err = test_cache_frame(rx, tx, 1, &frame)) == ENO_ERROR &&
+                          frame.address == 0x21 && frame.command == 0x42);
+
+    /* A frame that differs in the middle is decoded from all its pulses */
+    test_nec(tx, 0x21, 0x43);
+    TEST_AND_EXIT_ON_FAIL("late_miss", (err = test_cache_frame(rx, tx, 1, &frame)) == ENO_ERROR &&
+                          frame.address == 0x21 && frame.command == 0x43);
+
+    /* Repeat codes report the key of the last full frame */
+    test_nec_repeat(tx);
+    TEST_AND_EXIT_ON_FAIL("repeat", (err = test_cache_frame(rx, tx, 0, &frame)) == ENO_ERROR &&
+                          (frame.flags & IR_FRAME_REPEAT) && frame.command == 0x43);
+    test_nec_repeat(tx);
+    TEST_AND_EXIT_ON_FAIL("repeat", (err = test_cache_frame(rx, tx, 1, &frame)) == ENO_ERROR &&
+                          (frame.flags & IR_FRAME_REPEAT) && frame.command == 0x43);
+
+    /* A space within tolerance, then the same space just out of tolerance:
+     * the classes follow the lookup tables, so the second one misses and
+     * no frame is reported
+     */
+    for (i = 0; i < 2; i++) {
+        tx->seed = 7;
+        test_nec(tx, 0x21, 0x42);
+        tx->pulse[5].duration = i ? IR_NEC_ZERO_SPACE * (100 + IR_TOLERANCE_PCT) / 100 + 30 :
+                                    IR_NEC_ZERO_SPACE * (100 + IR_TOLERANCE_PCT) / 100 - 50;
+        err = test_cache_frame(rx, tx, 1, &frame);
+        TEST_AND_EXIT_ON_FAIL("tolerance", i ? err == EFAIL : err == ENO_ERROR &&
+                              frame.address == 0x21 && frame.command == 0x42);
+    }
+
+    /* A frame that completes nothing is not cached */
+    for (i = 0; i < 2; i++) {
+        test_level(tx, 1, IR_NEC_BIT_MARK);
+        test_level(tx, 0, IR_NEC_BIT_MARK);
+        test_level(tx, 1, IR_NEC_BIT_MARK);
+        test_level(tx, 0, TEST_GAP);
+        TEST_AND_EXIT_ON_FAIL("noise", (err = test_cache_frame(rx, tx, i != 0, &frame)) == EFAIL &&
+                              !((struct ir_rx_desc *)rx)->cached);
+    }
+    TEST_AND_EXIT_ON_FAIL("stats",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_GET_STATS), &stats)) == ENO_ERROR);
+    printf("%-15s: hits %u misses %u\n", "cache", stats.hits - start.hits,
+           stats.misses - start.misses);
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("stats", stats.hits + stats.misses == start.hits + start.misses + 7 &&
+                          stats.hits >= start.hits + 2);
+
+    return ENO_ERROR;
+}
+
+/**
+ * @brief Top level receive engine test function
+ */
+static int ir_rx_ss_test(void)
+{
+    static const struct ir_frame expect[] = {
+        { IR_PROTO_NEC,     0,               0x04,  0x08, 0 },
+        { IR_PROTO_NEC,     IR_FRAME_REPEAT, 0x04,  0x08, 0 },
+        { IR_PROTO_SAMSUNG, 0,               0x07,  0x02, 0 },
+        { IR_PROTO_JVC,     0,               0x03,  0x17, 0 },
+        { IR_PROTO_JVC,     IR_FRAME_REPEAT, 0x03,  0x17, 0 },
+        { IR_PROTO_SIRC,    0,               0x01,  0x15, 0 },
+        { IR_PROTO_SIRC,    0,               0x97,  0x2f, 0 },
+        { IR_PROTO_SIRC,    0,               0x1a5, 0x3c, 0 },
+        { IR_PROTO_RC5,     IR_FRAME_TOGGLE, 0x05,  0x35, 0 },
+        { IR_PROTO_RC5,     0,               0x14,  0x45, 0 },
+        { IR_PROTO_RC6,     0,               0x00,  0x0c, 0 },
+        { IR_PROTO_RC6,     IR_FRAME_TOGGLE, 0x80,  0xa1, 0 },
+        { IR_PROTO_NEC,     0,               0xfe,  0x01, 0 },
+        { IR_PROTO_NEC,     0,               0x5a,  0x3c, 0 },
+    };
+    struct test_tx *tx = &test_tx;
+    struct ir_frame frame;
+    unsigned i, found = 0;
+    void *rx;
+    int err = EFAIL;
+
+    rx = new(ir_rx, NULL);
+    TEST_AND_EXIT_ON_FAIL("ir_rx_new", rx != NULL);
+
+    TEST_AND_EXIT_ON_FAIL("add_nec",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_nec, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_rc5",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_rc5, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_rc6",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_rc6, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_sirc",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_sirc, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_samsung",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_samsung, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_jvc",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_jvc, NULL))) == ENO_ERROR);
+    TEST_AND_EXIT_ON_FAIL("add_null",
+        (err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), NULL)) == EFAIL);
+
+    /* Remotes of all the protocols taking turns */
+    tx->npulses = 0;
+    tx->seed = 1;
+    test_level(tx, 0, TEST_GAP);
+    test_nec(tx, 0x04, 0x08);
+    test_nec_repeat(tx);
+    test_samsung(tx, 0x07, 0x02);
+    test_jvc(tx, 0x03, 0x17, 0);
+    test_jvc(tx, 0x03, 0x17, 1);
+    test_sirc(tx, 12, 0x01, 0x15);
+    test_sirc(tx, 15, 0x97, 0x2f);
+    test_sirc(tx, 20, 0x1a5, 0x3c);
+    test_rc5(tx, 0x05, 0x35, 1);
+    test_rc5(tx, 0x14, 0x45, 0);
+    test_rc6(tx, 0x00, 0x0c, 0);
+    test_rc6(tx, 0x80, 0xa1, 1);
+    test_nec(tx, 0xfe, 0x01);
+
+    /* A frame cut short, the next one starts on the mark after it */
+    test_level(tx, 1, IR_NEC_HDR_MARK);
+    test_level(tx, 0, IR_NEC_HDR_SPACE);
+    for (i = 0; i < 5; i++) {
+        test_level(tx, 1, IR_NEC_BIT_MARK);
+        test_level(tx, 0, IR_NEC_ZERO_SPACE);
+    }
+    test_nec(tx, 0x5a, 0x3c);
+
+    for (i = 0; i < tx->npulses; i++) {
+        if (ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &tx->pulse[i]) != IR_DEC_FRAME_READY)
+            continue;
+
+        err = ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame);
+        TEST_AND_EXIT_ON_FAIL("get_frame", err == ENO_ERROR);
+        printf("%-15s: pulse %4u: proto %u addr 0x%04x cmd 0x%02x flags 0x%x conf %3u\n",
+               "frame", i, frame.protocol, frame.address, frame.command,
+               frame.flags, frame.confidence);
+
+        err = EFAIL;
+        TEST_AND_EXIT_ON_FAIL("unexpected_frame", found < ARRAY_SIZE(expect));
+        TEST_AND_EXIT_ON_FAIL("frame_protocol", frame.protocol == expect[found].protocol);
+        TEST_AND_EXIT_ON_FAIL("frame_flags", frame.flags == expect[found].flags);
+        TEST_AND_EXIT_ON_FAIL("frame_address", frame.address == expect[found].address);
+        TEST_AND_EXIT_ON_FAIL("frame_command", frame.command == expect[found].command);
+        TEST_AND_EXIT_ON_FAIL("frame_confidence", frame.confidence >= 50);
+        found++;
+    }
+
+    err = EFAIL;
+    TEST_AND_EXIT_ON_FAIL("missing_frame", found == ARRAY_SIZE(expect));
+
+    err = ir_rx_prune_test(rx);
+    if (err != ENO_ERROR)
+        return err;
+
+    return ir_rx_cache_test(rx);
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR receive engine\n");
+    if (ir_rx_ss_test() != ENO_ERROR)
+        printf("IR receive engine test failed\n");
+    else
+        printf("IR receive engine test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,75 @@
+/**
+ * @file  ir_rx.h
+ *
+ * @brief IR receive engine
+ *
+ * The receive engine feeds every captured pulse to a set of registered
+ * protocol decoders in parallel. A decoder that rejects a pulse drops out
+ * of the race until the next gap, so only the decoders that still fit the
+ * frame see the following pulses. If more than one decoder completes a
+ * frame on the same pulse, the frame with the highest confidence wins.
+ *
+ * The engine implements the IR decoder IOCTLs, so it can be used wherever
+ * a single decoder is used. Decoders are objects created with \a new() and
+ * are registered using IOCTL_IR_RX_ADD_DECODER, so only the protocols that
+ * are registered need to be linked in.
+ *
+ * Usage:
+ *
+ * void *rx = new(ir_rx, NULL);
+ * ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_nec, NULL));
+ * ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_RX_ADD_DECODER), new(ir_rc5, NULL));
+ *
+ * if (ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &pulse) == IR_DEC_FRAME_READY)
+ *     ioctl(rx, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame);
+ *
+ * A frame assembled in contiguous memory (see ir_pingpong.h) is decoded
+ * with a single IOCTL_IR_RX_FRAME instead of one IOCTL per pulse.
+ *
+ * While a key is held, a remote sends the same frame (or repeat code) over
+ * and over. The engine keeps the pulses of the last frame the decoders
+ * completed, from gap to gap, and the frame. A pulse matches the cached one
+ * if the decoders it is fed to give both the same symbol of their lookup
+ * tables (see ir_lut.h). While the pulses of the next frame match, the
+ * decoders are not run and the cached frame is reported on the pulse that
+ * completed it. This works the same for pulses fed one by one and for
+ * IOCTL_IR_RX_FRAME. Frames longer than IR_RX_CACHE_PULSES, frames that
+ * completed nothing or more than one frame, and engines with a decoder
+ * without lookup tables are not cached.
+ */
+
+#ifndef __IR_RX_H__
+#define __IR_RX_H__
+
+#include "ir.h"
+
+/**
+ * @brief IR receive engine IOCTLs (in addition to the decoder IOCTLs)
+ */
+/*!< Register a decoder object with the engine */
+#define IOCTL_IR_RX_ADD_DECODER     8
+/*!< Feed all the pulses of a frame (struct ir_pulse_seq) to the engine,
+ *   returns IR_DEC_FRAME_READY if a frame was decoded */
+#define IOCTL_IR_RX_FRAME           9
+/*!< Read the frame cache counters (struct ir_rx_stats) */
+#define IOCTL_IR_RX_GET_STATS       10
+
+/*!< Maximum number of decoders that can be registered with the engine */
+#define IR_RX_MAX_DECODERS          8
+
+/*!< Longest frame the frame cache holds, in pulses including the gap (a
+ *   NEC frame is 68) */
+#define IR_RX_CACHE_PULSES          72
+
+/**
+ * @brief IR receive engine frame cache counters
+ */
+struct ir_rx_stats {
+    unsigned hits;      /*!< Frames reported from the cache */
+    unsigned misses;    /*!< Frames completed by the decoders */
+};
+
+/* IR receive engine type definition */
+extern const void *ir_rx;
+
+#endif /* __IR_RX_H__ */
@@ -0,0 +1,254 @@
+/**
+ * @file  ir_samsung.c
+ *
+ * @brief Samsung protocol decoder
+ *
+ * The decoder is advanced once per captured pulse, the same way as the NEC
+ * decoder. A pulse that does not match the expected timing resets the
+ * decoder and is then checked for a header mark.
+ */
+
+#include "ir_samsung.h"
+#include "ir_lut.h"
+#include "class.h"
+
+/* Pulse classes of the Samsung timings */
+#define IR_SAMSUNG_MARK_SYM(c)                                          \
+    IR_LUT_SYM2(c, IR_SAMSUNG_BIT_MARK, IR_SYM_MARK_SHORT,              \
+                IR_SAMSUNG_HDR_MARK, IR_SYM_MARK_HDR)
+#define IR_SAMSUNG_SPACE_SYM(c)                                         \
+    IR_LUT_GAP(c, IR_LUT_SYM3(c, IR_SAMSUNG_ZERO_SPACE, IR_SYM_SPACE_SHORT, \
+                              IR_SAMSUNG_ONE_SPACE, IR_SYM_SPACE_LONG,  \
+                              IR_SAMSUNG_HDR_SPACE, IR_SYM_SPACE_HDR))
+
+/**
+ * @brief Pulse classifier tables, indexed by the level of the pulse
+ */
+static const uint8_t ir_samsung_lut[2][IR_LUT_SIZE] = {
+    { IR_LUT_TABLE(IR_SAMSUNG_SPACE_SYM) },
+    { IR_LUT_TABLE(IR_SAMSUNG_MARK_SYM) },
+};
+
+/**
+ * @brief Samsung decoder states
+ */
+enum ir_samsung_state {
+    SAMSUNG_IDLE,       /*!< Waiting for the header mark */
+    SAMSUNG_HDR_SPACE,  /*!< Waiting for the header space */
+    SAMSUNG_BIT_MARK,   /*!< Waiting for the mark of a data bit */
+    SAMSUNG_BIT_SPACE,  /*!< Waiting for the space of a data bit */
+};
+
+/**
+ * @brief Samsung decoder descriptor
+ *
+ * Internal structure used to manage the decoder.
+ */
+struct ir_samsung_desc {
+    const struct class *class;
+    enum ir_samsung_state state;    /*!< Current decoder state */
+    unsigned nbits;                 /*!< Number of data bits received */
+    uint32_t code;                  /*!< Data bits received (LSB first) */
+    struct ir_quality q;            /*!< Timing quality of the frame */
+    bool valid;                     /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;          /*!< Last decoded frame */
+};
+
+static void ir_samsung_reset(struct ir_samsung_desc *desc);
+static int ir_samsung_frame(struct ir_samsung_desc *desc);
+static int ir_samsung_edge(struct ir_samsung_desc *desc, const struct ir_pulse *pulse);
+
+static void *ir_samsung_ctor(void *data);
+static void ir_samsung_dtor(void *self);
+static int ir_samsung_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Reset the decoder state machine
+ */
+static void ir_samsung_reset(struct ir_samsung_desc *desc)
+{
+    desc->state = SAMSUNG_IDLE;
+    desc->nbits = 0;
+    desc->code = 0;
+    ir_quality_reset(&desc->q);
+}
+
+/**
+ * @brief Validate the received code word and update the frame
+ *
+ * @return IR_DEC_FRAME_READY, if the code word is a valid Samsung frame.
+ *         EIR_CHECKSUM, if the command does not match the inverted command.
+ */
+static int ir_samsung_frame(struct ir_samsung_desc *desc)
+{
+    uint32_t code = desc->code;
+    uint8_t cmd = (uint8_t)(code >> 16);
+    uint8_t ncmd = (uint8_t)(code >> 24);
+
+    if ((uint8_t)(cmd ^ ncmd) != 0xff) {
+        desc->valid = 0;
+        return EIR_CHECKSUM;
+    }
+
+    desc->frame.protocol = IR_PROTO_SAMSUNG;
+    desc->frame.flags = 0;
+    desc->frame.command = cmd;
+    desc->frame.confidence = ir_confidence(&desc->q, 1);
+
+    /* Most remotes send the address byte twice */
+    if ((uint8_t)code == (uint8_t)(code >> 8))
+        desc->frame.address = (uint8_t)code;
+    else
+        desc->frame.address = (uint16_t)code;
+
+    desc->valid = 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Advance the decoder by one pulse
+ *
+ * @param desc Decoder descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame.
+ *         ENO_ERROR, if the pulse was consumed, or if it is a header mark
+ *         that starts a new frame.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded and
+ *         does not start a new one.
+ *         EIR_CHECKSUM, if the frame failed the integrity check.
+ */
+static int ir_samsung_edge(struct ir_samsung_desc *desc, const struct ir_pulse *pulse)
+{
+    uint32_t d = pulse->duration;
+    int sym = IR_LUT_SYM(ir_samsung_lut, pulse);
+    int ret = ENO_ERROR;
+
+    switch (desc->state) {
+    case SAMSUNG_IDLE:
+        break;
+    case SAMSUNG_HDR_SPACE:
+        if (sym == IR_SYM_SPACE_HDR) {
+            ir_quality_add(&desc->q, d, IR_SAMSUNG_HDR_SPACE);
+            desc->state = SAMSUNG_BIT_MARK;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case SAMSUNG_BIT_MARK:
+        if (sym == IR_SYM_MARK_SHORT) {
+            ir_quality_add(&desc->q, d, IR_SAMSUNG_BIT_MARK);
+            desc->state = SAMSUNG_BIT_SPACE;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    case SAMSUNG_BIT_SPACE:
+        if (sym == IR_SYM_SPACE_SHORT) {
+            /* Zero bit, nothing to set in the code word */
+            ir_quality_add(&desc->q, d, IR_SAMSUNG_ZERO_SPACE);
+        } else if (sym == IR_SYM_SPACE_LONG) {
+            ir_quality_add(&desc->q, d, IR_SAMSUNG_ONE_SPACE);
+            desc->code |= (uint32_t)1 << desc->nbits;
+        } else {
+            ret = EIR_TIMING;
+            break;
+        }
+
+        if (++desc->nbits < IR_SAMSUNG_NBITS) {
+            desc->state = SAMSUNG_BIT_MARK;
+            return ENO_ERROR;
+        }
+
+        ret = ir_samsung_frame(desc);
+        ir_samsung_reset(desc);
+        return ret;
+    }
+
+    /* Look for the start of a new frame */
+    ir_samsung_reset(desc);
+    if (sym == IR_SYM_MARK_HDR) {
+        ir_quality_add(&desc->q, d, IR_SAMSUNG_HDR_MARK);
+        desc->state = SAMSUNG_HDR_SPACE;
+        ret = ENO_ERROR;
+    } else if (pulse->mark) {
+        ret = EIR_TIMING;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a Samsung decoder descriptor
+ */
+static void *ir_samsung_ctor(void *data)
+{
+    struct ir_samsung_desc *desc;
+
+    UNUSED(data);
+
+    desc = mm_alloc(sizeof(struct ir_samsung_desc));
+    if (desc) {
+        desc->class = ir_samsung;
+        desc->valid = 0;
+        ir_samsung_reset(desc);
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the Samsung decoder descriptor
+ */
+static void ir_samsung_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle Samsung decoder operations
+ */
+static int ir_samsung_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_samsung_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEC_EDGE:
+            ret = ir_samsung_edge(desc, (const struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_DEC_RESET:
+            ir_samsung_reset(desc);
+            desc->valid = 0;
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        case IOCTL_IR_DEC_GET_LUT:
+            *(const uint8_t (**)[IR_LUT_SIZE])data = ir_samsung_lut;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Samsung decoder class
+ */
+static const struct class _ir_samsung = {
+    ir_samsung_ctor,
+    ir_samsung_dtor,
+    ir_samsung_ioctl,
+};
+
+const void *ir_samsung = &_ir_samsung;
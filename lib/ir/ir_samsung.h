@@ -0,0 +1,48 @@
+/**
+ * @file  ir_samsung.h
+ *
+ * @brief Samsung protocol decoder
+ *
+ * Streaming decoder for the Samsung (32 bit) IR protocol. The bit encoding
+ * is the same as NEC, only the header differs.
+ *
+ * Samsung frame (all bits are sent LSB first):
+ *   4.5 ms mark, 4.5 ms space, 8 bit address, 8 bit address (repeated),
+ *   8 bit command, 8 bit ~command, 560 us stop mark.
+ *
+ * Held keys repeat the full frame.
+ */
+
+#ifndef __IR_SAMSUNG_H__
+#define __IR_SAMSUNG_H__
+
+#include "ir.h"
+
+/**
+ * @brief Samsung pulse durations in micro seconds
+ */
+#define IR_SAMSUNG_HDR_MARK     4500
+#define IR_SAMSUNG_HDR_SPACE    4500
+#define IR_SAMSUNG_BIT_MARK     560
+#define IR_SAMSUNG_ZERO_SPACE   560
+#define IR_SAMSUNG_ONE_SPACE    1690
+/*!< Frame start to the start of the next frame */
+#define IR_SAMSUNG_PERIOD       108000
+
+/*!< Carrier frequency in Hz */
+#define IR_SAMSUNG_CARRIER_HZ   38000
+
+/*!< Timing of the protocol descriptor (see ir_proto.h) */
+#define IR_SAMSUNG_TIMING(T)                                            \
+    { T(IR_SAMSUNG_HDR_MARK), T(IR_SAMSUNG_HDR_SPACE),                  \
+      T(IR_SAMSUNG_BIT_MARK), T(IR_SAMSUNG_ZERO_SPACE),                 \
+      T(IR_SAMSUNG_BIT_MARK), T(IR_SAMSUNG_ONE_SPACE),                  \
+      T(IR_SAMSUNG_BIT_MARK), T(0), T(IR_SAMSUNG_PERIOD) }
+
+/*!< Number of data bits in the Samsung frame */
+#define IR_SAMSUNG_NBITS        32
+
+/* Samsung decoder type definition */
+extern const void *ir_samsung;
+
+#endif /* __IR_SAMSUNG_H__ */
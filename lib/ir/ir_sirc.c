@@ -0,0 +1,233 @@
+/**
+ * @file  ir_sirc.c
+ *
+ * @brief Sony SIRC protocol decoder
+ *
+ * The decoder is advanced once per captured pulse. Bits are shifted into
+ * the code word as their marks arrive; the frame length is only known once
+ * the gap after the last mark is seen.
+ */
+
+#include "ir_sirc.h"
+#include "ir_lut.h"
+#include "class.h"
+
+/* Pulse classes of the SIRC timings */
+#define IR_SIRC_MARK_SYM(c)                                             \
+    IR_LUT_SYM3(c, IR_SIRC_ZERO_MARK, IR_SYM_MARK_SHORT,                \
+                IR_SIRC_ONE_MARK, IR_SYM_MARK_LONG,                     \
+                IR_SIRC_HDR_MARK, IR_SYM_MARK_HDR)
+#define IR_SIRC_SPACE_SYM(c)                                            \
+    IR_LUT_GAP(c, IR_LUT_SYM1(c, IR_SIRC_BIT_SPACE, IR_SYM_SPACE_SHORT))
+
+/**
+ * @brief Pulse classifier tables, indexed by the level of the pulse
+ */
+static const uint8_t ir_sirc_lut[2][IR_LUT_SIZE] = {
+    { IR_LUT_TABLE(IR_SIRC_SPACE_SYM) },
+    { IR_LUT_TABLE(IR_SIRC_MARK_SYM) },
+};
+
+/**
+ * @brief SIRC decoder states
+ */
+enum ir_sirc_state {
+    SIRC_IDLE,          /*!< Waiting for the header mark */
+    SIRC_BIT_SPACE,     /*!< Waiting for the space before a bit (or the gap) */
+    SIRC_BIT_MARK,      /*!< Waiting for the mark of a data bit */
+};
+
+/**
+ * @brief SIRC decoder descriptor
+ *
+ * Internal structure used to manage the decoder.
+ */
+struct ir_sirc_desc {
+    const struct class *class;
+    enum ir_sirc_state state;   /*!< Current decoder state */
+    unsigned nbits;             /*!< Number of data bits received */
+    uint32_t code;              /*!< Data bits received (LSB first) */
+    struct ir_quality q;        /*!< Timing quality of the frame */
+    bool valid;                 /*!< \a frame holds a decoded frame */
+    struct ir_frame frame;      /*!< Last decoded frame */
+};
+
+static void ir_sirc_reset(struct ir_sirc_desc *desc);
+static int ir_sirc_frame(struct ir_sirc_desc *desc);
+static int ir_sirc_edge(struct ir_sirc_desc *desc, const struct ir_pulse *pulse);
+
+static void *ir_sirc_ctor(void *data);
+static void ir_sirc_dtor(void *self);
+static int ir_sirc_ioctl(void *self, int cmd, void *data);
+
+/**
+ * @brief Reset the decoder state machine
+ */
+static void ir_sirc_reset(struct ir_sirc_desc *desc)
+{
+    desc->state = SIRC_IDLE;
+    desc->nbits = 0;
+    desc->code = 0;
+    ir_quality_reset(&desc->q);
+}
+
+/**
+ * @brief Validate the frame length and update the frame
+ *
+ * @return IR_DEC_FRAME_READY, if the frame is 12, 15 or 20 bits long.
+ *         EIR_TIMING, otherwise.
+ */
+static int ir_sirc_frame(struct ir_sirc_desc *desc)
+{
+    if (desc->nbits != 12 && desc->nbits != 15 && desc->nbits != 20)
+        return EIR_TIMING;
+
+    desc->frame.protocol = IR_PROTO_SIRC;
+    desc->frame.flags = 0;
+    desc->frame.command = (uint16_t)(desc->code & (BIT(IR_SIRC_CMD_BITS) - 1));
+    desc->frame.address = (uint16_t)(desc->code >> IR_SIRC_CMD_BITS);
+    desc->frame.confidence = ir_confidence(&desc->q, 0);
+    desc->valid = 1;
+
+    return IR_DEC_FRAME_READY;
+}
+
+/**
+ * @brief Advance the decoder by one pulse
+ *
+ * @param desc Decoder descriptor
+ * @param pulse Captured pulse
+ *
+ * @return IR_DEC_FRAME_READY, if this pulse completed a frame.
+ *         ENO_ERROR, if the pulse was consumed, or if it is a header mark
+ *         that starts a new frame.
+ *         EIR_TIMING, if the pulse does not fit the frame being decoded and
+ *         does not start a new one.
+ */
+static int ir_sirc_edge(struct ir_sirc_desc *desc, const struct ir_pulse *pulse)
+{
+    uint32_t d = pulse->duration;
+    int sym = IR_LUT_SYM(ir_sirc_lut, pulse);
+    int ret = ENO_ERROR;
+
+    switch (desc->state) {
+    case SIRC_IDLE:
+        break;
+    case SIRC_BIT_SPACE:
+        if (sym == IR_SYM_SPACE_SHORT) {
+            ir_quality_add(&desc->q, d, IR_SIRC_BIT_SPACE);
+            desc->state = SIRC_BIT_MARK;
+            return ENO_ERROR;
+        } else if (sym == IR_SYM_GAP) {
+            ret = ir_sirc_frame(desc);
+            ir_sirc_reset(desc);
+            return ret;
+        }
+        ret = EIR_TIMING;
+        break;
+    case SIRC_BIT_MARK:
+        if (sym == IR_SYM_MARK_SHORT) {
+            /* Zero bit, nothing to set in the code word */
+            ir_quality_add(&desc->q, d, IR_SIRC_ZERO_MARK);
+        } else if (sym == IR_SYM_MARK_LONG) {
+            ir_quality_add(&desc->q, d, IR_SIRC_ONE_MARK);
+            desc->code |= (uint32_t)1 << desc->nbits;
+        } else {
+            ret = EIR_TIMING;
+            break;
+        }
+
+        if (++desc->nbits <= 20) {
+            desc->state = SIRC_BIT_SPACE;
+            return ENO_ERROR;
+        }
+        ret = EIR_TIMING;
+        break;
+    }
+
+    /* Look for the start of a new frame */
+    ir_sirc_reset(desc);
+    if (sym == IR_SYM_MARK_HDR) {
+        ir_quality_add(&desc->q, d, IR_SIRC_HDR_MARK);
+        desc->state = SIRC_BIT_SPACE;
+        ret = ENO_ERROR;
+    } else if (pulse->mark) {
+        ret = EIR_TIMING;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Create and return a SIRC decoder descriptor
+ */
+static void *ir_sirc_ctor(void *data)
+{
+    struct ir_sirc_desc *desc;
+
+    UNUSED(data);
+
+    desc = mm_alloc(sizeof(struct ir_sirc_desc));
+    if (desc) {
+        desc->class = ir_sirc;
+        desc->valid = 0;
+        ir_sirc_reset(desc);
+    }
+
+    return desc;
+}
+
+/**
+ * @brief Delete the SIRC decoder descriptor
+ */
+static void ir_sirc_dtor(void *self)
+{
+    mm_free(self);
+}
+
+/**
+ * @brief Handle SIRC decoder operations
+ */
+static int ir_sirc_ioctl(void *self, int cmd, void *data)
+{
+    struct ir_sirc_desc *desc = self;
+    int ret = EFAIL;
+
+    if (IOC_TYPE(cmd) == IOCTL_IR) {
+        switch (IOC_NR(cmd)) {
+        case IOCTL_IR_DEC_EDGE:
+            ret = ir_sirc_edge(desc, (const struct ir_pulse *)data);
+            break;
+        case IOCTL_IR_DEC_RESET:
+            ir_sirc_reset(desc);
+            desc->valid = 0;
+            ret = ENO_ERROR;
+            break;
+        case IOCTL_IR_DEC_GET_FRAME:
+            if (desc->valid) {
+                *(struct ir_frame *)data = desc->frame;
+                ret = ENO_ERROR;
+            }
+            break;
+        case IOCTL_IR_DEC_GET_LUT:
+            *(const uint8_t (**)[IR_LUT_SIZE])data = ir_sirc_lut;
+            ret = ENO_ERROR;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * @brief SIRC decoder class
+ */
+static const struct class _ir_sirc = {
+    ir_sirc_ctor,
+    ir_sirc_dtor,
+    ir_sirc_ioctl,
+};
+
+const void *ir_sirc = &_ir_sirc;
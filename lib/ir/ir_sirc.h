@@ -0,0 +1,52 @@
+/**
+ * @file  ir_sirc.h
+ *
+ * @brief Sony SIRC protocol decoder
+ *
+ * Streaming decoder for the Sony SIRC IR protocol (12, 15 and 20 bit
+ * variants). The bit value is carried in the length of the mark.
+ *
+ * SIRC frame (all bits are sent LSB first):
+ *   2.4 ms mark, then for every bit a 600 us space followed by a 1.2 ms
+ *   (one) or 600 us (zero) mark. 7 bit command followed by a 5, 8 or 13
+ *   bit address.
+ *
+ * The variants only differ in the number of bits, so the frame is reported
+ * when the gap after the last mark is seen.
+ */
+
+#ifndef __IR_SIRC_H__
+#define __IR_SIRC_H__
+
+#include "ir.h"
+
+/**
+ * @brief SIRC pulse durations in micro seconds
+ */
+#define IR_SIRC_HDR_MARK        2400
+#define IR_SIRC_BIT_SPACE       600
+#define IR_SIRC_ZERO_MARK       600
+#define IR_SIRC_ONE_MARK        1200
+/*!< Frame start to the start of the next frame */
+#define IR_SIRC_PERIOD          45000
+
+/*!< Carrier frequency in Hz */
+#define IR_SIRC_CARRIER_HZ      40000
+
+/*!< Timing of the protocol descriptor (see ir_proto.h), the header space
+ *   is the space before the first bit and every bit ends with a space */
+#define IR_SIRC_TIMING(T)                                               \
+    { T(IR_SIRC_HDR_MARK), T(IR_SIRC_BIT_SPACE),                        \
+      T(IR_SIRC_ZERO_MARK), T(IR_SIRC_BIT_SPACE),                       \
+      T(IR_SIRC_ONE_MARK), T(IR_SIRC_BIT_SPACE),                        \
+      T(0), T(0), T(IR_SIRC_PERIOD) }
+
+/*!< Number of command bits in the SIRC frame */
+#define IR_SIRC_CMD_BITS        7
+/*!< Number of data bits in the 12 bit variant */
+#define IR_SIRC_NBITS           12
+
+/* SIRC decoder type definition */
+extern const void *ir_sirc;
+
+#endif /* __IR_SIRC_H__ */
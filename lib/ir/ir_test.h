@@ -0,0 +1,59 @@
+/**
+ * @file  ir_test.h
+ *
+ * @brief Test frames shared by the unit tests of the IR library
+ *
+ * Only included by the unit test code. The frames are generated by the
+ * encoder, so the receive tests play the timings the transmitter sends.
+ *
+ * Usage:
+ *
+ * n = ir_test_nec(pulse, NPULSES, 0x04, 0x08, 0);
+ * pulse[n].mark = 0;
+ * pulse[n++].duration = GAP;
+ */
+
+#ifndef __IR_TEST_H__
+#define __IR_TEST_H__
+
+#include "ir_tx.h"
+#include "ir_nec.h"
+
+/*!< Phases of a NEC frame, up to the stop mark */
+#define IR_TEST_NEC_PULSES          (2 * IR_NEC_NBITS + 3)
+
+/**
+ * @brief Store the phases of a NEC frame and its repeat codes
+ *
+ * The frames are one NEC period apart, in micro seconds. The gap after
+ * the last frame is not stored, so the caller can append its own.
+ *
+ * @param pulse Where to store the phases.
+ * @param size Maximum number of phases to store.
+ * @param addr Address of the frame.
+ * @param cmd Command of the frame.
+ * @param repeats Number of repeat codes after the frame.
+ *
+ * @return Number of phases stored.
+ */
+static inline unsigned ir_test_nec(struct ir_pulse *pulse, unsigned size, uint8_t addr,
+                                   uint8_t cmd, unsigned repeats)
+{
+    struct ir_pulse phase, next;
+    struct ir_tx tx;
+    unsigned n = 0;
+
+    ir_tx_send(&tx, &ir_proto_nec, &ir_proto_nec.us, addr, cmd, repeats);
+    if (!ir_tx_next(&tx, &phase))
+        return 0;
+    /* Every phase but the last one, the gap */
+    while (ir_tx_next(&tx, &next)) {
+        if (n < size)
+            pulse[n++] = phase;
+        phase = next;
+    }
+
+    return n;
+}
+
+#endif /* __IR_TEST_H__ */
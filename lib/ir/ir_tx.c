@@ -0,0 +1,314 @@
+/**
+ * @file  ir_tx.c
+ *
+ * @brief IR frame encoder
+ */
+
+#include "ir_tx.h"
+#include "ir_sirc.h"
+
+/**
+ * @brief Encoder states, the phase returned next
+ */
+enum ir_tx_state {
+    IR_TX_HDR_MARK,     /*!< Header mark */
+    IR_TX_HDR_SPACE,    /*!< Header space */
+    IR_TX_BIT_MARK,     /*!< Mark of a data bit */
+    IR_TX_BIT_SPACE,    /*!< Space of a data bit */
+    IR_TX_STOP_MARK,    /*!< Stop mark */
+    IR_TX_GAP,          /*!< Space up to the frame period */
+    IR_TX_RPT_MARK,     /*!< Header mark of the repeat code */
+    IR_TX_RPT_SPACE,    /*!< Space of the repeat code */
+    IR_TX_DONE,         /*!< All frames sent */
+};
+
+static void ir_tx_frame(struct ir_tx *tx, bool repeat);
+
+/**
+ * @brief Start a frame (or the repeat code)
+ */
+static void ir_tx_frame(struct ir_tx *tx, bool repeat)
+{
+    const struct ir_proto *proto = tx->proto;
+
+    tx->shift = tx->code;
+    tx->nbits = proto->nbits;
+    tx->elapsed = 0;
+
+    if (!repeat)
+        tx->state = IR_TX_HDR_MARK;
+    else if (tx->timing->rpt_space)
+        tx->state = IR_TX_RPT_MARK;
+    else if (proto->flags & IR_PROTO_RPT_NO_HDR)
+        tx->state = IR_TX_BIT_MARK;
+    else
+        tx->state = IR_TX_HDR_MARK;
+}
+
+/**
+ */
+uint32_t ir_tx_code(const struct ir_proto *proto, uint16_t address, uint16_t command)
+{
+    uint8_t cmd = (uint8_t)command;
+    uint32_t addr = address;
+
+    switch (proto->protocol) {
+    case IR_PROTO_NEC:
+        /* An 8 bit address is followed by its inverted copy, so an extended
+         * address with a zero high byte cannot be sent */
+        if (addr <= 0xff)
+            addr |= (uint32_t)(uint8_t)~address << 8;
+        return addr | (uint32_t)cmd << 16 | (uint32_t)(uint8_t)~cmd << 24;
+    case IR_PROTO_SAMSUNG:
+        /* An 8 bit address is sent twice */
+        if (addr <= 0xff)
+            addr |= addr << 8;
+        return addr | (uint32_t)cmd << 16 | (uint32_t)(uint8_t)~cmd << 24;
+    case IR_PROTO_JVC:
+        return (uint8_t)address | (uint32_t)cmd << 8;
+    case IR_PROTO_SIRC:
+        /* 12 bit frame: 7 bit command and 5 bit address */
+        addr &= BIT(IR_SIRC_NBITS - IR_SIRC_CMD_BITS) - 1;
+        return (command & (BIT(IR_SIRC_CMD_BITS) - 1)) | addr << IR_SIRC_CMD_BITS;
+    default:
+        return 0;
+    }
+}
+
+/**
+ */
+void ir_tx_send_code(struct ir_tx *tx, const struct ir_proto *proto,
+                     const struct ir_timing *timing, uint32_t code, unsigned repeats)
+{
+    tx->proto = proto;
+    tx->timing = timing;
+    tx->code = code;
+    tx->repeats = repeats;
+    ir_tx_frame(tx, 0);
+}
+
+/**
+ */
+void ir_tx_send(struct ir_tx *tx, const struct ir_proto *proto, const struct ir_timing *timing,
+                uint16_t address, uint16_t command, unsigned repeats)
+{
+    ir_tx_send_code(tx, proto, timing, ir_tx_code(proto, address, command), repeats);
+}
+
+/**
+ */
+bool ir_tx_next(struct ir_tx *tx, struct ir_pulse *phase)
+{
+    const struct ir_timing *t = tx->timing;
+    uint32_t d = 0;
+    bool one;
+
+    /* Phases of zero duration (no header, no stop mark) are skipped */
+    while (!d) {
+        switch (tx->state) {
+        case IR_TX_HDR_MARK:
+        case IR_TX_RPT_MARK:
+            d = t->hdr_mark;
+            phase->mark = 1;
+            tx->state = tx->state == IR_TX_HDR_MARK ? IR_TX_HDR_SPACE : IR_TX_RPT_SPACE;
+            break;
+        case IR_TX_HDR_SPACE:
+            d = t->hdr_space;
+            phase->mark = 0;
+            tx->state = IR_TX_BIT_MARK;
+            break;
+        case IR_TX_BIT_MARK:
+            d = (tx->shift & 1) ? t->one_mark : t->zero_mark;
+            phase->mark = 1;
+            tx->state = IR_TX_BIT_SPACE;
+            break;
+        case IR_TX_BIT_SPACE:
+            one = tx->shift & 1;
+            tx->shift >>= 1;
+            phase->mark = 0;
+            if (--tx->nbits) {
+                d = one ? t->one_space : t->zero_space;
+                tx->state = IR_TX_BIT_MARK;
+            } else if (t->stop_mark) {
+                d = one ? t->one_space : t->zero_space;
+                tx->state = IR_TX_STOP_MARK;
+            } else {
+                /* The space of the last bit is the start of the gap */
+                tx->state = IR_TX_GAP;
+            }
+            break;
+        case IR_TX_RPT_SPACE:
+            d = t->rpt_space;
+            phase->mark = 0;
+            tx->state = IR_TX_STOP_MARK;
+            break;
+        case IR_TX_STOP_MARK:
+            d = t->stop_mark;
+            phase->mark = 1;
+            tx->state = IR_TX_GAP;
+            break;
+        case IR_TX_GAP:
+            /* The next frame starts one period after this one */
+            phase->mark = 0;
+            phase->duration = t->period > tx->elapsed ? t->period - tx->elapsed : t->period;
+            if (tx->repeats) {
+                tx->repeats--;
+                ir_tx_frame(tx, 1);
+            } else {
+                tx->state = IR_TX_DONE;
+            }
+            return 1;
+        default:
+            return 0;
+        }
+    }
+
+    phase->duration = d;
+    tx->elapsed += d;
+
+    return 1;
+}
+
+/**
+ * Unit test code
+ */
+
+#ifdef UNIT_TEST
+
+#include <stdio.h>
+#include "new.h"
+#include "ir_nec.h"
+#include "ir_samsung.h"
+#include "ir_jvc.h"
+
+#define TEST_REPEATS        2
+#define TEST_CLK_KHZ        100
+#define TEST_TICKS(us)      IR_TICKS(us, TEST_CLK_KHZ)
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+
+/**
+ * @brief Protocol, its decoder and a key to send
+ */
+struct test_case {
+    const char *name;
+    const struct ir_proto *proto;
+    const struct ir_timing *ticks;
+    const void *const *decoder;
+    uint16_t address;
+    uint16_t command;
+    uint32_t code;          /* Expected code word */
+    bool repeat;            /* The repeats decode as repeats */
+};
+
+static const struct ir_timing test_nec_ticks = IR_NEC_TIMING(TEST_TICKS);
+static const struct ir_timing test_samsung_ticks = IR_SAMSUNG_TIMING(TEST_TICKS);
+static const struct ir_timing test_jvc_ticks = IR_JVC_TIMING(TEST_TICKS);
+static const struct ir_timing test_sirc_ticks = IR_SIRC_TIMING(TEST_TICKS);
+
+static const struct test_case test_case[] = {
+    { "nec", &ir_proto_nec, &test_nec_ticks, &ir_nec, 0x04, 0x08, 0xf708fb04, 1 },
+    { "nec ext", &ir_proto_nec, &test_nec_ticks, &ir_nec, 0x4000, 0x41, 0xbe414000, 1 },
+    { "samsung", &ir_proto_samsung, &test_samsung_ticks, &ir_samsung, 0x07, 0x1a,
+      0xe51a0707, 0 },
+    { "jvc", &ir_proto_jvc, &test_jvc_ticks, &ir_jvc, 0x03, 0x12, 0x1203, 1 },
+    { "sirc", &ir_proto_sirc, &test_sirc_ticks, &ir_sirc, 0x01, 0x15, 0x095, 0 },
+};
+
+static int ir_tx_ss_test(void);
+
+/* If cond is false, print diagnostics and abort the test */
+#define TEST_AND_EXIT_ON_FAIL(test, cond)                   \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("%s failed at line %d with error %d\n",  \
+                    test, __LINE__, err);                   \
+            return err;                                     \
+        }                                                   \
+    } while (0)
+
+/**
+ * @brief Top level IR encoder test function
+ */
+static int ir_tx_ss_test(void)
+{
+    const struct test_case *c;
+    struct ir_pulse phase, gap;
+    struct ir_frame frame;
+    struct ir_tx tx;
+    unsigned k, nphases, nframes;
+    uint32_t key, total;
+    bool last;
+    void *dec;
+    int res, err = EFAIL;
+
+    for (k = 0; k < ARRAY_SIZE(test_case); k++) {
+        c = &test_case[k];
+        TEST_AND_EXIT_ON_FAIL("code", ir_tx_code(c->proto, c->address, c->command) == c->code);
+        TEST_AND_EXIT_ON_FAIL("code", !(c->code >> (c->proto->nbits - 1) >> 1));
+
+        /* The key word holds the protocol, the address and the command */
+        key = IR_TX_KEY(c->proto->protocol, c->address, c->command);
+        TEST_AND_EXIT_ON_FAIL("key", ir_proto_get(IR_TX_KEY_PROTOCOL(key)) == c->proto &&
+                                     IR_TX_KEY_ADDRESS(key) == c->address &&
+                                     IR_TX_KEY_COMMAND(key) == c->command);
+
+        /* Sent in micro seconds, every frame decodes */
+        dec = new(*c->decoder, NULL);
+        TEST_AND_EXIT_ON_FAIL("new", dec != NULL);
+        gap.mark = 0;
+        gap.duration = c->proto->us.period;
+        ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &gap);
+
+        ir_tx_send_code(&tx, c->proto, &c->proto->us, c->code, TEST_REPEATS);
+        nphases = nframes = 0;
+        last = 0;
+        while (ir_tx_next(&tx, &phase)) {
+            /* Marks and spaces alternate */
+            TEST_AND_EXIT_ON_FAIL("level", phase.duration && phase.mark != last);
+            last = phase.mark;
+            nphases++;
+
+            res = ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_EDGE), &phase);
+            if (res != IR_DEC_FRAME_READY)
+                continue;
+            ioctl(dec, IOC(IOCTL_IR, IOCTL_IR_DEC_GET_FRAME), &frame);
+            TEST_AND_EXIT_ON_FAIL("frame", frame.protocol == c->proto->protocol &&
+                                           frame.address == c->address &&
+                                           frame.command == c->command);
+            if (nframes++ && c->repeat)
+                TEST_AND_EXIT_ON_FAIL("repeat", frame.flags & IR_FRAME_REPEAT);
+        }
+        TEST_AND_EXIT_ON_FAIL("frames", nframes == 1 + TEST_REPEATS);
+        TEST_AND_EXIT_ON_FAIL("done", !ir_tx_next(&tx, &phase));
+
+        /* Sent in ticks, the frames are one period apart */
+        ir_tx_send(&tx, ir_proto_get(IR_TX_KEY_PROTOCOL(key)), c->ticks,
+                   IR_TX_KEY_ADDRESS(key), IR_TX_KEY_COMMAND(key), TEST_REPEATS);
+        total = 0;
+        while (ir_tx_next(&tx, &phase))
+            total += phase.duration;
+        TEST_AND_EXIT_ON_FAIL("period", total == (1 + TEST_REPEATS) * c->ticks->period);
+
+        printf("%-15s: %u phases\n", c->name, nphases);
+    }
+
+    /* The SIRC address has 5 bits, the higher ones are not sent */
+    TEST_AND_EXIT_ON_FAIL("sirc_addr", ir_tx_code(&ir_proto_sirc, 0x21, 0x15) == 0x095);
+
+    return ENO_ERROR;
+}
+
+/**
+ */
+int main(void)
+{
+    printf("Testing IR encoder\n");
+    if (ir_tx_ss_test() != ENO_ERROR)
+        printf("IR encoder test failed\n");
+    else
+        printf("IR encoder test passed\n");
+
+    return 0;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,122 @@
+/**
+ * @file  ir_tx.h
+ *
+ * @brief IR frame encoder
+ *
+ * Streaming encoder for the protocols with a descriptor (see ir_proto.h).
+ * The address and the command are packed into the code word of the
+ * protocol once, then every call of ir_tx_next() returns the next phase
+ * (mark or space) of the frame, shifting the bits out of the code word.
+ * The frames are never stored as phases, so any key of any protocol can
+ * be sent without a table per key. A call costs a few compares and a
+ * shift, so it runs in the timer interrupt that times the phases.
+ *
+ * A code set is a table of keys packed in a word each with IR_TX_KEY(), 4
+ * bytes of flash per key. A code word captured from a remote is sent as it
+ * is with ir_tx_send_code().
+ *
+ * The durations are in the unit of the timing passed to ir_tx_send(): the
+ * micro seconds of the descriptor, or a table of timer ticks built at
+ * compile time with IR_XXX_TIMING(T).
+ *
+ * Usage:
+ *
+ * struct ir_tx tx;
+ * struct ir_pulse phase;
+ *
+ * ir_tx_send(&tx, &ir_proto_nec, &nec_ticks, 0x04, 0x08, 1);
+ *
+ * (or from a code set)
+ * static const uint32_t keys[] = { IR_TX_KEY(IR_PROTO_NEC, 0x04, 0x08), ... };
+ *
+ * proto = ir_proto_get(IR_TX_KEY_PROTOCOL(keys[i]));
+ * ir_tx_send(&tx, proto, &proto->us, IR_TX_KEY_ADDRESS(keys[i]),
+ *            IR_TX_KEY_COMMAND(keys[i]), 1);
+ *
+ * (on every timer update)
+ * if (ir_tx_next(&tx, &phase)) {
+ *     TIM->ARR = phase.duration - 1;
+ *     ir_carrier_gate(&carrier, phase.mark);
+ * }
+ */
+
+#ifndef __IR_TX_H__
+#define __IR_TX_H__
+
+#include "ir_proto.h"
+
+/**
+ * @brief Key packed in a word: protocol (bits 31..24), command (bits
+ *        23..16) and address (bits 15..0)
+ */
+#define IR_TX_KEY(protocol, address, command)                           \
+    ((uint32_t)(protocol) << 24 | (uint32_t)((command) & 0xff) << 16 |  \
+     (uint32_t)((address) & 0xffff))
+#define IR_TX_KEY_PROTOCOL(key)     ((unsigned)((key) >> 24))
+#define IR_TX_KEY_ADDRESS(key)      ((uint16_t)(key))
+#define IR_TX_KEY_COMMAND(key)      ((uint16_t)(((key) >> 16) & 0xff))
+
+/**
+ * @brief IR encoder state
+ */
+struct ir_tx {
+    const struct ir_proto *proto;   /*!< Protocol of the frames */
+    const struct ir_timing *timing; /*!< Durations of the phases */
+    uint32_t code;                  /*!< Code word of the frame */
+    uint32_t shift;                 /*!< Bits left to send, next one in bit 0 */
+    unsigned nbits;                 /*!< Number of bits left */
+    unsigned repeats;               /*!< Number of repeats left */
+    uint32_t elapsed;               /*!< Duration of the frame so far */
+    unsigned state;                 /*!< Next phase of the frame */
+};
+
+/**
+ * @brief Code word of a key
+ *
+ * @param proto Protocol descriptor.
+ * @param address Device address: 8 bit, or 16 bit for the extended NEC
+ *        and Samsung addresses (an address up to 0xff is always sent as
+ *        an 8 bit one, so the extended addresses 0x0000 - 0x00ff cannot
+ *        be sent), 5 bit for SIRC (the higher bits are dropped).
+ * @param command Key code (7 bit for SIRC, 8 bit otherwise).
+ *
+ * @return Code word, sent LSB first.
+ */
+uint32_t ir_tx_code(const struct ir_proto *proto, uint16_t address, uint16_t command);
+
+/**
+ * @brief Start the encoder on a frame
+ *
+ * @param tx Encoder state.
+ * @param proto Protocol descriptor.
+ * @param timing Durations of the phases (proto->us or a tick table).
+ * @param address Device address.
+ * @param command Key code.
+ * @param repeats Number of repeats after the frame (the key is held).
+ */
+void ir_tx_send(struct ir_tx *tx, const struct ir_proto *proto, const struct ir_timing *timing,
+                uint16_t address, uint16_t command, unsigned repeats);
+
+/**
+ * @brief Start the encoder on a code word
+ *
+ * @param tx Encoder state.
+ * @param proto Protocol descriptor.
+ * @param timing Durations of the phases (proto->us or a tick table).
+ * @param code Code word, sent LSB first.
+ * @param repeats Number of repeats after the frame (the key is held).
+ */
+void ir_tx_send_code(struct ir_tx *tx, const struct ir_proto *proto,
+                     const struct ir_timing *timing, uint32_t code, unsigned repeats);
+
+/**
+ * @brief Next phase of the frames
+ *
+ * @param tx Encoder state.
+ * @param phase Duration and level of the phase.
+ *
+ * @return 1, if \a phase is set. 0, once the last gap is returned.
+ */
+bool ir_tx_next(struct ir_tx *tx, struct ir_pulse *phase);
+
+#endif /* __IR_TX_H__ */
@@ -6,7 +6,11 @@
 
 #include "mm.h"
 
-#define CONFIG_MM_MEMORY_SIZE       1024
+/* Every IR receiver has its own receive engine (with its frame cache) and
+ * decoders */
+#ifndef CONFIG_MM_MEMORY_SIZE
+#define CONFIG_MM_MEMORY_SIZE       4096
+#endif
 
 static uint8_t mm[CONFIG_MM_MEMORY_SIZE];
 static uint8_t *mm_ptr = mm;